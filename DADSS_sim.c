@@ -0,0 +1,559 @@
+//==============================================================================
+//
+// VersICaL impedance bridge client
+//
+// Copyright 2018-2019	Massimo Ortolano <massimo.ortolano@polito.it> 
+//                		Martina Marzano <m.marzano@inrim.it>
+//
+// This code is licensed under MIT license (see LICENSE.txt for details)
+//
+//==============================================================================
+
+#ifdef DADSS_SIMULATION
+
+//==============================================================================
+// Include files
+
+#include <ansi_c.h>
+#include <cvidef.h>
+#include <utility.h>
+
+#include "DA_DSS_cvi_driver.h"
+#include "main.h"
+#include "DADSS_sim.h"
+#include "sim.h"
+
+//==============================================================================
+// Constants
+
+#define MDAC1_CODE_MAX (DADSS_MDAC1_CODE_RANGE-1)
+
+//==============================================================================
+// Types
+
+typedef struct {
+	double amplitude;
+	double phase;
+	unsigned int mdac1Code;
+	int mdac1Offset;
+	unsigned int mdac2Code;
+	int rangeMdac1;
+	int rangeMdac2;
+} SimChannel;
+
+//==============================================================================
+// Static global variables
+
+static struct {
+	int isInitialized;
+	unsigned int nvServer;
+	int clkSource;
+	int clkExport10MHz;
+	double clockFrequency;
+	double frequency;
+	double realFrequency;
+	int clockDivider;
+	int nSamples;
+	int isRunning;
+	SimChannel pending[DADSS_CHANNELS];	// Network variables as written
+	SimChannel staged[DADSS_CHANNELS];	// Committed by an Update call, settling
+	SimChannel active[DADSS_CHANNELS];	// Currently generated
+	SimChannel previous[DADSS_CHANNELS];	// Generated before activeTime
+	double stagedTime;
+	double activeTime;
+	int isStaged;
+	double settleTime;
+	double callLatency;
+	unsigned long updateCount;
+} dss;
+
+//==============================================================================
+// Static functions
+
+static double RangeMdac1Factor(int range)
+{
+	switch (range) {
+		case 2:
+			return 0.5;
+		case 4:
+			return 2.0;
+		default:
+			return 1.0;
+	}
+}
+
+static double RangeMdac2Factor(int range)
+{
+	return range == 1 ? 2.0 : 1.0;
+}
+
+// Full-scale amplitude in volts of a channel for MDAC1 code DADSS_MDAC1_CODE_RANGE
+static double FullScale(const SimChannel *c)
+{
+	return RangeMdac1Factor(c->rangeMdac1)*RangeMdac2Factor(c->rangeMdac2)*
+		   DADSS_REFERENCE_VOLTAGE*c->mdac2Code/(double)DADSS_MDAC2_CODE_RANGE;
+}
+
+static double QuantizePhase(double phase)
+{
+	double lsb = 2.0*PI/(1 << DADSS_SIM_PHASE_BITS);
+
+	phase = fmod(phase, 2.0*PI);
+	if (phase > PI)
+		phase -= 2.0*PI;
+	else if (phase < -PI)
+		phase += 2.0*PI;
+	return floor(phase/lsb+0.5)*lsb;
+}
+
+static void ComputeSamples(void)
+{
+	double sampleRate = dss.clockFrequency*1.0e6;
+	int n;
+
+	for (dss.clockDivider = 1; ; ++dss.clockDivider) {
+		n = (int)floor(sampleRate/(dss.clockDivider*dss.frequency)+0.5);
+		if (n <= DADSS_SAMPLES_MAX && sampleRate/dss.clockDivider <= DADSS_SIM_SAMPLE_RATE_MAX)
+			break;
+	}
+	dss.nSamples = n < DADSS_SAMPLES_MIN ? DADSS_SAMPLES_MIN : n;
+	dss.realFrequency = sampleRate/(dss.clockDivider*dss.nSamples);
+}
+
+static void Initialize(void)
+{
+	if (dss.isInitialized)
+		return;
+	dss.isInitialized = 1;
+	dss.settleTime = SimGetEnvDouble("DADSS_SIM_SETTLE_TIME", DADSS_SIM_SETTLE_TIME);
+	dss.callLatency = SimGetEnvDouble("DADSS_SIM_CALL_LATENCY", DADSS_SIM_CALL_LATENCY);
+	dss.clockFrequency = DADSS_CLOCKFREQUENCY_MAX;
+	dss.frequency = 1000.0;
+	for (int i = 0; i < DADSS_CHANNELS; ++i) {
+		dss.pending[i].rangeMdac1 = 3;
+		dss.pending[i].rangeMdac2 = 0;
+		dss.pending[i].mdac2Code = DADSS_MDAC2_CODE_MAX;
+	}
+	memcpy(dss.staged, dss.pending, sizeof dss.pending);
+	memcpy(dss.active, dss.pending, sizeof dss.pending);
+	memcpy(dss.previous, dss.pending, sizeof dss.pending);
+	ComputeSamples();
+}
+
+static void Promote(void)
+{
+	if (dss.isStaged && SimTime() >= dss.stagedTime) {
+		memcpy(dss.previous, dss.active, sizeof dss.previous);
+		memcpy(dss.active, dss.staged, sizeof dss.active);
+		dss.activeTime = dss.stagedTime;
+		dss.isStaged = 0;
+	}
+}
+
+// Every driver call goes through the network variables server: model its
+// round trip and promote the staged settings once they have settled
+static void Enter(void)
+{
+	Initialize();
+	SimDelay(dss.callLatency);
+	Promote();
+}
+
+static void Stage(void)
+{
+	if (!dss.isStaged)
+		memcpy(dss.staged, dss.active, sizeof dss.staged);
+	dss.isStaged = 1;
+	dss.stagedTime = SimTime()+dss.settleTime;
+	++dss.updateCount;
+}
+
+static int CheckChannel(int channel)
+{
+	return (channel < 1 || channel > DADSS_CHANNELS) ? DADSS_SIM_ERROR_CHANNEL : 0;
+}
+
+//==============================================================================
+// Global variables
+
+//==============================================================================
+// Global functions (driver surface)
+
+int CVIFUNC DADSS_SetNameNVServer(unsigned int nvServer)
+{
+	Initialize();
+	dss.nvServer = nvServer;
+	return 0;
+}
+
+int CVIFUNC DADSS_SetRangeMDAC1(int channel, int range)
+{
+	Enter();
+	if (CheckChannel(channel) < 0)
+		return DADSS_SIM_ERROR_CHANNEL;
+	if (range < 2 || range > 4)
+		return DADSS_SIM_ERROR_VALUE;
+	dss.pending[channel-1].rangeMdac1 = range;
+	return 0;
+}
+
+int CVIFUNC DADSS_GetRangeMDAC1(int channel, int *range)
+{
+	Enter();
+	if (CheckChannel(channel) < 0)
+		return DADSS_SIM_ERROR_CHANNEL;
+	*range = dss.active[channel-1].rangeMdac1;
+	return 0;
+}
+
+int CVIFUNC DADSS_SetRangeMDAC2(int channel, int range)
+{
+	Enter();
+	if (CheckChannel(channel) < 0)
+		return DADSS_SIM_ERROR_CHANNEL;
+	if (range < 0 || range > 1)
+		return DADSS_SIM_ERROR_VALUE;
+	dss.pending[channel-1].rangeMdac2 = range;
+	return 0;
+}
+
+int CVIFUNC DADSS_GetRangeMDAC2(int channel, int *range)
+{
+	Enter();
+	if (CheckChannel(channel) < 0)
+		return DADSS_SIM_ERROR_CHANNEL;
+	*range = dss.active[channel-1].rangeMdac2;
+	return 0;
+}
+
+int CVIFUNC DADSS_SetCLKSource(int source)
+{
+	Enter();
+	dss.clkSource = source;
+	return 0;
+}
+
+int CVIFUNC DADSS_GetCLKSource(int *source)
+{
+	Enter();
+	*source = dss.clkSource;
+	return 0;
+}
+
+int CVIFUNC DADSS_SetCLKExport10MHz(int enable)
+{
+	Enter();
+	dss.clkExport10MHz = enable;
+	return 0;
+}
+
+int CVIFUNC DADSS_GetCLKExport10MHzStatus(int *enable)
+{
+	Enter();
+	*enable = dss.clkExport10MHz;
+	return 0;
+}
+
+int CVIFUNC DADSS_UpdateConfiguration(void)
+{
+	Enter();
+	Stage();
+	for (int i = 0; i < DADSS_CHANNELS; ++i) {
+		dss.staged[i].rangeMdac1 = dss.pending[i].rangeMdac1;
+		dss.staged[i].rangeMdac2 = dss.pending[i].rangeMdac2;
+	}
+	return 0;
+}
+
+int CVIFUNC DADSS_SetAmplitude(int channel, double amplitude)
+{
+	Enter();
+	if (CheckChannel(channel) < 0)
+		return DADSS_SIM_ERROR_CHANNEL;
+	if (amplitude < DADSS_AMPLITUDE_MIN || amplitude > DADSS_AMPLITUDE_MAX)
+		return DADSS_SIM_ERROR_VALUE;
+	dss.pending[channel-1].amplitude = amplitude;
+	return 0;
+}
+
+int CVIFUNC DADSS_GetAmplitude(int channel, double *amplitude)
+{
+	Enter();
+	if (CheckChannel(channel) < 0)
+		return DADSS_SIM_ERROR_CHANNEL;
+	*amplitude = dss.active[channel-1].mdac1Code*FullScale(&dss.active[channel-1])/DADSS_MDAC1_CODE_RANGE;
+	return 0;
+}
+
+int CVIFUNC DADSS_SetPhase(int channel, double phase)
+{
+	Enter();
+	if (CheckChannel(channel) < 0)
+		return DADSS_SIM_ERROR_CHANNEL;
+	dss.pending[channel-1].phase = phase;
+	return 0;
+}
+
+int CVIFUNC DADSS_GetPhase(int channel, double *phase)
+{
+	Enter();
+	if (CheckChannel(channel) < 0)
+		return DADSS_SIM_ERROR_CHANNEL;
+	*phase = dss.active[channel-1].phase;
+	return 0;
+}
+
+// The requested amplitude is converted to an MDAC1 code with the ranges and
+// MDAC2 setting written so far; the code is clipped to full scale
+int CVIFUNC DADSS_UpdateWaveform(void)
+{
+	Enter();
+	Stage();
+	for (int i = 0; i < DADSS_CHANNELS; ++i) {
+		double fullScale = FullScale(&dss.pending[i]);
+		double code = fullScale > 0.0 ? dss.pending[i].amplitude/fullScale*DADSS_MDAC1_CODE_RANGE : 0.0;
+
+		dss.staged[i].mdac1Code = code > MDAC1_CODE_MAX ? MDAC1_CODE_MAX : (unsigned int)floor(code+0.5);
+		dss.staged[i].phase = QuantizePhase(dss.pending[i].phase);
+		dss.staged[i].mdac1Offset = dss.pending[i].mdac1Offset;
+	}
+	return 0;
+}
+
+int CVIFUNC DADSS_SetFrequency(double frequency)
+{
+	Enter();
+	if (frequency < DADSS_FREQUENCY_MIN || frequency > DADSS_FREQUENCY_MAX)
+		return DADSS_SIM_ERROR_VALUE;
+	dss.frequency = frequency;
+	ComputeSamples();
+	return 0;
+}
+
+int CVIFUNC DADSS_GetFrequency(double *frequency)
+{
+	Enter();
+	*frequency = dss.frequency;
+	return 0;
+}
+
+int CVIFUNC DADSS_GetRealFrequency(double *frequency)
+{
+	Enter();
+	*frequency = dss.realFrequency;
+	return 0;
+}
+
+int CVIFUNC DADSS_SetMDAC1Amplitude(int channel, double amplitude)
+{
+	Enter();
+	if (CheckChannel(channel) < 0)
+		return DADSS_SIM_ERROR_CHANNEL;
+	if (amplitude < 0.0 || amplitude > 1.0)
+		return DADSS_SIM_ERROR_VALUE;
+	dss.pending[channel-1].amplitude = amplitude*FullScale(&dss.pending[channel-1]);
+	return 0;
+}
+
+int CVIFUNC DADSS_GetMDAC1Amplitude(int channel, double *amplitude)
+{
+	Enter();
+	if (CheckChannel(channel) < 0)
+		return DADSS_SIM_ERROR_CHANNEL;
+	*amplitude = dss.active[channel-1].mdac1Code/(double)DADSS_MDAC1_CODE_RANGE;
+	return 0;
+}
+
+int CVIFUNC DADSS_SetMDAC1Offset(int channel, int offset)
+{
+	Enter();
+	if (CheckChannel(channel) < 0)
+		return DADSS_SIM_ERROR_CHANNEL;
+	dss.pending[channel-1].mdac1Offset = offset;
+	return 0;
+}
+
+int CVIFUNC DADSS_GetMDAC1Offset(int channel, int *offset)
+{
+	Enter();
+	if (CheckChannel(channel) < 0)
+		return DADSS_SIM_ERROR_CHANNEL;
+	*offset = dss.active[channel-1].mdac1Offset;
+	return 0;
+}
+
+int CVIFUNC DADSS_SetMDAC2(int channel, unsigned int code)
+{
+	Enter();
+	if (CheckChannel(channel) < 0)
+		return DADSS_SIM_ERROR_CHANNEL;
+	if (code > DADSS_MDAC2_CODE_MAX)
+		return DADSS_SIM_ERROR_VALUE;
+	dss.pending[channel-1].mdac2Code = code;
+	return 0;
+}
+
+int CVIFUNC DADSS_GetMDAC2(int channel, unsigned int *code)
+{
+	Enter();
+	if (CheckChannel(channel) < 0)
+		return DADSS_SIM_ERROR_CHANNEL;
+	*code = dss.active[channel-1].mdac2Code;
+	return 0;
+}
+
+int CVIFUNC DADSS_GetAmplitudeMax(int channel, double *amplitude)
+{
+	Enter();
+	if (CheckChannel(channel) < 0)
+		return DADSS_SIM_ERROR_CHANNEL;
+	*amplitude = FullScale(&dss.pending[channel-1])*MDAC1_CODE_MAX/DADSS_MDAC1_CODE_RANGE;
+	return 0;
+}
+
+int CVIFUNC DADSS_UpdateMDAC2(void)
+{
+	Enter();
+	Stage();
+	for (int i = 0; i < DADSS_CHANNELS; ++i)
+		dss.staged[i].mdac2Code = dss.pending[i].mdac2Code;
+	return 0;
+}
+
+int CVIFUNC DADSS_SetCLKFrequency(double clockFrequency)
+{
+	Enter();
+	if (clockFrequency < DADSS_CLOCKFREQUENCY_MIN || clockFrequency > DADSS_CLOCKFREQUENCY_MAX)
+		return DADSS_SIM_ERROR_VALUE;
+	dss.clockFrequency = clockFrequency;
+	ComputeSamples();
+	return 0;
+}
+
+int CVIFUNC DADSS_GetCLKFrequency(double *clockFrequency)
+{
+	Enter();
+	*clockFrequency = dss.clockFrequency;
+	return 0;
+}
+
+int CVIFUNC DADSS_SetNumberSamples(int nSamples)
+{
+	Enter();
+	if (nSamples < DADSS_SAMPLES_MIN || nSamples > DADSS_SAMPLES_MAX)
+		return DADSS_SIM_ERROR_SAMPLES;
+	dss.nSamples = nSamples;
+	dss.realFrequency = dss.clockFrequency*1.0e6/(dss.clockDivider*dss.nSamples);
+	return 0;
+}
+
+int CVIFUNC DADSS_GetNumberSamples(int *nSamples)
+{
+	Enter();
+	*nSamples = dss.nSamples;
+	return 0;
+}
+
+/// HIFN Synthesize one period of the waveform stored in the NCO memory, as
+/// HIFN MDAC1 codes: code*sin(2*pi*i/nSamples+phase)+offset
+int CVIFUNC DADSS_GetWaveform(int channel, int *samples, int nSamples)
+{
+	const SimChannel *c;
+	double w;
+
+	Enter();
+	if (CheckChannel(channel) < 0)
+		return DADSS_SIM_ERROR_CHANNEL;
+	if (nSamples < 0 || nSamples > dss.nSamples)
+		return DADSS_SIM_ERROR_SAMPLES;
+	c = &dss.active[channel-1];
+	w = 2.0*PI/dss.nSamples;
+	for (int i = 0; i < nSamples; ++i) {
+		int sample = (int)floor(c->mdac1Code*sin(w*i+c->phase)+0.5)+c->mdac1Offset;
+		samples[i] = sample > MDAC1_CODE_MAX ? MDAC1_CODE_MAX :
+					 sample < -MDAC1_CODE_MAX ? -MDAC1_CODE_MAX : sample;
+	}
+	return 0;
+}
+
+int CVIFUNC DADSS_StartStop(int start)
+{
+	Enter();
+	dss.isRunning = start != 0;
+	return 0;
+}
+
+int CVIFUNC DADSS_StartStop_Status(int *status)
+{
+	Enter();
+	*status = dss.isRunning;
+	return 0;
+}
+
+//==============================================================================
+// Global functions (simulation control)
+
+void DADSS_SimSetSettleTime(double settleTime)
+{
+	Initialize();
+	dss.settleTime = settleTime < 0.0 ? 0.0 : settleTime;
+}
+
+double DADSS_SimGetSettleTime(void)
+{
+	Initialize();
+	return dss.settleTime;
+}
+
+void DADSS_SimSetCallLatency(double callLatency)
+{
+	Initialize();
+	dss.callLatency = callLatency < 0.0 ? 0.0 : callLatency;
+}
+
+double DADSS_SimGetCallLatency(void)
+{
+	Initialize();
+	return dss.callLatency;
+}
+
+/// HIFN Phasor of the voltage generated by a channel at a given time. Times
+/// HIFN before the last settings change return the previous settings, so that
+/// HIFN a detector model can integrate its response over the past interval
+/// HIPAR channel/Channel number (1 to DADSS_CHANNELS)
+/// HIPAR time/Simulation time (SimTime) at which the output is evaluated
+/// HIPAR real/Real part in volts (peak), zero while generation is stopped
+/// HIPAR imag/Imaginary part in volts (peak)
+/// HIRET The return value is 0 on success or a negative value on failure
+int DADSS_SimGetOutputPhasor(int channel, double time, double *real, double *imag)
+{
+	const SimChannel *c;
+	double amplitude;
+
+	Initialize();
+	if (CheckChannel(channel) < 0)
+		return DADSS_SIM_ERROR_CHANNEL;
+	Promote();
+	if (dss.isStaged && time >= dss.stagedTime)
+		c = &dss.staged[channel-1];
+	else if (time >= dss.activeTime)
+		c = &dss.active[channel-1];
+	else
+		c = &dss.previous[channel-1];
+	amplitude = dss.isRunning ? c->mdac1Code*FullScale(c)/DADSS_MDAC1_CODE_RANGE : 0.0;
+	*real = amplitude*cos(c->phase);
+	*imag = amplitude*sin(c->phase);
+	return 0;
+}
+
+unsigned long DADSS_SimGetUpdateCount(void)
+{
+	return dss.updateCount;
+}
+
+void DADSS_SimResetUpdateCount(void)
+{
+	dss.updateCount = 0;
+}
+
+#endif /* DADSS_SIMULATION */
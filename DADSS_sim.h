@@ -0,0 +1,71 @@
+//==============================================================================
+//
+// VersICaL impedance bridge client
+//
+// Copyright 2018-2019	Massimo Ortolano <massimo.ortolano@polito.it> 
+//                		Martina Marzano <m.marzano@inrim.it>
+//
+// This code is licensed under MIT license (see LICENSE.txt for details)
+//
+//==============================================================================
+
+//==============================================================================
+//
+// Simulated DA-DSS source.
+//
+// When the project is compiled with DADSS_SIMULATION defined, DADSS_sim.c
+// provides the whole DADSS_* surface of DA_DSS_cvi_driver.h, so the client
+// runs without the PXI chassis: remove DA_DSS_cvi_driver.lib from the project
+// (or from the link line) and add /DDADSS_SIMULATION to the compiler defines.
+//
+// Settings written with the Set functions take effect after the matching
+// Update call plus the settle time, as on the real source. The settle time and
+// the per-call latency can be changed at run time with the functions below or
+// with the environment variables DADSS_SIM_SETTLE_TIME and
+// DADSS_SIM_CALL_LATENCY (seconds).
+//
+//==============================================================================
+
+#ifndef DADSS_SIM_H
+#define DADSS_SIM_H
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+//==============================================================================
+// Include files
+
+//==============================================================================
+// Constants
+
+#define DADSS_SIM_SETTLE_TIME 0.2
+#define DADSS_SIM_CALL_LATENCY 0.002
+#define DADSS_SIM_SAMPLE_RATE_MAX 1.0e6
+#define DADSS_SIM_PHASE_BITS 24
+
+//==============================================================================
+// Types
+
+typedef enum {
+	DADSS_SIM_ERROR_CHANNEL = -1,
+	DADSS_SIM_ERROR_VALUE = -2,
+	DADSS_SIM_ERROR_SAMPLES = -3
+} DADSS_SimError;
+
+//==============================================================================
+// Global functions
+
+void DADSS_SimSetSettleTime(double);
+double DADSS_SimGetSettleTime(void);
+void DADSS_SimSetCallLatency(double);
+double DADSS_SimGetCallLatency(void);
+int DADSS_SimGetOutputPhasor(int, double, double *, double *);
+unsigned long DADSS_SimGetUpdateCount(void);
+void DADSS_SimResetUpdateCount(void);
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif /* DADSS_SIM_H */
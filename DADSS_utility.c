@@ -13,10 +13,31 @@
 // Include files
 
 #include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "DA_DSS_cvi_driver.h"
 #include "DADSS_utility.h"
 
+#define TWO_PI 6.2831853071795865
+
+// Two decimal digits for each number from 0 to 99
+static const char digitPairs[] = 
+	"0001020304050607080910111213141516171819"
+	"2021222324252627282930313233343536373839"
+	"4041424344454647484950515253545556575859"
+	"6061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+// Cosine and sine tables of the last sample count seen by DADSS_GetWaveformPhasor
+static struct {
+	int nSamples;
+	void *block;
+	double *cosTable;
+	double *sinTable;
+} phasorTables = {0, NULL, NULL, NULL};
+
 const double DADSS_RangeMultipliers[] = {0.5, 1.0, 2.0, 4.0}; 
 const double DADSS_RangeMaxAmplitudes[] = {
 	[DADSS_RANGE_1V] = 1.5, 
@@ -28,6 +49,26 @@ const double DADSS_RangeMaxAmplitudes[] = {
 //==============================================================================
 // Static functions
 
+// Decimal digits of u, at least one, written from q backwards
+static char inline *FormatDigitsBackwards(unsigned int u, char *q)
+{
+	while (u >= 100) {
+		unsigned int r = u % 100;
+
+		u /= 100;
+		q -= 2;
+		q[0] = digitPairs[2*r];
+		q[1] = digitPairs[2*r+1];
+	}
+	if (u >= 10) {
+		q -= 2;
+		q[0] = digitPairs[2*u];
+		q[1] = digitPairs[2*u+1];
+	} else
+		*--q = (char)('0' + u);
+	return q;
+}
+
 static void inline PolarToCartesian(double mag, double arg, double *x, double *y)
 {
 	*x = mag*cos(arg);
@@ -40,6 +81,98 @@ static void inline CartesianToPolar(double x, double y, double *mag, double *arg
 	*arg = atan2(y,x);
 }
 
+// First DFT bin with the Goertzel algorithm in the form of Reinsch, which
+// stays accurate at the low relative frequency of the fundamental. The record
+// is split into DADSS_PHASOR_LANES interleaved subsequences, whose independent
+// recurrences are recombined at the end
+static void GoertzelPhasor(const int *samples, int nSamples, double *sumReal, double *sumImag)
+{
+	double s[DADSS_PHASOR_LANES] = {0.0}, d[DADSS_PHASOR_LANES] = {0.0};
+	double omega = TWO_PI/nSamples;
+	double laneOmega = DADSS_PHASOR_LANES*omega;
+	double lambda = -4.0*sin(laneOmega/2.0)*sin(laneOmega/2.0); // 2 cos(laneOmega)-2
+	int nBlocks = nSamples/DADSS_PHASOR_LANES;
+
+	for (int i = 0; i < nBlocks; ++i) {
+		const int *x = samples+i*DADSS_PHASOR_LANES;
+
+		for (int j = 0; j < DADSS_PHASOR_LANES; ++j) {
+			d[j] += x[j]+lambda*s[j];
+			s[j] += d[j];
+		}
+	}
+
+	// Lane j holds the DFT at laneOmega of samples j, j+LANES, ..., up to the
+	// phase factor of its last sample and of its offset j
+	*sumReal = *sumImag = 0.0;
+	for (int j = 0; j < DADSS_PHASOR_LANES; ++j) {
+		double re = -0.5*lambda*s[j]+d[j]*cos(laneOmega);
+		double im = (s[j]-d[j])*sin(laneOmega);
+		double theta = omega*((double)DADSS_PHASOR_LANES*(nBlocks-1)+j);
+
+		*sumReal += re*cos(theta)+im*sin(theta);
+		*sumImag += im*cos(theta)-re*sin(theta);
+	}
+	for (int i = nBlocks*DADSS_PHASOR_LANES; i < nSamples; ++i) {
+		*sumReal += samples[i]*cos(omega*i);
+		*sumImag -= samples[i]*sin(omega*i);
+	}
+}
+
+// Build the cosine and sine tables of one period of nSamples samples, unless
+// they are already cached. The tables share one block, each aligned to
+// DADSS_PHASOR_TABLE_ALIGNMENT bytes
+static int UpdatePhasorTables(int nSamples)
+{
+	int stride = (nSamples+DADSS_PHASOR_LANES-1)/DADSS_PHASOR_LANES*DADSS_PHASOR_LANES;
+	double omega = TWO_PI/nSamples;
+
+	if (phasorTables.nSamples == nSamples)
+		return 0;
+
+	free(phasorTables.block);
+	phasorTables.nSamples = 0;
+	phasorTables.block = malloc(2*stride*sizeof(double)+DADSS_PHASOR_TABLE_ALIGNMENT);
+	if (phasorTables.block == NULL)
+		return -1;
+	phasorTables.cosTable = (double *)(((uintptr_t)phasorTables.block+DADSS_PHASOR_TABLE_ALIGNMENT-1) &
+									   ~(uintptr_t)(DADSS_PHASOR_TABLE_ALIGNMENT-1));
+	phasorTables.sinTable = phasorTables.cosTable+stride;
+	for (int i = 0; i < nSamples; ++i) {
+		phasorTables.cosTable[i] = cos(omega*i);
+		phasorTables.sinTable[i] = sin(omega*i);
+	}
+	phasorTables.nSamples = nSamples;
+	return 0;
+}
+
+// First DFT bin as the correlation of the record with the cached tables, with
+// DADSS_PHASOR_LANES independent accumulators
+static void CorrelatePhasorTables(const int *samples, int nSamples, double *sumReal, double *sumImag)
+{
+	const double *cosTable = phasorTables.cosTable;
+	const double *sinTable = phasorTables.sinTable;
+	double re[DADSS_PHASOR_LANES] = {0.0}, im[DADSS_PHASOR_LANES] = {0.0};
+	int nBlocks = nSamples/DADSS_PHASOR_LANES;
+	int i;
+
+	for (i = 0; i < nBlocks*DADSS_PHASOR_LANES; i += DADSS_PHASOR_LANES)
+		for (int j = 0; j < DADSS_PHASOR_LANES; ++j) {
+			re[j] += samples[i+j]*cosTable[i+j];
+			im[j] -= samples[i+j]*sinTable[i+j];
+		}
+	for ( ; i < nSamples; ++i) {
+		re[0] += samples[i]*cosTable[i];
+		im[0] -= samples[i]*sinTable[i];
+	}
+
+	*sumReal = *sumImag = 0.0;
+	for (int j = 0; j < DADSS_PHASOR_LANES; ++j) {
+		*sumReal += re[j];
+		*sumImag += im[j];
+	}
+}
+
 //==============================================================================
 // Global functions
 
@@ -167,3 +300,90 @@ DADSS_RangeList DADSS_GetMinimumRange(double amplitude)
 		return DADSS_OVERRANGE;
 }
 
+/// HIFN Build the tables used by DADSS_GetWaveformPhasor for a sample count,
+/// HIFN unless already cached. Once they are built, DADSS_GetWaveformPhasor can
+/// HIFN be called concurrently from several threads for that sample count
+/// HIPAR nSamples/Number of samples in a period
+/// HIRET The return value is 0 on success or -1 if nSamples is out of range
+/// HIRET or the tables cannot be allocated
+int DADSS_PreparePhasorTables(int nSamples)
+{
+	if (nSamples < DADSS_SAMPLES_MIN || nSamples > DADSS_SAMPLES_MAX)
+		return -1;
+	return UpdatePhasorTables(nSamples);
+}
+
+/// HIFN Phasor of the fundamental of a waveform record, that is, its first
+/// HIFN DFT bin. The record is correlated with cosine and sine tables which
+/// HIFN are cached across calls and rebuilt only when nSamples changes; if the
+/// HIFN tables cannot be allocated, the Goertzel recurrence is used instead.
+/// HIFN Rebuilding the tables is not thread safe: see DADSS_PreparePhasorTables
+/// HIPAR samples/Waveform record (MDAC1 codes), as from DADSS_GetWaveform
+/// HIPAR nSamples/Number of samples in a period
+/// HIPAR real/Real part of the phasor (MDAC1 codes, peak)
+/// HIPAR imag/Imaginary part of the phasor (MDAC1 codes, peak)
+/// HIRET The return value is 0 on success or -1 if nSamples is out of range
+int DADSS_GetWaveformPhasor(const int *samples, int nSamples, double *real, double *imag)
+{
+	double sumReal, sumImag;
+
+	if (nSamples < DADSS_SAMPLES_MIN || nSamples > DADSS_SAMPLES_MAX)
+		return -1;
+
+	if (UpdatePhasorTables(nSamples) == 0)
+		CorrelatePhasorTables(samples, nSamples, &sumReal, &sumImag);
+	else
+		GoertzelPhasor(samples, nSamples, &sumReal, &sumImag);
+
+	// Samples are A sin(omega i+phi): the phasor A exp(j phi) is
+	// 2/N (-Im X1+j Re X1)
+	*real = -2.0*sumImag/nSamples;
+	*imag = 2.0*sumReal/nSamples;
+	return 0;
+}
+
+/// HIFN Formats waveform samples as decimal text, one sample per line. The
+/// HIFN digits are produced two at a time from a table, without snprintf
+/// HIPAR samples/Waveform record (MDAC1 codes), as from DADSS_GetWaveform
+/// HIPAR nSamples/Number of samples
+/// HIPAR buf/Output buffer of at least nSamples*DADSS_SAMPLE_TEXT_SZ+1 characters
+/// HIRET The return value is the length of the text, excluding the terminating null
+int DADSS_FormatSamples(const int *samples, int nSamples, char *buf)
+{
+	char *p = buf;
+	char digits[16]; // Room for the eight-byte copies
+
+	for (int i = 0; i < nSamples; ++i) {
+		unsigned int isNegative = samples[i] < 0;
+		unsigned int u = isNegative ? 0u-(unsigned int)samples[i] : (unsigned int)samples[i];
+
+		// The sign and the digit count are computed without branches, which
+		// random-looking samples would mispredict
+		*p = '-';
+		p += isNegative;
+		if (u < 1000000) {
+			// Six digits with leading zeros and the newline are packed in a
+			// word, in memory order on the little-endian x86 targets, then
+			// shifted to drop the leading zeros and stored at once
+			int nDigits = 1 + (u >= 10) + (u >= 100) + (u >= 1000) + (u >= 10000) + (u >= 100000);
+			uint16_t high, middle, low;
+			uint64_t word;
+
+			memcpy(&high, digitPairs + 2*(u / 10000), 2);
+			memcpy(&middle, digitPairs + 2*(u / 100 % 100), 2);
+			memcpy(&low, digitPairs + 2*(u % 100), 2);
+			word = high | (uint64_t)middle << 16 | (uint64_t)low << 32 | (uint64_t)'\n' << 48;
+			word >>= 8*(6-nDigits);
+			memcpy(p, &word, 8);
+			p += nDigits+1;
+		} else {
+			char *q = FormatDigitsBackwards(u, digits + sizeof digits);
+
+			memcpy(p, q, digits + sizeof digits - q);
+			p += digits + sizeof digits - q;
+			*p++ = '\n';
+		}
+	}
+	*p = '\0';
+	return p-buf;
+}
@@ -47,6 +47,9 @@
 #define DADSS_ADJ_DELAY 1.0
 #define DADSS_REFERENCE_VOLTAGE 3.0
 #define DADSS_MAX_RMS_OUTPUT_CURRENT 0.1
+#define DADSS_PHASOR_LANES 4 // Independent accumulators in DADSS_GetWaveformPhasor
+#define DADSS_PHASOR_TABLE_ALIGNMENT 32 // Bytes, for AVX loads
+#define DADSS_SAMPLE_TEXT_SZ 12 // Characters per sample in DADSS_FormatSamples: sign, 10 digits, newline
 
 #ifdef __cplusplus
 	extern "C" {
@@ -85,6 +88,9 @@ int DADSS_GetWaveformParametersPolar(int channel, double *, double *);
 int DADSS_SetWaveformParametersCartesian(int channel, double, double);
 int DADSS_GetWaveformParametersCartesian(int channel, double *, double *);
 DADSS_RangeList DADSS_GetMinimumRange(double);
+int DADSS_PreparePhasorTables(int);
+int DADSS_GetWaveformPhasor(const int *, int, double *, double *);
+int DADSS_FormatSamples(const int *, int, char *);
 
 //==============================================================================
 // Global variables
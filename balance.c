@@ -0,0 +1,865 @@
+//==============================================================================
+//
+// VersICaL impedance bridge client
+//
+// Copyright 2018-2019	Massimo Ortolano <massimo.ortolano@polito.it> 
+//                		Martina Marzano <m.marzano@inrim.it>
+//
+// This code is licensed under MIT license (see LICENSE.txt for details)
+//
+//==============================================================================
+
+//==============================================================================
+// Include files
+
+#include <ansi_c.h>
+#include <analysis.h>
+#include <utility.h>
+
+#include "main.h"
+#include "msg.h"
+#include "cfg.h"
+#include "lockin.h"
+#include "balance.h"
+#include "settle.h"
+#include "sensitivity.h"
+#include "sim.h"
+#include "DA_DSS_cvi_driver.h"
+
+//==============================================================================
+// Constants
+
+//==============================================================================
+// Types
+
+typedef struct {
+	double real;
+	double imag;
+} Phasor;
+
+// Lock-in of a balance, with the settling of its readings
+typedef struct {
+	Transport *transport;
+	int channel;			// Whose lock-in input settings are applied
+	double threshold;		// Balance threshold of the response being settled
+	double expectedChange;	// Of the response being settled, 0 if unknown
+	double noise;			// Rms noise of the readings
+	int isPredicted;		// Last reading predicted from the output filter response
+	SettleDetector detector;
+	LockinReading lockinReading;	// Last reading
+} LockinProbe;
+
+// Detection point of a joint balance, shared by the channels with the same
+// lock-in and lock-in input settings
+typedef struct {
+	int channel;		// First channel nulled at this point
+	double threshold;	// Smallest balance threshold of its channels
+	Phasor response;
+} DetectionPoint;
+
+// Lock-in of a joint balance, observing its detection points in turn
+typedef struct {
+	LockinProbe probe;
+	int nPoints;
+	int points[DADSS_CHANNELS];	// Indexes of the detection points
+	int current;				// In points, of the one the input is set for
+} JointLockin;
+
+//==============================================================================
+// Static global variables
+
+static volatile int isCancelled; // Set by BalanceCancel from another thread
+
+//==============================================================================
+// Static functions
+
+// The balance runs on the instrument thread, so nothing has to be processed
+// while waiting; a real-time wait is cut short by a cancel request
+static void Wait(double seconds)
+{
+	if (SimIsVirtualTime()) {
+		SimDelay(seconds);
+		return;
+	}
+	while (seconds > 0.0 && !isCancelled) {
+		double slice = fmin(seconds, AUTOZERO_CANCEL_INTERVAL);
+
+		Delay(slice);
+		seconds -= slice;
+	}
+}
+
+// Outcome of a balance stopped by BalanceCancel, checked after each stimulus
+// update and measurement of the responses: once cancelled, these return early
+// without updating the source, and with readings that are not used
+static int IsCancelled(BalanceResult *result)
+{
+	if (!isCancelled)
+		return 0;
+	result->outcome = BALANCE_CANCELLED;
+	return 1;
+}
+
+// Read the lock-ins at once, auto-ranging each first if requested for its
+// channel, from their data buffers if configured
+static int ReadResponses(LockinProbe *probes[], int nProbes)
+{
+	Transport *transports[MAX_LOCKINS];
+	LockinReading lockinReadings[MAX_LOCKINS];
+
+	for (int i = 0; i < nProbes; ++i) {
+		transports[i] = probes[i]->transport;
+		if (modeSettings[0].channelSettings[probes[i]->channel].lockinGainType == LOCKIN_GAIN_AUTO_INTERNAL) {
+			TRANSPORTERRCHK(transports[i], TransportWrite(transports[i], "AGAN"));
+		}
+	}
+	if (lockinSettings.bufferPoints > 0) {
+		// Average the data buffers filled at the chosen rate
+		for (int i = 0; i < nProbes; ++i)
+			TRANSPORTERRCHK(transports[i], StartLockinBufferRaw(transports[i], lockinSettings.bufferRateCode));
+		Wait(lockinSettings.bufferPoints/LockinBufferSampleRate(lockinSettings.bufferRateCode));
+		for (int i = 0; i < nProbes; ++i)
+			TRANSPORTERRCHK(transports[i], ReadLockinBufferRaw(transports[i], lockinSettings.bufferPoints,
+															   lockinSettings.bufferFormat, &probes[i]->lockinReading));
+	} else {
+		TRANSPORTERRCHK(FindLockinError(transports, nProbes), ReadLockinsRaw(transports, nProbes, lockinReadings));
+		for (int i = 0; i < nProbes; ++i)
+			probes[i]->lockinReading = lockinReadings[i];
+	}
+	return 0;
+
+Error:
+	return -1;
+}
+
+// Rms noise of the readings of each lock-in, from the differences of readings
+// taken at the polling interval, corrected for the correlation through the
+// output filter
+static int ReadNoise(LockinProbe *probes[], int nProbes)
+{
+	Transport *transports[MAX_LOCKINS];
+	LockinReading poll[2][MAX_LOCKINS];
+	double time[2], sum[MAX_LOCKINS] = {0.0};
+	double interval = HUGE_VAL;
+
+	for (int i = 0; i < nProbes; ++i) {
+		transports[i] = probes[i]->transport;
+		interval = fmin(interval, AUTOZERO_SETTLE_POLL_FRACTION*probes[i]->lockinReading.timeConstant);
+	}
+	TRANSPORTERRCHK(FindLockinError(transports, nProbes), ReadLockinsRaw(transports, nProbes, poll[0]));
+	time[0] = SimTime();
+	for (int k = 1; k < AUTOZERO_SETTLE_NOISE_READINGS && !isCancelled; ++k) {
+		Wait(interval);
+		TRANSPORTERRCHK(FindLockinError(transports, nProbes), ReadLockinsRaw(transports, nProbes, poll[k%2]));
+		time[k%2] = SimTime();
+		for (int i = 0; i < nProbes; ++i) {
+			double lag = (time[1]-time[0])/probes[i]->lockinReading.timeConstant;
+
+			sum[i] += ((poll[1][i].real-poll[0][i].real)*(poll[1][i].real-poll[0][i].real) +
+					   (poll[1][i].imag-poll[0][i].imag)*(poll[1][i].imag-poll[0][i].imag)) /
+					  (1.0-SettleNoiseCorrelation(probes[i]->lockinReading.filterPoles, lag));
+		}
+	}
+	for (int i = 0; i < nProbes; ++i)
+		probes[i]->noise = sqrt(sum[i]/(2.0*(AUTOZERO_SETTLE_NOISE_READINGS-1)));
+	return 0;
+
+Error:
+	return -1;
+}
+
+// Wait for the lock-ins to settle after a step of the stimulus, polling them
+// together at a fraction of the shortest time constant, but no longer than the
+// longest fixed delay adjDelay. A lock-in stops being polled once settled, or
+// with isPredicted set when its final reading, predicted from the response of
+// the output filter, is still well above the balance threshold; it is then
+// read once, without averaging: near the balance the prediction is not
+// accurate enough for the secant step
+static int WaitSettled(LockinProbe *probes[], int nProbes)
+{
+	Transport *transports[MAX_LOCKINS];
+	LockinProbe *pending[MAX_LOCKINS];
+	LockinReading poll[MAX_LOCKINS];
+	double startTime = SimTime();
+	double deadline = startTime, interval = HUGE_VAL;
+	int nPending = nProbes;
+
+	for (int i = 0; i < nProbes; ++i) {
+		pending[i] = probes[i];
+		probes[i]->isPredicted = 0;
+		deadline = fmax(deadline, startTime+probes[i]->lockinReading.adjDelay);
+		interval = fmin(interval, AUTOZERO_SETTLE_POLL_FRACTION*probes[i]->lockinReading.timeConstant);
+		SettleStart(&probes[i]->detector, AUTOZERO_SETTLE_TOLERANCE*probes[i]->threshold, probes[i]->expectedChange,
+					startTime);
+	}
+	while (nPending > 0 && !isCancelled) {
+		double now = SimTime();
+		int n = 0;
+
+		if (now+interval >= deadline) {
+			Wait(deadline-now);
+			return 0;
+		}
+		Wait(interval);
+		for (int i = 0; i < nPending; ++i)
+			transports[i] = pending[i]->transport;
+		TRANSPORTERRCHK(FindLockinError(transports, nPending), ReadLockinsRaw(transports, nPending, poll));
+		now = SimTime();
+		for (int i = 0; i < nPending; ++i) {
+			LockinProbe *probe = pending[i];
+			SettleState state = SettleAddReading(&probe->detector, now, poll[i].real, poll[i].imag);
+
+			if (state == SETTLE_PREDICTED && lockinSettings.bufferPoints == 0 &&
+					sqrt(probe->detector.predictedReal*probe->detector.predictedReal +
+						 probe->detector.predictedImag*probe->detector.predictedImag) >
+					AUTOZERO_PREDICT_MIN_RESPONSE*probe->threshold) {
+				probe->lockinReading = poll[i];
+				probe->lockinReading.real = probe->detector.predictedReal;
+				probe->lockinReading.imag = probe->detector.predictedImag;
+				probe->isPredicted = 1;
+			} else if (state != SETTLE_CONVERGED && state != SETTLE_NOISE)
+				pending[n++] = probe;
+		}
+		nPending = n;
+	}
+	return 0;
+
+Error:
+	return -1;
+}
+
+// Read back the stimulus actually generated by a channel
+static int ReadStimulus(int channel, Phasor *stimulus)
+{
+	ChannelSettings *channelSettings = &modeSettings[0].channelSettings[channel];
+
+	DSSERRCHK(DADSS_GetWaveformParametersPolar(channel+1, &channelSettings->amplitude, &channelSettings->phase));
+	ToRect(channelSettings->amplitude, channelSettings->phase, &channelSettings->real, &channelSettings->imag);
+	stimulus->real = channelSettings->real;
+	stimulus->imag = channelSettings->imag;
+	return 0;
+
+Error:
+	return -1;
+}
+
+// Apply a new stimulus, read back the value actually generated and measure
+// the response, expected to change by the expectedChange of the probe (0 if
+// unknown): the predicted final reading of the lock-in if the balance is still
+// far, a reading once the lock-in has settled otherwise
+static int SetStimulus(int channel, double amplitude, double phase, LockinProbe *probe,
+					   Phasor *stimulus, Phasor *response)
+{
+	if (isCancelled)
+		return 0;
+	DSSERRCHK(DADSS_SetWaveformParametersPolar(channel+1, amplitude, phase));
+	DSSERRCHK(DADSS_UpdateWaveform());
+
+	/* Read the outcome */
+	if (WaitSettled(&probe, 1) < 0 || ReadStimulus(channel, stimulus) < 0)
+		goto Error;
+	if (isCancelled)
+		return 0;
+	if (!probe->isPredicted && ReadResponses(&probe, 1) < 0)
+		goto Error;
+	response->real = probe->lockinReading.real;
+	response->imag = probe->lockinReading.imag;
+	SettleEnd(&probe->detector, response->real, response->imag);
+	return 0;
+
+Error:
+	return -1;
+}
+
+static int IsSameLockinInput(const LockinInputSettings *a, const LockinInputSettings *b)
+{
+	return a->lockinInputType == b->lockinInputType &&
+		   a->lockinGroundConnection == b->lockinGroundConnection &&
+		   a->lockinCouplingType == b->lockinCouplingType &&
+		   a->lockinFiltersType == b->lockinFiltersType &&
+		   a->lockinReserveType == b->lockinReserveType;
+}
+
+// Measure the responses at the detection points, expected to become expected
+// (NULL if unknown), with all the lock-ins at once. Each lock-in observes its
+// points in turn from current, the point its input is set for, or from the
+// next one if skipCurrent, and its settle detector restarts from the last
+// reading at each switch. A step of the stimulus is then first seen where no
+// switch hides its delay
+static int MeasurePoints(DetectionPoint *points, JointLockin *lockins, int nLockins, int skipCurrent,
+						 const Phasor *expected, BalanceStepFunction stepFunction, void *data)
+{
+	for (int n = 0; ; ++n) {
+		LockinProbe *probes[MAX_LOCKINS], *reading[MAX_LOCKINS];
+		int measured[MAX_LOCKINS]; // Point of each probe
+		int nProbes = 0, nReading = 0;
+
+		for (int l = 0; l < nLockins; ++l) {
+			JointLockin *lockin = &lockins[l];
+			LockinProbe *probe = &lockin->probe;
+			int index, i;
+
+			if (n >= lockin->nPoints-skipCurrent)
+				continue;
+			index = (lockin->current+(n > 0 || skipCurrent))%lockin->nPoints;
+			i = lockin->points[index];
+			if (index != lockin->current) {
+				TRANSPORTERRCHK(probe->transport, SetLockinInputRaw(probe->transport,
+								modeSettings[0].channelSettings[points[i].channel].lockinInputSettings));
+				SettleInit(&probe->detector, probe->lockinReading.timeConstant, probe->lockinReading.filterPoles,
+						   probe->noise, SimTime(), probe->lockinReading.real, probe->lockinReading.imag);
+				lockin->current = index;
+				probe->channel = points[i].channel;
+			}
+			probe->threshold = points[i].threshold;
+			probe->expectedChange = 0.0;
+			if (expected != NULL)
+				probe->expectedChange = sqrt((expected[i].real-probe->lockinReading.real) *
+											 (expected[i].real-probe->lockinReading.real) +
+											 (expected[i].imag-probe->lockinReading.imag) *
+											 (expected[i].imag-probe->lockinReading.imag));
+			measured[nProbes] = i;
+			probes[nProbes++] = probe;
+		}
+		if (nProbes == 0)
+			return 0;
+
+		if (WaitSettled(probes, nProbes) < 0)
+			goto Error;
+		if (isCancelled)
+			return 0;
+		for (int k = 0; k < nProbes; ++k)
+			if (!probes[k]->isPredicted)
+				reading[nReading++] = probes[k];
+		if (nReading > 0 && ReadResponses(reading, nReading) < 0)
+			goto Error;
+		for (int k = 0; k < nProbes; ++k) {
+			DetectionPoint *point = &points[measured[k]];
+
+			point->response.real = probes[k]->lockinReading.real;
+			point->response.imag = probes[k]->lockinReading.imag;
+			SettleEnd(&probes[k]->detector, point->response.real, point->response.imag);
+			if (stepFunction != NULL)
+				stepFunction(probes[k]->lockinReading, data);
+		}
+	}
+
+Error:
+	return -1;
+}
+
+static int IsBalanced(const DetectionPoint *points, int nPoints)
+{
+	for (int i = 0; i < nPoints; ++i)
+		if (sqrt(points[i].response.real*points[i].response.real +
+				 points[i].response.imag*points[i].response.imag) > points[i].threshold)
+			return 0;
+	return 1;
+}
+
+// Stimulus steps nulling the responses at all the detection points to first
+// order, in the least-squares sense with responses in balance thresholds and
+// stimuli in full scales. The normal equations are regularized by a small
+// fraction of their mean diagonal, which gives the smallest step when fewer
+// points than channels leave the balance undetermined. Returns -1 if the
+// sensitivities vanish
+static int SolveJointStep(Phasor jacobian[][DADSS_CHANNELS], const DetectionPoint *points, int nPoints,
+						  const double *scale, int nChannels, Phasor *step)
+{
+	Phasor a[DADSS_CHANNELS][DADSS_CHANNELS+1]; // Normal equations, augmented
+	double trace = 0.0;
+
+	for (int j = 0; j < nChannels; ++j) {
+		for (int l = 0; l <= nChannels; ++l) {
+			a[j][l].real = a[j][l].imag = 0.0;
+			for (int i = 0; i < nPoints; ++i) {
+				double weight = scale[j]/(points[i].threshold*points[i].threshold);
+				double real, imag;
+				const Phasor *column = l < nChannels ? &jacobian[i][l] : &points[i].response;
+
+				// conj(J_ij) J_il, or -conj(J_ij) r_i for the right-hand side
+				CxMul(jacobian[i][j].real, -jacobian[i][j].imag, column->real, column->imag, &real, &imag);
+				if (l < nChannels) {
+					a[j][l].real += weight*scale[l]*real;
+					a[j][l].imag += weight*scale[l]*imag;
+				} else {
+					a[j][l].real -= weight*real;
+					a[j][l].imag -= weight*imag;
+				}
+			}
+		}
+		trace += a[j][j].real;
+	}
+	if (!(trace > 0.0))
+		return -1;
+	for (int j = 0; j < nChannels; ++j)
+		a[j][j].real += AUTOZERO_JOINT_REGULARIZATION*trace/nChannels;
+
+	// Gauss-Jordan elimination with partial pivoting
+	for (int j = 0; j < nChannels; ++j) {
+		int pivot = j;
+
+		for (int i = j+1; i < nChannels; ++i)
+			if (a[i][j].real*a[i][j].real+a[i][j].imag*a[i][j].imag >
+					a[pivot][j].real*a[pivot][j].real+a[pivot][j].imag*a[pivot][j].imag)
+				pivot = i;
+		if (a[pivot][j].real == 0.0 && a[pivot][j].imag == 0.0)
+			return -1;
+		for (int l = 0; l <= nChannels; ++l) {
+			Phasor t = a[j][l];
+
+			a[j][l] = a[pivot][l];
+			a[pivot][l] = t;
+		}
+		for (int l = nChannels; l >= j; --l)
+			CxDiv(a[j][l].real, a[j][l].imag, a[j][j].real, a[j][j].imag, &a[j][l].real, &a[j][l].imag);
+		for (int i = 0; i < nChannels; ++i) {
+			if (i == j)
+				continue;
+			for (int l = nChannels; l >= j; --l) {
+				double real, imag;
+
+				CxMul(a[i][j].real, a[i][j].imag, a[j][l].real, a[j][l].imag, &real, &imag);
+				a[i][l].real -= real;
+				a[i][l].imag -= imag;
+			}
+		}
+	}
+	for (int j = 0; j < nChannels; ++j) {
+		step[j].real = scale[j]*a[j][nChannels].real;
+		step[j].imag = scale[j]*a[j][nChannels].imag;
+	}
+	return 0;
+}
+
+// Broyden update of the sensitivities after the stimulus steps, the smallest
+// change, with stimuli in full scales, that accounts for the observed change
+// of the responses. Skipped when the change expected from the step is within
+// the noise of the readings
+static void UpdateJacobian(Phasor jacobian[][DADSS_CHANNELS], const DetectionPoint *points, const Phasor *previous,
+						   int nPoints, const double *scale, const Phasor *step, int nChannels, double noise)
+{
+	Phasor error[DADSS_CHANNELS];
+	double norm = 0.0, maxChange = 0.0;
+
+	for (int i = 0; i < nPoints; ++i) {
+		double changeReal = 0.0, changeImag = 0.0;
+
+		for (int j = 0; j < nChannels; ++j) {
+			double real, imag;
+
+			CxMul(jacobian[i][j].real, jacobian[i][j].imag, step[j].real, step[j].imag, &real, &imag);
+			changeReal += real;
+			changeImag += imag;
+		}
+		maxChange = fmax(maxChange, sqrt(changeReal*changeReal+changeImag*changeImag));
+		error[i].real = points[i].response.real-previous[i].real-changeReal;
+		error[i].imag = points[i].response.imag-previous[i].imag-changeImag;
+	}
+	if (maxChange < AUTOZERO_BROYDEN_MIN_CHANGE*noise)
+		return;
+	for (int j = 0; j < nChannels; ++j)
+		norm += (step[j].real*step[j].real+step[j].imag*step[j].imag)/(scale[j]*scale[j]);
+	if (norm == 0.0)
+		return;
+	for (int i = 0; i < nPoints; ++i)
+		for (int j = 0; j < nChannels; ++j) {
+			double real, imag;
+
+			// error_i conj(step_j)
+			CxMul(error[i].real, error[i].imag, step[j].real, -step[j].imag, &real, &imag);
+			jacobian[i][j].real += real/(scale[j]*scale[j]*norm);
+			jacobian[i][j].imag += imag/(scale[j]*scale[j]*norm);
+		}
+}
+
+// Slope of the response to the stimulus of a channel cached by an earlier
+// balance, if it applies to the present source settings
+static int GetCachedSlope(int channel, Phasor *slope)
+{
+	const SensitivityCache *sensitivityCache = &modeSettings[0].channelSettings[channel].sensitivityCache;
+
+	if (!sensitivityCache->isValid ||
+			fabs(sensitivityCache->frequency-sourceSettings.frequency) >
+				AUTOZERO_CACHE_FREQUENCY_TOLERANCE*sourceSettings.frequency ||
+			sensitivityCache->range != sourceSettings.range[channel] ||
+			sensitivityCache->mdac2Code != modeSettings[0].channelSettings[channel].mdac2Code)
+		return 0;
+	slope->real = sensitivityCache->real;
+	slope->imag = sensitivityCache->imag;
+	return 1;
+}
+
+// Rms noise of the readings measured by the balance that cached the slope, if
+// read with the same time constant
+static int GetCachedNoise(int channel, double timeConstant, double *noise)
+{
+	const SensitivityCache *sensitivityCache = &modeSettings[0].channelSettings[channel].sensitivityCache;
+
+	if (!(sensitivityCache->noise > 0.0) || sensitivityCache->timeConstant != timeConstant)
+		return 0;
+	*noise = sensitivityCache->noise;
+	return 1;
+}
+
+static void SetCachedSlope(int channel, const SensitivityEstimator *estimator, const LockinProbe *probe)
+{
+	SensitivityCache *sensitivityCache = &modeSettings[0].channelSettings[channel].sensitivityCache;
+
+	if (SensitivityGetSlope(estimator, &sensitivityCache->real, &sensitivityCache->imag) < 0)
+		return;
+	sensitivityCache->frequency = sourceSettings.frequency;
+	sensitivityCache->range = sourceSettings.range[channel];
+	sensitivityCache->mdac2Code = modeSettings[0].channelSettings[channel].mdac2Code;
+	sensitivityCache->noise = probe->noise;
+	sensitivityCache->timeConstant = probe->lockinReading.timeConstant;
+	sensitivityCache->isValid = 1;
+}
+
+//==============================================================================
+// Global variables
+
+//==============================================================================
+// Global functions
+
+/// HIFN Null the detector by adjusting the stimulus of one channel on the
+/// HIFN complex plane, with the sensitivity estimated by recursive least
+/// HIFN squares over all the points of the balance. The sensitivity of the
+/// HIFN last balance reached with the same source settings, if any, replaces
+/// HIFN the exploratory second point, and its noise estimate the noise
+/// HIFN readings if the time constant is the same; the sensitivity reached is
+/// HIFN kept for the next
+/// HIPAR channel/Zero-based channel index
+/// HIPAR stepFunction/Called after each lock-in reading, can be NULL
+/// HIPAR result/Outcome, number of steps, residual and elapsed time
+/// HIRET The return value is 0 on completion, also when cancelled by
+/// HIRET BalanceCancel, or -1 on a device error, which has already been
+/// HIRET reported
+int BalanceChannel(int channel, BalanceStepFunction stepFunction, void *data, BalanceResult *result)
+{
+	double maxAmplitude, amplitude, phase, damping;
+	double startTime = SimTime();
+	ChannelSettings *channelSettings = &modeSettings[0].channelSettings[channel];
+	LockinProbe probe = {.transport = GetChannelLockin(channel), .channel = channel,
+						 .threshold = channelSettings->balanceThreshold};
+	LockinProbe *probes[] = {&probe};
+	SensitivityEstimator estimator;
+	Phasor stimulus[MAX_AUTOZERO_STEPS] = {{0}}, response[MAX_AUTOZERO_STEPS] = {{0}}, target, slope;
+	int isCached, k;
+
+	result->outcome = BALANCE_REACHED;
+	result->nSteps = 0;
+	isCancelled = 0;
+
+	DSSERRCHK(DADSS_GetAmplitudeMax(channel+1, &maxAmplitude));
+
+	// First data point of the equilibrium strategy
+	stimulus[0].real = channelSettings->real;
+	stimulus[0].imag = channelSettings->imag;
+	if (ReadResponses(probes, 1) < 0)
+		goto Error;
+	response[0].real = probe.lockinReading.real;
+	response[0].imag = probe.lockinReading.imag;
+	k = 1;
+	if (stepFunction != NULL)
+		stepFunction(probe.lockinReading, data);
+
+	// The noise measured with a cached sensitivity is reused, sparing its
+	// readings
+	isCached = GetCachedSlope(channel, &slope);
+	if (!isCached || !GetCachedNoise(channel, probe.lockinReading.timeConstant, &probe.noise)) {
+		if (ReadNoise(probes, 1) < 0)
+			goto Error;
+		if (IsCancelled(result))
+			goto Done;
+	}
+	SettleInit(&probe.detector, probe.lockinReading.timeConstant, probe.lockinReading.filterPoles, probe.noise,
+			   SimTime(), response[0].real, response[0].imag);
+	SensitivityInit(&estimator, maxAmplitude, AUTOZERO_RLS_FORGETTING);
+	SensitivityAddPoint(&estimator, stimulus[0].real, stimulus[0].imag, response[0].real, response[0].imag);
+
+	// Without a cached sensitivity, randomly update the stimulus for the
+	// second point
+	if (!isCached ||
+			SensitivitySetSlope(&estimator, slope.real, slope.imag, AUTOZERO_CACHE_UNCERTAINTY, probe.noise) < 0) {
+		stimulus[1].real = stimulus[0].real+maxAmplitude*Random(-0.01,0.01);
+		stimulus[1].imag = stimulus[0].imag+maxAmplitude*Random(-0.01,0.01);
+
+		ToPolar(stimulus[1].real, stimulus[1].imag, &amplitude, &phase);
+		if (amplitude > maxAmplitude) {
+			result->outcome = BALANCE_OUT_OF_RANGE;
+			goto Done;
+		}
+
+		probe.expectedChange = 0.0;
+		if (SetStimulus(channel, amplitude, phase, &probe, &stimulus[1], &response[1]) < 0)
+			goto Error;
+		if (IsCancelled(result))
+			goto Done;
+		if (stepFunction != NULL)
+			stepFunction(probe.lockinReading, data);
+		SensitivityAddPoint(&estimator, stimulus[1].real, stimulus[1].imag, response[1].real, response[1].imag);
+		k = 2;
+	}
+
+	// Start the equilibrium procedure
+	for (;
+			k < MAX_AUTOZERO_STEPS &&
+			sqrt(response[k-1].real*response[k-1].real +
+				 response[k-1].imag*response[k-1].imag) > channelSettings->balanceThreshold;
+			++k) {
+		// Update the source towards the null of the response fitted to all
+		// the points so far, by a fraction of the way if the sensitivity is
+		// still uncertain
+		if (SensitivityGetNull(&estimator, &target.real, &target.imag) < 0) {
+			result->outcome = BALANCE_OUT_OF_RANGE;
+			break;
+		}
+		damping = AUTOZERO_RLS_MAX_UNCERTAINTY/SensitivityUncertainty(&estimator, probe.noise);
+		if (damping > 1.0)
+			damping = 1.0;
+		stimulus[k].real = stimulus[k-1].real+damping*(target.real-stimulus[k-1].real);
+		stimulus[k].imag = stimulus[k-1].imag+damping*(target.imag-stimulus[k-1].imag);
+
+		ToPolar(stimulus[k].real, stimulus[k].imag, &amplitude, &phase);
+		if (amplitude > maxAmplitude) {
+			result->outcome = BALANCE_OUT_OF_RANGE;
+			break;
+		}
+
+		// The step aims at nulling the response
+		probe.expectedChange = sqrt(response[k-1].real*response[k-1].real+response[k-1].imag*response[k-1].imag);
+		if (SetStimulus(channel, amplitude, phase, &probe, &stimulus[k], &response[k]) < 0)
+			goto Error;
+		if (IsCancelled(result))
+			goto Done;
+		if (stepFunction != NULL)
+			stepFunction(probe.lockinReading, data);
+		SensitivityAddPoint(&estimator, stimulus[k].real, stimulus[k].imag, response[k].real, response[k].imag);
+	}
+	if (k == MAX_AUTOZERO_STEPS)
+		result->outcome = BALANCE_MAX_STEPS;
+	if (result->outcome == BALANCE_REACHED)
+		SetCachedSlope(channel, &estimator, &probe);
+	else
+		channelSettings->sensitivityCache.isValid = 0;
+
+Done:
+	TRANSPORTERRCHK(probe.transport, RestoreLockinBufferRaw(probe.transport));
+	result->nSteps = k;
+	result->residual = sqrt(response[k-1].real*response[k-1].real + response[k-1].imag*response[k-1].imag);
+	result->time = SimTime()-startTime;
+	return 0;
+
+Error:
+	RestoreLockinBufferRaw(probe.transport); // The error has already been reported
+	return -1;
+}
+
+/// HIFN Null the detector jointly over several channels, with the complex
+/// HIFN sensitivity of the response at each detection point to each channel
+/// HIFN estimated from one perturbation of each channel and refined by Broyden
+/// HIFN updates. The channels with the same lock-in and lock-in input settings
+/// HIFN share a detection point. The lock-ins are read at once, each switching
+/// HIFN its input between its points if it has more than one and leaving it as
+/// HIFN for its first channel
+/// HIPAR channels/Zero-based channel indexes, the lock-in input being set as
+/// HIPAR channels/for the first one
+/// HIPAR nChannels/Number of channels, up to DADSS_CHANNELS
+/// HIPAR stepFunction/Called after each lock-in reading, can be NULL
+/// HIPAR result/Outcome, number of stimulus updates, largest residual and
+/// HIPAR result/elapsed time
+/// HIRET The return value is 0 on completion, also when cancelled by
+/// HIRET BalanceCancel, or -1 on a device error, which has already been
+/// HIRET reported
+int BalanceChannels(const int *channels, int nChannels, BalanceStepFunction stepFunction, void *data,
+					BalanceResult *result)
+{
+	double maxAmplitude[DADSS_CHANNELS], amplitude[DADSS_CHANNELS], phase[DADSS_CHANNELS], noise = 0.0;
+	double startTime = SimTime();
+	DetectionPoint points[DADSS_CHANNELS];
+	JointLockin lockins[MAX_LOCKINS];
+	LockinProbe *probes[MAX_LOCKINS];
+	Phasor jacobian[DADSS_CHANNELS][DADSS_CHANNELS]; // Response at each point vs. stimulus of each channel
+	Phasor stimulus[DADSS_CHANNELS], step[DADSS_CHANNELS], previous[DADSS_CHANNELS], expected[DADSS_CHANNELS];
+	int nPoints = 0, nLockins = 0, k = 0;
+
+	result->outcome = BALANCE_REACHED;
+	result->nSteps = 0;
+	isCancelled = 0;
+
+	// Group the channels by detection point, and the points by lock-in
+	for (int j = 0; j < nChannels; ++j) {
+		ChannelSettings *channelSettings = &modeSettings[0].channelSettings[channels[j]];
+		int i, l;
+
+		DSSERRCHK(DADSS_GetAmplitudeMax(channels[j]+1, &maxAmplitude[j]));
+		stimulus[j].real = channelSettings->real;
+		stimulus[j].imag = channelSettings->imag;
+		for (i = 0; i < nPoints; ++i)
+			if (modeSettings[0].channelSettings[points[i].channel].lockin == channelSettings->lockin &&
+					IsSameLockinInput(&modeSettings[0].channelSettings[points[i].channel].lockinInputSettings,
+									  &channelSettings->lockinInputSettings))
+				break;
+		if (i < nPoints) {
+			if (channelSettings->balanceThreshold < points[i].threshold)
+				points[i].threshold = channelSettings->balanceThreshold;
+			continue;
+		}
+		points[nPoints].channel = channels[j];
+		points[nPoints].threshold = channelSettings->balanceThreshold;
+		points[nPoints].response.real = points[nPoints].response.imag = 0.0;
+		for (l = 0; l < nLockins; ++l)
+			if (lockins[l].probe.transport == GetChannelLockin(channels[j]))
+				break;
+		if (l == nLockins) {
+			memset(&lockins[l], 0, sizeof lockins[l]);
+			lockins[l].probe.transport = GetChannelLockin(channels[j]);
+			lockins[l].probe.channel = channels[j];
+			probes[nLockins++] = &lockins[l].probe;
+		}
+		lockins[l].points[lockins[l].nPoints++] = nPoints++;
+	}
+
+	// First data point, with the input of each lock-in set for its first
+	// point, once the output filters of the switched lock-ins have settled.
+	// That of the first lock-in is already
+	if (nLockins > 1) {
+		double delay = 0.0;
+
+		for (int l = 1; l < nLockins; ++l)
+			TRANSPORTERRCHK(lockins[l].probe.transport, SetLockinInputRaw(lockins[l].probe.transport,
+							modeSettings[0].channelSettings[lockins[l].probe.channel].lockinInputSettings));
+		if (ReadResponses(probes+1, nLockins-1) < 0)
+			goto Error;
+		for (int l = 1; l < nLockins; ++l)
+			delay = fmax(delay, lockins[l].probe.lockinReading.adjDelay);
+		Wait(delay);
+	}
+	if (ReadResponses(probes, nLockins) < 0)
+		goto Error;
+	for (int l = 0; l < nLockins; ++l) {
+		points[lockins[l].points[0]].response.real = lockins[l].probe.lockinReading.real;
+		points[lockins[l].points[0]].response.imag = lockins[l].probe.lockinReading.imag;
+		if (stepFunction != NULL)
+			stepFunction(lockins[l].probe.lockinReading, data);
+	}
+	if (ReadNoise(probes, nLockins) < 0)
+		goto Error;
+	if (IsCancelled(result))
+		goto Done;
+	for (int l = 0; l < nLockins; ++l) {
+		LockinProbe *probe = &lockins[l].probe;
+
+		SettleInit(&probe->detector, probe->lockinReading.timeConstant, probe->lockinReading.filterPoles, probe->noise,
+				   SimTime(), probe->lockinReading.real, probe->lockinReading.imag);
+		noise = fmax(noise, probe->noise);
+	}
+	if (MeasurePoints(points, lockins, nLockins, 1, NULL, stepFunction, data) < 0)
+		goto Error;
+	k = 1;
+	if (IsCancelled(result))
+		goto Done;
+
+	// Randomly update one channel at a time for the sensitivities to it
+	for (int j = 0; j < nChannels; ++j, ++k) {
+		Phasor updated;
+
+		ToPolar(stimulus[j].real+maxAmplitude[j]*Random(-0.01,0.01),
+				stimulus[j].imag+maxAmplitude[j]*Random(-0.01,0.01), &amplitude[j], &phase[j]);
+		if (amplitude[j] > maxAmplitude[j]) {
+			result->outcome = BALANCE_OUT_OF_RANGE;
+			goto Done;
+		}
+		for (int i = 0; i < nPoints; ++i)
+			previous[i] = points[i].response;
+		DSSERRCHK(DADSS_SetWaveformParametersPolar(channels[j]+1, amplitude[j], phase[j]));
+		DSSERRCHK(DADSS_UpdateWaveform());
+		if (MeasurePoints(points, lockins, nLockins, 0, NULL, stepFunction, data) < 0 ||
+				ReadStimulus(channels[j], &updated) < 0)
+			goto Error;
+		if (IsCancelled(result))
+			goto Done;
+		for (int i = 0; i < nPoints; ++i)
+			CxDiv(points[i].response.real-previous[i].real, points[i].response.imag-previous[i].imag,
+				  updated.real-stimulus[j].real, updated.imag-stimulus[j].imag,
+				  &jacobian[i][j].real, &jacobian[i][j].imag);
+		stimulus[j] = updated;
+	}
+
+	// Update all the channels at once towards the null of the responses
+	for (; k < MAX_AUTOZERO_STEPS && !IsBalanced(points, nPoints); ++k) {
+		if (SolveJointStep(jacobian, points, nPoints, maxAmplitude, nChannels, step) < 0) {
+			result->outcome = BALANCE_OUT_OF_RANGE;
+			goto Done;
+		}
+		for (int j = 0; j < nChannels; ++j) {
+			ToPolar(stimulus[j].real+step[j].real, stimulus[j].imag+step[j].imag, &amplitude[j], &phase[j]);
+			if (amplitude[j] > maxAmplitude[j]) {
+				result->outcome = BALANCE_OUT_OF_RANGE;
+				goto Done;
+			}
+		}
+		for (int i = 0; i < nPoints; ++i) {
+			previous[i] = points[i].response;
+			expected[i] = points[i].response;
+			for (int j = 0; j < nChannels; ++j) {
+				double real, imag;
+
+				CxMul(jacobian[i][j].real, jacobian[i][j].imag, step[j].real, step[j].imag, &real, &imag);
+				expected[i].real += real;
+				expected[i].imag += imag;
+			}
+		}
+		for (int j = 0; j < nChannels; ++j)
+			DSSERRCHK(DADSS_SetWaveformParametersPolar(channels[j]+1, amplitude[j], phase[j]));
+		DSSERRCHK(DADSS_UpdateWaveform());
+		if (MeasurePoints(points, lockins, nLockins, 0, expected, stepFunction, data) < 0)
+			goto Error;
+
+		// Steps actually generated
+		for (int j = 0; j < nChannels; ++j) {
+			Phasor updated;
+
+			if (ReadStimulus(channels[j], &updated) < 0)
+				goto Error;
+			step[j].real = updated.real-stimulus[j].real;
+			step[j].imag = updated.imag-stimulus[j].imag;
+			stimulus[j] = updated;
+		}
+		if (IsCancelled(result))
+			goto Done;
+		UpdateJacobian(jacobian, points, previous, nPoints, maxAmplitude, step, nChannels, noise);
+	}
+	if (k == MAX_AUTOZERO_STEPS)
+		result->outcome = BALANCE_MAX_STEPS;
+
+Done:
+	for (int l = 0; l < nLockins; ++l) {
+		if (lockins[l].current != 0)
+			TRANSPORTERRCHK(lockins[l].probe.transport, SetLockinInputRaw(lockins[l].probe.transport,
+							modeSettings[0].channelSettings[points[lockins[l].points[0]].channel].lockinInputSettings));
+		TRANSPORTERRCHK(lockins[l].probe.transport, RestoreLockinBufferRaw(lockins[l].probe.transport));
+	}
+	result->nSteps = k;
+	result->residual = 0.0;
+	for (int i = 0; i < nPoints; ++i)
+		result->residual = fmax(result->residual, sqrt(points[i].response.real*points[i].response.real +
+													   points[i].response.imag*points[i].response.imag));
+	result->time = SimTime()-startTime;
+	return 0;
+
+Error:
+	for (int l = 0; l < nLockins; ++l)
+		RestoreLockinBufferRaw(lockins[l].probe.transport); // The error has already been reported
+	return -1;
+}
+
+/// HIFN Asks the running balance to stop, from any thread. It stops before its
+/// HIFN next DSS update or lock-in reading, cutting short the wait in progress,
+/// HIFN with the stimulus reached so far and the BALANCE_CANCELLED outcome. A
+/// HIFN request made before the balance starts has no effect
+void BalanceCancel(void)
+{
+	isCancelled = 1;
+}
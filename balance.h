@@ -0,0 +1,61 @@
+//==============================================================================
+//
+// VersICaL impedance bridge client
+//
+// Copyright 2018-2019	Massimo Ortolano <massimo.ortolano@polito.it> 
+//                		Martina Marzano <m.marzano@inrim.it>
+//
+// This code is licensed under MIT license (see LICENSE.txt for details)
+//
+//==============================================================================
+
+#ifndef BALANCE_H
+#define BALANCE_H
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+//==============================================================================
+// Include files
+
+#include "main.h"
+
+//==============================================================================
+// Constants
+
+//==============================================================================
+// Types
+
+typedef enum {
+	BALANCE_REACHED,
+	BALANCE_OUT_OF_RANGE,
+	BALANCE_MAX_STEPS,
+	BALANCE_CANCELLED
+} BalanceOutcome;
+
+typedef struct {
+	BalanceOutcome outcome;
+	int nSteps;
+	double residual;
+	double time;
+} BalanceResult;
+
+// Called after each lock-in reading, once the channel settings are updated
+typedef void (*BalanceStepFunction)(LockinReading, void *);
+
+//==============================================================================
+// External variables
+
+//==============================================================================
+// Global functions
+
+int BalanceChannel(int, BalanceStepFunction, void *, BalanceResult *);
+int BalanceChannels(const int *, int, BalanceStepFunction, void *, BalanceResult *);
+void BalanceCancel(void);
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif /* BALANCE_H */
@@ -0,0 +1,328 @@
+//==============================================================================
+//
+// VersICaL impedance bridge client
+//
+// Copyright 2018-2019	Massimo Ortolano <massimo.ortolano@polito.it> 
+//                		Martina Marzano <m.marzano@inrim.it>
+//
+// This code is licensed under MIT license (see LICENSE.txt for details)
+//
+//==============================================================================
+
+//==============================================================================
+//
+// Balance benchmark (balance_bench.prj).
+//
+// Runs the AutoZero balance (BalanceChannel) on the simulated DA-DSS, bridge
+// and lock-in over a matrix of starting offsets, noise densities, lock-in
+// time constants and balance thresholds, in virtual time. For each case it
+// reports the simulated time to null, the number of DA-DSS updates and lock-in
+// transactions, the mean lock-in transaction latency (the largest over the
+// lock-ins), and the final residual, as tab-separated values on the
+// standard output and, if a file name is given, in that file. The environment
+// variable BENCH_BUFFER_POINTS selects lock-in readings averaged over that
+// many data buffer points instead of SNAP? readings. With BENCH_JOINT set to
+// 1, the two current channels are both detuned and nulled together
+// (BalanceChannels), at the low node and at the series resistance of voltage
+// channel A, selected with the differential input of the lock-in. With
+// BENCH_LOCKINS also set to 2, the second point is observed by a second
+// lock-in, read at once with the first one, instead of switching the input of
+// the first one. With BENCH_WARM_START set to 1, a first balance caches the
+// sensitivity and the channel is detuned again before the balance that is
+// reported.
+//
+// The project must be compiled with DADSS_SIMULATION and LOCKIN_SIMULATION
+// defined.
+//
+//==============================================================================
+
+//==============================================================================
+// Include files
+
+#include <ansi_c.h>
+#include <cvirte.h>
+#include <analysis.h>
+#include <utility.h>
+
+#include "main.h"
+#include "msg.h"
+#include "cfg.h"
+#include "lockin.h"
+#include "balance.h"
+#include "sim.h"
+#include "DADSS_sim.h"
+#include "lockin_sim.h"
+#include "bridge_sim.h"
+#include "DA_DSS_cvi_driver.h"
+#include "DADSS_utility.h"
+
+//==============================================================================
+// Constants
+
+#define BENCH_RMS_CURRENT 1.0e-3
+#define BENCH_CHANNEL CURRENT_CHANNEL_B
+#define BENCH_JOINT_CHANNEL CURRENT_CHANNEL_A
+#define BENCH_JOINT_THRESHOLD 10.0 // Of the auxiliary balance, relative to the main one
+#define BENCH_JOINT_GPIB_ADDRESS 9 // Of the second lock-in
+#define BENCH_COUNT(a) (sizeof(a)/sizeof((a)[0]))
+
+//==============================================================================
+// Types
+
+typedef struct {
+	double offset;
+	double noise;
+	int timeConstantCode;
+	double balanceThreshold;
+} BenchCase;
+
+//==============================================================================
+// Static global variables
+
+// Relative deviation of the balanced channel from its balance value
+static const double offsets[] = {1.0e-2, 1.0e-3, 1.0e-4};
+// Lock-in input noise density in V/sqrt(Hz)
+static const double noises[] = {0.0, 10.0e-9, 100.0e-9};
+// 10 ms, 100 ms and 1 s
+static const int timeConstantCodes[] = {6, 8, 10};
+// Volts (rms)
+static const double balanceThresholds[] = {1.0e-6, 1.0e-7};
+
+static const char *outcomeNames[] = {
+	[BALANCE_REACHED] = "Balanced",
+	[BALANCE_OUT_OF_RANGE] = "Out of range",
+	[BALANCE_MAX_STEPS] = "Max steps",
+	[BALANCE_CANCELLED] = "Cancelled"
+};
+
+//==============================================================================
+// Static functions
+
+// Balanced bridge as set by PresetBridgeParameters, with the impedances of the
+// bridge model
+static void PresetBridge(void)
+{
+	double ZReal[BRIDGE_SIM_ARM_COUNT], ZImag[BRIDGE_SIM_ARM_COUNT];
+	double magnitude[BRIDGE_SIM_ARM_COUNT], phase[BRIDGE_SIM_ARM_COUNT];
+	double loadedMagnitude[BRIDGE_SIM_ARM_COUNT], loadedPhase[BRIDGE_SIM_ARM_COUNT];
+	double currentAmplitude = BENCH_RMS_CURRENT*sqrt(2.0), currentPhase;
+
+	BridgeSimGetImpedance(BRIDGE_SIM_ARM_A, &ZReal[BRIDGE_SIM_ARM_A], &ZImag[BRIDGE_SIM_ARM_A]);
+	BridgeSimGetImpedance(BRIDGE_SIM_ARM_B, &ZReal[BRIDGE_SIM_ARM_B], &ZImag[BRIDGE_SIM_ARM_B]);
+	ToPolar(ZReal[BRIDGE_SIM_ARM_A], ZImag[BRIDGE_SIM_ARM_A], &magnitude[BRIDGE_SIM_ARM_A], &phase[BRIDGE_SIM_ARM_A]);
+	ToPolar(ZReal[BRIDGE_SIM_ARM_B], ZImag[BRIDGE_SIM_ARM_B], &magnitude[BRIDGE_SIM_ARM_B], &phase[BRIDGE_SIM_ARM_B]);
+	ToPolar(ZReal[BRIDGE_SIM_ARM_A]+bridgeSettings.seriesResistance[CURRENT_CHANNEL_A], ZImag[BRIDGE_SIM_ARM_A],
+			&loadedMagnitude[BRIDGE_SIM_ARM_A], &loadedPhase[BRIDGE_SIM_ARM_A]);
+	ToPolar(ZReal[BRIDGE_SIM_ARM_B]+bridgeSettings.seriesResistance[CURRENT_CHANNEL_B], ZImag[BRIDGE_SIM_ARM_B],
+			&loadedMagnitude[BRIDGE_SIM_ARM_B], &loadedPhase[BRIDGE_SIM_ARM_B]);
+	currentPhase = -(phase[BRIDGE_SIM_ARM_A]+phase[BRIDGE_SIM_ARM_B]+PI)/2;
+
+	ChannelSettings *channelSettings = modeSettings[0].channelSettings;
+	channelSettings[bridgeSettings.channelAssignment[VOLTAGE_CHANNEL_A]].amplitude = magnitude[BRIDGE_SIM_ARM_A]*currentAmplitude;
+	channelSettings[bridgeSettings.channelAssignment[VOLTAGE_CHANNEL_A]].phase = phase[BRIDGE_SIM_ARM_A]+currentPhase;
+	channelSettings[bridgeSettings.channelAssignment[VOLTAGE_CHANNEL_B]].amplitude = magnitude[BRIDGE_SIM_ARM_B]*currentAmplitude;
+	channelSettings[bridgeSettings.channelAssignment[VOLTAGE_CHANNEL_B]].phase = phase[BRIDGE_SIM_ARM_B]+currentPhase+PI;
+	channelSettings[bridgeSettings.channelAssignment[CURRENT_CHANNEL_A]].amplitude = loadedMagnitude[BRIDGE_SIM_ARM_A]*currentAmplitude;
+	channelSettings[bridgeSettings.channelAssignment[CURRENT_CHANNEL_A]].phase = loadedPhase[BRIDGE_SIM_ARM_A]+currentPhase;
+	channelSettings[bridgeSettings.channelAssignment[CURRENT_CHANNEL_B]].amplitude = loadedMagnitude[BRIDGE_SIM_ARM_B]*currentAmplitude;
+	channelSettings[bridgeSettings.channelAssignment[CURRENT_CHANNEL_B]].phase = loadedPhase[BRIDGE_SIM_ARM_B]+currentPhase+PI;
+}
+
+// Same sequence as Connect, without the user interface
+static int ConnectDevices(void)
+{
+	for (int i = 0; i < lockinSettings.nLockins; ++i) {
+		Transport *transport = &lockinSettings.lockins[i].transport;
+
+		TRANSPORTERRCHK(transport, TransportOpen(transport, &lockinSettings.lockins[i].transportSettings));
+		TRANSPORTERRCHK(transport, InitLockinRaw(transport, lockinSettings.lockins[i].initString));
+	}
+	TRANSPORTERRCHK(GetChannelLockin(sourceSettings.activeChannel), SetLockinInputRaw(GetChannelLockin(sourceSettings.activeChannel),
+					modeSettings[0].channelSettings[sourceSettings.activeChannel].lockinInputSettings));
+
+	DSSERRCHK(DADSS_StartStop(0));
+	DSSERRCHK(DADSS_SetCLKFrequency(sourceSettings.clockFrequency));
+	DSSERRCHK(DADSS_SetFrequency(sourceSettings.frequency));
+	DSSERRCHK(DADSS_GetRealFrequency(&sourceSettings.realFrequency));
+	for (int i = 0; i < DADSS_CHANNELS; ++i)
+		DSSERRCHK(DADSS_SetRange(i+1, sourceSettings.range[i]));
+	DSSERRCHK(DADSS_UpdateConfiguration());
+	for (int i = 0; i < DADSS_CHANNELS; ++i)
+		DSSERRCHK(DADSS_SetMDAC2(i+1, modeSettings[0].channelSettings[i].mdac2Code));
+	DSSERRCHK(DADSS_UpdateMDAC2());
+	for (int i = 0; i < DADSS_CHANNELS; ++i) {
+		DSSERRCHK(DADSS_SetAmplitude(i+1, modeSettings[0].channelSettings[i].amplitude));
+		DSSERRCHK(DADSS_SetPhase(i+1, modeSettings[0].channelSettings[i].phase));
+	}
+	DSSERRCHK(DADSS_UpdateWaveform());
+	DSSERRCHK(DADSS_StartStop(1));
+
+	SimDelay(DADSS_ADJ_DELAY);
+	for (int i = 0; i < DADSS_CHANNELS; ++i) {
+		DSSERRCHK(DADSS_GetAmplitude(i+1, &modeSettings[0].channelSettings[i].amplitude));
+		DSSERRCHK(DADSS_GetPhase(i+1, &modeSettings[0].channelSettings[i].phase));
+		ToRect(modeSettings[0].channelSettings[i].amplitude,
+			   modeSettings[0].channelSettings[i].phase,
+			   &modeSettings[0].channelSettings[i].real,
+			   &modeSettings[0].channelSettings[i].imag);
+	}
+	return 0;
+
+Error:
+	CloseLockins();
+	return -1;
+}
+
+static void Print(FILE *file, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stdout, fmt, ap);
+	va_end(ap);
+	if (file != NULL) {
+		va_start(ap, fmt);
+		vfprintf(file, fmt, ap);
+		va_end(ap);
+	}
+}
+
+static int RunCase(const BenchCase *benchCase, FILE *file)
+{
+	int channel, channels[2], isJoint, isWarm;
+	double gain, phaseShift, amplitude, phase;
+	double runTime, residualReal, residualImag;
+	unsigned long updateCount, transactionCount = 0;
+	double latency = 0.0;
+	char buf[GPIB_BUF_SZ];
+	LockinReading lockinReading;
+	BalanceResult balanceResult;
+
+	SimSeed(SIM_DEFAULT_SEED);
+	SetRandomSeed(1);
+	SetDefaultSettings();
+	lockinSettings.bufferPoints = (int)SimGetEnvDouble("BENCH_BUFFER_POINTS", 0.0);
+	isJoint = (int)SimGetEnvDouble("BENCH_JOINT", 0.0);
+	lockinSettings.nLockins = isJoint && SimGetEnvDouble("BENCH_LOCKINS", 1.0) > 1.0 ? 2 : 1;
+	for (int i = 0; i < lockinSettings.nLockins; ++i)
+		lockinSettings.lockins[i].transportSettings.type = TRANSPORT_MOCK;
+	lockinSettings.lockins[1].transportSettings.gpibAddress = BENCH_JOINT_GPIB_ADDRESS;
+	isWarm = (int)SimGetEnvDouble("BENCH_WARM_START", 0.0) && !isJoint;
+	channel = bridgeSettings.channelAssignment[BENCH_CHANNEL];
+	channels[0] = channel;
+	channels[1] = bridgeSettings.channelAssignment[BENCH_JOINT_CHANNEL];
+	sourceSettings.activeChannel = channel;
+	modeSettings[0].channelSettings[channels[0]].balanceThreshold = benchCase->balanceThreshold;
+	modeSettings[0].channelSettings[channels[1]].balanceThreshold = BENCH_JOINT_THRESHOLD*benchCase->balanceThreshold;
+	modeSettings[0].channelSettings[channels[1]].lockinInputSettings.lockinInputType = LOCKIN_INPUT_VOLTAGE_DIFFERENTIAL;
+	modeSettings[0].channelSettings[channels[1]].lockin = lockinSettings.nLockins-1;
+	PresetBridge();
+
+	// Detune the balanced channels, the second one the other way round
+	ToPolar(1.0+benchCase->offset/sqrt(2.0), benchCase->offset/sqrt(2.0), &gain, &phaseShift);
+	modeSettings[0].channelSettings[channels[0]].amplitude *= gain;
+	modeSettings[0].channelSettings[channels[0]].phase += phaseShift;
+	if (isJoint) {
+		modeSettings[0].channelSettings[channels[1]].amplitude /= gain;
+		modeSettings[0].channelSettings[channels[1]].phase -= phaseShift;
+	}
+
+	LockinSimSetNoise(benchCase->noise);
+	if (ConnectDevices() < 0)
+		return -1;
+	snprintf(buf, GPIB_BUF_SZ, "OFLT %d", benchCase->timeConstantCode);
+	for (int i = 0; i < lockinSettings.nLockins; ++i)
+		TRANSPORTERRCHK(&lockinSettings.lockins[i].transport, TransportWrite(&lockinSettings.lockins[i].transport, buf));
+	InvalidateLockinTimeConstant();
+
+	// Let the lock-in output filters settle on the starting point
+	TRANSPORTERRCHK(GetChannelLockin(channel), ReadLockinRaw(GetChannelLockin(channel), &lockinReading));
+	SimDelay(lockinReading.adjDelay);
+
+	// Cache the sensitivity with a first balance, then detune again
+	if (isWarm) {
+		amplitude = modeSettings[0].channelSettings[channel].amplitude;
+		phase = modeSettings[0].channelSettings[channel].phase;
+		if (BalanceChannel(channel, NULL, NULL, &balanceResult) < 0)
+			goto Error;
+		DSSERRCHK(DADSS_SetAmplitude(channel+1, amplitude));
+		DSSERRCHK(DADSS_SetPhase(channel+1, phase));
+		DSSERRCHK(DADSS_UpdateWaveform());
+		SimDelay(DADSS_ADJ_DELAY);
+		DSSERRCHK(DADSS_GetAmplitude(channel+1, &modeSettings[0].channelSettings[channel].amplitude));
+		DSSERRCHK(DADSS_GetPhase(channel+1, &modeSettings[0].channelSettings[channel].phase));
+		ToRect(modeSettings[0].channelSettings[channel].amplitude, modeSettings[0].channelSettings[channel].phase,
+			   &modeSettings[0].channelSettings[channel].real, &modeSettings[0].channelSettings[channel].imag);
+		SimDelay(lockinReading.adjDelay);
+	}
+
+	DADSS_SimResetUpdateCount();
+	for (int i = 0; i < lockinSettings.nLockins; ++i)
+		TransportResetStats(&lockinSettings.lockins[i].transport);
+	runTime = Timer();
+	if ((isJoint ? BalanceChannels(channels, 2, NULL, NULL, &balanceResult) :
+				   BalanceChannel(channel, NULL, NULL, &balanceResult)) < 0)
+		goto Error;
+	runTime = Timer()-runTime;
+	updateCount = DADSS_SimGetUpdateCount();
+	for (int i = 0; i < lockinSettings.nLockins; ++i) {
+		transactionCount += lockinSettings.lockins[i].transport.stats.nWrites+lockinSettings.lockins[i].transport.stats.nReads;
+		latency = fmax(latency, TransportGetMeanLatency(&lockinSettings.lockins[i].transport));
+	}
+	BridgeSimGetDetectorPhasor(SimTime(), &residualReal, &residualImag);
+
+	Print(file, "%g\t%g\t%d\t%g\t%s\t%d\t%.3f\t%lu\t%lu\t%.3f\t%.3e\t%.3e\t%.3f\n",
+		  benchCase->offset, benchCase->noise, benchCase->timeConstantCode, benchCase->balanceThreshold,
+		  outcomeNames[balanceResult.outcome], balanceResult.nSteps, balanceResult.time,
+		  updateCount, transactionCount, 1000.0*latency, balanceResult.residual,
+		  sqrt(residualReal*residualReal+residualImag*residualImag)/sqrt(2.0), runTime);
+
+	CloseLockins();
+	return 0;
+
+Error:
+	CloseLockins();
+	return -1;
+}
+
+//==============================================================================
+// Global variables
+
+//==============================================================================
+// Global functions
+
+int main (int argc, char *argv[])
+{
+	FILE *file = NULL;
+	BenchCase benchCase;
+	int nFailed = 0;
+	double totalTime = Timer();
+
+	if (InitCVIRTE(0, argv, 0) == 0)
+		return -1; // Out of memory
+
+	if (argc > 1 && (file = fopen(argv[1], "w")) == NULL) {
+		fprintf(stderr, "Cannot open %s\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	SimSetVirtualTime(1);
+	Print(file, "Offset\tNoise (V/sqrt(Hz))\tOFLT\tThreshold (V)\tOutcome\tSteps\tTime to null (s)\t"
+		  "DSS updates\tLock-in transactions\tLock-in latency (ms)\tResidual (V)\tBridge residual (V)\tRun time (s)\n");
+	for (int i = 0; i < BENCH_COUNT(offsets); ++i)
+		for (int j = 0; j < BENCH_COUNT(noises); ++j)
+			for (int k = 0; k < BENCH_COUNT(timeConstantCodes); ++k)
+				for (int l = 0; l < BENCH_COUNT(balanceThresholds); ++l) {
+					benchCase.offset = offsets[i];
+					benchCase.noise = noises[j];
+					benchCase.timeConstantCode = timeConstantCodes[k];
+					benchCase.balanceThreshold = balanceThresholds[l];
+					if (RunCase(&benchCase, file) < 0)
+						++nFailed;
+				}
+	fprintf(stdout, "Total run time: %.3f s, failed cases: %d\n", Timer()-totalTime, nFailed);
+
+	if (file != NULL)
+		fclose(file);
+	return nFailed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
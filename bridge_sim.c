@@ -0,0 +1,208 @@
+//==============================================================================
+//
+// VersICaL impedance bridge client
+//
+// Copyright 2018-2019	Massimo Ortolano <massimo.ortolano@polito.it> 
+//                		Martina Marzano <m.marzano@inrim.it>
+//
+// This code is licensed under MIT license (see LICENSE.txt for details)
+//
+//==============================================================================
+
+#ifdef DADSS_SIMULATION
+
+//==============================================================================
+// Include files
+
+#include <ansi_c.h>
+#include <analysis.h>
+
+#include "main.h"
+#include "cfg.h"
+#include "bridge_sim.h"
+#include "DADSS_sim.h"
+#include "sim.h"
+#include "lockin_sim.h"
+
+//==============================================================================
+// Constants
+
+//==============================================================================
+// Types
+
+//==============================================================================
+// Static global variables
+
+static int isInitialized = 0;
+static struct {
+	double real;
+	double imag;
+} impedance[BRIDGE_SIM_ARM_COUNT];
+
+static const struct {
+	MainChannelType current;
+	MainChannelType voltage;
+} armChannels[BRIDGE_SIM_ARM_COUNT] = {
+	[BRIDGE_SIM_ARM_A] = {CURRENT_CHANNEL_A, VOLTAGE_CHANNEL_A},
+	[BRIDGE_SIM_ARM_B] = {CURRENT_CHANNEL_B, VOLTAGE_CHANNEL_B}
+};
+
+//==============================================================================
+// Static functions
+
+static void Initialize(void)
+{
+	if (isInitialized)
+		return;
+	isInitialized = 1;
+	impedance[BRIDGE_SIM_ARM_A].real = SimGetEnvDouble("BRIDGE_SIM_ZA_REAL", BRIDGE_SIM_IMPEDANCE);
+	impedance[BRIDGE_SIM_ARM_A].imag = SimGetEnvDouble("BRIDGE_SIM_ZA_IMAG", 0.0);
+	impedance[BRIDGE_SIM_ARM_B].real = SimGetEnvDouble("BRIDGE_SIM_ZB_REAL", BRIDGE_SIM_IMPEDANCE);
+	impedance[BRIDGE_SIM_ARM_B].imag = SimGetEnvDouble("BRIDGE_SIM_ZB_IMAG", 0.0);
+	for (int i = 0; i < BRIDGE_SIM_ARM_COUNT; ++i)
+		if (impedance[i].real == 0.0 && impedance[i].imag == 0.0)
+			impedance[i].real = BRIDGE_SIM_IMPEDANCE;
+}
+
+static double SeriesConductance(MainChannelType channel)
+{
+	double r = bridgeSettings.seriesResistance[channel];
+
+	return 1.0/(r > BRIDGE_SIM_MIN_RESISTANCE ? r : BRIDGE_SIM_MIN_RESISTANCE);
+}
+
+//==============================================================================
+// Global variables
+
+//==============================================================================
+// Global functions
+
+/// HIFN Set one of the two unknown impedances of the bridge
+/// HIPAR arm/Arm of the bridge (A or B)
+/// HIPAR real/Resistance in ohm
+/// HIPAR imag/Reactance in ohm
+/// HIRET The return value is 0 on success or a negative BridgeSimError
+int BridgeSimSetImpedance(BridgeSimArm arm, double real, double imag)
+{
+	Initialize();
+	if (arm < 0 || arm >= BRIDGE_SIM_ARM_COUNT)
+		return BRIDGE_SIM_ERROR_ARM;
+	if (real == 0.0 && imag == 0.0)
+		return BRIDGE_SIM_ERROR_VALUE;
+	impedance[arm].real = real;
+	impedance[arm].imag = imag;
+	return 0;
+}
+
+int BridgeSimGetImpedance(BridgeSimArm arm, double *real, double *imag)
+{
+	Initialize();
+	if (arm < 0 || arm >= BRIDGE_SIM_ARM_COUNT)
+		return BRIDGE_SIM_ERROR_ARM;
+	*real = impedance[arm].real;
+	*imag = impedance[arm].imag;
+	return 0;
+}
+
+/// HIFN Compute the voltage of a detection point from the simulated DA-DSS
+/// HIFN outputs
+/// HIPAR point/Low node or series resistance of a voltage channel
+/// HIPAR time/Simulation time (see SimTime)
+/// HIPAR real/Real part of the detector voltage (volts, peak)
+/// HIPAR imag/Imaginary part of the detector voltage (volts, peak)
+/// HIRET The return value is 0 on success or a negative BridgeSimError or
+/// HIRET DADSS_SimError
+int BridgeSimGetPointPhasor(BridgeSimPoint point, double time, double *real, double *imag)
+{
+	// Each arm is reduced to the admittance seen from node L and to the
+	// current it injects into L when L is grounded; the voltage of L is the
+	// ratio of the total injected current to the total admittance
+	double currentReal = 0.0, currentImag = 0.0;
+	double admittanceReal = 1.0/BRIDGE_SIM_DETECTOR_RESISTANCE, admittanceImag = 0.0;
+	double eVReal[BRIDGE_SIM_ARM_COUNT], eVImag[BRIDGE_SIM_ARM_COUNT];
+	double highReal[BRIDGE_SIM_ARM_COUNT], highImag[BRIDGE_SIM_ARM_COUNT]; // Voltage of the high node, L grounded
+	double lowReal, lowImag;
+	int ret;
+
+	Initialize();
+	if (point < 0 || point >= BRIDGE_SIM_POINT_COUNT)
+		return BRIDGE_SIM_ERROR_POINT;
+	for (int i = 0; i < BRIDGE_SIM_ARM_COUNT; ++i) {
+		double yI = SeriesConductance(armChannels[i].current);
+		double yV = SeriesConductance(armChannels[i].voltage);
+		double eIReal, eIImag;
+		double yReal, yImag, sReal, sImag, jReal, jImag, tReal, tImag;
+
+		if ((ret = DADSS_SimGetOutputPhasor(bridgeSettings.channelAssignment[armChannels[i].current]+1,
+											time, &eIReal, &eIImag)) < 0 ||
+				(ret = DADSS_SimGetOutputPhasor(bridgeSettings.channelAssignment[armChannels[i].voltage]+1,
+												time, &eVReal[i], &eVImag[i])) < 0)
+			return ret;
+
+		// Y = 1/Z, S = Y+yI+yV is the admittance of the high node and
+		// J = yI EI+yV EV the current its sources inject into it
+		CxRecip(impedance[i].real, impedance[i].imag, &yReal, &yImag);
+		sReal = yReal+yI+yV;
+		sImag = yImag;
+		jReal = yI*eIReal+yV*eVReal[i];
+		jImag = yI*eIImag+yV*eVImag[i];
+		CxDiv(jReal, jImag, sReal, sImag, &highReal[i], &highImag[i]);
+
+		// Injected current Y J/S and admittance Y (yI+yV)/S
+		CxDiv(yReal, yImag, sReal, sImag, &tReal, &tImag);
+		CxMul(tReal, tImag, jReal, jImag, &jReal, &jImag);
+		currentReal += jReal;
+		currentImag += jImag;
+		admittanceReal += tReal*(yI+yV);
+		admittanceImag += tImag*(yI+yV);
+	}
+	CxDiv(currentReal, currentImag, admittanceReal, admittanceImag, &lowReal, &lowImag);
+	if (point == BRIDGE_SIM_POINT_LOW) {
+		*real = lowReal;
+		*imag = lowImag;
+	} else {
+		// The high node follows L through Y/S: EV-VH = EV-(J+Y VL)/S
+		int i = point == BRIDGE_SIM_POINT_VOLTAGE_A ? BRIDGE_SIM_ARM_A : BRIDGE_SIM_ARM_B;
+		double yReal, yImag, tReal, tImag;
+
+		CxRecip(impedance[i].real, impedance[i].imag, &yReal, &yImag);
+		CxDiv(yReal, yImag, yReal+SeriesConductance(armChannels[i].current)+SeriesConductance(armChannels[i].voltage),
+			  yImag, &tReal, &tImag);
+		CxMul(tReal, tImag, lowReal, lowImag, &tReal, &tImag);
+		*real = eVReal[i]-highReal[i]-tReal;
+		*imag = eVImag[i]-highImag[i]-tImag;
+	}
+	return 0;
+}
+
+/// HIFN Compute the detector voltage from the simulated DA-DSS outputs
+/// HIPAR time/Simulation time (see SimTime)
+/// HIPAR real/Real part of the detector voltage (volts, peak)
+/// HIPAR imag/Imaginary part of the detector voltage (volts, peak)
+/// HIRET The return value is 0 on success or a negative DADSS_SimError
+int BridgeSimGetDetectorPhasor(double time, double *real, double *imag)
+{
+	return BridgeSimGetPointPhasor(BRIDGE_SIM_POINT_LOW, time, real, imag);
+}
+
+/// HIFN Lock-in emulator input function backed by the bridge model: the input
+/// HIFN source of the lock-in selects the detection point, A the low node, A-B
+/// HIFN the series resistance of voltage channel A and I that of voltage
+/// HIFN channel B
+/// HIPAR pad/GPIB address of the emulated lock-in
+/// HIPAR data/Unused
+void BridgeSimInput(int pad, double time, double *real, double *imag, void *data)
+{
+	static const BridgeSimPoint points[] = {
+		BRIDGE_SIM_POINT_LOW,		// A
+		BRIDGE_SIM_POINT_VOLTAGE_A,	// A-B
+		BRIDGE_SIM_POINT_VOLTAGE_B,	// I (1 Mohm)
+		BRIDGE_SIM_POINT_VOLTAGE_B	// I (100 Mohm)
+	};
+	int source = LockinSimGetInputSource(pad);
+
+	if (source < 0 || source > 3 || BridgeSimGetPointPhasor(points[source], time, real, imag) < 0)
+		*real = *imag = 0.0;
+}
+
+#endif /* DADSS_SIMULATION */
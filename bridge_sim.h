@@ -0,0 +1,87 @@
+//==============================================================================
+//
+// VersICaL impedance bridge client
+//
+// Copyright 2018-2019	Massimo Ortolano <massimo.ortolano@polito.it> 
+//                		Martina Marzano <m.marzano@inrim.it>
+//
+// This code is licensed under MIT license (see LICENSE.txt for details)
+//
+//==============================================================================
+
+//==============================================================================
+//
+// Simulated impedance bridge.
+//
+// The model is the network that PresetBridgeParameters assumes: the unknown
+// impedances ZA and ZB share the low node L, which is connected to the
+// detector. The channels assigned in bridgeSettings drive the high node of
+// each impedance through their series resistances: the current channels
+// A and B and the voltage channels A and B. Channels that are not assigned
+// are left unconnected. The detector voltage is the voltage of node L,
+// loaded by the lock-in input impedance, computed from the phasors of the
+// simulated DA-DSS channels at a given time. The voltages across the series
+// resistances of the voltage channels, null when the current channels alone
+// supply the impedances, are the detection points of the auxiliary balances.
+//
+// When the project is compiled with DADSS_SIMULATION defined, the bridge
+// model is the default input of the lock-in emulator, whose input source
+// selects the detection point (see BridgeSimInput). The impedances can be
+// set at run time or with the environment variables BRIDGE_SIM_ZA_REAL,
+// BRIDGE_SIM_ZA_IMAG, BRIDGE_SIM_ZB_REAL and BRIDGE_SIM_ZB_IMAG (ohm).
+//
+//==============================================================================
+
+#ifndef BRIDGE_SIM_H
+#define BRIDGE_SIM_H
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+//==============================================================================
+// Include files
+
+//==============================================================================
+// Constants
+
+#define BRIDGE_SIM_IMPEDANCE 1000.0
+#define BRIDGE_SIM_DETECTOR_RESISTANCE 10.0e6 // SR830 voltage input
+#define BRIDGE_SIM_MIN_RESISTANCE 1.0e-3 // Stands for a zero series resistance
+
+//==============================================================================
+// Types
+
+typedef enum {
+	BRIDGE_SIM_ERROR_ARM = -1,
+	BRIDGE_SIM_ERROR_VALUE = -2,
+	BRIDGE_SIM_ERROR_POINT = -3
+} BridgeSimError;
+
+typedef enum {
+	BRIDGE_SIM_ARM_A,
+	BRIDGE_SIM_ARM_B,
+	BRIDGE_SIM_ARM_COUNT
+} BridgeSimArm;
+
+typedef enum {
+	BRIDGE_SIM_POINT_LOW,		// Low node L
+	BRIDGE_SIM_POINT_VOLTAGE_A,	// Series resistance of voltage channel A
+	BRIDGE_SIM_POINT_VOLTAGE_B,	// Series resistance of voltage channel B
+	BRIDGE_SIM_POINT_COUNT
+} BridgeSimPoint;
+
+//==============================================================================
+// Global functions
+
+int BridgeSimSetImpedance(BridgeSimArm, double, double);
+int BridgeSimGetImpedance(BridgeSimArm, double *, double *);
+int BridgeSimGetPointPhasor(BridgeSimPoint, double, double *, double *);
+int BridgeSimGetDetectorPhasor(double, double *, double *);
+void BridgeSimInput(int, double, double *, double *, void *);
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif /* BRIDGE_SIM_H */
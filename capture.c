@@ -0,0 +1,136 @@
+//==============================================================================
+//
+// VersICaL impedance bridge client
+//
+// Copyright 2018-2019	Massimo Ortolano <massimo.ortolano@polito.it> 
+//                		Martina Marzano <m.marzano@inrim.it>
+//
+// This code is licensed under MIT license (see LICENSE.txt for details)
+//
+//==============================================================================
+
+//==============================================================================
+// Include files
+
+#include <ansi_c.h>
+#include <utility.h>
+
+#include "DA_DSS_cvi_driver.h"
+#include "DADSS_utility.h"
+#include "main.h"
+#include "cfg.h"
+#include "msg.h"
+#include "datafile.h"
+#include "capture.h"
+
+//==============================================================================
+// Constants
+
+//==============================================================================
+// Types
+
+//==============================================================================
+// Static global variables
+
+// Block being written by the thread pool
+static struct {
+	unsigned char *block;
+	size_t size;
+	char pathName[MAX_PATHNAME_LEN];
+	int isScheduled;
+	CmtThreadFunctionID functionId;
+} capture = {NULL, 0, "", 0, 0};
+
+//==============================================================================
+// Static functions
+
+static int CVICALLBACK WriteCapture(void *functionData)
+{
+	FILE *file = fopen(capture.pathName, "ab");
+	int isWritten = file != NULL && fwrite(capture.block, 1, capture.size, file) == capture.size;
+
+	if (file != NULL && fclose(file) != 0)
+		isWritten = 0;
+	free(capture.block);
+	capture.block = NULL;
+	// The message is formatted here, before a later capture can change the
+	// path name, and shown from the user interface thread
+	if (!isWritten)
+		warn("%s %s.", msgStrings[MSG_SAVING_ERROR], capture.pathName);
+	return 0;
+}
+
+//==============================================================================
+// Global variables
+
+//==============================================================================
+// Global functions
+
+/// HIFN Captures the waveforms of all the source channels, to be appended to a
+/// HIFN file by CaptureWrite. Called from the instrument thread.
+/// HIPAR pathName/The capture file.
+/// HIRET Returns 0 if the waveforms have been captured, or -1 on error, which has
+/// HIRET already been reported.
+int CaptureWaveforms(const char *pathName)
+{
+	DataFileWaveformHeader header;
+	int nSamples, *samples;
+
+	CaptureWait();
+
+	DSSERRCHK(DADSS_GetNumberSamples(&nSamples));
+	capture.size = DATAFILE_WAVEFORM_HEADER_SZ + (size_t)DADSS_CHANNELS*nSamples*sizeof(int);
+	if ((capture.block = malloc(capture.size)) == NULL) {
+		warn(msgStrings[MSG_OUT_OF_MEMORY]);
+		return -1;
+	}
+
+	GetCurrentDateTime(&header.timeStamp);
+	header.realFrequency = sourceSettings.realFrequency;
+	header.clockFrequency = sourceSettings.clockFrequency;
+	header.nSamples = nSamples;
+	for (int i = 0; i < DADSS_CHANNELS; ++i) {
+		strcpy(header.label[i], sourceSettings.label[i]);
+		header.range[i] = sourceSettings.range[i];
+		header.mdac2Code[i] = modeSettings[0].channelSettings[i].mdac2Code;
+		header.mdac2Val[i] = modeSettings[0].channelSettings[i].mdac2Val;
+		header.scale[i] = modeSettings[0].channelSettings[i].mdac2Val * \
+						  (DADSS_RangeMultipliers[sourceSettings.range[i]]/DADSS_MDAC1_CODE_RANGE) * \
+						  DADSS_REFERENCE_VOLTAGE;
+	}
+	DataFileEncodeWaveformHeader(&header, capture.block);
+
+	// The samples go straight into the block, whose header size is a multiple of
+	// 8, in the byte order of the host (little-endian on all CVI targets)
+	samples = (int *)(capture.block + DATAFILE_WAVEFORM_HEADER_SZ);
+	for (int i = 0; i < DADSS_CHANNELS; ++i)
+		DSSERRCHK(DADSS_GetWaveform(i+1, samples + (size_t)i*nSamples, nSamples));
+
+	strncpy(capture.pathName, pathName, MAX_PATHNAME_LEN-1);
+	capture.pathName[MAX_PATHNAME_LEN-1] = '\0';
+	return 0;
+
+Error:
+	free(capture.block);
+	capture.block = NULL;
+	return -1;
+}
+
+/// HIFN Starts writing the last captured waveforms.
+void CaptureWrite(void)
+{
+	if (CmtScheduleThreadPoolFunction(DEFAULT_THREAD_POOL_HANDLE, WriteCapture, NULL, &capture.functionId) >= 0)
+		capture.isScheduled = 1;
+	else
+		WriteCapture(NULL);
+}
+
+/// HIFN Waits until the last capture has been written.
+void CaptureWait(void)
+{
+	if (capture.isScheduled) {
+		CmtWaitForThreadPoolFunctionCompletion(DEFAULT_THREAD_POOL_HANDLE, capture.functionId, 0);
+		CmtReleaseThreadPoolFunctionID(DEFAULT_THREAD_POOL_HANDLE, capture.functionId);
+		capture.isScheduled = 0;
+	}
+}
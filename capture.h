@@ -0,0 +1,52 @@
+//==============================================================================
+//
+// VersICaL impedance bridge client
+//
+// Copyright 2018-2019	Massimo Ortolano <massimo.ortolano@polito.it> 
+//                		Martina Marzano <m.marzano@inrim.it>
+//
+// This code is licensed under MIT license (see LICENSE.txt for details)
+//
+//==============================================================================
+
+//==============================================================================
+//
+// Raw waveform capture.
+//
+// CaptureWaveforms fetches the samples of all the source channels, together
+// with their range, MDAC2 setting and the real frequency, and appends them as
+// a binary block (datafile.h), which CaptureWrite appends to a capture file.
+// The samples are fetched by the instrument thread and written as they come
+// from the source, without formatting, by a thread of the default thread
+// pool; a new capture waits for the previous one to be written.
+//
+//==============================================================================
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+//==============================================================================
+// Include files
+
+//==============================================================================
+// Constants
+
+//==============================================================================
+// Types
+
+//==============================================================================
+// Global functions
+
+int CaptureWaveforms(const char *);
+void CaptureWrite(void);
+void CaptureWait(void);
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif /* CAPTURE_H */
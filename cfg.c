@@ -32,11 +32,81 @@
 //==============================================================================
 // Static functions
 
+// Reads the settings of a lock-in from its section: the GPIB address and the
+// initialization string are mandatory, the transport parameters optional, for
+// compatibility with files written before their introduction, missing ones
+// keeping the default values
+static int LoadLockinDevice(IniText iniText, const char *section, LockinDevice *lockin, const char *fileName)
+{
+	TransportSettings transportDefaults;
+	int ret;
+
+	if ((ret = Ini_GetInt(iniText, section, "GPIB address", &lockin->transportSettings.gpibAddress)) <= 0 ||
+			(ret = Ini_GetStringIntoBuffer(iniText, section, "Init string", lockin->initString, GPIB_BUF_SZ)) <= 0) {
+		if (ret == 0)
+			warn("%s %s.\n%s [%s].", msgStrings[MSG_LOADING_ERROR], fileName, 
+				 msgStrings[MSG_SETTINGS_MISSING_PARAMETER], section);
+		else
+			warn("%s %s.\n%s %s [%s].", msgStrings[MSG_LOADING_ERROR], fileName, GetGeneralErrorString(ret), 
+				 msgStrings[MSG_SETTINGS_SECTION], section);
+		return -1;
+	}
+	
+	TransportSetDefaultSettings(&transportDefaults);
+	lockin->transportSettings.type = transportDefaults.type;
+	strncpy(lockin->transportSettings.host, transportDefaults.host, TRANSPORT_HOST_SZ);
+	lockin->transportSettings.port = transportDefaults.port;
+	lockin->transportSettings.serialPort = transportDefaults.serialPort;
+	lockin->transportSettings.baudRate = transportDefaults.baudRate;
+	lockin->transportSettings.timeout = transportDefaults.timeout;
+	if ((ret = Ini_GetInt(iniText, section, "Transport", (int *)&lockin->transportSettings.type)) < 0 ||
+			(ret = Ini_GetStringIntoBuffer(iniText, section, "Host", 
+										   lockin->transportSettings.host, TRANSPORT_HOST_SZ)) < 0 ||
+			(ret = Ini_GetUInt(iniText, section, "Port", &lockin->transportSettings.port)) < 0 ||
+			(ret = Ini_GetInt(iniText, section, "Serial port", &lockin->transportSettings.serialPort)) < 0 ||
+			(ret = Ini_GetInt(iniText, section, "Baud rate", &lockin->transportSettings.baudRate)) < 0 ||
+			(ret = Ini_GetDouble(iniText, section, "Timeout", &lockin->transportSettings.timeout)) < 0) {
+		warn("%s %s.\n%s %s [%s].", msgStrings[MSG_LOADING_ERROR], fileName, GetGeneralErrorString(ret), 
+			 msgStrings[MSG_SETTINGS_SECTION], section);
+		return -1;
+	}
+	
+	// The initialization string is sent as one command line
+	if (strlen(lockin->initString) > TRANSPORT_COMMAND_LEN ||
+			lockin->transportSettings.type < 0 || lockin->transportSettings.type >= TRANSPORT_TYPE_COUNT ||
+			lockin->transportSettings.gpibAddress < 0 || lockin->transportSettings.gpibAddress > 30 ||
+			lockin->transportSettings.port > 65535 ||
+			lockin->transportSettings.serialPort < 1 ||
+			lockin->transportSettings.baudRate <= 0 ||
+			lockin->transportSettings.timeout < 0.0) {
+		warn("%s %s.\n%s [%s].", msgStrings[MSG_LOADING_ERROR], fileName, 
+			 msgStrings[MSG_SETTINGS_PARAMETER_OUT_OF_RANGE], section);
+		return -1;
+	}
+	return 0;
+}
+
+static int SaveLockinDevice(IniText iniText, const char *section, const LockinDevice *lockin)
+{
+	int ret;
+
+	if ((ret = Ini_PutInt(iniText, section, "GPIB address", lockin->transportSettings.gpibAddress)) < 0 ||
+			(ret = Ini_PutString(iniText, section, "Init string", lockin->initString)) < 0 ||
+			(ret = Ini_PutInt(iniText, section, "Transport", lockin->transportSettings.type)) < 0 ||
+			(ret = Ini_PutString(iniText, section, "Host", lockin->transportSettings.host)) < 0 ||
+			(ret = Ini_PutUInt(iniText, section, "Port", lockin->transportSettings.port)) < 0 ||
+			(ret = Ini_PutInt(iniText, section, "Serial port", lockin->transportSettings.serialPort)) < 0 ||
+			(ret = Ini_PutInt(iniText, section, "Baud rate", lockin->transportSettings.baudRate)) < 0 ||
+			(ret = Ini_PutDouble(iniText, section, "Timeout", lockin->transportSettings.timeout)) < 0)
+		return ret;
+	return 0;
+}
+
 //==============================================================================
 // Global variables
 
-SourceSettings sourceSettings = {.dataPathName = "", .dataFileHandle = NULL };
-LockinSettings lockinSettings = {.lockinDesc = 0};
+SourceSettings sourceSettings = {.dataPathName = "", .dataFileHandle = NULL, .dataFileFormat = DATA_FILE_TEXT };
+LockinSettings lockinSettings = {.nLockins = 1};
 ModeSettings modeSettings[MAX_MODES];
 BridgeSettings bridgeSettings;
 
@@ -61,8 +131,14 @@ void SetDefaultSettings(void)
 	sourceSettings.activeMode = 1;
 	sourceSettings.activeChannel = 0;
 	
-	lockinSettings.gpibAddress = 8;
-	strncpy(lockinSettings.initString, "*RST;*CLS;FMOD 0;RSLP 0", GPIB_BUF_SZ);
+	lockinSettings.nLockins = 1;
+	for (int i = 0; i < MAX_LOCKINS; ++i) {
+		TransportSetDefaultSettings(&lockinSettings.lockins[i].transportSettings);
+		strncpy(lockinSettings.lockins[i].initString, "*RST;*CLS;FMOD 0;RSLP 0", GPIB_BUF_SZ);
+	}
+	lockinSettings.bufferPoints = 0;
+	lockinSettings.bufferRateCode = 9;
+	lockinSettings.bufferFormat = LOCKIN_BUFFER_IEEE;
 	
 	for (int i = 1; i < MAX_MODES; ++i) 
 		SetDefaultModeSettings(i);
@@ -83,12 +159,14 @@ void SetDefaultModeSettings(int mode)
 	snprintf(modeSettings[mode].label, LABEL_SZ, "Mode %d", mode);
 	for (int i = 0; i < DADSS_CHANNELS; ++i) {
 		modeSettings[mode].channelSettings[i].isLocked = 0;
+		modeSettings[mode].channelSettings[i].isJointBalanced = 0;
 		modeSettings[mode].channelSettings[i].amplitude = 0;
 		modeSettings[mode].channelSettings[i].phase = 0;
 		modeSettings[mode].channelSettings[i].real = 0;
 		modeSettings[mode].channelSettings[i].imag = 0;
 		modeSettings[mode].channelSettings[i].mdac2Code = DADSS_MDAC2_CODE_MAX;
 		DADSS_Mdac2CodeToValue(modeSettings[mode].channelSettings[i].mdac2Code, &modeSettings[mode].channelSettings[i].mdac2Val);
+		modeSettings[mode].channelSettings[i].lockin = 0;
 		modeSettings[mode].channelSettings[i].lockinGainType = LOCKIN_GAIN_MANUAL;
 		modeSettings[mode].channelSettings[i].lockinInputSettings.lockinInputType = LOCKIN_INPUT_VOLTAGE_SINGLE_ENDED;
 		modeSettings[mode].channelSettings[i].lockinInputSettings.lockinReserveType = LOCKIN_RESERVE_LOW_NOISE;  
@@ -96,14 +174,15 @@ void SetDefaultModeSettings(int mode)
 		modeSettings[mode].channelSettings[i].lockinInputSettings.lockinGroundConnection = LOCKIN_INPUT_FLOAT;
 		modeSettings[mode].channelSettings[i].lockinInputSettings.lockinCouplingType = LOCKIN_COUPLING_AC;
 		modeSettings[mode].channelSettings[i].balanceThreshold = 1e-5;
+		modeSettings[mode].channelSettings[i].sensitivityCache.isValid = 0;
 	}
 }
 
 void LoadSettings(char *fileName)
 {
-	SourceSettings sourceSettingsTmp = {.dataFileHandle = sourceSettings.dataFileHandle};
+	SourceSettings sourceSettingsTmp = {.dataFileHandle = sourceSettings.dataFileHandle, .dataFileFormat = sourceSettings.dataFileFormat};
 	strncpy(sourceSettingsTmp.dataPathName, sourceSettings.dataPathName, MAX_PATHNAME_LEN);
-	LockinSettings lockinSettingsTmp = {.lockinDesc = lockinSettings.lockinDesc};
+	LockinSettings lockinSettingsTmp = lockinSettings; // Keeps the transports open
 	ModeSettings modeSettingsTmp[MAX_MODES];
 	BridgeSettings bridgeSettingsTmp;
 	
@@ -172,18 +251,39 @@ void LoadSettings(char *fileName)
 	}
 	sourceSettingsTmp.realFrequency = sourceSettingsTmp.frequency;
 		
-	if ((ret = Ini_GetInt(iniText, "Lock-in", "GPIB address", &lockinSettingsTmp.gpibAddress)) <= 0 ||
-			(ret = Ini_GetStringIntoBuffer(iniText, "Lock-in", "Init string", 
-										   lockinSettingsTmp.initString, GPIB_BUF_SZ)) <= 0) {
-		if (ret == 0)
-			warn("%s %s.\n%s [%s].", msgStrings[MSG_LOADING_ERROR], fileName, 
-				 msgStrings[MSG_SETTINGS_MISSING_PARAMETER], "Lock-in");
-		else
-			warn("%s %s.\n%s %s [%s].", msgStrings[MSG_LOADING_ERROR], fileName, GetGeneralErrorString(ret), 
-				 msgStrings[MSG_SETTINGS_SECTION], "Lock-in");
+	// The main lock-in is in the Lock-in section, any other in sections
+	// numbered from 2
+	if (LoadLockinDevice(iniText, "Lock-in", &lockinSettingsTmp.lockins[0], fileName) < 0)
+		goto cleanup;
+	lockinSettingsTmp.nLockins = 1;
+	lockinSettingsTmp.bufferPoints = 0;
+	lockinSettingsTmp.bufferRateCode = 9;
+	lockinSettingsTmp.bufferFormat = LOCKIN_BUFFER_IEEE;
+	if ((ret = Ini_GetInt(iniText, "Lock-in", "Lock-ins", &lockinSettingsTmp.nLockins)) < 0 ||
+			(ret = Ini_GetInt(iniText, "Lock-in", "Buffer points", &lockinSettingsTmp.bufferPoints)) < 0 ||
+			(ret = Ini_GetInt(iniText, "Lock-in", "Buffer sample rate", &lockinSettingsTmp.bufferRateCode)) < 0 ||
+			(ret = Ini_GetInt(iniText, "Lock-in", "Buffer format", (int *)&lockinSettingsTmp.bufferFormat)) < 0) {
+		warn("%s %s.\n%s %s [%s].", msgStrings[MSG_LOADING_ERROR], fileName, GetGeneralErrorString(ret), 
+			 msgStrings[MSG_SETTINGS_SECTION], "Lock-in");
+		goto cleanup;
+	}
+	
+	if (lockinSettingsTmp.nLockins < 1 || lockinSettingsTmp.nLockins > MAX_LOCKINS ||
+			lockinSettingsTmp.bufferPoints < 0 || lockinSettingsTmp.bufferPoints > LOCKIN_BUFFER_POINTS_MAX ||
+			lockinSettingsTmp.bufferRateCode < 0 || lockinSettingsTmp.bufferRateCode > LOCKIN_BUFFER_RATE_MAX ||
+			lockinSettingsTmp.bufferFormat < LOCKIN_BUFFER_IEEE || lockinSettingsTmp.bufferFormat > LOCKIN_BUFFER_NON_NORMALIZED) {
+		warn("%s %s.\n%s [%s].", msgStrings[MSG_LOADING_ERROR], fileName, 
+			 msgStrings[MSG_SETTINGS_PARAMETER_OUT_OF_RANGE], "Lock-in");
 		goto cleanup;
 	}
 	
+	for (int i = 1; i < lockinSettingsTmp.nLockins; ++i) {
+		char buf[BUF_SZ];
+		snprintf(buf, BUF_SZ, "Lock-in %d", i+1);
+		if (LoadLockinDevice(iniText, buf, &lockinSettingsTmp.lockins[i], fileName) < 0)
+			goto cleanup;
+	}
+	
 	for (int j = 0; j < sourceSettingsTmp.nModes; ++j) {
 		char buf[BUF_SZ];
 		snprintf(buf, BUF_SZ, "Mode %d", j);
@@ -230,12 +330,55 @@ void LoadSettings(char *fileName)
 						 msgStrings[MSG_SETTINGS_SECTION], buf);
 				goto cleanup;
 			}
+			modeSettingsTmp[j].channelSettings[i].isJointBalanced = 0;
+			modeSettingsTmp[j].channelSettings[i].lockin = 0;
+			if ((ret = Ini_GetBoolean(iniText, buf, "Joint balance", &modeSettingsTmp[j].channelSettings[i].isJointBalanced)) < 0 ||
+					(ret = Ini_GetInt(iniText, buf, "Lock-in", &modeSettingsTmp[j].channelSettings[i].lockin)) < 0) {
+				warn("%s %s.\n%s %s [%s].", msgStrings[MSG_LOADING_ERROR], fileName, GetGeneralErrorString(ret), 
+					 msgStrings[MSG_SETTINGS_SECTION], buf);
+				goto cleanup;
+			}
+
+			// The sensitivity cache is optional, but complete if present
+			SensitivityCache *sensitivityCache = &modeSettingsTmp[j].channelSettings[i].sensitivityCache;
+			sensitivityCache->isValid = 0;
+			if (Ini_ItemExists(iniText, buf, "Sensitivity real")) {
+				if ((ret = Ini_GetDouble(iniText, buf, "Sensitivity real", &sensitivityCache->real)) <= 0 ||
+						(ret = Ini_GetDouble(iniText, buf, "Sensitivity imaginary", &sensitivityCache->imag)) <= 0 ||
+						(ret = Ini_GetDouble(iniText, buf, "Sensitivity frequency", &sensitivityCache->frequency)) <= 0 ||
+						(ret = Ini_GetInt(iniText, buf, "Sensitivity range", (int *)&sensitivityCache->range)) <= 0 ||
+						(ret = Ini_GetUInt(iniText, buf, "Sensitivity MDAC2 code", &sensitivityCache->mdac2Code)) <= 0) {
+					if (ret == 0)
+						warn("%s %s.\n%s [%s].", msgStrings[MSG_LOADING_ERROR], fileName, 
+							 msgStrings[MSG_SETTINGS_MISSING_PARAMETER], buf);
+					else
+						warn("%s %s.\n%s %s [%s].", msgStrings[MSG_LOADING_ERROR], fileName, GetGeneralErrorString(ret), 
+							 msgStrings[MSG_SETTINGS_SECTION], buf);
+					goto cleanup;
+				}
+				sensitivityCache->noise = 0.0;
+				if (Ini_ItemExists(iniText, buf, "Sensitivity noise") &&
+						((ret = Ini_GetDouble(iniText, buf, "Sensitivity noise", &sensitivityCache->noise)) <= 0 ||
+						 (ret = Ini_GetDouble(iniText, buf, "Sensitivity time constant",
+											  &sensitivityCache->timeConstant)) <= 0)) {
+					if (ret == 0)
+						warn("%s %s.\n%s [%s].", msgStrings[MSG_LOADING_ERROR], fileName, 
+							 msgStrings[MSG_SETTINGS_MISSING_PARAMETER], buf);
+					else
+						warn("%s %s.\n%s %s [%s].", msgStrings[MSG_LOADING_ERROR], fileName, GetGeneralErrorString(ret), 
+							 msgStrings[MSG_SETTINGS_SECTION], buf);
+					goto cleanup;
+				}
+				sensitivityCache->isValid = 1;
+			}
 		
 			if (modeSettingsTmp[j].channelSettings[i].amplitude < DADSS_AMPLITUDE_MIN ||
 					modeSettingsTmp[j].channelSettings[i].amplitude > DADSS_AMPLITUDE_MAX ||
 					modeSettingsTmp[j].channelSettings[i].phase < DADSS_PHASE_MIN ||
 					modeSettingsTmp[j].channelSettings[i].phase > DADSS_PHASE_MAX ||
 					modeSettingsTmp[j].channelSettings[i].balanceThreshold < 0 ||
+					modeSettingsTmp[j].channelSettings[i].lockin < 0 ||
+					modeSettingsTmp[j].channelSettings[i].lockin > lockinSettingsTmp.nLockins-1 ||
 					mdac2Code > DADSS_MDAC2_CODE_MAX ||
 			        modeSettingsTmp[j].channelSettings[i].lockinGainType < LOCKIN_GAIN_MANUAL ||
 			   		modeSettingsTmp[j].channelSettings[i].lockinGainType > LOCKIN_GAIN_AUTO_PROGRAM ||
@@ -329,10 +472,20 @@ void SaveSettings(char *fileName)
 			(ret = Ini_PutDouble(iniText, "Source", "Clock frequency", sourceSettings.clockFrequency)) < 0 ||
 			(ret = Ini_PutDouble(iniText, "Source", "Frequency", sourceSettings.frequency)) < 0 ||
 			(ret = Ini_PutInt(iniText, "Source", "Active channel", sourceSettings.activeChannel)) < 0 ||
-			(ret = Ini_PutInt(iniText, "Lock-in", "GPIB address", lockinSettings.gpibAddress)) < 0 ||
-			(ret = Ini_PutString(iniText, "Lock-in", "Init string", lockinSettings.initString)) < 0) 
+			(ret = SaveLockinDevice(iniText, "Lock-in", &lockinSettings.lockins[0])) < 0 ||
+			(ret = Ini_PutInt(iniText, "Lock-in", "Lock-ins", lockinSettings.nLockins)) < 0 ||
+			(ret = Ini_PutInt(iniText, "Lock-in", "Buffer points", lockinSettings.bufferPoints)) < 0 ||
+			(ret = Ini_PutInt(iniText, "Lock-in", "Buffer sample rate", lockinSettings.bufferRateCode)) < 0 ||
+			(ret = Ini_PutInt(iniText, "Lock-in", "Buffer format", lockinSettings.bufferFormat)) < 0) 
 		goto error;
 	
+	for (int i = 1; i < lockinSettings.nLockins; ++i) {
+		char buf[BUF_SZ];
+		snprintf(buf, BUF_SZ, "Lock-in %d", i+1);
+		if ((ret = SaveLockinDevice(iniText, buf, &lockinSettings.lockins[i])) < 0)
+			goto error;
+	}
+	
 	for (int i = 0; i < DADSS_CHANNELS; ++i) {
 		char buf[BUF_SZ];
 		snprintf(buf, BUF_SZ, "Range %d", i+1);
@@ -356,6 +509,8 @@ void SaveSettings(char *fileName)
 			snprintf(buf, BUF_SZ, "Mode %d Channel %d", j, i+1);
 		
 			if ((ret = Ini_PutBoolean(iniText, buf, "Locked", modeSettings[j].channelSettings[i].isLocked)) < 0 ||
+					(ret = Ini_PutBoolean(iniText, buf, "Joint balance", modeSettings[j].channelSettings[i].isJointBalanced)) < 0 ||
+					(ret = Ini_PutInt(iniText, buf, "Lock-in", modeSettings[j].channelSettings[i].lockin)) < 0 ||
 					(ret = Ini_PutDouble(iniText, buf, "Amplitude", modeSettings[j].channelSettings[i].amplitude)) < 0 ||
 					(ret = Ini_PutDouble(iniText, buf, "Phase", modeSettings[j].channelSettings[i].phase)) < 0 ||
 					(ret = Ini_PutUInt(iniText, buf, "MDAC2 code", modeSettings[j].channelSettings[i].mdac2Code)) < 0 ||
@@ -374,6 +529,19 @@ void SaveSettings(char *fileName)
 					(ret = Ini_PutDouble(iniText, buf, "Balance threshold", 
 										 modeSettings[j].channelSettings[i].balanceThreshold)) < 0)
 				goto error;
+
+			const SensitivityCache *sensitivityCache = &modeSettings[j].channelSettings[i].sensitivityCache;
+			if (sensitivityCache->isValid &&
+					((ret = Ini_PutDouble(iniText, buf, "Sensitivity real", sensitivityCache->real)) < 0 ||
+					 (ret = Ini_PutDouble(iniText, buf, "Sensitivity imaginary", sensitivityCache->imag)) < 0 ||
+					 (ret = Ini_PutDouble(iniText, buf, "Sensitivity frequency", sensitivityCache->frequency)) < 0 ||
+					 (ret = Ini_PutInt(iniText, buf, "Sensitivity range", sensitivityCache->range)) < 0 ||
+					 (ret = Ini_PutUInt(iniText, buf, "Sensitivity MDAC2 code", sensitivityCache->mdac2Code)) < 0))
+				goto error;
+			if (sensitivityCache->isValid && sensitivityCache->noise > 0.0 &&
+					((ret = Ini_PutDouble(iniText, buf, "Sensitivity noise", sensitivityCache->noise)) < 0 ||
+					 (ret = Ini_PutDouble(iniText, buf, "Sensitivity time constant", sensitivityCache->timeConstant)) < 0))
+				goto error;
 		}
 	}
 	
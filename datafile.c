@@ -0,0 +1,370 @@
+//==============================================================================
+//
+// VersICaL impedance bridge client
+//
+// Copyright 2018-2019	Massimo Ortolano <massimo.ortolano@polito.it> 
+//                		Martina Marzano <m.marzano@inrim.it>
+//
+// This code is licensed under MIT license (see LICENSE.txt for details)
+//
+//==============================================================================
+
+//==============================================================================
+// Include files
+
+#include <ansi_c.h>
+#include <stdint.h>
+#include <utility.h>
+
+#include "datafile.h"
+
+//==============================================================================
+// Constants
+
+#define TIMESTAMP_BUF_SZ 16 // YYYYMMDDTHHMMSS
+
+//==============================================================================
+// Types
+
+typedef struct {
+	char name[DATAFILE_COLUMN_NAME_SZ];
+	DataFileColumnType type;
+	unsigned int size;
+} DataFileColumn;
+
+//==============================================================================
+// Static global variables
+
+//==============================================================================
+// Static functions
+
+static unsigned char *PutUInt32(unsigned char *p, uint32_t x)
+{
+	for (int i = 0; i < 4; ++i)
+		*p++ = (unsigned char)(x >> 8*i);
+	return p;
+}
+
+static unsigned char *PutInt32(unsigned char *p, int32_t x)
+{
+	return PutUInt32(p, (uint32_t)x);
+}
+
+static unsigned char *PutFloat64(unsigned char *p, double x)
+{
+	uint64_t u;
+
+	memcpy(&u, &x, sizeof u);
+	for (int i = 0; i < 8; ++i)
+		*p++ = (unsigned char)(u >> 8*i);
+	return p;
+}
+
+static unsigned char *PutChars(unsigned char *p, const char *s, int size)
+{
+	strncpy((char *)p, s, size);
+	p[size-1] = '\0';
+	return p+size;
+}
+
+static const unsigned char *GetUInt32(const unsigned char *p, uint32_t *x)
+{
+	*x = 0;
+	for (int i = 0; i < 4; ++i)
+		*x |= (uint32_t)p[i] << 8*i;
+	return p+4;
+}
+
+static const unsigned char *GetInt32(const unsigned char *p, int32_t *x)
+{
+	uint32_t u;
+
+	p = GetUInt32(p, &u);
+	*x = (int32_t)u;
+	return p;
+}
+
+static const unsigned char *GetFloat64(const unsigned char *p, double *x)
+{
+	uint64_t u = 0;
+
+	for (int i = 0; i < 8; ++i)
+		u |= (uint64_t)p[i] << 8*i;
+	memcpy(x, &u, sizeof u);
+	return p+8;
+}
+
+static const unsigned char *GetChars(const unsigned char *p, char *s, int size)
+{
+	memcpy(s, p, size);
+	s[size-1] = '\0';
+	return p+size;
+}
+
+// Columns of the records, as written by this version
+static void GetColumns(const DataFileHeader *header, DataFileColumn columns[DATAFILE_COLUMNS])
+{
+	int n = 0;
+
+	columns[n++] = (DataFileColumn){"Timestamp", DATAFILE_FLOAT64, 8};
+	columns[n++] = (DataFileColumn){"Mode", DATAFILE_CHAR, LABEL_SZ};
+	columns[n++] = (DataFileColumn){"Frequency", DATAFILE_FLOAT64, 8};
+	columns[n++] = (DataFileColumn){"Active", DATAFILE_INT32, 4};
+	for (int i = 0; i < DADSS_CHANNELS; ++i) {
+		columns[n] = (DataFileColumn){"", DATAFILE_FLOAT64, 8};
+		snprintf(columns[n++].name, DATAFILE_COLUMN_NAME_SZ, "Re(%s)", header->label[i]);
+		columns[n] = (DataFileColumn){"", DATAFILE_FLOAT64, 8};
+		snprintf(columns[n++].name, DATAFILE_COLUMN_NAME_SZ, "Im(%s)", header->label[i]);
+		columns[n] = (DataFileColumn){"", DATAFILE_FLOAT64, 8};
+		snprintf(columns[n++].name, DATAFILE_COLUMN_NAME_SZ, "Threshold(%s)", header->label[i]);
+	}
+	columns[n++] = (DataFileColumn){"Commit", DATAFILE_UINT32, 4};
+}
+
+// FNV-1a hash of the record content, written last: a record torn by a crash
+// or a zero-filled tail left by the file system does not match its marker
+static uint32_t CommitMarker(const unsigned char *buf)
+{
+	uint32_t hash = 2166136261u;
+
+	for (int i = 0; i < DATAFILE_RECORD_SZ-4; ++i) {
+		hash ^= buf[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+//==============================================================================
+// Global variables
+
+//==============================================================================
+// Global functions
+
+/// HIFN Chooses the data file format from the file name extension.
+/// HIPAR pathName/The data file path name.
+/// HIRET DATA_FILE_BINARY if the extension is DATAFILE_EXTENSION, DATA_FILE_TEXT otherwise.
+DataFileFormat DataFileGetFormat(const char *pathName)
+{
+	const char *extension = strrchr(pathName, '.');
+	const char *binaryExtension = DATAFILE_EXTENSION;
+
+	if (extension == NULL)
+		return DATA_FILE_TEXT;
+	while (*extension != '\0' && tolower((unsigned char)*extension) == *binaryExtension) {
+		++extension;
+		++binaryExtension;
+	}
+	return *extension == '\0' && *binaryExtension == '\0' ? DATA_FILE_BINARY : DATA_FILE_TEXT;
+}
+
+/// HIFN Writes the header of a binary data file.
+/// HIPAR file/The data file, opened in binary mode.
+/// HIPAR header/The file description.
+/// HIRET Returns 0 on success or a negative DataFileError.
+int DataFileWriteHeader(FILE *file, const DataFileHeader *header)
+{
+	unsigned char buf[DATAFILE_HEADER_SZ];
+	unsigned char *p = buf;
+	DataFileColumn columns[DATAFILE_COLUMNS];
+
+	memset(p, 0, DATAFILE_MAGIC_SZ);
+	memcpy(p, DATAFILE_MAGIC, sizeof DATAFILE_MAGIC);
+	p += DATAFILE_MAGIC_SZ;
+	p = PutUInt32(p, DATAFILE_VERSION);
+	p = PutUInt32(p, DATAFILE_HEADER_SZ);
+	p = PutUInt32(p, DATAFILE_RECORD_SZ);
+	p = PutUInt32(p, DATAFILE_COLUMNS);
+	p = PutUInt32(p, DADSS_CHANNELS);
+	p = PutInt32(p, header->nSamples);
+	p = PutFloat64(p, header->clockFrequency);
+	for (int i = 0; i < DADSS_CHANNELS; ++i)
+		p = PutChars(p, header->label[i], LABEL_SZ);
+	p = PutUInt32(p, MAIN_CHANNEL_COUNT);
+	for (int i = 0; i < MAIN_CHANNEL_COUNT; ++i) {
+		p = PutInt32(p, header->bridgeSettings.channelAssignment[i]);
+		p = PutFloat64(p, header->bridgeSettings.seriesResistance[i]);
+	}
+	GetColumns(header, columns);
+	for (int i = 0; i < DATAFILE_COLUMNS; ++i) {
+		p = PutChars(p, columns[i].name, DATAFILE_COLUMN_NAME_SZ);
+		p = PutUInt32(p, columns[i].type);
+		p = PutUInt32(p, columns[i].size);
+	}
+	if (fwrite(buf, 1, DATAFILE_HEADER_SZ, file) != DATAFILE_HEADER_SZ)
+		return DATAFILE_ERROR_IO;
+	return DATAFILE_ERROR_NONE;
+}
+
+/// HIFN Decodes and checks the header of a binary data file.
+/// HIPAR buf/The beginning of the file.
+/// HIPAR len/The number of bytes available in buf.
+/// HIPAR header/The file description.
+/// HIRET Returns 0 on success or a negative DataFileError.
+int DataFileDecodeHeader(const unsigned char *buf, size_t len, DataFileHeader *header)
+{
+	const unsigned char *p = buf;
+	uint32_t version, headerSize, recordSize, nColumns, nChannels, nBridgeChannels, type, size;
+	int32_t assignment;
+	char name[DATAFILE_COLUMN_NAME_SZ];
+	DataFileColumn columns[DATAFILE_COLUMNS];
+
+	if (len < DATAFILE_HEADER_SZ)
+		return DATAFILE_ERROR_FORMAT;
+	if (memcmp(p, DATAFILE_MAGIC, sizeof DATAFILE_MAGIC) != 0)
+		return DATAFILE_ERROR_FORMAT;
+	p += DATAFILE_MAGIC_SZ;
+	p = GetUInt32(p, &version);
+	p = GetUInt32(p, &headerSize);
+	p = GetUInt32(p, &recordSize);
+	p = GetUInt32(p, &nColumns);
+	p = GetUInt32(p, &nChannels);
+	if (version != DATAFILE_VERSION || headerSize != DATAFILE_HEADER_SZ || recordSize != DATAFILE_RECORD_SZ ||
+			nColumns != DATAFILE_COLUMNS || nChannels != DADSS_CHANNELS)
+		return DATAFILE_ERROR_FORMAT;
+	p = GetInt32(p, &header->nSamples);
+	p = GetFloat64(p, &header->clockFrequency);
+	for (int i = 0; i < DADSS_CHANNELS; ++i)
+		p = GetChars(p, header->label[i], LABEL_SZ);
+	p = GetUInt32(p, &nBridgeChannels);
+	if (nBridgeChannels != MAIN_CHANNEL_COUNT)
+		return DATAFILE_ERROR_FORMAT;
+	for (int i = 0; i < MAIN_CHANNEL_COUNT; ++i) {
+		p = GetInt32(p, &assignment);
+		header->bridgeSettings.channelAssignment[i] = assignment;
+		p = GetFloat64(p, &header->bridgeSettings.seriesResistance[i]);
+	}
+	// The column table must describe the record layout of this version
+	GetColumns(header, columns);
+	for (int i = 0; i < DATAFILE_COLUMNS; ++i) {
+		p = GetChars(p, name, DATAFILE_COLUMN_NAME_SZ);
+		p = GetUInt32(p, &type);
+		p = GetUInt32(p, &size);
+		if (strcmp(name, columns[i].name) != 0 || type != columns[i].type || size != columns[i].size)
+			return DATAFILE_ERROR_FORMAT;
+	}
+	return DATAFILE_ERROR_NONE;
+}
+
+/// HIFN Encodes a record of a binary data file.
+/// HIPAR record/The record to encode.
+/// HIPAR buf/A buffer of at least DATAFILE_RECORD_SZ bytes.
+/// HIRET Returns the size of the encoded record.
+int DataFileEncodeRecord(const DataFileRecord *record, unsigned char *buf)
+{
+	unsigned char *p = buf;
+
+	p = PutFloat64(p, record->timeStamp);
+	p = PutChars(p, record->mode, LABEL_SZ);
+	p = PutFloat64(p, record->frequency);
+	p = PutInt32(p, record->activeChannel);
+	for (int i = 0; i < DADSS_CHANNELS; ++i) {
+		p = PutFloat64(p, record->real[i]);
+		p = PutFloat64(p, record->imag[i]);
+		p = PutFloat64(p, record->balanceThreshold[i]);
+	}
+	p = PutUInt32(p, CommitMarker(buf));
+	return p-buf;
+}
+
+/// HIFN Tells whether a record has been completely written.
+/// HIPAR buf/The DATAFILE_RECORD_SZ bytes of the record.
+/// HIRET Returns 1 if the commit marker matches the record content, 0 otherwise.
+int DataFileIsRecordCommitted(const unsigned char *buf)
+{
+	uint32_t marker;
+
+	GetUInt32(buf + DATAFILE_RECORD_SZ-4, &marker);
+	return marker == CommitMarker(buf);
+}
+
+/// HIFN Decodes a record of a binary data file.
+/// HIPAR buf/The DATAFILE_RECORD_SZ bytes of the record.
+/// HIPAR record/The decoded record.
+void DataFileDecodeRecord(const unsigned char *buf, DataFileRecord *record)
+{
+	const unsigned char *p = buf;
+	int32_t activeChannel;
+
+	p = GetFloat64(p, &record->timeStamp);
+	p = GetChars(p, record->mode, LABEL_SZ);
+	p = GetFloat64(p, &record->frequency);
+	p = GetInt32(p, &activeChannel);
+	record->activeChannel = activeChannel;
+	for (int i = 0; i < DADSS_CHANNELS; ++i) {
+		p = GetFloat64(p, &record->real[i]);
+		p = GetFloat64(p, &record->imag[i]);
+		p = GetFloat64(p, &record->balanceThreshold[i]);
+	}
+}
+
+/// HIFN Decodes the timestamp of a record of a binary data file.
+/// HIPAR buf/The DATAFILE_RECORD_SZ bytes of the record.
+/// HIRET Returns the timestamp, in seconds since 1900-01-01.
+double DataFileDecodeTimeStamp(const unsigned char *buf)
+{
+	double timeStamp;
+
+	GetFloat64(buf, &timeStamp);
+	return timeStamp;
+}
+
+/// HIFN Encodes the header of a waveform capture block.
+/// HIPAR header/The capture description.
+/// HIPAR buf/A buffer of at least DATAFILE_WAVEFORM_HEADER_SZ bytes.
+/// HIRET Returns the size of the encoded header.
+int DataFileEncodeWaveformHeader(const DataFileWaveformHeader *header, unsigned char *buf)
+{
+	unsigned char *p = buf;
+
+	memset(p, 0, DATAFILE_MAGIC_SZ);
+	memcpy(p, DATAFILE_WAVEFORM_MAGIC, sizeof DATAFILE_WAVEFORM_MAGIC);
+	p += DATAFILE_MAGIC_SZ;
+	p = PutUInt32(p, DATAFILE_WAVEFORM_VERSION);
+	p = PutUInt32(p, DATAFILE_WAVEFORM_HEADER_SZ + DADSS_CHANNELS*header->nSamples*4);
+	p = PutFloat64(p, header->timeStamp);
+	p = PutFloat64(p, header->realFrequency);
+	p = PutFloat64(p, header->clockFrequency);
+	p = PutInt32(p, header->nSamples);
+	p = PutUInt32(p, DADSS_CHANNELS);
+	for (int i = 0; i < DADSS_CHANNELS; ++i) {
+		p = PutChars(p, header->label[i], LABEL_SZ);
+		p = PutInt32(p, header->range[i]);
+		p = PutUInt32(p, header->mdac2Code[i]);
+		p = PutFloat64(p, header->mdac2Val[i]);
+		p = PutFloat64(p, header->scale[i]);
+	}
+	return p-buf;
+}
+
+/// HIFN Formats the column header line of the tab-separated data file.
+/// HIPAR buf/The output buffer.
+/// HIPAR size/The size of the output buffer.
+/// HIPAR header/The file description.
+/// HIRET Returns the length of the line or a negative value if it does not fit.
+int DataFileFormatTextHeader(char *buf, int size, const DataFileHeader *header)
+{
+	int len = snprintf(buf, size, "Timestamp\tMode\tFrequency\tActive");
+
+	for (int i = 0; i < DADSS_CHANNELS && len >= 0 && len < size; ++i)
+		len += snprintf(buf+len, size-len, "\tRe(%s)\tIm(%s)\tThreshold(%s)",
+						header->label[i], header->label[i], header->label[i]);
+	return len >= 0 && len < size ? len : -1;
+}
+
+/// HIFN Formats a record of the tab-separated data file, starting with a newline.
+/// HIPAR buf/The output buffer.
+/// HIPAR size/The size of the output buffer.
+/// HIPAR record/The record to format.
+/// HIRET Returns the length of the line or a negative value if it does not fit.
+int DataFileFormatTextRecord(char *buf, int size, const DataFileRecord *record)
+{
+	char timeStampBuf[TIMESTAMP_BUF_SZ];
+	int len;
+
+	FormatDateTimeString(record->timeStamp, "%Y%m%dT%H%M%S", timeStampBuf, sizeof timeStampBuf);
+	len = snprintf(buf, size, "\n%s\t%s\t%.11g\t%d", timeStampBuf, record->mode, record->frequency, record->activeChannel);
+	for (int i = 0; i < DADSS_CHANNELS && len >= 0 && len < size; ++i)
+		len += snprintf(buf+len, size-len, "\t% 16.10e\t% 16.10e\t% 16.10e",
+						record->real[i], record->imag[i], record->balanceThreshold[i]);
+	return len >= 0 && len < size ? len : -1;
+}
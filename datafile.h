@@ -0,0 +1,156 @@
+//==============================================================================
+//
+// VersICaL impedance bridge client
+//
+// Copyright 2018-2019	Massimo Ortolano <massimo.ortolano@polito.it> 
+//                		Martina Marzano <m.marzano@inrim.it>
+//
+// This code is licensed under MIT license (see LICENSE.txt for details)
+//
+//==============================================================================
+
+//==============================================================================
+//
+// Binary measurement data file.
+//
+// Alternative to the tab-separated data file for long runs. All the numbers
+// are little-endian, whatever the host. The file begins with a header:
+//
+//   char[8]   magic "BCLDATA\0"
+//   uint32    format version
+//   uint32    header size, in bytes
+//   uint32    record size, in bytes
+//   uint32    number of columns
+//   uint32    number of source channels
+//   int32     number of waveform samples
+//   float64   source clock frequency (Hz)
+//   char[LABEL_SZ]        label, for each source channel
+//   uint32                number of bridge channels
+//   int32, float64        channel assignment and series resistance, for each
+//                         bridge channel (MainChannelType order)
+//   char[32], uint32, uint32  name, type and size of each column
+//
+// followed by fixed-size records, whose columns match the text file:
+// timestamp (float64, seconds since 1900-01-01), mode label (char[LABEL_SZ]),
+// frequency (float64), active channel (int32, 1-based) and, for each source
+// channel, the real and imaginary parts of the phasor and the balance
+// threshold (float64). Each record ends with a commit marker (uint32), a hash
+// of its content written last, which tells complete records from a tail torn
+// by a crash. A file can thus be seeked to record n directly; datastore.h
+// maps it in memory and converts it back into the tab-separated format.
+//
+// Waveform capture files hold a sequence of self-contained blocks, each with
+// the samples of all the source channels at a given time:
+//
+//   char[8]   magic "BCLWAVE\0"
+//   uint32    format version
+//   uint32    block size, in bytes, header included
+//   float64   timestamp (seconds since 1900-01-01)
+//   float64   real frequency (Hz)
+//   float64   source clock frequency (Hz)
+//   int32     number of samples per channel
+//   uint32    number of source channels
+//   char[LABEL_SZ], int32, uint32, float64, float64
+//             label, range, MDAC2 code, MDAC2 value and scale (volts per
+//             MDAC1 code), for each source channel
+//   int32     samples (MDAC1 codes), channel after channel
+//
+//==============================================================================
+
+#ifndef DATAFILE_H
+#define DATAFILE_H
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+//==============================================================================
+// Include files
+
+#include <stdio.h>
+
+#include "main.h"
+
+//==============================================================================
+// Constants
+
+#define DATAFILE_MAGIC "BCLDATA"
+#define DATAFILE_MAGIC_SZ 8
+#define DATAFILE_VERSION 2
+#define DATAFILE_COLUMN_NAME_SZ 32
+#define DATAFILE_COLUMNS (5+3*DADSS_CHANNELS)
+#define DATAFILE_HEADER_SZ (DATAFILE_MAGIC_SZ + 6*4 + 8 + DADSS_CHANNELS*LABEL_SZ + \
+							4 + MAIN_CHANNEL_COUNT*(4+8) + DATAFILE_COLUMNS*(DATAFILE_COLUMN_NAME_SZ+8))
+#define DATAFILE_RECORD_SZ (8 + LABEL_SZ + 8 + 4 + 3*8*DADSS_CHANNELS + 4)
+#define DATAFILE_EXTENSION ".bcd"
+#define DATAFILE_WAVEFORM_MAGIC "BCLWAVE"
+#define DATAFILE_WAVEFORM_VERSION 1
+#define DATAFILE_WAVEFORM_HEADER_SZ (DATAFILE_MAGIC_SZ + 2*4 + 3*8 + 2*4 + DADSS_CHANNELS*(LABEL_SZ + 2*4 + 2*8))
+#define DATAFILE_WAVEFORM_EXTENSION ".bcw"
+#define DATAFILE_TEXT_RECORD_SZ 1024
+
+//==============================================================================
+// Types
+
+typedef enum {
+	DATAFILE_ERROR_NONE = 0,
+	DATAFILE_ERROR_IO = -1,
+	DATAFILE_ERROR_FORMAT = -2,
+	DATAFILE_ERROR_RANGE = -3
+} DataFileError;
+
+typedef enum {
+	DATAFILE_FLOAT64,
+	DATAFILE_INT32,
+	DATAFILE_UINT32,
+	DATAFILE_CHAR
+} DataFileColumnType;
+
+typedef struct {
+	int nSamples;
+	double clockFrequency;
+	char label[DADSS_CHANNELS][LABEL_SZ];
+	BridgeSettings bridgeSettings;
+} DataFileHeader;
+
+typedef struct {
+	double timeStamp;
+	char mode[LABEL_SZ];
+	double frequency;
+	int activeChannel;
+	double real[DADSS_CHANNELS];
+	double imag[DADSS_CHANNELS];
+	double balanceThreshold[DADSS_CHANNELS];
+} DataFileRecord;
+
+typedef struct {
+	double timeStamp;
+	double realFrequency;
+	double clockFrequency;
+	int nSamples;
+	char label[DADSS_CHANNELS][LABEL_SZ];
+	DADSS_RangeList range[DADSS_CHANNELS];
+	unsigned int mdac2Code[DADSS_CHANNELS];
+	double mdac2Val[DADSS_CHANNELS];
+	double scale[DADSS_CHANNELS]; // Volts per MDAC1 code
+} DataFileWaveformHeader;
+
+//==============================================================================
+// Global functions
+
+DataFileFormat DataFileGetFormat(const char *);
+int DataFileWriteHeader(FILE *, const DataFileHeader *);
+int DataFileDecodeHeader(const unsigned char *, size_t, DataFileHeader *);
+int DataFileEncodeRecord(const DataFileRecord *, unsigned char *);
+int DataFileIsRecordCommitted(const unsigned char *);
+void DataFileDecodeRecord(const unsigned char *, DataFileRecord *);
+double DataFileDecodeTimeStamp(const unsigned char *);
+int DataFileEncodeWaveformHeader(const DataFileWaveformHeader *, unsigned char *);
+int DataFileFormatTextHeader(char *, int, const DataFileHeader *);
+int DataFileFormatTextRecord(char *, int, const DataFileRecord *);
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif /* DATAFILE_H */
@@ -0,0 +1,106 @@
+//==============================================================================
+//
+// VersICaL impedance bridge client
+//
+// Copyright 2018-2019	Massimo Ortolano <massimo.ortolano@polito.it> 
+//                		Martina Marzano <m.marzano@inrim.it>
+//
+// This code is licensed under MIT license (see LICENSE.txt for details)
+//
+//==============================================================================
+
+//==============================================================================
+//
+// Data file converter (datafile_convert.prj).
+//
+// Converts a binary data file (datafile.h) to the tab-separated format written
+// by the client. Usage:
+//
+//   DataFileConvert binary-file [text-file [start [stop]]]
+//
+// Without a second argument, the text file takes the name of the binary file
+// with the .txt extension. start and stop, in the YYYYMMDDTHHMMSS format of the
+// timestamps, restrict the conversion to the records saved from start to stop
+// (excluded); the data file is mapped in memory and the window is located by
+// bisection, without reading the records outside it.
+//
+//==============================================================================
+
+//==============================================================================
+// Include files
+
+#include <ansi_c.h>
+#include <cvirte.h>
+#include <utility.h>
+
+#include "datastore.h"
+
+//==============================================================================
+// Constants
+
+#define TEXT_EXTENSION ".txt"
+
+//==============================================================================
+// Types
+
+//==============================================================================
+// Static global variables
+
+//==============================================================================
+// Static functions
+
+// Parse a YYYYMMDDTHHMMSS timestamp
+static int ParseTimeStamp(const char *s, double *timeStamp)
+{
+	int year, month, day, hours, minutes, seconds;
+	char separator;
+
+	if (sscanf(s, "%4d%2d%2d%c%2d%2d%2d", &year, &month, &day, &separator, &hours, &minutes, &seconds) != 7 ||
+			separator != 'T')
+		return -1;
+	return MakeDateTime(hours, minutes, seconds, month, day, year, timeStamp) < 0 ? -1 : 0;
+}
+
+//==============================================================================
+// Global variables
+
+//==============================================================================
+// Global functions
+
+int main (int argc, char *argv[])
+{
+	char textPathName[MAX_PATHNAME_LEN];
+	char *extension;
+	double start = -HUGE_VAL, stop = HUGE_VAL;
+	int ret;
+
+	if (InitCVIRTE(0, argv, 0) == 0)
+		return -1; // Out of memory
+
+	if (argc < 2 || argc > 5 || (argc > 3 && ParseTimeStamp(argv[3], &start) < 0) ||
+			(argc > 4 && ParseTimeStamp(argv[4], &stop) < 0)) {
+		fprintf(stderr, "Usage: %s binary-file [text-file [start [stop]]]\n", argv[0]);
+		fprintf(stderr, "start and stop in the YYYYMMDDTHHMMSS format\n");
+		return EXIT_FAILURE;
+	}
+	if (argc >= 3)
+		snprintf(textPathName, sizeof textPathName, "%s", argv[2]);
+	else {
+		snprintf(textPathName, sizeof textPathName - strlen(TEXT_EXTENSION), "%s", argv[1]);
+		if ((extension = strrchr(textPathName, '.')) != NULL && strpbrk(extension, "\\/") == NULL)
+			*extension = '\0';
+		strcat(textPathName, TEXT_EXTENSION);
+	}
+
+	switch (ret = DataStoreConvertToText(argv[1], textPathName, start, stop)) {
+		case DATAFILE_ERROR_IO:
+			fprintf(stderr, "Cannot read %s or write %s\n", argv[1], textPathName);
+			return EXIT_FAILURE;
+		case DATAFILE_ERROR_FORMAT:
+			fprintf(stderr, "%s is not a binary data file of this version\n", argv[1]);
+			return EXIT_FAILURE;
+		default:
+			fprintf(stdout, "%d records written to %s\n", ret, textPathName);
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,189 @@
+//==============================================================================
+//
+// VersICaL impedance bridge client
+//
+// Copyright 2018-2019	Massimo Ortolano <massimo.ortolano@polito.it> 
+//                		Martina Marzano <m.marzano@inrim.it>
+//
+// This code is licensed under MIT license (see LICENSE.txt for details)
+//
+//==============================================================================
+
+//==============================================================================
+// Include files
+
+#include <windows.h>
+#include <ansi_c.h>
+
+#include "datastore.h"
+
+//==============================================================================
+// Constants
+
+//==============================================================================
+// Types
+
+//==============================================================================
+// Static global variables
+
+//==============================================================================
+// Static functions
+
+static void Unmap(DataStore *store)
+{
+	if (store->view != NULL)
+		UnmapViewOfFile(store->view);
+	if (store->mappingHandle != NULL)
+		CloseHandle(store->mappingHandle);
+	store->view = NULL;
+	store->mappingHandle = NULL;
+	store->records = NULL;
+	store->nRecords = 0;
+}
+
+// Map the whole file and count the committed records
+static int Map(DataStore *store)
+{
+	LARGE_INTEGER size;
+	int nRecords, ret;
+
+	if (!GetFileSizeEx(store->fileHandle, &size))
+		return DATAFILE_ERROR_IO;
+	if (size.QuadPart < DATAFILE_HEADER_SZ || size.QuadPart > (SIZE_T)-1)
+		return DATAFILE_ERROR_FORMAT;
+	if ((store->mappingHandle = CreateFileMapping(store->fileHandle, NULL, PAGE_READONLY, 0, 0, NULL)) == NULL)
+		return DATAFILE_ERROR_IO;
+	if ((store->view = MapViewOfFile(store->mappingHandle, FILE_MAP_READ, 0, 0, 0)) == NULL) {
+		Unmap(store);
+		return DATAFILE_ERROR_IO;
+	}
+	if ((ret = DataFileDecodeHeader(store->view, (size_t)size.QuadPart, &store->header)) < 0) {
+		Unmap(store);
+		return ret;
+	}
+	store->records = store->view + DATAFILE_HEADER_SZ;
+
+	// Records are written in order, so only the tail can be incomplete
+	nRecords = (int)((size.QuadPart - DATAFILE_HEADER_SZ) / DATAFILE_RECORD_SZ);
+	while (nRecords > 0 && !DataFileIsRecordCommitted(store->records + (size_t)(nRecords-1)*DATAFILE_RECORD_SZ))
+		--nRecords;
+	store->nRecords = nRecords;
+	return DATAFILE_ERROR_NONE;
+}
+
+//==============================================================================
+// Global variables
+
+//==============================================================================
+// Global functions
+
+/// HIFN Maps a binary data file for reading.
+/// HIPAR store/The data store to initialize.
+/// HIPAR pathName/The binary data file.
+/// HIRET Returns 0 on success or a negative DataFileError.
+int DataStoreOpen(DataStore *store, const char *pathName)
+{
+	int ret;
+
+	memset(store, 0, sizeof *store);
+	store->fileHandle = CreateFile(pathName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+								   OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (store->fileHandle == INVALID_HANDLE_VALUE) {
+		store->fileHandle = NULL;
+		return DATAFILE_ERROR_IO;
+	}
+	if ((ret = Map(store)) < 0) {
+		DataStoreClose(store);
+		return ret;
+	}
+	return DATAFILE_ERROR_NONE;
+}
+
+/// HIFN Maps again a data file that may have grown since it was opened.
+/// HIPAR store/The data store.
+/// HIRET Returns the number of committed records or a negative DataFileError.
+int DataStoreRefresh(DataStore *store)
+{
+	int ret;
+
+	Unmap(store);
+	if ((ret = Map(store)) < 0)
+		return ret;
+	return store->nRecords;
+}
+
+/// HIFN Unmaps and closes a data file.
+/// HIPAR store/The data store.
+void DataStoreClose(DataStore *store)
+{
+	Unmap(store);
+	if (store->fileHandle != NULL)
+		CloseHandle(store->fileHandle);
+	store->fileHandle = NULL;
+}
+
+/// HIFN Decodes a record.
+/// HIPAR store/The data store.
+/// HIPAR index/The record index, from 0 to nRecords-1.
+/// HIPAR record/The decoded record.
+/// HIRET Returns 0 on success or DATAFILE_ERROR_RANGE.
+int DataStoreGetRecord(const DataStore *store, int index, DataFileRecord *record)
+{
+	if (index < 0 || index >= store->nRecords)
+		return DATAFILE_ERROR_RANGE;
+	DataFileDecodeRecord(store->records + (size_t)index*DATAFILE_RECORD_SZ, record);
+	return DATAFILE_ERROR_NONE;
+}
+
+/// HIFN Finds the first record not older than a given time.
+/// HIPAR store/The data store.
+/// HIPAR timeStamp/The time, in seconds since 1900-01-01 (see GetCurrentDateTime).
+/// HIRET Returns the record index, or nRecords if all the records are older.
+int DataStoreFind(const DataStore *store, double timeStamp)
+{
+	int first = 0, last = store->nRecords;
+
+	while (first < last) {
+		int middle = first + (last-first)/2;
+
+		if (DataFileDecodeTimeStamp(store->records + (size_t)middle*DATAFILE_RECORD_SZ) < timeStamp)
+			first = middle+1;
+		else
+			last = middle;
+	}
+	return first;
+}
+
+/// HIFN Converts a time window of a binary data file to the tab-separated format.
+/// HIPAR binaryPathName/The binary data file.
+/// HIPAR textPathName/The tab-separated file to create.
+/// HIPAR start/The beginning of the window, in seconds since 1900-01-01.
+/// HIPAR stop/The end of the window (excluded).
+/// HIRET Returns the number of records converted or a negative DataFileError.
+int DataStoreConvertToText(const char *binaryPathName, const char *textPathName, double start, double stop)
+{
+	DataStore store;
+	DataFileRecord record;
+	FILE *textFile;
+	char buf[DATAFILE_TEXT_RECORD_SZ];
+	int ret, first, last;
+
+	if ((ret = DataStoreOpen(&store, binaryPathName)) < 0)
+		return ret;
+	if ((textFile = fopen(textPathName, "w")) == NULL) {
+		DataStoreClose(&store);
+		return DATAFILE_ERROR_IO;
+	}
+	first = DataStoreFind(&store, start);
+	last = DataStoreFind(&store, stop);
+	ret = DataFileFormatTextHeader(buf, sizeof buf, &store.header) < 0 || fputs(buf, textFile) < 0 ? DATAFILE_ERROR_IO : 0;
+	for (int i = first; i < last && ret == 0; ++i) {
+		DataStoreGetRecord(&store, i, &record);
+		if (DataFileFormatTextRecord(buf, sizeof buf, &record) < 0 || fputs(buf, textFile) < 0)
+			ret = DATAFILE_ERROR_IO;
+	}
+	if (fclose(textFile) != 0)
+		ret = DATAFILE_ERROR_IO;
+	DataStoreClose(&store);
+	return ret < 0 ? ret : last > first ? last-first : 0;
+}
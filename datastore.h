@@ -0,0 +1,68 @@
+//==============================================================================
+//
+// VersICaL impedance bridge client
+//
+// Copyright 2018-2019	Massimo Ortolano <massimo.ortolano@polito.it> 
+//                		Martina Marzano <m.marzano@inrim.it>
+//
+// This code is licensed under MIT license (see LICENSE.txt for details)
+//
+//==============================================================================
+
+//==============================================================================
+//
+// Memory-mapped reader of binary data files.
+//
+// A data store maps a binary data file (datafile.h) read-only, so that any
+// record is reached without reading the ones before it. The records are
+// appended in time order, hence their timestamps are themselves the index:
+// a time range is located by bisection in O(log n), touching only the pages
+// it probes. Only the records whose commit marker is valid are counted, so a
+// file whose last record was torn by a crash can still be read. The file can
+// be mapped while the client is still appending to it; DataStoreRefresh maps
+// the records written since.
+//
+//==============================================================================
+
+#ifndef DATASTORE_H
+#define DATASTORE_H
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+//==============================================================================
+// Include files
+
+#include "datafile.h"
+
+//==============================================================================
+// Constants
+
+//==============================================================================
+// Types
+
+typedef struct {
+	DataFileHeader header;
+	int nRecords; // Committed records
+	const unsigned char *records;
+	const unsigned char *view;
+	void *fileHandle;
+	void *mappingHandle;
+} DataStore;
+
+//==============================================================================
+// Global functions
+
+int DataStoreOpen(DataStore *, const char *);
+int DataStoreRefresh(DataStore *);
+void DataStoreClose(DataStore *);
+int DataStoreGetRecord(const DataStore *, int, DataFileRecord *);
+int DataStoreFind(const DataStore *, double);
+int DataStoreConvertToText(const char *, const char *, double, double);
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif /* DATASTORE_H */
@@ -0,0 +1,152 @@
+//==============================================================================
+//
+// VersICaL impedance bridge client
+//
+// Copyright 2018-2019	Massimo Ortolano <massimo.ortolano@polito.it> 
+//                		Martina Marzano <m.marzano@inrim.it>
+//
+// This code is licensed under MIT license (see LICENSE.txt for details)
+//
+//==============================================================================
+
+//==============================================================================
+// Include files
+
+#include <ansi_c.h>
+#include <userint.h>
+#include <utility.h>
+
+#include "msg.h"
+#include "instrument.h"
+
+//==============================================================================
+// Constants
+
+//==============================================================================
+// Types
+
+typedef struct {
+	InstrumentFunction function;
+	InstrumentCompletion completion;
+	void *data;
+	int status;
+} InstrumentCommand;
+
+//==============================================================================
+// Static global variables
+
+static struct {
+	CmtTSQHandle queue;
+	CmtThreadFunctionID workerId;
+	int isRunning;
+	volatile long isStopping;
+	long nSubmitted; // Commands submitted, on the user interface thread
+	long nCompleted; // Completions called, idem
+} instrument = {0, 0, 0, 0, 0, 0};
+
+//==============================================================================
+// Static functions
+
+static void CVICALLBACK CompleteCommand(void *callbackData)
+{
+	InstrumentCommand *command = callbackData;
+
+	++instrument.nCompleted;
+	if (command->completion != NULL)
+		command->completion(command->status, command->data);
+	free(command);
+}
+
+// Run the queued commands in order and post their completions
+static int CVICALLBACK InstrumentWorker(void *functionData)
+{
+	InstrumentCommand *command;
+
+	while (!instrument.isStopping) {
+		if (CmtReadTSQData(instrument.queue, &command, 1, (int)(INSTRUMENT_POLL_INTERVAL*1000), 0) != 1)
+			continue;
+		command->status = command->function(command->data);
+		while (PostDeferredCall(CompleteCommand, command) < 0 && !instrument.isStopping)
+			Delay(INSTRUMENT_POLL_INTERVAL);
+	}
+	return 0;
+}
+
+//==============================================================================
+// Global variables
+
+//==============================================================================
+// Global functions
+
+/// HIFN Starts the instrument thread.
+/// HIRET Returns 0 on success or a negative value on error.
+int InstrumentStart(void)
+{
+	if (instrument.isRunning)
+		return 0;
+	if (CmtNewTSQ(INSTRUMENT_QUEUE_LEN, sizeof(InstrumentCommand *), 0, &instrument.queue) < 0)
+		return -1;
+	instrument.isStopping = 0;
+	if (CmtScheduleThreadPoolFunction(DEFAULT_THREAD_POOL_HANDLE, InstrumentWorker, NULL, &instrument.workerId) < 0) {
+		CmtDiscardTSQ(instrument.queue);
+		return -1;
+	}
+	instrument.isRunning = 1;
+	return 0;
+}
+
+/// HIFN Queues a command for the instrument thread; it does not wait for it.
+/// HIPAR function/The command, run on the instrument thread.
+/// HIPAR completion/Called on the user interface thread when the command has
+/// HIPAR completion/returned, or NULL.
+/// HIPAR data/Passed to the command and to its completion.
+/// HIRET Returns 0 if the command has been queued or -1 on error, which has
+/// HIRET already been reported; the completion is then not called.
+int InstrumentSubmit(InstrumentFunction function, InstrumentCompletion completion, void *data)
+{
+	InstrumentCommand *command;
+
+	if (!instrument.isRunning) {
+		warn(msgStrings[MSG_INTERNAL_ERROR]);
+		return -1;
+	}
+	if ((command = malloc(sizeof *command)) == NULL) {
+		warn(msgStrings[MSG_OUT_OF_MEMORY]);
+		return -1;
+	}
+	command->function = function;
+	command->completion = completion;
+	command->data = data;
+	command->status = 0;
+	if (CmtWriteTSQData(instrument.queue, &command, 1, INSTRUMENT_QUEUE_TIMEOUT, NULL) != 1) {
+		free(command);
+		warn(msgStrings[MSG_INTERNAL_ERROR]);
+		return -1;
+	}
+	++instrument.nSubmitted;
+	return 0;
+}
+
+/// HIFN Tells whether commands are queued or running, or their completions pending.
+/// HIRET Returns 1 if some completion has not been called yet, 0 otherwise.
+int InstrumentIsBusy(void)
+{
+	return instrument.nCompleted != instrument.nSubmitted;
+}
+
+/// HIFN Stops the instrument thread once the running command has returned.
+/// HIFN The commands still queued are discarded, without completion.
+void InstrumentStop(void)
+{
+	InstrumentCommand *command;
+
+	if (!instrument.isRunning)
+		return;
+	InterlockedExchange(&instrument.isStopping, 1);
+	CmtWaitForThreadPoolFunctionCompletion(DEFAULT_THREAD_POOL_HANDLE, instrument.workerId, 0);
+	CmtReleaseThreadPoolFunctionID(DEFAULT_THREAD_POOL_HANDLE, instrument.workerId);
+	while (CmtReadTSQData(instrument.queue, &command, 1, 0, 0) == 1)
+		free(command);
+	CmtDiscardTSQ(instrument.queue);
+	instrument.isRunning = 0;
+}
@@ -0,0 +1,67 @@
+//==============================================================================
+//
+// VersICaL impedance bridge client
+//
+// Copyright 2018-2019	Massimo Ortolano <massimo.ortolano@polito.it> 
+//                		Martina Marzano <m.marzano@inrim.it>
+//
+// This code is licensed under MIT license (see LICENSE.txt for details)
+//
+//==============================================================================
+
+//==============================================================================
+//
+// Instrument I/O thread.
+//
+// The source and lock-in operations that take longer than a user interface
+// event (connecting, changing the frequency or the range, AutoZero) are
+// queued as commands on a thread-safe queue and run in order by a worker
+// thread of the default thread pool, so that the panel keeps being redrawn
+// while the instruments are busy. When a command returns, its completion is
+// called on the user interface thread with PostDeferredCall, together with
+// the status returned by the command: the program state moves on there.
+// A command reports its own errors with warn, which shows them from the user
+// interface thread. Progress of a command is posted the same way.
+//
+//==============================================================================
+
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+//==============================================================================
+// Include files
+
+//==============================================================================
+// Constants
+
+#define INSTRUMENT_QUEUE_LEN 16 // Commands
+#define INSTRUMENT_POLL_INTERVAL 0.1 // Seconds
+#define INSTRUMENT_QUEUE_TIMEOUT 1000 // Milliseconds
+
+//==============================================================================
+// Types
+
+// Runs on the instrument thread; returns 0 on success or -1 on error, which
+// has already been reported
+typedef int (*InstrumentFunction)(void *data);
+
+// Runs on the user interface thread with the status returned by the command
+typedef void (*InstrumentCompletion)(int status, void *data);
+
+//==============================================================================
+// Global functions
+
+int InstrumentStart(void);
+int InstrumentSubmit(InstrumentFunction, InstrumentCompletion, void *);
+int InstrumentIsBusy(void);
+void InstrumentStop(void);
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif /* INSTRUMENT_H */
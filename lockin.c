@@ -13,9 +13,9 @@
 // Include files
 
 #include <ansi_c.h>
-#include <gpib.h>
 
 #include "lockin.h"
+#include "cfg.h"
 
 //==============================================================================
 // Constants
@@ -23,69 +23,416 @@
 //==============================================================================
 // Types
 
+// Last state known to be applied to a lock-in
+typedef struct {
+	const Transport *transport;
+	int timeConstantCode;
+	int filterSlopeCode;
+	int isTimeConstantValid;	// Both time constant and filter slope
+	LockinInputSettings inputSettings;
+	int isInputValid;
+	int ddef[2][2];	// Display and ratio of CH1 and CH2, before the data buffers were used
+	int srat;		// Idem, data buffer settings
+	int send;
+	int tstr;
+	int isBufferSaved;	// To be restored by RestoreLockinBufferRaw
+} LockinShadow;
+
 //==============================================================================
 // Static global variables
 
+static LockinShadow shadows[MAX_LOCKINS];
+static int nextShadow = 0;
+
+// X and Y buffers as transferred by TRCB? or TRCL?, 4 bytes per point
+static unsigned char bufferBlock[2*4*LOCKIN_BUFFER_POINTS_MAX];
+
 //==============================================================================
 // Static functions
 
-//==============================================================================
-// Global variables
+// State of the lock-in reached through a transport, which takes over the
+// least recently claimed one if the transport is new
+static LockinShadow *GetShadow(const Transport *transport)
+{
+	LockinShadow *shadow;
 
-//==============================================================================
-// Global functions
+	for (int i = 0; i < MAX_LOCKINS; ++i)
+		if (shadows[i].transport == transport)
+			return &shadows[i];
+	shadow = &shadows[nextShadow];
+	nextShadow = (nextShadow+1)%MAX_LOCKINS;
+	shadow->transport = transport;
+	shadow->isTimeConstantValid = 0;
+	shadow->isInputValid = 0;
+	shadow->isBufferSaved = 0;
+	return shadow;
+}
 
-unsigned long ReadLockinRaw(int lockinDesc, LockinReading *lockinReading)	
+// Appends "<command> <value>" to a semicolon-separated command line, whose
+// length is returned
+static int AppendCommand(char *buf, int pos, const char *command, int value)
 {
-	char buf[GPIB_BUF_SZ];
-	unsigned long ret;
+	return pos+snprintf(buf+pos, GPIB_BUF_SZ-pos, "%s%s %d", pos > 0 ? ";" : "", command, value);
+}
 
-	// Read lock-in time constant
-	snprintf(buf, GPIB_BUF_SZ, "OFLT?");
-	if ((ret = ibwrt(lockinDesc, buf, strlen(buf))) & ERR ||
-		(ret = ibrd(lockinDesc, buf, GPIB_READ_LEN)) & ERR)
+// Reads the responses to a command line of nResponses queries, which may
+// come back on one line separated by semicolons, in one read with
+// terminators in between or, when the instrument terminates each response,
+// in separate reads. The responses are split in place in buf
+static int ReadResponses(Transport *transport, char *buf, char **responses, int nResponses)
+{
+	int len = 0, n = 0, ret;
+	char *p;
+
+	while (n < nResponses) {
+		if (len > 0)
+			buf[len++] = ';';
+		if ((ret = TransportRead(transport, buf+len, GPIB_BUF_SZ-len)) < 0)
+			return ret;
+		len += ret;
+		while (len > 0 && (buf[len-1] == '\n' || buf[len-1] == '\r'))
+			buf[--len] = '\0';
+		for (n = 1, p = buf; *p != '\0'; ++p)
+			if (*p == ';' || *p == '\n')
+				++n;
+	}
+	responses[0] = buf;
+	for (n = 1, p = buf; *p != '\0'; ++p)
+		if (*p == ';' || *p == '\n') {
+			*p = '\0';
+			if (n < nResponses)
+				responses[n++] = p+1;
+		}
+	return 0;
+}
+
+// Sends a query preceded by OFLT? and OFSL? if the output filter settings are
+// not cached, and returns the number of responses to read back
+static int WriteQueryWithTimeConstant(Transport *transport, const char *query)
+{
+	char command[GPIB_BUF_SZ];
+	int ret;
+
+	if (GetShadow(transport)->isTimeConstantValid) {
+		if ((ret = TransportWrite(transport, query)) < 0)
+			return ret;
+		return 1;
+	}
+	snprintf(command, GPIB_BUF_SZ, "OFLT?;OFSL?;%s", query);
+	if ((ret = TransportWrite(transport, command)) < 0)
 		return ret;
-	sscanf(buf, "%d", &lockinReading->timeConstantCode);
+	return 3;
+}
+
+// Reads back the responses to WriteQueryWithTimeConstant, caching the output
+// filter settings, and points response to the query's own response
+static int ReadQueryWithTimeConstant(Transport *transport, int nResponses, char *buf, char **response)
+{
+	LockinShadow *shadow = GetShadow(transport);
+	char *responses[3];
+	int ret;
+
+	if (nResponses == 1) {
+		if ((ret = TransportRead(transport, buf, GPIB_READ_LEN)) < 0)
+			return ret;
+		*response = buf;
+		return 0;
+	}
+	if ((ret = ReadResponses(transport, buf, responses, 3)) < 0)
+		return ret;
+	shadow->isTimeConstantValid = sscanf(responses[0], "%d", &shadow->timeConstantCode) == 1 &&
+								  sscanf(responses[1], "%d", &shadow->filterSlopeCode) == 1;
+	*response = responses[2];
+	return 0;
+}
+
+static int QueryWithTimeConstant(Transport *transport, const char *query, char *buf, char **response)
+{
+	int nResponses;
+
+	if ((nResponses = WriteQueryWithTimeConstant(transport, query)) < 0)
+		return nResponses;
+	return ReadQueryWithTimeConstant(transport, nResponses, buf, response);
+}
+
+// Fills in the time constant, the filter order and the settling delay from
+// the cached codes
+static void SetTimeConstant(const LockinShadow *shadow, LockinReading *lockinReading)
+{
+	lockinReading->timeConstantCode = shadow->timeConstantCode;
+	lockinReading->filterPoles = shadow->filterSlopeCode+1; // 6 dB/oct per pole
 
 	// Convert code to actual time constant
 	lockinReading->timeConstant = (lockinReading->timeConstantCode % 2) ? 
 						 	3.0*pow(10.0,(lockinReading->timeConstantCode-11)/2) : 
 							pow(10.0,(lockinReading->timeConstantCode-10)/2);
 	lockinReading->adjDelay = AUTOZERO_ADJ_DELAY_FACTOR*lockinReading->timeConstant + AUTOZERO_ADJ_DELAY_BASE;
-		 
-	snprintf(buf, GPIB_BUF_SZ, "SNAP?1,2");
-	if ((ret = ibwrt(lockinDesc, buf, strlen(buf))) & ERR ||
-		(ret = ibrd(lockinDesc, buf, GPIB_READ_LEN)) & ERR)
+}
+
+// Sum of n little-endian IEEE floats (TRCB?)
+static double SumIeeePoints(const unsigned char *p, int n)
+{
+	double sum = 0.0;
+
+	for (int i = 0; i < n; ++i, p += 4) {
+		unsigned int bits = p[0] | (unsigned int)p[1] << 8 | (unsigned int)p[2] << 16 | (unsigned int)p[3] << 24;
+		float value;
+
+		memcpy(&value, &bits, sizeof value);
+		sum += value;
+	}
+	return sum;
+}
+
+// Sum of n little-endian non-normalized points (TRCL?), each a 16-bit
+// mantissa m and a 16-bit exponent e with value m*2^(e-124). The mantissas
+// are summed as integers over runs of equal exponents, which on a settled
+// signal span the whole buffer, so that scaling is done once per run
+static double SumNonNormalizedPoints(const unsigned char *p, int n)
+{
+	double sum = 0.0;
+	long long mantissaSum = 0;
+	int runExponent = 0;
+
+	for (int i = 0; i < n; ++i, p += 4) {
+		int mantissa = (short)(p[0] | p[1] << 8);
+		int exponent = (short)(p[2] | p[3] << 8);
+
+		if (exponent != runExponent) {
+			sum += ldexp((double)mantissaSum, runExponent-124);
+			mantissaSum = 0;
+			runExponent = exponent;
+		}
+		mantissaSum += mantissa;
+	}
+	return sum+ldexp((double)mantissaSum, runExponent-124);
+}
+
+//==============================================================================
+// Global variables
+
+//==============================================================================
+// Global functions
+
+/// HIFN Sends the initialization string to the lock-in and forgets all the
+/// HIFN cached lock-in state, since the string may reset the instrument.
+/// HIRET 0 on success, a negative transport error code otherwise
+int InitLockinRaw(Transport *transport, const char *initString)
+{
+	LockinShadow *shadow = GetShadow(transport);
+
+	shadow->isTimeConstantValid = 0;
+	shadow->isInputValid = 0;
+	return TransportWrite(transport, initString);
+}
+
+/// HIFN Forgets the cached time constant and filter slope of all the lock-ins,
+/// HIFN which ReadLockinRaw queries again on its next call. Call it whenever
+/// HIFN they may have been changed behind ReadLockinRaw's back (gain settings,
+/// HIFN direct OFLT or OFSL writes).
+void InvalidateLockinTimeConstant(void)
+{
+	for (int i = 0; i < MAX_LOCKINS; ++i)
+		shadows[i].isTimeConstantValid = 0;
+}
+
+/// HIFN Reads X and Y from the lock-in, along with its time constant and
+/// HIFN filter slope. Their codes are cached: while the cache is valid a single
+/// HIFN SNAP?1,2 transaction is performed, otherwise OFLT?, OFSL? and SNAP?1,2
+/// HIFN are sent on one command line and their responses read back together.
+/// HIRET 0 on success, a negative transport error code otherwise
+int ReadLockinRaw(Transport *transport, LockinReading *lockinReading)	
+{
+	char buf[GPIB_BUF_SZ];
+	char *snap;
+	int ret;
+
+	if ((ret = QueryWithTimeConstant(transport, "SNAP?1,2", buf, &snap)) < 0)
 		return ret;
-	sscanf(buf, "%lf,%lf", &lockinReading->real, &lockinReading->imag);
+	sscanf(snap, "%lf,%lf", &lockinReading->real, &lockinReading->imag);
+	lockinReading->nPoints = 1;
+	SetTimeConstant(GetShadow(transport), lockinReading);
 	
-	return ret;
+	return 0;
 }
 
-unsigned long SetLockinInputRaw(int lockinDesc, LockinInputSettings lockinInputSettings)	
+/// HIFN Reads X and Y from several lock-ins as ReadLockinRaw, but sends the
+/// HIFN SNAP?1,2 queries to all of them before reading back any response: the
+/// HIFN lock-ins sample their outputs within one write of each other and
+/// HIFN answer in parallel.
+/// HIPAR transports/One per lock-in, at most MAX_LOCKINS
+/// HIRET 0 on success, a negative transport error code otherwise, the transport
+/// HIRET that failed being given by FindLockinError
+int ReadLockinsRaw(Transport *transports[], int nLockins, LockinReading lockinReadings[])
 {
 	char buf[GPIB_BUF_SZ];
-	unsigned long ret;
+	char *snap;
+	int nResponses[MAX_LOCKINS];
+	int ret;
+
+	for (int i = 0; i < nLockins; ++i)
+		if ((nResponses[i] = WriteQueryWithTimeConstant(transports[i], "SNAP?1,2")) < 0)
+			return nResponses[i];
+	for (int i = 0; i < nLockins; ++i) {
+		if ((ret = ReadQueryWithTimeConstant(transports[i], nResponses[i], buf, &snap)) < 0)
+			return ret;
+		sscanf(snap, "%lf,%lf", &lockinReadings[i].real, &lockinReadings[i].imag);
+		lockinReadings[i].nPoints = 1;
+		SetTimeConstant(GetShadow(transports[i]), &lockinReadings[i]);
+	}
+	return 0;
+}
+
+/// HIFN Transport that failed in the last call of ReadLockinsRaw, the first
+/// HIFN one if none did
+Transport *FindLockinError(Transport *transports[], int nLockins)
+{
+	for (int i = 0; i < nLockins; ++i)
+		if (transports[i]->error.code != TRANSPORT_ERROR_NONE)
+			return transports[i];
+	return transports[0];
+}
+
+/// HIFN Data buffer sample rate of an SRAT code, in hertz
+double LockinBufferSampleRate(int sampleRateCode)
+{
+	return 0.0625*pow(2.0, sampleRateCode);
+}
+
+/// HIFN Clears the lock-in data buffers and starts filling them with X and Y
+/// HIFN in one-shot mode. The first call after a restore first reads the
+/// HIFN display and data buffer settings, for RestoreLockinBufferRaw.
+/// HIPAR sampleRateCode/SRAT code, 0 (62.5 mHz) to LOCKIN_BUFFER_RATE_MAX
+/// HIRET 0 on success, a negative transport error code otherwise
+int StartLockinBufferRaw(Transport *transport, int sampleRateCode)
+{
+	LockinShadow *shadow = GetShadow(transport);
+	char buf[GPIB_BUF_SZ];
+	char *responses[5];
+	int ret;
 	
-	snprintf(buf, GPIB_BUF_SZ, "ISRC %d", lockinInputSettings.lockinInputType);	
-	if ((ret = ibwrt(lockinDesc, buf, strlen(buf))) & ERR)
-		return ret;
+	if (!shadow->isBufferSaved) {
+		if ((ret = TransportWrite(transport, "DDEF?1;DDEF?2;SRAT?;SEND?;TSTR?")) < 0 ||
+				(ret = ReadResponses(transport, buf, responses, 5)) < 0)
+			return ret;
+		shadow->isBufferSaved = sscanf(responses[0], "%d,%d", &shadow->ddef[0][0], &shadow->ddef[0][1]) == 2 &&
+								sscanf(responses[1], "%d,%d", &shadow->ddef[1][0], &shadow->ddef[1][1]) == 2 &&
+								sscanf(responses[2], "%d", &shadow->srat) == 1 &&
+								sscanf(responses[3], "%d", &shadow->send) == 1 &&
+								sscanf(responses[4], "%d", &shadow->tstr) == 1;
+	}
+	snprintf(buf, GPIB_BUF_SZ, "REST;DDEF 1,0,0;DDEF 2,0,0;SRAT %d;SEND 0;TSTR 0;STRT", sampleRateCode);
+	return TransportWrite(transport, buf);
+}
+
+/// HIFN Stops the lock-in data buffers and restores the display and data
+/// HIFN buffer settings read by StartLockinBufferRaw, so that a shared
+/// HIFN instrument is given back as it was found; the buffered data is lost.
+/// HIFN Nothing is sent if the settings were not saved.
+/// HIRET 0 on success, a negative transport error code otherwise
+int RestoreLockinBufferRaw(Transport *transport)
+{
+	LockinShadow *shadow = GetShadow(transport);
+	char buf[GPIB_BUF_SZ];
+
+	if (!shadow->isBufferSaved)
+		return 0;
+	shadow->isBufferSaved = 0;
+	snprintf(buf, GPIB_BUF_SZ, "PAUS;DDEF 1,%d,%d;DDEF 2,%d,%d;SRAT %d;SEND %d;TSTR %d",
+			 shadow->ddef[0][0], shadow->ddef[0][1], shadow->ddef[1][0], shadow->ddef[1][1],
+			 shadow->srat, shadow->send, shadow->tstr);
+	return TransportWrite(transport, buf);
+}
+
+/// HIFN Pauses the lock-in data buffers started by StartLockinBufferRaw and
+/// HIFN reads the mean of up to nPoints X and Y samples. Both buffers are
+/// HIFN transferred in binary in a single transaction. If the buffers are
+/// HIFN still empty a SNAP?1,2 reading is taken instead.
+/// HIPAR nPoints/Number of samples to average, at most LOCKIN_BUFFER_POINTS_MAX
+/// HIPAR format/TRCB? or TRCL? transfer
+/// HIRET 0 on success, a negative transport error code otherwise
+int ReadLockinBufferRaw(Transport *transport, int nPoints, LockinBufferFormat format, LockinReading *lockinReading)
+{
+	char buf[GPIB_BUF_SZ];
+	char *response;
+	int nStored = 0;
+	int ret;
 	
-	snprintf(buf, GPIB_BUF_SZ, "RMOD %d", lockinInputSettings.lockinReserveType);	
-	if ((ret = ibwrt(lockinDesc, buf, strlen(buf))) & ERR)
+	if ((ret = QueryWithTimeConstant(transport, "PAUS;SPTS?", buf, &response)) < 0)
 		return ret;
+	sscanf(response, "%d", &nStored);
+	if (nPoints > nStored)
+		nPoints = nStored;
+	if (nPoints > LOCKIN_BUFFER_POINTS_MAX)
+		nPoints = LOCKIN_BUFFER_POINTS_MAX;
+	if (nPoints < 1)
+		return ReadLockinRaw(transport, lockinReading);
 	
-	snprintf(buf, GPIB_BUF_SZ, "ILIN %d", lockinInputSettings.lockinFiltersType);	
-	if ((ret = ibwrt(lockinDesc, buf, strlen(buf))) & ERR)
-		return ret;
-		
-	snprintf(buf, GPIB_BUF_SZ, "IGND %d", lockinInputSettings.lockinGroundConnection);	
-	if ((ret = ibwrt(lockinDesc, buf, strlen(buf))) & ERR)
+	snprintf(buf, GPIB_BUF_SZ, format == LOCKIN_BUFFER_NON_NORMALIZED ? "TRCL?1,0,%d;TRCL?2,0,%d" : "TRCB?1,0,%d;TRCB?2,0,%d",
+			 nPoints, nPoints);
+	if ((ret = TransportWrite(transport, buf)) < 0 ||
+			(ret = TransportReadBinary(transport, bufferBlock, 2*4*nPoints)) < 0)
 		return ret;
+	if (format == LOCKIN_BUFFER_NON_NORMALIZED) {
+		lockinReading->real = SumNonNormalizedPoints(bufferBlock, nPoints)/nPoints;
+		lockinReading->imag = SumNonNormalizedPoints(bufferBlock+4*nPoints, nPoints)/nPoints;
+	} else {
+		lockinReading->real = SumIeeePoints(bufferBlock, nPoints)/nPoints;
+		lockinReading->imag = SumIeeePoints(bufferBlock+4*nPoints, nPoints)/nPoints;
+	}
+	lockinReading->nPoints = nPoints;
+	SetTimeConstant(GetShadow(transport), lockinReading);
+	
+	return 0;
+}
+
+/// HIFN Applies the lock-in input settings, sending only the parameters that
+/// HIFN differ from the last ones applied through the same transport, all on
+/// HIFN one command line. Nothing is sent if no parameter changed.
+/// HIRET 0 on success, a negative transport error code otherwise
+int SetLockinInputRaw(Transport *transport, LockinInputSettings lockinInputSettings)	
+{
+	char buf[GPIB_BUF_SZ];
+	LockinShadow *shadow = GetShadow(transport);
+	const LockinInputSettings *last = &shadow->inputSettings;
+	int isValid = shadow->isInputValid;
+	int pos = 0;
+	int ret;
+	
+	if (!isValid || lockinInputSettings.lockinInputType != last->lockinInputType)
+		pos = AppendCommand(buf, pos, "ISRC", lockinInputSettings.lockinInputType);
+	if (!isValid || lockinInputSettings.lockinReserveType != last->lockinReserveType)
+		pos = AppendCommand(buf, pos, "RMOD", lockinInputSettings.lockinReserveType);
+	if (!isValid || lockinInputSettings.lockinFiltersType != last->lockinFiltersType)
+		pos = AppendCommand(buf, pos, "ILIN", lockinInputSettings.lockinFiltersType);
+	if (!isValid || lockinInputSettings.lockinGroundConnection != last->lockinGroundConnection)
+		pos = AppendCommand(buf, pos, "IGND", lockinInputSettings.lockinGroundConnection);
+	if (!isValid || lockinInputSettings.lockinCouplingType != last->lockinCouplingType)
+		pos = AppendCommand(buf, pos, "ICPL", lockinInputSettings.lockinCouplingType);
+	if (pos == 0)
+		return 0;
 	
-	snprintf(buf, GPIB_BUF_SZ, "ICPL %d", lockinInputSettings.lockinCouplingType);	
-	if ((ret = ibwrt(lockinDesc, buf, strlen(buf))) & ERR)
+	// Until the write succeeds the state of the lock-in is unknown
+	shadow->isInputValid = 0;
+	shadow->isTimeConstantValid = 0;
+	if ((ret = TransportWrite(transport, buf)) < 0)
 		return ret;
+	shadow->inputSettings = lockinInputSettings;
+	shadow->isInputValid = 1;
 
-	return ret;
+	return 0;
+}
+
+/// HIFN Transport of the lock-in detecting the null of a channel
+/// HIPAR channel/Zero-based channel index
+Transport *GetChannelLockin(int channel)
+{
+	return &lockinSettings.lockins[modeSettings[0].channelSettings[channel].lockin].transport;
+}
+
+/// HIFN Closes the transports of all the lock-ins, ignoring errors
+void CloseLockins(void)
+{
+	for (int i = 0; i < MAX_LOCKINS; ++i)
+		TransportClose(&lockinSettings.lockins[i].transport);
 }
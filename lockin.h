@@ -33,8 +33,18 @@
 //==============================================================================
 // Global functions
 
-unsigned long ReadLockinRaw(int, LockinReading *);
-unsigned long SetLockinInputRaw(int, LockinInputSettings);
+int InitLockinRaw(Transport *, const char *);
+void InvalidateLockinTimeConstant(void);
+int ReadLockinRaw(Transport *, LockinReading *);
+int ReadLockinsRaw(Transport *[], int, LockinReading []);
+Transport *FindLockinError(Transport *[], int);
+int SetLockinInputRaw(Transport *, LockinInputSettings);
+double LockinBufferSampleRate(int);
+int StartLockinBufferRaw(Transport *, int);
+int RestoreLockinBufferRaw(Transport *);
+int ReadLockinBufferRaw(Transport *, int, LockinBufferFormat, LockinReading *);
+Transport *GetChannelLockin(int);
+void CloseLockins(void);
 
 #ifdef __cplusplus
     }
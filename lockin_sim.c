@@ -0,0 +1,743 @@
+//==============================================================================
+//
+// VersICaL impedance bridge client
+//
+// Copyright 2018-2019	Massimo Ortolano <massimo.ortolano@polito.it> 
+//                		Martina Marzano <m.marzano@inrim.it>
+//
+// This code is licensed under MIT license (see LICENSE.txt for details)
+//
+//==============================================================================
+
+//==============================================================================
+// Include files
+
+#include <ansi_c.h>
+#include <utility.h>
+#include <tcpsupp.h>
+
+#include "main.h"
+#include "lockin_sim.h"
+#include "sim.h"
+#include "bridge_sim.h"
+
+//==============================================================================
+// Constants
+
+#define FILTER_POLES_MAX 4
+#define FILTER_STEPS_MAX 4000
+#define FILTER_STEPS_PER_TC 20.0
+#define FILTER_SETTLED_TCS 40.0
+
+#define SENS_CODE_MAX 26
+#define OFLT_CODE_MAX 19
+#define OFSL_CODE_MAX 3
+#define SRAT_CODE_MAX 14 // Sample on external trigger
+#define SRAT_CODE_TRIGGER 14
+
+// Room for the largest binary response, both buffers in one command line
+#define LOCKIN_SIM_OUTPUT_SZ (LOCKIN_SIM_QUEUE_SZ+2*4*LOCKIN_SIM_BUFFER_SZ)
+
+#define SR830_IDN "Stanford_Research_Systems,SR830,s/n00000,ver1.07"
+
+//==============================================================================
+// Types
+
+typedef struct {
+	int isOpen;
+	int isrc;
+	int rmod;
+	int ilin;
+	int ignd;
+	int icpl;
+	int sens;
+	int oflt;
+	int ofsl;
+	int fmod;
+	int rslp;
+	int harm;
+	double x[FILTER_POLES_MAX];	// Filter stages, in-phase
+	double y[FILTER_POLES_MAX];	// Filter stages, quadrature
+	double filterTime;
+	int srat;
+	int send;
+	int tstr;
+	int ddef[2];	// Display of CH1 (X, R...) and CH2 (Y, theta...)
+	int ddefRatio[2];
+	int isBufferRunning;
+	unsigned long nBufferSamples;	// Samples taken since REST, wrapping in loop mode
+	double nextSampleTime;
+	int isNoiseValid;
+	double noiseTime;
+	double noiseX;	// Output noise at noiseTime
+	double noiseY;
+	float buffer[2][LOCKIN_SIM_BUFFER_SZ];
+	char queue[LOCKIN_SIM_OUTPUT_SZ];	// Output queue
+	int queueLen;
+	int commandErrors;
+} LockinSim;
+
+//==============================================================================
+// Static global variables
+
+static LockinSim devices[LOCKIN_SIM_DEVICES];
+static int isInitialized = 0;
+static double latency;
+static double noise;
+static unsigned long transactionCount = 0;
+static LockinSimInputFunction inputFunction = NULL;
+static void *inputData = NULL;
+
+static unsigned int serverPort = 0;
+static int serverPad = 0;
+
+//==============================================================================
+// Static functions
+
+static void Initialize(void)
+{
+	if (isInitialized)
+		return;
+	isInitialized = 1;
+	latency = SimGetEnvDouble("LOCKIN_SIM_LATENCY", LOCKIN_SIM_LATENCY);
+	noise = SimGetEnvDouble("LOCKIN_SIM_NOISE", LOCKIN_SIM_NOISE);
+}
+
+static void Reset(LockinSim *lockin)
+{
+	lockin->isrc = 0;
+	lockin->rmod = 1;
+	lockin->ilin = 0;
+	lockin->ignd = 0;
+	lockin->icpl = 0;
+	lockin->sens = SENS_CODE_MAX;
+	lockin->oflt = 10;
+	lockin->ofsl = 1;
+	lockin->fmod = 1;
+	lockin->rslp = 0;
+	lockin->harm = 1;
+	lockin->srat = 4;
+	lockin->send = 1;
+	lockin->tstr = 0;
+	lockin->ddef[0] = lockin->ddef[1] = 0;
+	lockin->ddefRatio[0] = lockin->ddefRatio[1] = 0;
+	lockin->isBufferRunning = 0;
+	lockin->nBufferSamples = 0;
+	lockin->isNoiseValid = 0;
+	lockin->queueLen = 0;
+	lockin->commandErrors = 0;
+}
+
+// Time constant as reported by OFLT (1, 3, 10, 30... sequence from 10 us)
+static double TimeConstant(int oflt)
+{
+	return (oflt % 2) ? 3.0*pow(10.0, (oflt-11)/2) : pow(10.0, (oflt-10)/2);
+}
+
+// Full scale of sensitivity code SENS (2 nV to 1 V in 1, 2, 5 steps)
+static double Sensitivity(int sens)
+{
+	static const double mantissa[3] = {2.0, 5.0, 10.0};
+
+	return mantissa[sens % 3]*pow(10.0, sens/3-9);
+}
+
+// Equivalent noise bandwidth of the output filter for 6, 12, 18 and 24 dB/oct
+static double NoiseBandwidth(int oflt, int ofsl)
+{
+	static const double enbw[OFSL_CODE_MAX+1] = {1.0/4.0, 1.0/8.0, 3.0/32.0, 5.0/64.0};
+
+	return enbw[ofsl]/TimeConstant(oflt);
+}
+
+// Data buffer sample rate of code SRAT (62.5 mHz to 512 Hz in octaves)
+static double SampleRate(int srat)
+{
+	return 0.0625*pow(2.0, srat);
+}
+
+static void GetInput(int pad, double time, double *real, double *imag)
+{
+	if (inputFunction != NULL) {
+		inputFunction(pad, time, real, imag, inputData);
+		return;
+	}
+#ifdef DADSS_SIMULATION
+	BridgeSimInput(pad, time, real, imag, NULL);
+#else
+	*real = *imag = 0.0;
+#endif
+}
+
+static double Output(int i, double x, double y)
+{
+	switch (i) {
+		case 1:
+			return x;
+		case 2:
+			return y;
+		case 3:
+			return sqrt(x*x+y*y);
+		case 4:
+			return atan2(y, x)*180.0/PI;
+		default:
+			return 0.0;
+	}
+}
+
+// Advance the output filter from its last update to a given time. The
+// filter is a cascade of equal first-order stages, stepped with their exact
+// exponential response while the input is sampled at each step
+static void AdvanceFilter(int pad, double now)
+{
+	LockinSim *lockin = &devices[pad];
+	int nPoles = lockin->ofsl+1;
+	double tc = TimeConstant(lockin->oflt);
+	double dt = now-lockin->filterTime;
+	double step, a, inRe, inIm;
+	int nSteps;
+
+	if (dt <= 0.0)
+		return;
+	if (dt > FILTER_SETTLED_TCS*tc) {
+		GetInput(pad, now, &inRe, &inIm);
+		for (int k = 0; k < nPoles; ++k) {
+			lockin->x[k] = inRe/sqrt(2.0);
+			lockin->y[k] = inIm/sqrt(2.0);
+		}
+		lockin->filterTime = now;
+		return;
+	}
+	nSteps = (int)ceil(dt/tc*FILTER_STEPS_PER_TC);
+	if (nSteps > FILTER_STEPS_MAX)
+		nSteps = FILTER_STEPS_MAX;
+	step = dt/nSteps;
+	a = exp(-step/tc);
+	for (int i = 1; i <= nSteps; ++i) {
+		GetInput(pad, lockin->filterTime+i*step, &inRe, &inIm);
+		// The lock-in outputs are rms values of the input phasor
+		inRe /= sqrt(2.0);
+		inIm /= sqrt(2.0);
+		for (int k = 0; k < nPoles; ++k) {
+			lockin->x[k] = inRe+a*(lockin->x[k]-inRe);
+			lockin->y[k] = inIm+a*(lockin->y[k]-inIm);
+			inRe = lockin->x[k];
+			inIm = lockin->y[k];
+		}
+	}
+	lockin->filterTime = now;
+}
+
+// Bring the output noise to a given time. The output noise is correlated
+// through the filter: it is modelled as a first-order autoregressive process
+// with the correlation time 1/(4 ENBW) of a single-pole filter having the same
+// noise bandwidth
+static void AdvanceNoise(int pad, double time)
+{
+	LockinSim *lockin = &devices[pad];
+	double enbw = NoiseBandwidth(lockin->oflt, lockin->ofsl);
+	double sigma = noise*sqrt(enbw);
+	double rho = lockin->isNoiseValid ? exp(-4.0*enbw*(time-lockin->noiseTime)) : 0.0;
+
+	lockin->noiseX = rho*lockin->noiseX+sqrt(1.0-rho*rho)*sigma*SimGaussian();
+	lockin->noiseY = rho*lockin->noiseY+sqrt(1.0-rho*rho)*sigma*SimGaussian();
+	lockin->noiseTime = time;
+	lockin->isNoiseValid = 1;
+}
+
+// Store the present outputs in the data buffers
+static void StoreSample(int pad, double time)
+{
+	LockinSim *lockin = &devices[pad];
+	double x, y;
+	int i;
+
+	if (lockin->send == 0 && lockin->nBufferSamples >= LOCKIN_SIM_BUFFER_SZ) {
+		lockin->isBufferRunning = 0;	// One shot: the buffer is full
+		return;
+	}
+	AdvanceNoise(pad, time);
+	x = lockin->x[lockin->ofsl]+lockin->noiseX;
+	y = lockin->y[lockin->ofsl]+lockin->noiseY;
+	i = (int)(lockin->nBufferSamples++ % LOCKIN_SIM_BUFFER_SZ);
+	lockin->buffer[0][i] = (float)(lockin->ddef[0] == 0 ? x : lockin->ddef[0] == 1 ? Output(3, x, y) : 0.0);
+	lockin->buffer[1][i] = (float)(lockin->ddef[1] == 0 ? y : lockin->ddef[1] == 1 ? Output(4, x, y) : 0.0);
+}
+
+// Take the buffer samples due up to now, then bring the filter to now
+static void UpdateFilter(int pad)
+{
+	LockinSim *lockin = &devices[pad];
+	double now = SimTime();
+
+	if (lockin->isBufferRunning && lockin->srat != SRAT_CODE_TRIGGER) {
+		double period = 1.0/SampleRate(lockin->srat);
+
+		while (lockin->isBufferRunning && lockin->nextSampleTime <= now) {
+			AdvanceFilter(pad, lockin->nextSampleTime);
+			StoreSample(pad, lockin->nextSampleTime);
+			lockin->nextSampleTime += period;
+		}
+	}
+	AdvanceFilter(pad, now);
+}
+
+static void GetOutputs(int pad, double *x, double *y)
+{
+	LockinSim *lockin = &devices[pad];
+
+	UpdateFilter(pad);
+	AdvanceNoise(pad, SimTime());
+	*x = lockin->x[lockin->ofsl]+lockin->noiseX;
+	*y = lockin->y[lockin->ofsl]+lockin->noiseY;
+}
+
+static void Respond(int pad, const char *format, ...)
+{
+	LockinSim *lockin = &devices[pad];
+	va_list args;
+	int n;
+
+	va_start(args, format);
+	n = vsnprintf(lockin->queue+lockin->queueLen, LOCKIN_SIM_OUTPUT_SZ-lockin->queueLen, format, args);
+	va_end(args);
+	if (n < 0 || lockin->queueLen+n >= LOCKIN_SIM_OUTPUT_SZ-1) {
+		++lockin->commandErrors;
+		return;
+	}
+	lockin->queueLen += n;
+	lockin->queue[lockin->queueLen++] = '\n';
+	lockin->queue[lockin->queueLen] = '\0';
+}
+
+// Binary response, without terminator
+static int RespondBinary(int pad, const unsigned char *data, int len)
+{
+	LockinSim *lockin = &devices[pad];
+
+	if (lockin->queueLen+len >= LOCKIN_SIM_OUTPUT_SZ-1)
+		return -1;
+	memcpy(lockin->queue+lockin->queueLen, data, len);
+	lockin->queueLen += len;
+	lockin->queue[lockin->queueLen] = '\0';
+	return 0;
+}
+
+// Buffer point in the TRCB? (IEEE float) or TRCL? (mantissa and exponent
+// with a bias of 124) format, little-endian
+static void EncodePoint(float value, int isNonNormalized, unsigned char *p)
+{
+	unsigned int bits;
+
+	if (isNonNormalized) {
+		int exponent = 0;
+		int mantissa = 0;
+
+		if (value != 0.0f) {
+			mantissa = (int)floor(frexp(value, &exponent)*32768.0+0.5);
+			if (mantissa == 32768) {
+				mantissa = 16384;
+				++exponent;
+			}
+			exponent += 109;
+		}
+		bits = ((unsigned int)mantissa & 0xFFFFu) | ((unsigned int)exponent << 16);
+	} else
+		memcpy(&bits, &value, sizeof bits);
+	p[0] = (unsigned char)bits;
+	p[1] = (unsigned char)(bits >> 8);
+	p[2] = (unsigned char)(bits >> 16);
+	p[3] = (unsigned char)(bits >> 24);
+}
+
+// Buffer transfer, e.g. "TRCB? 1,0,100"
+static int Trace(int pad, const char *args, int isNonNormalized)
+{
+	static unsigned char data[4*LOCKIN_SIM_BUFFER_SZ];
+	LockinSim *lockin = &devices[pad];
+	unsigned long nStored = lockin->nBufferSamples < LOCKIN_SIM_BUFFER_SZ ? lockin->nBufferSamples : LOCKIN_SIM_BUFFER_SZ;
+	unsigned long oldest = lockin->nBufferSamples > LOCKIN_SIM_BUFFER_SZ ? lockin->nBufferSamples % LOCKIN_SIM_BUFFER_SZ : 0;
+	int channel, start, count;
+
+	if (sscanf(args, "%d,%d,%d", &channel, &start, &count) != 3 || channel < 1 || channel > 2 ||
+			start < 0 || count < 1 || (unsigned long)start+count > nStored)
+		return -1;
+	for (int i = 0; i < count; ++i)
+		EncodePoint(lockin->buffer[channel-1][(oldest+start+i) % LOCKIN_SIM_BUFFER_SZ], isNonNormalized, data+4*i);
+	return RespondBinary(pad, data, 4*count);
+}
+
+// Integer setting with query form, e.g. "OFLT 9" or "OFLT?"
+static int IntSetting(int pad, int *setting, int isQuery, const char *args, int min, int max)
+{
+	int value;
+
+	if (isQuery) {
+		Respond(pad, "%d", *setting);
+		return 0;
+	}
+	if (sscanf(args, "%d", &value) != 1 || value < min || value > max)
+		return -1;
+	*setting = value;
+	return 0;
+}
+
+static int Execute(int pad, char *command)
+{
+	LockinSim *lockin = &devices[pad];
+	char mnemonic[8];
+	char *args;
+	int isQuery = 0;
+	int n = 0;
+
+	while (isspace((unsigned char)*command))
+		++command;
+	if (*command == '\0')
+		return 0;
+	while ((isalpha((unsigned char)command[n]) || command[n] == '*') && n < (int)sizeof mnemonic-1) {
+		mnemonic[n] = toupper((unsigned char)command[n]);
+		++n;
+	}
+	mnemonic[n] = '\0';
+	args = command+n;
+	if (*args == '?') {
+		isQuery = 1;
+		++args;
+	}
+
+	// Changing the input or the filter takes effect from now on
+	UpdateFilter(pad);
+
+	if (strcmp(mnemonic, "ISRC") == 0)
+		return IntSetting(pad, &lockin->isrc, isQuery, args, 0, 3);
+	if (strcmp(mnemonic, "RMOD") == 0)
+		return IntSetting(pad, &lockin->rmod, isQuery, args, 0, 2);
+	if (strcmp(mnemonic, "ILIN") == 0)
+		return IntSetting(pad, &lockin->ilin, isQuery, args, 0, 3);
+	if (strcmp(mnemonic, "IGND") == 0)
+		return IntSetting(pad, &lockin->ignd, isQuery, args, 0, 1);
+	if (strcmp(mnemonic, "ICPL") == 0)
+		return IntSetting(pad, &lockin->icpl, isQuery, args, 0, 1);
+	if (strcmp(mnemonic, "SENS") == 0)
+		return IntSetting(pad, &lockin->sens, isQuery, args, 0, SENS_CODE_MAX);
+	if (strcmp(mnemonic, "OFLT") == 0)
+		return IntSetting(pad, &lockin->oflt, isQuery, args, 0, OFLT_CODE_MAX);
+	if (strcmp(mnemonic, "OFSL") == 0)
+		return IntSetting(pad, &lockin->ofsl, isQuery, args, 0, OFSL_CODE_MAX);
+	if (strcmp(mnemonic, "FMOD") == 0)
+		return IntSetting(pad, &lockin->fmod, isQuery, args, 0, 1);
+	if (strcmp(mnemonic, "RSLP") == 0)
+		return IntSetting(pad, &lockin->rslp, isQuery, args, 0, 2);
+	if (strcmp(mnemonic, "HARM") == 0)
+		return IntSetting(pad, &lockin->harm, isQuery, args, 1, 19999);
+	if (strcmp(mnemonic, "AGAN") == 0 && !isQuery) {
+		// Select the most sensitive range that keeps the magnitude on scale
+		double x, y, r;
+
+		GetOutputs(pad, &x, &y);
+		r = sqrt(x*x+y*y);
+		for (lockin->sens = 0; lockin->sens < SENS_CODE_MAX; ++lockin->sens)
+			if (Sensitivity(lockin->sens) >= 1.1*r)
+				break;
+		return 0;
+	}
+	if ((strcmp(mnemonic, "SNAP") == 0 || strcmp(mnemonic, "OUTP") == 0) && isQuery) {
+		char response[LOCKIN_SIM_QUEUE_SZ] = "";
+		double x, y;
+		int len = 0;
+		int nItems = 0;
+
+		GetOutputs(pad, &x, &y);
+		for (char *p = args; *p != '\0'; ) {
+			char *end;
+			long i = strtol(p, &end, 10);
+
+			if (end == p || i < 1 || i > 11)
+				return -1;
+			len += snprintf(response+len, sizeof response-len, "%s%.6e", nItems++ ? "," : "", Output((int)i, x, y));
+			p = end;
+			while (*p == ',' || isspace((unsigned char)*p))
+				++p;
+		}
+		if (nItems == 0 || (mnemonic[0] == 'O' && nItems != 1) || (mnemonic[0] == 'S' && (nItems < 2 || nItems > 6)))
+			return -1;
+		Respond(pad, "%s", response);
+		return 0;
+	}
+	if (strcmp(mnemonic, "SRAT") == 0)
+		return IntSetting(pad, &lockin->srat, isQuery, args, 0, SRAT_CODE_MAX);
+	if (strcmp(mnemonic, "SEND") == 0)
+		return IntSetting(pad, &lockin->send, isQuery, args, 0, 1);
+	if (strcmp(mnemonic, "TSTR") == 0)
+		return IntSetting(pad, &lockin->tstr, isQuery, args, 0, 1);
+	if (strcmp(mnemonic, "DDEF") == 0) {
+		int channel, display, ratio;
+
+		if (isQuery) {
+			if (sscanf(args, "%d", &channel) != 1 || channel < 1 || channel > 2)
+				return -1;
+			Respond(pad, "%d,%d", lockin->ddef[channel-1], lockin->ddefRatio[channel-1]);
+			return 0;
+		}
+		if (sscanf(args, "%d,%d,%d", &channel, &display, &ratio) != 3 || channel < 1 || channel > 2 ||
+				display < 0 || display > 4 || ratio < 0 || ratio > 2)
+			return -1;
+		lockin->ddef[channel-1] = display;
+		lockin->ddefRatio[channel-1] = ratio;
+		return 0;
+	}
+	if (strcmp(mnemonic, "STRT") == 0 && !isQuery) {
+		if (!lockin->isBufferRunning) {
+			lockin->isBufferRunning = 1;
+			lockin->nextSampleTime = SimTime();
+		}
+		return 0;
+	}
+	if (strcmp(mnemonic, "PAUS") == 0 && !isQuery) {
+		lockin->isBufferRunning = 0;
+		return 0;
+	}
+	if (strcmp(mnemonic, "REST") == 0 && !isQuery) {
+		lockin->isBufferRunning = 0;
+		lockin->nBufferSamples = 0;
+		return 0;
+	}
+	if (strcmp(mnemonic, "TRIG") == 0 && !isQuery) {
+		if (lockin->isBufferRunning && lockin->srat == SRAT_CODE_TRIGGER)
+			StoreSample(pad, SimTime());
+		return 0;
+	}
+	if (strcmp(mnemonic, "SPTS") == 0 && isQuery) {
+		Respond(pad, "%lu", lockin->nBufferSamples < LOCKIN_SIM_BUFFER_SZ ? lockin->nBufferSamples : LOCKIN_SIM_BUFFER_SZ);
+		return 0;
+	}
+	if (strcmp(mnemonic, "TRCB") == 0 && isQuery)
+		return Trace(pad, args, 0);
+	if (strcmp(mnemonic, "TRCL") == 0 && isQuery)
+		return Trace(pad, args, 1);
+	if (strcmp(mnemonic, "*RST") == 0) {
+		Reset(lockin);
+		return 0;
+	}
+	if (strcmp(mnemonic, "*CLS") == 0) {
+		lockin->commandErrors = 0;
+		return 0;
+	}
+	if (strcmp(mnemonic, "*IDN") == 0 && isQuery) {
+		Respond(pad, SR830_IDN);
+		return 0;
+	}
+	return -1;
+}
+
+static void ExecuteLine(int pad, const char *line, int len)
+{
+	char buf[LOCKIN_SIM_QUEUE_SZ];
+	char *command, *next;
+
+	if (len >= LOCKIN_SIM_QUEUE_SZ)
+		len = LOCKIN_SIM_QUEUE_SZ-1;
+	memcpy(buf, line, len);
+	buf[len] = '\0';
+	for (command = buf; command != NULL; command = next) {
+		next = strpbrk(command, ";\n\r");
+		if (next != NULL)
+			*next++ = '\0';
+		if (Execute(pad, command) < 0)
+			++devices[pad].commandErrors;
+	}
+}
+
+static int CheckDevice(int pad)
+{
+	return (pad < 0 || pad >= LOCKIN_SIM_DEVICES || !devices[pad].isOpen) ? -1 : 0;
+}
+
+static int CVICALLBACK ServerCallback(unsigned handle, int event, int error, void *callbackData)
+{
+	char buf[LOCKIN_SIM_QUEUE_SZ];
+	int len;
+
+	switch (event) {
+		case TCP_DATAREADY:
+			if ((len = ServerTCPRead(handle, buf, sizeof buf, 0)) <= 0)
+				break;
+			if (LockinSimWrite(serverPad, buf, len) < 0)
+				break;
+			while (devices[serverPad].queueLen > 0 &&
+					(len = LockinSimRead(serverPad, buf, sizeof buf)) > 0)
+				ServerTCPWrite(handle, buf, len, 0);
+			break;
+	}
+	return 0;
+}
+
+//==============================================================================
+// Global variables
+
+//==============================================================================
+// Global functions
+
+/// HIFN Open (power on) the emulated lock-in at a GPIB primary address
+/// HIRET The return value is 0 on success or -1 for an invalid address
+int LockinSimOpen(int pad)
+{
+	Initialize();
+	if (pad < 0 || pad >= LOCKIN_SIM_DEVICES)
+		return -1;
+	if (!devices[pad].isOpen) {
+		memset(&devices[pad], 0, sizeof devices[pad]);
+		Reset(&devices[pad]);
+		devices[pad].filterTime = SimTime();
+		devices[pad].isOpen = 1;
+	}
+	return 0;
+}
+
+int LockinSimClose(int pad)
+{
+	if (CheckDevice(pad) < 0)
+		return -1;
+	devices[pad].isOpen = 0;
+	return 0;
+}
+
+/// HIFN Send a command line to an emulated lock-in, taking the transaction
+/// HIFN latency. Responses to queries are appended to its output queue, each
+/// HIFN terminated by a newline
+/// HIRET The return value is the number of bytes accepted or -1 on failure
+int LockinSimWrite(int pad, const char *buf, int len)
+{
+	if (CheckDevice(pad) < 0)
+		return -1;
+	SimDelay(latency);
+	++transactionCount;
+	ExecuteLine(pad, buf, len);
+	return len;
+}
+
+/// HIFN Read one response from the output queue of an emulated lock-in,
+/// HIFN taking the transaction latency
+/// HIRET The return value is the number of bytes read, 0 if the queue is empty
+/// HIRET or -1 on failure
+int LockinSimRead(int pad, char *buf, int len)
+{
+	LockinSim *lockin;
+	char *eol;
+	int n;
+
+	if (CheckDevice(pad) < 0)
+		return -1;
+	SimDelay(latency);
+	++transactionCount;
+	lockin = &devices[pad];
+	n = lockin->queueLen < len ? lockin->queueLen : len;
+	if ((eol = memchr(lockin->queue, '\n', n)) != NULL)
+		n = (int)(eol-lockin->queue)+1;
+	memcpy(buf, lockin->queue, n);
+	memmove(lockin->queue, lockin->queue+n, lockin->queueLen-n+1);
+	lockin->queueLen -= n;
+	return n;
+}
+
+/// HIFN Read a binary block from the output queue of an emulated lock-in,
+/// HIFN taking the transaction latency
+/// HIRET The return value is the number of bytes read, fewer than len if the
+/// HIRET queue runs out, or -1 on failure
+int LockinSimReadBinary(int pad, char *buf, int len)
+{
+	LockinSim *lockin;
+	int n;
+
+	if (CheckDevice(pad) < 0)
+		return -1;
+	SimDelay(latency);
+	++transactionCount;
+	lockin = &devices[pad];
+	n = lockin->queueLen < len ? lockin->queueLen : len;
+	memcpy(buf, lockin->queue, n);
+	memmove(lockin->queue, lockin->queue+n, lockin->queueLen-n+1);
+	lockin->queueLen -= n;
+	return n;
+}
+
+/// HIFN Set the model of the signal at the lock-in input
+/// HIPAR function/Function returning the input phasor, NULL for the default
+/// HIPAR function/model (simulated bridge, see bridge_sim.h)
+void LockinSimSetInputFunction(LockinSimInputFunction function, void *data)
+{
+	inputFunction = function;
+	inputData = data;
+}
+
+/// HIFN Input source selected on an emulated lock-in (ISRC), for the input
+/// HIFN function
+/// HIPAR pad/GPIB address of the emulated lock-in
+/// HIRET The return value is the ISRC code, or -1 if the device is not open
+int LockinSimGetInputSource(int pad)
+{
+	return CheckDevice(pad) < 0 ? -1 : devices[pad].isrc;
+}
+
+void LockinSimSetLatency(double seconds)
+{
+	Initialize();
+	latency = seconds < 0.0 ? 0.0 : seconds;
+}
+
+double LockinSimGetLatency(void)
+{
+	Initialize();
+	return latency;
+}
+
+void LockinSimSetNoise(double density)
+{
+	Initialize();
+	noise = density < 0.0 ? 0.0 : density;
+}
+
+double LockinSimGetNoise(void)
+{
+	Initialize();
+	return noise;
+}
+
+unsigned long LockinSimGetTransactionCount(void)
+{
+	return transactionCount;
+}
+
+void LockinSimResetTransactionCount(void)
+{
+	transactionCount = 0;
+}
+
+/// HIFN Expose an emulated lock-in on a loopback TCP port
+/// HIPAR port/TCP port
+/// HIPAR pad/GPIB primary address of the emulated lock-in
+/// HIRET The return value is 0 on success or a negative TCP library error
+int LockinSimStartServer(unsigned int port, int pad)
+{
+	int ret;
+
+	if (LockinSimOpen(pad) < 0)
+		return -1;
+	if (serverPort != 0)
+		LockinSimStopServer();
+	if ((ret = RegisterTCPServer(port, ServerCallback, NULL)) < 0)
+		return ret;
+	serverPort = port;
+	serverPad = pad;
+	return 0;
+}
+
+int LockinSimStopServer(void)
+{
+	int ret = 0;
+
+	if (serverPort != 0)
+		ret = UnregisterTCPServer(serverPort);
+	serverPort = 0;
+	return ret;
+}
@@ -0,0 +1,88 @@
+//==============================================================================
+//
+// VersICaL impedance bridge client
+//
+// Copyright 2018-2019	Massimo Ortolano <massimo.ortolano@polito.it> 
+//                		Martina Marzano <m.marzano@inrim.it>
+//
+// This code is licensed under MIT license (see LICENSE.txt for details)
+//
+//==============================================================================
+
+//==============================================================================
+//
+// Simulated SR830 lock-in amplifier.
+//
+// The emulator understands the subset of the SR830 command set used by the
+// client (ISRC, RMOD, ILIN, IGND, ICPL, SENS, OFLT, OFSL, FMOD, RSLP, AGAN,
+// SNAP?, OUTP?, *RST, *CLS, *IDN?), with queries and semicolon-separated
+// command lines. The X and Y outputs follow the detector input through the
+// output low-pass filter selected with OFLT and OFSL, plus noise correlated
+// over the time constant, for successive readings as for buffer samples. With
+// DADSS_SIMULATION defined, the detector input is given by the bridge model
+// (bridge_sim.h) unless LockinSimSetInputFunction sets another one.
+//
+// The data buffers (DDEF, SRAT, SEND, TSTR, STRT, PAUS, REST, TRIG, SPTS?)
+// are filled in simulation time and read in binary with TRCB? and TRCL?.
+//
+// The client reaches the emulator through the mock transport (transport.c),
+// which is the default when the project is compiled with LOCKIN_SIMULATION
+// defined. LockinSimStartServer additionally exposes an emulated lock-in on a
+// loopback TCP port, one command line per newline-terminated message.
+//
+// The GPIB transaction latency and the noise density can be set at run time
+// or with the environment variables LOCKIN_SIM_LATENCY (seconds) and
+// LOCKIN_SIM_NOISE (V/sqrt(Hz)).
+//
+//==============================================================================
+
+#ifndef LOCKIN_SIM_H
+#define LOCKIN_SIM_H
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+//==============================================================================
+// Include files
+
+//==============================================================================
+// Constants
+
+#define LOCKIN_SIM_DEVICES 31 // GPIB primary addresses 0 to 30
+#define LOCKIN_SIM_LATENCY 0.004
+#define LOCKIN_SIM_NOISE 10.0e-9
+#define LOCKIN_SIM_QUEUE_SZ 1024
+#define LOCKIN_SIM_BUFFER_SZ 16383 // Points per data buffer
+
+//==============================================================================
+// Types
+
+// Detector input phasor (volts, peak) at a given simulation time
+typedef void (*LockinSimInputFunction)(int pad, double time, double *real, double *imag, void *data);
+
+//==============================================================================
+// Global functions
+
+int LockinSimOpen(int);
+int LockinSimClose(int);
+int LockinSimWrite(int, const char *, int);
+int LockinSimRead(int, char *, int);
+int LockinSimReadBinary(int, char *, int);
+void LockinSimSetInputFunction(LockinSimInputFunction, void *);
+int LockinSimGetInputSource(int);
+void LockinSimSetLatency(double);
+double LockinSimGetLatency(void);
+void LockinSimSetNoise(double);
+double LockinSimGetNoise(void);
+unsigned long LockinSimGetTransactionCount(void);
+void LockinSimResetTransactionCount(void);
+
+int LockinSimStartServer(unsigned int, int);
+int LockinSimStopServer(void);
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif /* LOCKIN_SIM_H */
@@ -0,0 +1,173 @@
+//==============================================================================
+//
+// VersICaL impedance bridge client
+//
+// Copyright 2018-2019	Massimo Ortolano <massimo.ortolano@polito.it> 
+//                		Martina Marzano <m.marzano@inrim.it>
+//
+// This code is licensed under MIT license (see LICENSE.txt for details)
+//
+//==============================================================================
+
+//==============================================================================
+// Include files
+
+#include <ansi_c.h>
+#include <utility.h>
+
+#include "logger.h"
+
+//==============================================================================
+// Constants
+
+//==============================================================================
+// Types
+
+typedef struct {
+	int len;
+	char data[LOGGER_RECORD_SZ];
+} LoggerRecord;
+
+//==============================================================================
+// Static global variables
+
+static struct {
+	FILE *file;
+	CmtTSQHandle queue;
+	CmtThreadFunctionID writerId;
+	volatile long isStopping;
+	volatile long nBarriers; // Threads waiting in LoggerSync
+	volatile long error; // First write error, sticky until the logger is closed
+	volatile long nQueued; // Records queued by the producers
+	volatile long nFlushed; // Records written and flushed by the writer
+} logger = {NULL, 0, 0, 0, 0, 0, 0, 0};
+
+//==============================================================================
+// Static functions
+
+// Drain the queue into the file, flushing on the size and time policy or as
+// soon as the queue is empty and a barrier is waiting
+static int CVICALLBACK LoggerWriter(void *functionData)
+{
+	static LoggerRecord batch[LOGGER_BATCH_LEN];
+	long nWritten = 0;
+	size_t nUnflushed = 0;
+	double lastFlushTime = Timer();
+	int nRecords, nPending;
+
+	while (1) {
+		nRecords = CmtReadTSQData(logger.queue, batch, LOGGER_BATCH_LEN, (int)(LOGGER_POLL_INTERVAL*1000), 0);
+		if (nRecords < 0) {
+			InterlockedCompareExchange(&logger.error, nRecords, 0);
+			nRecords = 0;
+		}
+		for (int i = 0; i < nRecords; ++i) {
+			size_t len = batch[i].len;
+
+			// After an error the records are discarded, so that producers never block
+			if (logger.error == 0 && fwrite(batch[i].data, 1, len, logger.file) != len)
+				InterlockedCompareExchange(&logger.error, -1, 0);
+			nUnflushed += len;
+		}
+		nWritten += nRecords;
+		if (CmtGetTSQAttribute(logger.queue, ATTR_TSQ_ITEMS_IN_QUEUE, &nPending) < 0)
+			nPending = 0;
+		if (nUnflushed >= LOGGER_FLUSH_SZ || Timer()-lastFlushTime >= LOGGER_FLUSH_INTERVAL ||
+				(nPending == 0 && nWritten != logger.nFlushed && (logger.nBarriers > 0 || logger.isStopping))) {
+			if (nUnflushed > 0 && logger.error == 0 && fflush(logger.file))
+				InterlockedCompareExchange(&logger.error, -1, 0);
+			nUnflushed = 0;
+			lastFlushTime = Timer();
+			InterlockedExchange(&logger.nFlushed, nWritten);
+		}
+		if (logger.isStopping && nPending == 0 && nWritten == logger.nQueued)
+			break;
+	}
+	return 0;
+}
+
+static int QueueRecord(const LoggerRecord *record)
+{
+	if (CmtWriteTSQData(logger.queue, record, 1, LOGGER_QUEUE_TIMEOUT, NULL) != 1)
+		return -1;
+	InterlockedIncrement(&logger.nQueued);
+	return 0;
+}
+
+//==============================================================================
+// Global variables
+
+//==============================================================================
+// Global functions
+
+/// HIFN Starts logging to an open file.
+/// HIPAR file/The data file, which stays owned by the caller.
+/// HIRET Returns 0 on success or a negative value on error.
+int LoggerOpen(FILE *file)
+{
+	if (file == NULL || logger.file != NULL)
+		return -1;
+	if (CmtNewTSQ(LOGGER_QUEUE_LEN, sizeof(LoggerRecord), 0, &logger.queue) < 0)
+		return -1;
+	logger.file = file;
+	logger.isStopping = 0;
+	logger.nBarriers = 0;
+	logger.error = 0;
+	logger.nQueued = 0;
+	logger.nFlushed = 0;
+	if (CmtScheduleThreadPoolFunction(DEFAULT_THREAD_POOL_HANDLE, LoggerWriter, NULL, &logger.writerId) < 0) {
+		CmtDiscardTSQ(logger.queue);
+		logger.file = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/// HIFN Queues a binary record; it does not wait for the disk.
+/// HIPAR data/The bytes to write.
+/// HIPAR len/The number of bytes, at most LOGGER_RECORD_SZ.
+/// HIRET Returns 0 on success or a negative value if the record does not fit,
+/// HIRET the queue stays full or an earlier write failed.
+int LoggerWrite(const void *data, int len)
+{
+	LoggerRecord record;
+
+	if (logger.file == NULL || logger.error != 0 || len < 0 || len > LOGGER_RECORD_SZ)
+		return -1;
+	memcpy(record.data, data, len);
+	record.len = len;
+	return QueueRecord(&record);
+}
+
+/// HIFN Waits until all the records queued so far have been written and the
+/// HIFN stdio buffer flushed; the operating system may still cache them.
+/// HIRET Returns 0 on success or a negative value on error.
+int LoggerSync(void)
+{
+	long target = logger.nQueued;
+
+	if (logger.file == NULL)
+		return -1;
+	InterlockedIncrement(&logger.nBarriers);
+	while (logger.nFlushed - target < 0 && logger.error == 0)
+		Delay(LOGGER_POLL_INTERVAL/10);
+	InterlockedDecrement(&logger.nBarriers);
+	return logger.error == 0 ? 0 : -1;
+}
+
+/// HIFN Writes out the queued records and stops the writer. The file is not closed.
+/// HIRET Returns 0 on success or a negative value if a record could not be written.
+int LoggerClose(void)
+{
+	int ret;
+
+	if (logger.file == NULL)
+		return 0;
+	ret = LoggerSync();
+	InterlockedExchange(&logger.isStopping, 1);
+	CmtWaitForThreadPoolFunctionCompletion(DEFAULT_THREAD_POOL_HANDLE, logger.writerId, 0);
+	CmtReleaseThreadPoolFunctionID(DEFAULT_THREAD_POOL_HANDLE, logger.writerId);
+	CmtDiscardTSQ(logger.queue);
+	logger.file = NULL;
+	return ret;
+}
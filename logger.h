@@ -0,0 +1,64 @@
+//==============================================================================
+//
+// VersICaL impedance bridge client
+//
+// Copyright 2018-2019	Massimo Ortolano <massimo.ortolano@polito.it> 
+//                		Martina Marzano <m.marzano@inrim.it>
+//
+// This code is licensed under MIT license (see LICENSE.txt for details)
+//
+//==============================================================================
+
+//==============================================================================
+//
+// Asynchronous data logger.
+//
+// Records are formatted on the calling thread and queued on a thread-safe
+// queue; a writer thread from the default thread pool drains the queue in
+// batches and writes them to the data file, which is flushed when enough data
+// or time has accumulated. LoggerSync is a barrier on the queue: when it
+// returns, every record queued before the call has been written and its stdio
+// buffer flushed to the operating system, which may still cache it.
+// A write error is kept by the logger and reported by the following calls.
+//
+//==============================================================================
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+//==============================================================================
+// Include files
+
+#include <stdio.h>
+
+//==============================================================================
+// Constants
+
+#define LOGGER_RECORD_SZ 1024 // Bytes per queued record
+#define LOGGER_QUEUE_LEN 512 // Records
+#define LOGGER_BATCH_LEN 64 // Records written per batch
+#define LOGGER_FLUSH_SZ 65536 // Bytes written before a flush
+#define LOGGER_FLUSH_INTERVAL 1.0 // Seconds
+#define LOGGER_POLL_INTERVAL 0.01 // Seconds
+#define LOGGER_QUEUE_TIMEOUT 1000 // Milliseconds
+
+//==============================================================================
+// Types
+
+//==============================================================================
+// Global functions
+
+int LoggerOpen(FILE *);
+int LoggerWrite(const void *, int);
+int LoggerSync(void);
+int LoggerClose(void);
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif /* LOGGER_H */
@@ -17,7 +17,6 @@
 #include <userint.h>
 #include <analysis.h>
 #include <utility.h>
-#include <gpib.h> 
 
 #include "toolbox.h" 
 
@@ -26,6 +25,10 @@
 #include "msg.h" 
 #include "cfg.h"
 #include "DA_DSS_cvi_driver.h" 
+#include "lockin_sim.h"
+#include "sim.h"
+#include "workspace.h"
+#include "instrument.h"
 
 //==============================================================================
 // Constants
@@ -36,6 +39,9 @@
 //==============================================================================
 // Static global variables
 
+static int menuBarFileCapture = 0; // Menu items created at run time
+static int menuBarSettingsJointBalance = 0;
+
 //==============================================================================
 // Static functions
 
@@ -72,6 +78,13 @@ int main (int argc, char *argv[])
 		LoadSettings(defaultSettingsFile);
 	
 	DADSS_SetNameNVServer(sourceSettings.nvServer);
+	
+#ifdef LOCKIN_SIMULATION
+	// Expose the emulated lock-in on a loopback TCP port, if requested
+	int simPort = (int)SimGetEnvDouble("LOCKIN_SIM_PORT", 0.0);
+	if (simPort > 0 && LockinSimStartServer(simPort, lockinSettings.lockins[0].transportSettings.gpibAddress) < 0)
+		warn("%s: %d", msgStrings[MSG_SIM_SERVER_ERROR], simPort);
+#endif
 
 	UIERRCHK(SetSystemAttribute(ATTR_REPORT_LOAD_FAILURE, 0)); 
 	int panel = LoadPanel(0, panelsFile, PANEL); 
@@ -83,15 +96,20 @@ int main (int argc, char *argv[])
 	UpdatePanelModes(panel);
 	UpdatePanel(panel);
 
-	// Display the panel and run the user interface
+	// Display the panel and run the user interface, the instruments being
+	// operated from their own thread
+	if (InstrumentStart() < 0)
+		die(msgStrings[MSG_INTERNAL_ERROR]);
 	UIERRCHK(DisplayPanel(panel));
 	UIERRCHK(SetSleepPolicy(VAL_SLEEP_NONE));
 	int status = RunUserInterface();
+	InstrumentStop();
 	UIERRCHK(DiscardPanel(panel));
 	
 	// Save the configuration file and exit
 	if (settingsPathFound)
 		SaveSettings(defaultSettingsFile);
+	WorkspaceDiscard();
 	CloseCVIRTE();
 	exit(status);
 }
@@ -134,12 +152,17 @@ void InitPanelAttributes(int panel)
 	UIERRCHK(InsertListItem(panel, PANEL_LOCKIN_FILTERS_TYPE, -1, "2x line", LOCKIN_FILTERS_LINE_NOTCH_IN_2X));
 	UIERRCHK(InsertListItem(panel, PANEL_LOCKIN_FILTERS_TYPE, -1, "Line", LOCKIN_FILTERS_LINE_NOTCH_IN));  
 	UIERRCHK(InsertListItem(panel, PANEL_LOCKIN_FILTERS_TYPE, -1, "No filters", LOCKIN_FILTERS_NO_OUT));  	   
+	UIERRCHK(menuBarFileCapture = NewMenuItem(GetPanelMenuBar(panel), MENUBAR_FILE, msgStrings[MSG_MENU_CAPTURE], 
+											  MENUBAR_FILE_CLOSE, 0, FileCapture, NULL));
+	UIERRCHK(menuBarSettingsJointBalance = NewMenuItem(GetPanelMenuBar(panel), MENUBAR_SETTINGS, 
+													   msgStrings[MSG_MENU_JOINT_BALANCE], MENUBAR_SETTINGS_SEPARATOR_2, 0,
+													   SettingsJointBalance, NULL));
 }
 
 void UpdatePanel(int panel)
 {		
 	UIERRCHK(SetCtrlVal(panel, PANEL_CON2_NV_SERVER, sourceSettings.nvServer));
-	UIERRCHK(SetCtrlVal(panel, PANEL_CON2_LOCKIN_GPIB_ADDRESS, lockinSettings.gpibAddress));
+	UIERRCHK(SetCtrlVal(panel, PANEL_CON2_LOCKIN_GPIB_ADDRESS, lockinSettings.lockins[0].transportSettings.gpibAddress));
 	UIERRCHK(SetCtrlVal(panel, PANEL_CLOCKFREQUENCY, sourceSettings.clockFrequency));
 	UIERRCHK(SetCtrlVal(panel, PANEL_FREQUENCY, sourceSettings.frequency));
 	UIERRCHK(SetCtrlVal(panel, PANEL_REAL_FREQUENCY, sourceSettings.realFrequency)); 
@@ -162,6 +185,7 @@ void UpdatePanel(int panel)
 			UIERRCHK(SetMenuBarAttribute(menuBar, MENUBAR_FILE, ATTR_DIMMED, 0));
 			UIERRCHK(SetMenuBarAttribute(menuBar, MENUBAR_FILE_NEW, ATTR_DIMMED, 1));
 			UIERRCHK(SetMenuBarAttribute(menuBar, MENUBAR_FILE_SAVE, ATTR_DIMMED, 1));
+			UIERRCHK(SetMenuBarAttribute(menuBar, menuBarFileCapture, ATTR_DIMMED, 1));
 			UIERRCHK(SetMenuBarAttribute(menuBar, MENUBAR_FILE_CLOSE, ATTR_DIMMED, 1));
 			UIERRCHK(SetMenuBarAttribute(menuBar, MENUBAR_SETTINGS, ATTR_DIMMED, 0));
 			UIERRCHK(SetMenuBarAttribute(menuBar, MENUBAR_SETTINGS_CONNECTION, ATTR_DIMMED, 0));
@@ -190,6 +214,7 @@ void UpdatePanel(int panel)
 			UIERRCHK(SetMenuBarAttribute(menuBar, MENUBAR_FILE, ATTR_DIMMED, 0));
 			UIERRCHK(SetMenuBarAttribute(menuBar, MENUBAR_FILE_NEW, ATTR_DIMMED, 1));
 			UIERRCHK(SetMenuBarAttribute(menuBar, MENUBAR_FILE_SAVE, ATTR_DIMMED, 1));
+			UIERRCHK(SetMenuBarAttribute(menuBar, menuBarFileCapture, ATTR_DIMMED, 1));
 			UIERRCHK(SetMenuBarAttribute(menuBar, MENUBAR_FILE_CLOSE, ATTR_DIMMED, 1));
 			UIERRCHK(SetMenuBarAttribute(menuBar, MENUBAR_SETTINGS, ATTR_DIMMED, 0));
 			UIERRCHK(SetMenuBarAttribute(menuBar, MENUBAR_SETTINGS_CONNECTION, ATTR_DIMMED, 1)); 
@@ -198,6 +223,12 @@ void UpdatePanel(int panel)
 			UIERRCHK(SetMenuBarAttribute(menuBar, MENUBAR_SETTINGS_PRESET, ATTR_DIMMED, 0));
 			UIERRCHK(SetCtrlVal(panel, PANEL_START_STOP_LED, 0));
 			break;
+		case STATE_CONFIGURING: // From a connected or a running source, whose LED is kept
+			UIERRCHK(SetPanelAttribute(panel, ATTR_DIMMED, 1));
+			UIERRCHK(SetCtrlVal(panel, PANEL_CONNECT_LED, 1));
+			UIERRCHK(SetMenuBarAttribute(menuBar, MENUBAR_FILE, ATTR_DIMMED, 1));
+			UIERRCHK(SetMenuBarAttribute(menuBar, MENUBAR_SETTINGS, ATTR_DIMMED, 1));
+			break;
 		case STATE_RUNNING_UP:
 		case STATE_RUNNING_DOWN:
 		case STATE_AUTOZEROING:
@@ -228,6 +259,7 @@ void UpdatePanel(int panel)
 				UIERRCHK(SetMenuBarAttribute(menuBar, MENUBAR_FILE_CLOSE, ATTR_DIMMED, 0));
 			}
 			UIERRCHK(SetMenuBarAttribute(menuBar, MENUBAR_FILE_SAVE, ATTR_DIMMED, 0));
+			UIERRCHK(SetMenuBarAttribute(menuBar, menuBarFileCapture, ATTR_DIMMED, 0));
 			UIERRCHK(SetMenuBarAttribute(menuBar, MENUBAR_SETTINGS, ATTR_DIMMED, 0));
 			UIERRCHK(SetMenuBarAttribute(menuBar, MENUBAR_SETTINGS_CONNECTION, ATTR_DIMMED, 1));
 			UIERRCHK(SetMenuBarAttribute(menuBar, MENUBAR_SETTINGS_LOAD, ATTR_DIMMED, 1));
@@ -237,6 +269,19 @@ void UpdatePanel(int panel)
 			break;
 	}
 	
+	// A lock-in command is queued without a busy state: nothing else may be
+	// queued on the same transport until its completion
+	if (InstrumentIsBusy()) {
+		UIERRCHK(SetCtrlAttribute(panel, PANEL_CONNECT, ATTR_DIMMED, 1));
+		UIERRCHK(SetCtrlAttribute(panel, PANEL_START_STOP, ATTR_DIMMED, 1));
+		UIERRCHK(SetCtrlAttribute(panel, PANEL_ACTIVE_MODE, ATTR_DIMMED, 1));
+		UIERRCHK(SetCtrlAttribute(panel, PANEL_CLOCKFREQUENCY, ATTR_DIMMED, 1));
+		UIERRCHK(SetCtrlAttribute(panel, PANEL_FREQUENCY, ATTR_DIMMED, 1));
+		UIERRCHK(SetMenuBarAttribute(menuBar, MENUBAR_FILE_SAVE, ATTR_DIMMED, 1));
+		UIERRCHK(SetMenuBarAttribute(menuBar, menuBarFileCapture, ATTR_DIMMED, 1));
+		UIERRCHK(SetMenuBarAttribute(menuBar, MENUBAR_SETTINGS_PRESET, ATTR_DIMMED, 1));
+	}
+	
 	UIERRCHK(ProcessDrawEvents());
 	
 	UpdatePanelActiveChannel(panel);
@@ -263,6 +308,8 @@ void UpdatePanelActiveChannel(int panel)
 	
 	UIERRCHK(SetCtrlVal(panel, PANEL_BALANCE_THRESHOLD, 
 						modeSettings[0].channelSettings[sourceSettings.activeChannel].balanceThreshold));
+	UIERRCHK(SetMenuBarAttribute(GetPanelMenuBar(panel), menuBarSettingsJointBalance, ATTR_CHECKED,
+								 modeSettings[0].channelSettings[sourceSettings.activeChannel].isJointBalanced));
 	
 	if (programState == STATE_IDLE) {
 		UIERRCHK(SetCtrlAttribute(panel, PANEL_ACTIVE_CHANNEL, ATTR_DIMMED, 1));
@@ -333,7 +380,8 @@ void UpdatePanelActiveChannel(int panel)
 	} else if (programState == STATE_CONNECTING || 
 		 programState == STATE_RUNNING_UP || 
 		 programState == STATE_RUNNING_DOWN || 
-		 programState == STATE_SWITCHING_MODE) {
+		 programState == STATE_SWITCHING_MODE ||
+		 programState == STATE_CONFIGURING) {
 		UIERRCHK(SetCtrlVal(panel, PANEL_AUTOZERO_LED, 0));
 		UIERRCHK(SetCtrlVal(panel, PANEL_OUT_OF_RANGE_LED, 0));
 	} else if (programState == STATE_RUNNING) {
@@ -383,6 +431,14 @@ void UpdatePanelActiveChannel(int panel)
 	} else
 		die(msgStrings[MSG_INTERNAL_ERROR]);
 	
+	if (InstrumentIsBusy()) {
+		UIERRCHK(SetCtrlAttribute(panel, PANEL_ACTIVE_CHANNEL, ATTR_DIMMED, 1));
+		UIERRCHK(SetCtrlAttribute(panel, PANEL_SWAP_ACTIVE_CHANNEL, ATTR_DIMMED, 1));
+		UIERRCHK(SetCtrlAttribute(panel, PANEL_RANGE, ATTR_DIMMED, 1));
+		UIERRCHK(SetCtrlAttribute(panel, PANEL_LOCKIN_READ, ATTR_DIMMED, 1));
+		UIERRCHK(SetCtrlAttribute(panel, PANEL_AUTOZERO, ATTR_DIMMED, 1));
+	}
+	
 	UIERRCHK(ProcessDrawEvents());  
 			
 	UpdatePanelLockinInputSettings(panel);
@@ -425,7 +481,8 @@ void UpdatePanelLockinInputSettings(int panel)
 	
 	if (programState == STATE_IDLE || modeSettings[0].channelSettings[sourceSettings.activeChannel].isLocked || 
 		programState == STATE_CONNECTING || programState == STATE_RUNNING_UP || programState == STATE_RUNNING_DOWN ||
-	    programState == STATE_AUTOZEROING || programState == STATE_SWITCHING_MODE) {
+	    programState == STATE_AUTOZEROING || programState == STATE_SWITCHING_MODE || programState == STATE_CONFIGURING ||
+		InstrumentIsBusy()) {
 		UIERRCHK(SetCtrlAttribute(panel, PANEL_LOCKIN_GAIN_TYPE, ATTR_DIMMED, 1));
 		UIERRCHK(SetCtrlAttribute(panel, PANEL_LOCKIN_INPUT_TYPE, ATTR_DIMMED, 1)); 
 		UIERRCHK(SetCtrlAttribute(panel, PANEL_LOCKIN_RESERVE_TYPE, ATTR_DIMMED, 1)); 
@@ -22,6 +22,8 @@
 #include <stdio.h>
 
 #include "DADSS_utility.h"
+#include "transport.h"
+#include "instrument.h"
 
 		
 //==============================================================================
@@ -35,6 +37,9 @@
 #define CLIPBOARD_BUF_SZ 393216
 #define GPIB_BUF_SZ 1024
 #define GPIB_READ_LEN 50
+#define LOCKIN_BUFFER_POINTS_MAX 16383
+#define LOCKIN_BUFFER_RATE_MAX 13 // 512 Hz; 14 selects the external trigger
+#define MAX_LOCKINS 4
 #define LABEL_SZ 32
 		
 #define STARTSTOP_STEPS 25
@@ -43,6 +48,25 @@
 #define MAX_AUTOZERO_STEPS 25
 #define AUTOZERO_ADJ_DELAY_BASE 1.0 
 #define AUTOZERO_ADJ_DELAY_FACTOR 10.0
+#define AUTOZERO_SETTLE_POLL_FRACTION 0.5	// Lock-in polling interval, in time constants
+#define AUTOZERO_SETTLE_MIN_TCS 1.0		// No settle decision before
+#define AUTOZERO_SETTLE_NOISE_TCS 5.0		// Noise-limited readings are accepted after
+#define AUTOZERO_SETTLE_TOLERANCE 0.1		// Fraction of the balance threshold
+#define AUTOZERO_SETTLE_MOVE_FRACTION 0.1	// Of the expected change, to detect the response
+#define AUTOZERO_SETTLE_NOISE_SIGMAS 4.0	// Idem, in rms noise of the readings
+#define AUTOZERO_SETTLE_MOVE_READINGS 2		// Consecutive readings beyond the threshold
+#define AUTOZERO_SETTLE_NOISE_READINGS 5	// Taken to measure the noise
+#define AUTOZERO_PREDICT_TCS 2.5			// Readings needed after the step, in time constants
+#define AUTOZERO_PREDICT_MIN_READINGS 3		// Idem, after the response was detected
+#define AUTOZERO_PREDICT_RESIDUAL_SIGMAS 2.0	// Rms fit residual accepted, in rms noise
+#define AUTOZERO_PREDICT_MIN_RESPONSE 10.0	// Predictions used above, in balance thresholds
+#define AUTOZERO_RLS_FORGETTING 0.8			// Weight of a point per later point
+#define AUTOZERO_RLS_MAX_UNCERTAINTY 0.2	// Of the sensitivity, for full steps
+#define AUTOZERO_JOINT_REGULARIZATION 1.0e-9	// Of the mean sensitivity, for rank-deficient balances
+#define AUTOZERO_BROYDEN_MIN_CHANGE 10.0	// Expected change updating the sensitivities, in rms noise
+#define AUTOZERO_CACHE_UNCERTAINTY 0.05		// Relative, of a sensitivity cached by an earlier balance
+#define AUTOZERO_CACHE_FREQUENCY_TOLERANCE 1.0e-6	// Relative, for a cached sensitivity to apply
+#define AUTOZERO_CANCEL_INTERVAL 0.1			// Longest wait between checks for a cancel, in seconds
 		
 #define MAX_MODES 21
 
@@ -57,7 +81,8 @@ typedef enum {
 	STATE_RUNNING,
 	STATE_RUNNING_DOWN,
 	STATE_AUTOZEROING,
-	STATE_SWITCHING_MODE
+	STATE_SWITCHING_MODE,
+	STATE_CONFIGURING // Source settings being changed or waveforms fetched
 } ProgramState;
 
 typedef enum {
@@ -96,6 +121,11 @@ typedef enum {
 	LOCKIN_FILTERS_LINE_NOTCH_IN_BOTH
 } LockinFiltersType;
 
+typedef enum {
+	LOCKIN_BUFFER_IEEE, 		// TRCB?, IEEE floats
+	LOCKIN_BUFFER_NON_NORMALIZED	// TRCL?, 16-bit mantissa and exponent
+} LockinBufferFormat;
+
 typedef enum {
 	RESISTANCE,
 	CAPACITANCE,
@@ -113,11 +143,17 @@ typedef enum {
 } MainChannelType;
 	
 
+typedef enum {
+	DATA_FILE_TEXT,
+	DATA_FILE_BINARY
+} DataFileFormat;
+
 typedef struct {
 	unsigned int nvServer;
 	double clockFrequency;
 	double frequency;
 	double realFrequency;
+	int nSamples; // Per waveform, read from the source with the real frequency
 	DADSS_RangeList range[DADSS_CHANNELS];
 	int nModes;
 	int activeMode;
@@ -125,12 +161,21 @@ typedef struct {
 	char label[DADSS_CHANNELS][LABEL_SZ]; 
 	char dataPathName[MAX_PATHNAME_LEN];
 	FILE *dataFileHandle;
+	DataFileFormat dataFileFormat;
 } SourceSettings;
 
 typedef struct {
-	int gpibAddress;
+	TransportSettings transportSettings;
 	char initString[GPIB_BUF_SZ];
-	int lockinDesc;
+	Transport transport;
+} LockinDevice;
+
+typedef struct {
+	int nLockins;
+	LockinDevice lockins[MAX_LOCKINS];	// The first one is the main detector
+	int bufferPoints;	// Points averaged from the data buffer, 0 for SNAP? readings
+	int bufferRateCode;	// SRAT code
+	LockinBufferFormat bufferFormat;
 } LockinSettings;
 
 typedef struct {
@@ -144,22 +189,38 @@ typedef struct {
 typedef struct {
 	double real;
 	double imag;
+	int nPoints;	// Samples averaged
 	int timeConstantCode;
 	double timeConstant;
+	int filterPoles;	// Order of the output filter, from its slope
 	double adjDelay;
 } LockinReading;
 
+typedef struct {
+	int isValid;
+	double real;	// Response per volt of stimulus
+	double imag;
+	double frequency;	// Source settings of the balance that gave it
+	DADSS_RangeList range;
+	unsigned int mdac2Code;
+	double noise;			// Rms noise of the lock-in readings, 0 if unknown
+	double timeConstant;	// Of the lock-in output filter when the noise was read
+} SensitivityCache;
+
 typedef struct {
 	int isLocked;
+	int isJointBalanced;	// Nulled together with the active channel by AutoZero
 	double amplitude;
 	double phase;
 	double real;
 	double imag;
 	unsigned int mdac2Code;
 	double mdac2Val;
+	int lockin;		// Detecting the null of the channel, index in lockinSettings.lockins
 	LockinInputSettings lockinInputSettings;
 	LockinGainType lockinGainType;
 	double balanceThreshold;
+	SensitivityCache sensitivityCache;	// Of the last AutoZero of the channel
 } ChannelSettings;
 
 typedef struct {
@@ -191,6 +252,12 @@ void UpdatePanelLockinReading(int, LockinReading);
 void UpdatePanelLockinInputSettings(int);
 void UpdatePanelTitle(int);
 
+void RunCommand(int, ProgramState, InstrumentFunction, InstrumentCompletion);
+void RestoreProgramState(int, void *);
+
+void CVICALLBACK FileCapture(int, int, void *, int);
+void CVICALLBACK SettingsJointBalance(int, int, void *, int);
+
 #ifdef __cplusplus
 	}
 #endif
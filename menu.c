@@ -24,6 +24,10 @@
 #include "main.h"
 #include "cfg.h"
 #include "msg.h"
+#include "workspace.h"
+#include "logger.h"
+#include "datafile.h"
+#include "capture.h"
 
 //==============================================================================
 // Constants
@@ -31,12 +35,133 @@
 //==============================================================================
 // Types
 
+typedef struct {
+	int nSamples;
+	int *samples; // Waveform workspace buffer
+	double real;
+	double imag;
+	int ret;
+	int isScheduled;
+	CmtThreadFunctionID functionId;
+} ChannelAnalysis;
+
 //==============================================================================
 // Static global variables
 
+static ChannelAnalysis channelAnalysis[DADSS_CHANNELS];
+
+// Record being saved, whose waveforms are fetched by the instrument thread
+static struct {
+	int menuBar;
+	int menuItem;
+	int panel;
+	int nSamples;
+	DataFileRecord record;
+} save;
+
+static char capturePathName[MAX_PATHNAME_LEN];
+
 //==============================================================================
 // Static functions
 
+static int CVICALLBACK AnalyzeChannel(void *functionData)
+{
+	ChannelAnalysis *analysis = functionData;
+
+	analysis->ret = DADSS_GetWaveformPhasor(analysis->samples, analysis->nSamples, &analysis->real, &analysis->imag);
+	return 0;
+}
+
+// Wait for the analyses scheduled on the thread pool
+static void WaitChannelAnalyses(void)
+{
+	for (int i = 0; i < DADSS_CHANNELS; ++i) {
+		if (channelAnalysis[i].isScheduled) {
+			CmtWaitForThreadPoolFunctionCompletion(DEFAULT_THREAD_POOL_HANDLE, channelAnalysis[i].functionId, 0);
+			CmtReleaseThreadPoolFunctionID(DEFAULT_THREAD_POOL_HANDLE, channelAnalysis[i].functionId);
+			channelAnalysis[i].isScheduled = 0;
+		}
+	}
+}
+
+// Fetch the waveforms of all the channels into the workspace
+static int FetchWaveforms(void *data)
+{
+	WaveformWorkspace *workspace = WorkspaceCreate();
+
+	DSSERRCHK(DADSS_GetNumberSamples(&save.nSamples));
+	for (int i = 0; i < DADSS_CHANNELS; ++i)
+		DSSERRCHK(DADSS_GetWaveform(i+1, workspace->samples[i], save.nSamples));
+	return 0;
+
+Error:
+	return -1;
+}
+
+// Analyse the fetched waveforms and queue the record to the logger. The
+// analyses run concurrently on the thread pool only if the phasor tables are
+// ready
+static void SaveWaveforms(int status, void *data)
+{
+	int isConcurrent, len;
+	double dacScale;
+	WaveformWorkspace *workspace = WorkspaceCreate();
+	unsigned char buf[DATAFILE_TEXT_RECORD_SZ];
+
+	RestoreProgramState(status, data);
+	if (status < 0)
+		goto Error;
+
+	isConcurrent = DADSS_PreparePhasorTables(save.nSamples) == 0;
+	for (int i = 0; i < DADSS_CHANNELS; ++i) {
+		channelAnalysis[i].nSamples = save.nSamples;
+		channelAnalysis[i].samples = workspace->samples[i];
+		if (isConcurrent && CmtScheduleThreadPoolFunction(DEFAULT_THREAD_POOL_HANDLE, AnalyzeChannel,
+				&channelAnalysis[i], &channelAnalysis[i].functionId) >= 0)
+			channelAnalysis[i].isScheduled = 1;
+		else
+			AnalyzeChannel(&channelAnalysis[i]);
+	}
+	WaitChannelAnalyses();
+
+	for (int i = 0; i < DADSS_CHANNELS; ++i) {
+		DSSERRCHK(channelAnalysis[i].ret);
+		dacScale = (modeSettings[0].channelSettings[i].mdac2Val) * \ 
+				   (DADSS_RangeMultipliers[sourceSettings.range[i]]/DADSS_MDAC1_CODE_RANGE) * \
+				   DADSS_REFERENCE_VOLTAGE;
+		save.record.real[i] = channelAnalysis[i].real*dacScale;
+		save.record.imag[i] = channelAnalysis[i].imag*dacScale;
+		save.record.balanceThreshold[i] = modeSettings[0].channelSettings[i].balanceThreshold;
+	}
+
+	// The record is queued to the logger, which writes it in the background
+	if (sourceSettings.dataFileFormat == DATA_FILE_BINARY)
+		len = DataFileEncodeRecord(&save.record, buf);
+	else
+		len = DataFileFormatTextRecord((char *)buf, sizeof buf, &save.record);
+	if (len < 0 || LoggerWrite(buf, len) < 0) {
+		warn("%s %s.", msgStrings[MSG_SAVING_ERROR], sourceSettings.dataPathName);
+		goto Error;
+	}
+	return;
+
+Error: 
+	WaitChannelAnalyses();
+	FileClose(save.menuBar, save.menuItem, NULL, save.panel);
+}
+
+static int FetchCapture(void *data)
+{
+	return CaptureWaveforms(capturePathName);
+}
+
+static void WriteCaptureDone(int status, void *data)
+{
+	RestoreProgramState(status, data);
+	if (status == 0)
+		CaptureWrite();
+}
+
 //==============================================================================
 // Global variables
 
@@ -46,6 +171,9 @@
 void CVICALLBACK FileNew (int menuBar, int menuItem, void *callbackData,
 						  int panel)
 {
+	DataFileHeader header;
+	char buf[DATAFILE_TEXT_RECORD_SZ];
+	int len;
 	int ret = FileSelectPopup("", 
 							  "",
 							  "*.*",
@@ -61,27 +189,36 @@ void CVICALLBACK FileNew (int menuBar, int menuItem, void *callbackData,
 			break;
 		case VAL_EXISTING_FILE_SELECTED:
 		case VAL_NEW_FILE_SELECTED:
-			sourceSettings.dataFileHandle = fopen(sourceSettings.dataPathName, "w");
+			// Files with the DATAFILE_EXTENSION extension are written in binary
+			sourceSettings.dataFileFormat = DataFileGetFormat(sourceSettings.dataPathName);
+			sourceSettings.dataFileHandle = fopen(sourceSettings.dataPathName, 
+												  sourceSettings.dataFileFormat == DATA_FILE_BINARY ? "wb" : "w");
     		if(sourceSettings.dataFileHandle == NULL) {
         		warn("%s %s.", msgStrings[MSG_SAVING_ERROR], sourceSettings.dataPathName);
 				strcpy(sourceSettings.dataPathName, "");
 				UpdatePanel(panel);
         		return;
     		}
-			if (fprintf(sourceSettings.dataFileHandle,"Timestamp\tMode\tFrequency\tActive") < 0 || fflush(sourceSettings.dataFileHandle)) {
-				warn("%s %s.", msgStrings[MSG_SAVING_ERROR], sourceSettings.dataPathName);
-				goto Error;	
-			}
-			for (int i = 0; i < DADSS_CHANNELS; ++i) {
-				if (fprintf(sourceSettings.dataFileHandle, "\tRe(%s)\tIm(%s)\tThreshold(%s)",\
-							sourceSettings.label[i], sourceSettings.label[i], sourceSettings.label[i]) < 0) {
+			// The tab-separated header only names the channels
+			memcpy(header.label, sourceSettings.label, sizeof header.label);
+			if (sourceSettings.dataFileFormat == DATA_FILE_BINARY) {
+				header.nSamples = sourceSettings.nSamples;
+				header.clockFrequency = sourceSettings.clockFrequency;
+				header.bridgeSettings = bridgeSettings;
+				if (DataFileWriteHeader(sourceSettings.dataFileHandle, &header) < 0) {
 					warn("%s %s.", msgStrings[MSG_SAVING_ERROR], sourceSettings.dataPathName);
 					goto Error;
-    			}
+				}
 			}
-			if (fflush(sourceSettings.dataFileHandle)) {
+			if (LoggerOpen(sourceSettings.dataFileHandle) < 0) {
 				warn("%s %s.", msgStrings[MSG_SAVING_ERROR], sourceSettings.dataPathName);
-				goto Error;	
+				goto Error;
+			}
+			if (sourceSettings.dataFileFormat == DATA_FILE_TEXT) {
+				if ((len = DataFileFormatTextHeader(buf, sizeof buf, &header)) < 0 || LoggerWrite(buf, len) < 0) {
+					warn("%s %s.", msgStrings[MSG_SAVING_ERROR], sourceSettings.dataPathName);
+					goto Error;	
+				}
 			}
 			UpdatePanel(panel);
 			break;		
@@ -98,48 +235,51 @@ Error:
 void CVICALLBACK FileSave (int menuBar, int menuItem, void *callbackData,
 						   int panel)
 {
-	int nSamples;
-	int samples[DADSS_SAMPLES_MAX] = {0};
-	double xReal[DADSS_SAMPLES_MAX] = {0.0};
-	double xImag[DADSS_SAMPLES_MAX] = {0.0};
-	double dacScale;
-	double timeStamp;
-	char timeStampBuf[16]; // YYYYMMDDTHHMMSS
-
 	if (sourceSettings.dataFileHandle == NULL) 
 		FileNew(menuBar, menuItem, callbackData, panel);
 	if (sourceSettings.dataFileHandle == NULL)
 		return;
 	
-	GetCurrentDateTime(&timeStamp);
-	FormatDateTimeString(timeStamp, "%Y%m%dT%H%M%S", timeStampBuf, sizeof timeStampBuf);
-	if (fprintf(sourceSettings.dataFileHandle,"\n%s\t%s\t%.11g\t%d", timeStampBuf, modeSettings[0].label, sourceSettings.realFrequency, sourceSettings.activeChannel+1) < 0) {
-		warn("%s %s.", msgStrings[MSG_SAVING_ERROR], sourceSettings.dataPathName);
-		goto Error;
-	}
+	GetCurrentDateTime(&save.record.timeStamp);
+	strcpy(save.record.mode, modeSettings[0].label);
+	save.record.frequency = sourceSettings.realFrequency;
+	save.record.activeChannel = sourceSettings.activeChannel+1;
 
-	DSSERRCHK(DADSS_GetNumberSamples(&nSamples));
-	for (int i = 0; i < DADSS_CHANNELS; ++i) {
-		DSSERRCHK(DADSS_GetWaveform(i+1,samples,nSamples));
-		for (int j = 0; j < DADSS_SAMPLES_MAX; ++j)
-			xReal[j] = samples[j];
-		ALERRCHK(FFT(xReal, xImag, nSamples)); 
-		dacScale = (modeSettings[0].channelSettings[i].mdac2Val) * \ 
-				   (DADSS_RangeMultipliers[sourceSettings.range[i]]/DADSS_MDAC1_CODE_RANGE) * \
-				   DADSS_REFERENCE_VOLTAGE/nSamples;
-		if (fprintf(sourceSettings.dataFileHandle,"\t% 16.10e\t% 16.10e\t% 16.10e",
-					(xImag[nSamples-1]-xImag[1])*dacScale,
-					(xReal[1]+xReal[nSamples-1])*dacScale,
-					modeSettings[0].channelSettings[i].balanceThreshold) < 0 || fflush(sourceSettings.dataFileHandle)) {
-			warn("%s %s.", msgStrings[MSG_SAVING_ERROR], sourceSettings.dataPathName);
-			goto Error;
-		}
+	save.menuBar = menuBar;
+	save.menuItem = menuItem;
+	save.panel = panel;
+	if (WorkspaceCreate() == NULL) {
+		warn("%s %s.\n%s.", msgStrings[MSG_SAVING_ERROR], sourceSettings.dataPathName, msgStrings[MSG_OUT_OF_MEMORY]);
+		FileClose(menuBar, menuItem, callbackData, panel);
+		return;
 	}
-	return;
+	RunCommand(panel, STATE_CONFIGURING, FetchWaveforms, SaveWaveforms);
+}
 
-Error: 
-	FileClose(menuBar, menuItem, callbackData, panel);
-	return;
+
+void CVICALLBACK FileCapture (int menuBar, int menuItem, void *callbackData,
+							  int panel)
+{
+	int ret = FileSelectPopup("", 
+							  "*" DATAFILE_WAVEFORM_EXTENSION,
+							  "*" DATAFILE_WAVEFORM_EXTENSION ";*.*",
+							  msgStrings[MSG_POPUP_CAPTURE_FILE_TITLE],
+							  VAL_SAVE_BUTTON,
+							  0,
+							  0,
+							  1,
+							  1,
+							  capturePathName);
+	switch (ret) {
+		case VAL_NO_FILE_SELECTED:
+			break;
+		case VAL_EXISTING_FILE_SELECTED: // The capture is appended
+		case VAL_NEW_FILE_SELECTED:
+			RunCommand(panel, STATE_CONFIGURING, FetchCapture, WriteCaptureDone);
+			break;
+		default:
+			die(GetUILErrorString(ret));
+	}
 }
 
 
@@ -147,7 +287,10 @@ void CVICALLBACK FileClose (int menuBar, int menuItem, void *callbackData,
 							int panel)
 {
 	if (sourceSettings.dataFileHandle != NULL) {
-		fclose(sourceSettings.dataFileHandle);
+		// Write out the queued records before closing the file
+		int ret = LoggerClose();
+		if (fclose(sourceSettings.dataFileHandle) != 0 || ret < 0)
+			warn("%s %s.", msgStrings[MSG_SAVING_ERROR], sourceSettings.dataPathName);
 		sourceSettings.dataFileHandle = NULL;
 		strcpy(sourceSettings.dataPathName, "");
 		UpdatePanel(panel);
@@ -172,7 +315,7 @@ void CVICALLBACK SettingsMenu (int menuBar, int menuItem, void *callbackData,
 		case MENUBAR_SETTINGS_CONNECTION:
 			UIERRCHK(settingsPanel = LoadPanel(0, panelsFile, PANEL_CON2));
 			UIERRCHK(SetCtrlVal(settingsPanel, PANEL_CON2_NV_SERVER, sourceSettings.nvServer));
-			UIERRCHK(SetCtrlVal(settingsPanel, PANEL_CON2_LOCKIN_GPIB_ADDRESS, lockinSettings.gpibAddress));
+			UIERRCHK(SetCtrlVal(settingsPanel, PANEL_CON2_LOCKIN_GPIB_ADDRESS, lockinSettings.lockins[0].transportSettings.gpibAddress));
 			UIERRCHK(InstallPopup(settingsPanel));
 			return;	
 		case MENUBAR_SETTINGS_MODES:
@@ -276,3 +419,12 @@ void CVICALLBACK SettingsMenu (int menuBar, int menuItem, void *callbackData,
 			break;
 	}
 }
+
+void CVICALLBACK SettingsJointBalance (int menuBar, int menuItem, void *callbackData,
+									   int panel)
+{
+	ChannelSettings *channelSettings = &modeSettings[0].channelSettings[sourceSettings.activeChannel];
+
+	channelSettings->isJointBalanced = !channelSettings->isJointBalanced;
+	UIERRCHK(SetMenuBarAttribute(menuBar, menuItem, ATTR_CHECKED, channelSettings->isJointBalanced));
+}
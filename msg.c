@@ -14,6 +14,7 @@
 
 #include <ansi_c.h>
 #include <userint.h> 
+#include <utility.h>
 
 #include "msg.h"
 
@@ -29,6 +30,12 @@
 //==============================================================================
 // Static functions
 
+static void CVICALLBACK ShowWarning(void *callbackData)
+{
+	MessagePopup("Warning", callbackData);
+	free(callbackData);
+}
+
 //==============================================================================
 // Global variables
 
@@ -54,7 +61,7 @@ const char *msgStrings[] = {
 	[MSG_DEVICE_CLOSE_ERROR] = "Error closing",
 	[MSG_DEVICE_INIT_ERROR] = "Error initializing",
 	[MSG_DSS_ERROR] = "DSS error",
-	[MSG_GPIB_ERROR] = "GPIB error",
+	[MSG_TRANSPORT_ERROR] = "Lock-in communication error",
 	[MSG_ANALYSIS_ERROR] = "Analysis library error",
 	[MSG_UNLOCK_CHANNEL] = "Unlock?",
 	[MSG_CONNECTING_TITLE] = "Connecting...",
@@ -65,8 +72,19 @@ const char *msgStrings[] = {
 	[MSG_CANNOT_REMOVE_ACTIVE_MODE] = "Cannot remove active mode",
 	[MSG_POPUP_NEW_FILE_TITLE] = "New",
 	[MSG_POPUP_SAVEAS_FILE_TITLE] = "Save As",
+	[MSG_POPUP_CAPTURE_FILE_TITLE] = "Capture waveforms",
+	[MSG_MENU_CAPTURE] = "Capture waveforms...",
+	[MSG_MENU_JOINT_BALANCE] = "Joint AutoZero of the active channel",
 	[MSG_EQUAL_CHANNELS] = "Channel numbers cannot be equal",
 	[MSG_PRESET_OVERRANGE] = "Voltage values over supported ranges",
+	[MSG_SIM_SERVER_ERROR] = "Cannot start the simulated lock-in server on port",
+	[MSG_AUTOZERO_TITLE] = "AutoZero",
+	[MSG_AUTOZERO_CANCELLING_TITLE] = "Cancelling AutoZero...",
+	[MSG_AUTOZERO_RESPONSE] = "Response magnitude (V)",
+	[MSG_AUTOZERO_STIMULUS] = "Stimulus of the active channel (V)",
+	[MSG_AUTOZERO_CANCEL] = "Cancel",
+	[MSG_REAL_PART] = "Real",
+	[MSG_IMAG_PART] = "Imaginary",
 };
 
 //==============================================================================
@@ -95,7 +113,16 @@ void warn(const char *fmt, ...)
 	va_start(ap, fmt);
 	
 	vsnprintf(buf, MSG_BUF_SZ, fmt, ap);
-	MessagePopup("Warning", buf);
 	
 	va_end(ap);
+	
+	// Popups are shown from the user interface thread
+	if (CmtGetCurrentThreadID() != CmtGetMainThreadID()) {
+		char *msg = malloc(strlen(buf)+1);
+		
+		if (msg != NULL && PostDeferredCall(ShowWarning, strcpy(msg, buf)) >= 0)
+			return;
+		free(msg);
+	}
+	MessagePopup("Warning", buf);
 }
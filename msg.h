@@ -39,10 +39,9 @@
 	}\
 }
 
-#define GPIBERRCHK(fCall) {\
-	(fCall); \
-	if (ibsta & ERR) {\
-		warn("%s: %d", msgStrings[MSG_GPIB_ERROR], iberr);\
+#define TRANSPORTERRCHK(transport, fCall) {\
+	if ((fCall) < 0) {\
+		warn("%s: %s", msgStrings[MSG_TRANSPORT_ERROR], TransportGetErrorString(transport));\
 		goto Error;\
 	}\
 }
@@ -80,7 +79,7 @@ enum MESSAGES {
 	MSG_DEVICE_CLOSE_ERROR,
 	MSG_DEVICE_INIT_ERROR,
 	MSG_DSS_ERROR,
-	MSG_GPIB_ERROR,
+	MSG_TRANSPORT_ERROR,
 	MSG_ANALYSIS_ERROR,
 	MSG_UNLOCK_CHANNEL,
 	MSG_CONNECTING_TITLE,
@@ -91,8 +90,19 @@ enum MESSAGES {
 	MSG_CANNOT_REMOVE_ACTIVE_MODE,
 	MSG_POPUP_NEW_FILE_TITLE,
 	MSG_POPUP_SAVEAS_FILE_TITLE,
+	MSG_POPUP_CAPTURE_FILE_TITLE,
+	MSG_MENU_CAPTURE,
+	MSG_MENU_JOINT_BALANCE,
 	MSG_EQUAL_CHANNELS,
 	MSG_PRESET_OVERRANGE,
+	MSG_SIM_SERVER_ERROR,
+	MSG_AUTOZERO_TITLE,
+	MSG_AUTOZERO_CANCELLING_TITLE,
+	MSG_AUTOZERO_RESPONSE,
+	MSG_AUTOZERO_STIMULUS,
+	MSG_AUTOZERO_CANCEL,
+	MSG_REAL_PART,
+	MSG_IMAG_PART,
 };
 
 //==============================================================================
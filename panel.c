@@ -17,7 +17,6 @@
 #include <userint.h>
 #include <analysis.h>
 #include <utility.h>
-#include <gpib.h>
 
 #include "toolbox.h" 
 #include "progressbar.h"
@@ -27,325 +26,692 @@
 #include "msg.h" 
 #include "cfg.h"
 #include "lockin.h"
+#include "balance.h"
 #include "DA_DSS_cvi_driver.h"
 #include "DADSS_utility.h"
+#include "workspace.h"
+#include "capture.h"
+#include "instrument.h"
 
 //==============================================================================
 // Constants
 
+// AutoZero progress panel, built at run time
+#define AUTOZERO_PANEL_MARGIN 25
+#define AUTOZERO_CHART_WIDTH 400
+#define AUTOZERO_CHART_HEIGHT 150
+#define AUTOZERO_CHART_POINTS 100 // Lock-in readings shown
+
 //==============================================================================
 // Types
 
+// Lock-in reading of a balance, with the stimulus of its first channel
+typedef struct {
+	LockinReading lockinReading;
+	double stimulusReal;
+	double stimulusImag;
+} BalanceStep;
+
 //==============================================================================
 // Static global variables
 
+// Command running on the instrument thread, one at a time as the panel, or
+// the controls queuing commands, are dimmed until its completion
+static struct {
+	int panel;
+	int pbPanel; // Progress bar of the connection, of the start or of the stop
+	ProgramState savedProgramState; // Restored by RestoreProgramState
+	int isClockChanged;
+	int isMdac2Changed; // Otherwise the waveform of the active channel
+	int swapChannel; // Swapped with the active channel
+	int copyControl; // Copy of the samples or of their phasor
+	int nSamples;
+	LockinReading lockinReading;
+	int isStarting;
+	volatile int isInterrupted; // Set by the interrupt button of the start or stop
+	int isStopped; // Source stopped, not interrupted
+	int isQuitting; // Quit once the source is stopped
+	double progress; // Percentage of the start or stop
+	int channels[DADSS_CHANNELS]; // Nulled by AutoZero
+	int nChannels;
+	BalanceResult balanceResult;
+	int autoZeroPanel; // Progress of AutoZero
+	int responseChart;
+	int stimulusChart;
+} command;
+
 //==============================================================================
 // Static functions
 
-//==============================================================================
-// Global variables
+// Queue a lock-in command without leaving the program state: UpdatePanel keeps
+// the controls queuing commands dimmed while the instrument thread is busy
+static void RunLockinCommand(int panel, InstrumentFunction function, InstrumentCompletion completion)
+{
+	command.panel = panel;
+	if (InstrumentSubmit(function, completion, NULL) < 0)
+		completion(-1, NULL);
+	else
+		UpdatePanel(panel);
+}
 
-//==============================================================================
-// Global functions
+static void RefreshPanel(int status, void *data)
+{
+	UpdatePanel(command.panel);
+}
 
-int CVICALLBACK AutoZero (int panel, int control, int event,
-		void *callbackData, int eventData1, int eventData2)
+static void CVICALLBACK ShowBalanceStep(void *callbackData)
 {
-	double maxAmplitude, amplitude, phase;
-	LockinReading lockinReading;
-	char buf[GPIB_BUF_SZ];
-	struct {
-		double real;
-		double imag;
-	} stimulus[MAX_AUTOZERO_STEPS] = {{0}}, response[MAX_AUTOZERO_STEPS] = {{0}},
-	deltaStimulus[MAX_AUTOZERO_STEPS-2] = {{0}}, deltaResponse[MAX_AUTOZERO_STEPS-2] = {{0}},
-	sensitivity[MAX_AUTOZERO_STEPS-2] = {{0}}, stimulusCorrection[MAX_AUTOZERO_STEPS-2]= {{0}};
+	BalanceStep *step = callbackData;
+	double magnitude = sqrt(step->lockinReading.real*step->lockinReading.real +
+							step->lockinReading.imag*step->lockinReading.imag);
+	double stimulus[] = {step->stimulusReal, step->stimulusImag};
 
-	switch (event)
-	{
+	UpdatePanelWaveformParameters(command.panel);
+	UpdatePanelLockinReading(command.panel, step->lockinReading);
+	UIERRCHK(PlotStripChart(command.autoZeroPanel, command.responseChart, &magnitude, 1, 0, 0, VAL_DOUBLE));
+	UIERRCHK(PlotStripChart(command.autoZeroPanel, command.stimulusChart, stimulus, 2, 0, 0, VAL_DOUBLE));
+	free(step);
+}
+
+// Called by the balance on the instrument thread
+static void PostBalanceStep(LockinReading lockinReading, void *data)
+{
+	BalanceStep *step = malloc(sizeof *step);
+
+	if (step == NULL)
+		return;
+	step->lockinReading = lockinReading;
+	step->stimulusReal = modeSettings[0].channelSettings[command.channels[0]].real;
+	step->stimulusImag = modeSettings[0].channelSettings[command.channels[0]].imag;
+	if (PostDeferredCall(ShowBalanceStep, step) < 0)
+		free(step);
+}
+
+static int CVICALLBACK CancelAutoZero(int panel, int control, int event,
+									  void *callbackData, int eventData1, int eventData2)
+{
+	switch (event) {
 		case EVENT_COMMIT:
-			programState = STATE_AUTOZEROING;
-			UpdatePanel(panel);
+			BalanceCancel();
+			UIERRCHK(SetCtrlAttribute(panel, control, ATTR_DIMMED, 1));
+			UIERRCHK(SetPanelAttribute(panel, ATTR_TITLE, msgStrings[MSG_AUTOZERO_CANCELLING_TITLE]));
+			break;
+	}
+	return 0;
+}
 
-			DSSERRCHK(DADSS_GetAmplitudeMax(sourceSettings.activeChannel+1, &maxAmplitude));
+static int NewAutoZeroChart(int panel, const char *label, int top, int nTraces)
+{
+	int chart;
 
-			// First data point of the equilibrium strategy
-			stimulus[0].real = modeSettings[0].channelSettings[sourceSettings.activeChannel].real; 
-			stimulus[0].imag = modeSettings[0].channelSettings[sourceSettings.activeChannel].imag;
-			if (modeSettings[0].channelSettings[sourceSettings.activeChannel].lockinGainType == LOCKIN_GAIN_AUTO_INTERNAL) {
-				snprintf(buf, GPIB_BUF_SZ, "AGAN");	
-				GPIBERRCHK(ibwrt(lockinSettings.lockinDesc, buf, strlen(buf)));
-			}
-			GPIBERRCHK(ReadLockinRaw(lockinSettings.lockinDesc, &lockinReading));
-			UpdatePanelLockinReading(panel, lockinReading);
-			response[0].real = lockinReading.real;
-			response[0].imag = lockinReading.imag;
-
-			// Randomly update the stimulus for the second point
-			stimulus[1].real = stimulus[0].real+maxAmplitude*Random(-0.01,0.01);
-			stimulus[1].imag = stimulus[0].imag+maxAmplitude*Random(-0.01,0.01);
+	UIERRCHK(chart = NewCtrl(panel, CTRL_STRIP_CHART, label, top, AUTOZERO_PANEL_MARGIN));
+	UIERRCHK(SetCtrlAttribute(panel, chart, ATTR_WIDTH, AUTOZERO_CHART_WIDTH));
+	UIERRCHK(SetCtrlAttribute(panel, chart, ATTR_HEIGHT, AUTOZERO_CHART_HEIGHT));
+	UIERRCHK(SetCtrlAttribute(panel, chart, ATTR_NUM_TRACES, nTraces));
+	UIERRCHK(SetCtrlAttribute(panel, chart, ATTR_POINTS_PER_SCREEN, AUTOZERO_CHART_POINTS));
+	UIERRCHK(SetAxisScalingMode(panel, chart, VAL_LEFT_YAXIS, VAL_AUTOSCALE, 0.0, 0.0));
+	return chart;
+}
+
+// Top-level panel following a running AutoZero, which stays active while the
+// main panel is dimmed: the magnitude of the response and the stimulus of the
+// first channel at each lock-in reading, and a button cancelling the balance
+static void DisplayAutoZeroPanel(void)
+{
+	int panel, cancelButton;
+	int top = AUTOZERO_PANEL_MARGIN;
+
+	UIERRCHK(panel = NewPanel(0, msgStrings[MSG_AUTOZERO_TITLE], VAL_AUTO_CENTER, VAL_AUTO_CENTER,
+							  4*AUTOZERO_PANEL_MARGIN+2*AUTOZERO_CHART_HEIGHT,
+							  2*AUTOZERO_PANEL_MARGIN+AUTOZERO_CHART_WIDTH));
+	UIERRCHK(SetPanelAttribute(panel, ATTR_CLOSE_ITEM_VISIBLE, 0));
+	command.autoZeroPanel = panel;
+
+	// Diverging or converging over decades
+	command.responseChart = NewAutoZeroChart(panel, msgStrings[MSG_AUTOZERO_RESPONSE], top, 1);
+	UIERRCHK(SetCtrlAttribute(panel, command.responseChart, ATTR_YMAP_MODE, VAL_LOG));
+	top += AUTOZERO_CHART_HEIGHT+AUTOZERO_PANEL_MARGIN;
+
+	command.stimulusChart = NewAutoZeroChart(panel, msgStrings[MSG_AUTOZERO_STIMULUS], top, 2);
+	UIERRCHK(SetCtrlAttribute(panel, command.stimulusChart, ATTR_LEGEND_VISIBLE, 1));
+	UIERRCHK(SetTraceAttribute(panel, command.stimulusChart, 1, ATTR_TRACE_COLOR, VAL_RED));
+	UIERRCHK(SetTraceAttribute(panel, command.stimulusChart, 1, ATTR_TRACE_LG_TEXT, msgStrings[MSG_REAL_PART]));
+	UIERRCHK(SetTraceAttribute(panel, command.stimulusChart, 2, ATTR_TRACE_COLOR, VAL_BLUE));
+	UIERRCHK(SetTraceAttribute(panel, command.stimulusChart, 2, ATTR_TRACE_LG_TEXT, msgStrings[MSG_IMAG_PART]));
+	top += AUTOZERO_CHART_HEIGHT+AUTOZERO_PANEL_MARGIN/2;
+
+	UIERRCHK(cancelButton = NewCtrl(panel, CTRL_SQUARE_COMMAND_BUTTON, msgStrings[MSG_AUTOZERO_CANCEL],
+									top, AUTOZERO_PANEL_MARGIN));
+	UIERRCHK(InstallCtrlCallback(panel, cancelButton, CancelAutoZero, NULL));
+	UIERRCHK(DisplayPanel(panel));
+}
+
+// Channels nulled by AutoZero: the active channel and, if it is marked for the
+// joint balance, the other unlocked channels so marked
+static int GetBalanceChannels(int *channels)
+{
+	ChannelSettings *channelSettings = modeSettings[0].channelSettings;
+	int nChannels = 0;
+
+	channels[nChannels++] = sourceSettings.activeChannel;
+	if (channelSettings[sourceSettings.activeChannel].isJointBalanced)
+		for (int i = 0; i < DADSS_CHANNELS; ++i)
+			if (i != sourceSettings.activeChannel && channelSettings[i].isJointBalanced && !channelSettings[i].isLocked)
+				channels[nChannels++] = i;
+	return nChannels;
+}
+
+static int RunAutoZero(void *data)
+{
+	return command.nChannels > 1 ?
+		   BalanceChannels(command.channels, command.nChannels, PostBalanceStep, NULL, &command.balanceResult) :
+		   BalanceChannel(command.channels[0], PostBalanceStep, NULL, &command.balanceResult);
+}
+
+static void AutoZeroDone(int status, void *data)
+{
+	UIERRCHK(DiscardPanel(command.autoZeroPanel));
+	if (status == 0) {
+		if (command.balanceResult.outcome == BALANCE_OUT_OF_RANGE)
+			SetCtrlVal(command.panel, PANEL_OUT_OF_RANGE_LED, 1);
+		else if (command.balanceResult.outcome == BALANCE_MAX_STEPS)
+			warn("%s.", msgStrings[MSG_MAX_AUTOZERO_STEPS]);
+		else if (command.balanceResult.outcome == BALANCE_CANCELLED)
+			UpdatePanelWaveformParameters(command.panel); // Stimulus reached after the last step shown
+	}
+	programState = STATE_RUNNING;
+	UpdatePanel(command.panel);
+}
+
+static void CVICALLBACK AdvanceConnectProgress(void *callbackData)
+{
+	UIERRCHK(ProgressBar_AdvanceMilestone(command.pbPanel, PANEL_CON1_PROGRESSBAR, 0));
+}
+
+// Open and initialize the lock-ins and update the source to the current
+// settings, advancing the progress bar at each milestone
+static int OpenDevices(void *data)
+{
+	int ret;
 	
-			ToPolar(stimulus[1].real, stimulus[1].imag, &amplitude, &phase);
-			if (amplitude > maxAmplitude) {
-				SetCtrlVal(panel, PANEL_OUT_OF_RANGE_LED, 1);
-				programState = STATE_RUNNING;
-				UpdatePanel(panel);
-				break; 
-			}
-			
-			DSSERRCHK(DADSS_SetWaveformParametersPolar(sourceSettings.activeChannel+1, amplitude, phase));
-			DSSERRCHK(DADSS_UpdateWaveform());
-			
-			/* Read the outcome */
-			Delay(lockinReading.adjDelay);
-			DSSERRCHK(DADSS_GetWaveformParametersPolar(sourceSettings.activeChannel+1,
-							&modeSettings[0].channelSettings[sourceSettings.activeChannel].amplitude, 
-							&modeSettings[0].channelSettings[sourceSettings.activeChannel].phase));
-			ToRect(modeSettings[0].channelSettings[sourceSettings.activeChannel].amplitude, 
-				   modeSettings[0].channelSettings[sourceSettings.activeChannel].phase, 
-				   &modeSettings[0].channelSettings[sourceSettings.activeChannel].real, 
-				   &modeSettings[0].channelSettings[sourceSettings.activeChannel].imag);
-			UpdatePanelWaveformParameters(panel);
-			stimulus[1].real = modeSettings[0].channelSettings[sourceSettings.activeChannel].real;
-			stimulus[1].imag = modeSettings[0].channelSettings[sourceSettings.activeChannel].imag;
-			if (modeSettings[0].channelSettings[sourceSettings.activeChannel].lockinGainType == LOCKIN_GAIN_AUTO_INTERNAL) {
-				snprintf(buf, GPIB_BUF_SZ, "AGAN");	
-				GPIBERRCHK(ibwrt(lockinSettings.lockinDesc, buf, strlen(buf)));
-			}
-			GPIBERRCHK(ReadLockinRaw(lockinSettings.lockinDesc, &lockinReading));
-			UpdatePanelLockinReading(panel, lockinReading);
-			response[1].real = lockinReading.real;
-			response[1].imag = lockinReading.imag;
-
-			// Start the equilibrium procedure
-			int k = 2;
-			for ( ; k < MAX_AUTOZERO_STEPS && 
-					sqrt(response[k-1].real*response[k-1].real +
-						 response[k-1].imag*response[k-1].imag) > modeSettings[0].channelSettings[sourceSettings.activeChannel].balanceThreshold;
-					++k) {
-				// Update the source
-				CxSub(stimulus[k-1].real, stimulus[k-1].imag, 
-					  stimulus[k-2].real, stimulus[k-2].imag, 
-					  &deltaStimulus[k-2].real, &deltaStimulus[k-2].imag);
-				CxSub(response[k-1].real, response[k-1].imag, 
-					  response[k-2].real, response[k-2].imag, 
-					  &deltaResponse[k-2].real, &deltaResponse[k-2].imag); 	
-				CxDiv(deltaStimulus[k-2].real, deltaStimulus[k-2].imag, 
-					  deltaResponse[k-2].real, deltaResponse[k-2].imag,
-					  &sensitivity[k-2].real, &sensitivity[k-2].imag);
-				CxMul(sensitivity[k-2].real, sensitivity[k-2].imag,
-					  response[k-1].real, response[k-1].imag, 
-					  &stimulusCorrection[k-2].real, &stimulusCorrection[k-2].imag);
-				CxSub(stimulus[k-1].real, stimulus[k-1].imag, 
-					  stimulusCorrection[k-2].real, stimulusCorrection[k-2].imag, 
-					  &stimulus[k].real, &stimulus[k].imag); 
-			
-				ToPolar(stimulus[k].real, stimulus[k].imag, &amplitude, &phase);
-				if (amplitude > maxAmplitude) {
-					SetCtrlVal(panel, PANEL_OUT_OF_RANGE_LED, 1);
-					break; 
-				}
-			
-				DSSERRCHK(DADSS_SetWaveformParametersPolar(sourceSettings.activeChannel+1, amplitude, phase));
-				DSSERRCHK(DADSS_UpdateWaveform());
-			
-				/* Read the outcome */
-				DelayWithEventProcessing(lockinReading.adjDelay);
-				DSSERRCHK(DADSS_GetWaveformParametersPolar(sourceSettings.activeChannel+1, 
-						  &modeSettings[0].channelSettings[sourceSettings.activeChannel].amplitude, 
-						  &modeSettings[0].channelSettings[sourceSettings.activeChannel].phase));
-				ToRect(modeSettings[0].channelSettings[sourceSettings.activeChannel].amplitude, 
-					   modeSettings[0].channelSettings[sourceSettings.activeChannel].phase, 
-					   &modeSettings[0].channelSettings[sourceSettings.activeChannel].real, 
-					   &modeSettings[0].channelSettings[sourceSettings.activeChannel].imag);
-				UpdatePanelWaveformParameters(panel);
-				stimulus[k].real = modeSettings[0].channelSettings[sourceSettings.activeChannel].real;
-				stimulus[k].imag = modeSettings[0].channelSettings[sourceSettings.activeChannel].imag;
-				if (modeSettings[0].channelSettings[sourceSettings.activeChannel].lockinGainType == LOCKIN_GAIN_AUTO_INTERNAL) {
-					snprintf(buf, GPIB_BUF_SZ, "AGAN");	
-					GPIBERRCHK(ibwrt(lockinSettings.lockinDesc, buf, strlen(buf)));
-				}
-				GPIBERRCHK(ReadLockinRaw(lockinSettings.lockinDesc, &lockinReading));
-				UpdatePanelLockinReading(panel, lockinReading);
-				response[k].real = lockinReading.real;
-				response[k].imag = lockinReading.imag;
-			}
-			if (k == MAX_AUTOZERO_STEPS)
-				warn("%s.", msgStrings[MSG_MAX_AUTOZERO_STEPS]);
-			programState = STATE_RUNNING;
-			UpdatePanel(panel);
+	for (int i = 0; i < lockinSettings.nLockins; ++i) {
+		Transport *transport = &lockinSettings.lockins[i].transport;
+		
+		if (TransportOpen(transport, &lockinSettings.lockins[i].transportSettings) < 0) {
+			warn("%s lock-in %d: %s", msgStrings[MSG_DEVICE_OPEN_ERROR], i+1, TransportGetErrorString(transport));
+			goto Error;
+		}
+	}
+	PostDeferredCall(AdvanceConnectProgress, NULL); // 1
+	
+	for (int i = 0; i < lockinSettings.nLockins; ++i) {
+		Transport *transport = &lockinSettings.lockins[i].transport;
+		
+		if (InitLockinRaw(transport, lockinSettings.lockins[i].initString) < 0) {
+			warn("%s lock-in %d: %s", msgStrings[MSG_DEVICE_INIT_ERROR], i+1, TransportGetErrorString(transport));
+			goto Error;
+		}
+	}
+	if (SetLockinInputRaw(GetChannelLockin(sourceSettings.activeChannel), modeSettings[0].channelSettings[sourceSettings.activeChannel].lockinInputSettings) < 0) {
+		warn("%s: %s", msgStrings[MSG_TRANSPORT_ERROR], TransportGetErrorString(GetChannelLockin(sourceSettings.activeChannel)));
+		goto Error;
+	}
+	PostDeferredCall(AdvanceConnectProgress, NULL); // 2
+	
+	if ((ret = DADSS_StartStop(0)) < 0)
+		goto DSSError;
+	PostDeferredCall(AdvanceConnectProgress, NULL); // 3
+	
+	// Update the source to current settings
+	if ((ret = DADSS_SetCLKFrequency(sourceSettings.clockFrequency)) < 0 ||
+				(Delay(DADSS_ADJ_DELAY), (ret = DADSS_SetFrequency(sourceSettings.frequency))) < 0 ||
+				(Delay(DADSS_ADJ_DELAY), (ret = DADSS_GetRealFrequency(&sourceSettings.realFrequency))) < 0 ||
+				(ret = DADSS_GetNumberSamples(&sourceSettings.nSamples)) < 0)
+		goto DSSError;
+	PostDeferredCall(AdvanceConnectProgress, NULL); // 4
+	
+	for (int i = 0; i < DADSS_CHANNELS; ++i)
+		if ((ret = DADSS_SetRange(i+1, sourceSettings.range[i])) < 0)
+			goto DSSError;
+	if ((ret = DADSS_UpdateConfiguration()) < 0)
+		goto DSSError;
+	PostDeferredCall(AdvanceConnectProgress, NULL); // 5
+	
+	for (int i = 0; i < DADSS_CHANNELS; ++i)
+		if ((ret = DADSS_SetMDAC2(i+1, modeSettings[0].channelSettings[i].mdac2Code)) < 0)
+			goto DSSError;
+	if ((ret = DADSS_UpdateMDAC2()) < 0)
+		goto DSSError;
+	PostDeferredCall(AdvanceConnectProgress, NULL); // 6
+	
+	for (int i = 0; i < DADSS_CHANNELS; ++i)
+		if ((ret = DADSS_SetAmplitude(i+1, modeSettings[0].channelSettings[i].amplitude)) < 0 ||
+				(ret = DADSS_SetPhase(i+1, modeSettings[0].channelSettings[i].phase)) < 0)
+			goto DSSError;
+	if ((ret = DADSS_UpdateWaveform()) < 0)
+		goto DSSError;
+	PostDeferredCall(AdvanceConnectProgress, NULL); // 7
+	
+	Delay(DADSS_ADJ_DELAY);
+	for (int i = 0; i < DADSS_CHANNELS; ++i) {
+		if ((ret = DADSS_GetAmplitude(i+1, &modeSettings[0].channelSettings[i].amplitude)) < 0 ||
+				(ret = DADSS_GetPhase(i+1, &modeSettings[0].channelSettings[i].phase)) < 0)
+			goto DSSError;
+		ToRect(modeSettings[0].channelSettings[i].amplitude,
+			   modeSettings[0].channelSettings[i].phase, 
+			   &modeSettings[0].channelSettings[i].real, 
+			   &modeSettings[0].channelSettings[i].imag);
 	}
+	PostDeferredCall(AdvanceConnectProgress, NULL); // 8
 	return 0;
+	
+DSSError:
+	warn("%s DSS: %d", msgStrings[MSG_DEVICE_INIT_ERROR], ret);
+Error:
+	CloseLockins();
+	return -1;
+}
+
+static void ConnectDone(int status, void *data)
+{
+	UIERRCHK(DiscardPanel(command.pbPanel));
+	if (status < 0)
+		programState = STATE_IDLE;
+	else {
+		// Allocate the waveform buffers once, before any transfer needs them
+		if (WorkspaceCreate() == NULL)
+			warn(msgStrings[MSG_OUT_OF_MEMORY]);
+		programState = STATE_CONNECTED;
+	}
+	UpdatePanel(command.panel);
+}
+
+static int ChangeFrequency(void *data)
+{
+	if (command.isClockChanged) {
+		DSSERRCHK(DADSS_SetCLKFrequency(sourceSettings.clockFrequency));
+		Delay(DADSS_ADJ_DELAY);
+	}
+	DSSERRCHK(DADSS_SetFrequency(sourceSettings.frequency));
+	Delay(DADSS_ADJ_DELAY);
+	DSSERRCHK(DADSS_GetRealFrequency(&sourceSettings.realFrequency));
+	DSSERRCHK(DADSS_GetNumberSamples(&sourceSettings.nSamples));
+	return 0;
+	
+Error:
+	return -1;
+}
 
+static int ChangeRange(void *data)
+{
+	DSSERRCHK(DADSS_SetRange(sourceSettings.activeChannel+1, 
+							 sourceSettings.range[sourceSettings.activeChannel]));
+	DSSERRCHK(DADSS_UpdateConfiguration());
+	DSSERRCHK(DADSS_UpdateWaveform());
+	Delay(DADSS_ADJ_DELAY);
+	DSSERRCHK(DADSS_GetWaveformParametersPolar(sourceSettings.activeChannel+1, 
+					&modeSettings[0].channelSettings[sourceSettings.activeChannel].amplitude,
+					&modeSettings[0].channelSettings[sourceSettings.activeChannel].phase));
+	ToRect(modeSettings[0].channelSettings[sourceSettings.activeChannel].amplitude,
+			modeSettings[0].channelSettings[sourceSettings.activeChannel].phase, 
+		   &modeSettings[0].channelSettings[sourceSettings.activeChannel].real, 
+		   &modeSettings[0].channelSettings[sourceSettings.activeChannel].imag);
+	return 0;
+	
 Error:
-	programState = STATE_RUNNING;
+	return -1;
+}
+
+static int SwitchMode(void *data)
+{
+	for (int i = 0; i < DADSS_CHANNELS; ++i)
+		DSSERRCHK(DADSS_SetMDAC2(i+1, modeSettings[0].channelSettings[i].mdac2Code));
+	DSSERRCHK(DADSS_UpdateMDAC2());
+	for (int i = 0; i < DADSS_CHANNELS; ++i) {
+		DSSERRCHK(DADSS_SetAmplitude(i+1, modeSettings[0].channelSettings[i].amplitude));
+		DSSERRCHK(DADSS_SetPhase(i+1, modeSettings[0].channelSettings[i].phase));
+	}
+	DSSERRCHK(DADSS_UpdateWaveform());
+	Delay(DADSS_ADJ_DELAY);
+	for (int i = 0; i < DADSS_CHANNELS; ++i) {
+		DSSERRCHK(DADSS_GetAmplitude(i+1, &modeSettings[0].channelSettings[i].amplitude));
+		DSSERRCHK(DADSS_GetPhase(i+1, &modeSettings[0].channelSettings[i].phase));
+	}
+	TRANSPORTERRCHK(GetChannelLockin(sourceSettings.activeChannel), SetLockinInputRaw(GetChannelLockin(sourceSettings.activeChannel), modeSettings[0].channelSettings[sourceSettings.activeChannel].lockinInputSettings));     
+	return 0;
+	
+Error:
+	return -1;
+}
+
+static int ReadActiveLockin(void *data)
+{
+	Transport *transport = GetChannelLockin(sourceSettings.activeChannel);
+
+	if (modeSettings[0].channelSettings[sourceSettings.activeChannel].lockinGainType == LOCKIN_GAIN_AUTO_INTERNAL) {
+		TRANSPORTERRCHK(transport, TransportWrite(transport, "AGAN"));
+	}
+	TRANSPORTERRCHK(transport, ReadLockinRaw(transport, &command.lockinReading));
+	return 0;
+	
+Error:
+	return -1;
+}
+
+static void ReadLockinDone(int status, void *data)
+{
+	if (status == 0)
+		UpdatePanelLockinReading(command.panel, command.lockinReading);
+	UpdatePanel(command.panel);
+}
+
+static int SetActiveLockinInput(void *data)
+{
+	Transport *transport = GetChannelLockin(sourceSettings.activeChannel);
+	
+	TRANSPORTERRCHK(transport, SetLockinInputRaw(transport, modeSettings[0].channelSettings[sourceSettings.activeChannel].lockinInputSettings));
+	return 0;
+	
+Error:
+	return -1;
+}
+
+static void CVICALLBACK ShowStartStopProgress(void *callbackData)
+{
+	UIERRCHK(ProgressBar_SetPercentage(command.pbPanel, PANEL_S_PROGRESSBAR, command.progress, 0));
+}
+
+static int CVICALLBACK InterruptStartStop(int panel, int control, int event,
+										  void *callbackData, int eventData1, int eventData2)
+{
+	switch (event) {
+		case EVENT_COMMIT:
+			command.isInterrupted = 1;
+			UIERRCHK(SetCtrlAttribute(panel, control, ATTR_DIMMED, 1));
+			break;
+	}
+	return 0;
+}
+
+// Scale the MDAC2 codes of all the channels by t, from 0 to 1, one step of
+// the start or stop ramp
+static int ScaleMDAC2(double t)
+{
+	for (int i = 0; i < DADSS_CHANNELS; ++i) {
+		unsigned int mdac2Code = (unsigned int)RoundRealToNearestInteger(modeSettings[0].channelSettings[i].mdac2Code*t);
+		DSSERRCHK(DADSS_SetMDAC2(i+1, mdac2Code));
+	}
+	DSSERRCHK(DADSS_UpdateMDAC2());
+	Delay(STARTSTOP_STEP_DELAY);
+	command.progress = 100.0*t;
+	PostDeferredCall(ShowStartStopProgress, NULL);
+	return 0;
+	
+Error:
+	return -1;
+}
+
+// Read back the MDAC2 codes and the waveforms reached by the ramp
+static int ReadRampedChannels(void)
+{
+	for (int i = 0; i < DADSS_CHANNELS; ++i) {
+		DSSERRCHK(DADSS_GetMDAC2(i+1, &modeSettings[0].channelSettings[i].mdac2Code));
+		DSSERRCHK(DADSS_Mdac2CodeToValue(modeSettings[0].channelSettings[i].mdac2Code, 
+										 &modeSettings[0].channelSettings[i].mdac2Val));
+		DSSERRCHK(DADSS_GetWaveformParametersPolar(i+1, &modeSettings[0].channelSettings[i].amplitude, 
+												   &modeSettings[0].channelSettings[i].phase));
+		ToRect(modeSettings[0].channelSettings[i].amplitude, 
+			   modeSettings[0].channelSettings[i].phase, 
+			   &modeSettings[0].channelSettings[i].real,
+			   &modeSettings[0].channelSettings[i].imag);
+	}
+	return 0;
+	
+Error:
+	return -1;
+}
+
+// Ramp the source up from zero or down to zero, unless interrupted: a stop
+// interrupted leaves the source running at the codes reached
+static int RampSource(void *data)
+{
+	if (command.isStarting) {
+		for (int i = 0; i < DADSS_CHANNELS; ++i)
+			DSSERRCHK(DADSS_SetMDAC2(i+1, 0));
+		DSSERRCHK(DADSS_UpdateMDAC2());
+		DSSERRCHK(DADSS_StartStop(1));
+		for (int i = 1; i <= STARTSTOP_STEPS && !command.isInterrupted; ++i)
+			if (ScaleMDAC2((double)i/STARTSTOP_STEPS) < 0)
+				goto Error;
+		Delay(DADSS_ADJ_DELAY);
+		return ReadRampedChannels();
+	}
+	
+	for (int i = STARTSTOP_STEPS; i >= 0 && !command.isInterrupted; --i)
+		if (ScaleMDAC2((double)i/STARTSTOP_STEPS) < 0)
+			goto Error;
+	command.isStopped = !command.isInterrupted;
+	Delay(DADSS_ADJ_DELAY);
+	if (!command.isStopped)
+		return ReadRampedChannels();
+	DSSERRCHK(DADSS_StartStop(0));
+	for (int i = 0; i < DADSS_CHANNELS; ++i)
+		DSSERRCHK(DADSS_SetMDAC2(i+1, modeSettings[0].channelSettings[i].mdac2Code));
+	DSSERRCHK(DADSS_UpdateMDAC2());
+	return 0;
+	
+Error:
+	return -1;
+}
+
+static void StartStopDone(int status, void *data)
+{
+	UIERRCHK(DiscardPanel(command.pbPanel));
+	if (status < 0) {
+		CloseLockins();
+		programState = STATE_IDLE;
+	} else
+		programState = command.isStopped ? STATE_CONNECTED : STATE_RUNNING;
+	UpdatePanel(command.panel);
+	
+	if (command.isQuitting) {
+		command.isQuitting = 0;
+		if (programState == STATE_RUNNING)
+			return; // Stop interrupted, quit cancelled
+		if (programState == STATE_CONNECTED)
+			Connect(command.panel, PANEL_CONNECT, EVENT_COMMIT, NULL, 0, 0);
+		UIERRCHK(QuitUserInterface(0));
+	}
+}
+
+static int PresetSource(void *data)
+{
+	for (int i = 0; i < DADSS_CHANNELS; ++i)
+		DSSERRCHK(DADSS_SetRange(i+1, sourceSettings.range[i]));
+	DSSERRCHK(DADSS_UpdateConfiguration());
+	
+	for (int i = 0; i < DADSS_CHANNELS; ++i) {
+		DSSERRCHK(DADSS_SetRange(i+1, sourceSettings.range[i]));
+		DSSERRCHK(DADSS_SetAmplitude(i+1, modeSettings[0].channelSettings[i].amplitude));
+		DSSERRCHK(DADSS_SetPhase(i+1, modeSettings[0].channelSettings[i].phase));
+	}
+	DSSERRCHK(DADSS_UpdateWaveform());
+
+	Delay(DADSS_ADJ_DELAY);
+	for (int i = 0; i < DADSS_CHANNELS; ++i) {
+		DSSERRCHK(DADSS_GetAmplitude(i+1, &modeSettings[0].channelSettings[i].amplitude));
+		DSSERRCHK(DADSS_GetPhase(i+1, &modeSettings[0].channelSettings[i].phase));
+		ToRect(modeSettings[0].channelSettings[i].amplitude, 
+			   modeSettings[0].channelSettings[i].phase, 
+			   &modeSettings[0].channelSettings[i].real, 
+			   &modeSettings[0].channelSettings[i].imag);
+	}
+	return 0;
+	
+Error:
+	return -1;
+}
+
+// Write the edited waveform or MDAC2 code of the active channel and read back
+// the values set
+static int ChangeWaveform(void *data)
+{
+	ChannelSettings *channelSettings = &modeSettings[0].channelSettings[sourceSettings.activeChannel];
+	int channel = sourceSettings.activeChannel+1;
+	
+	if (command.isMdac2Changed) {
+		DSSERRCHK(DADSS_SetMDAC2(channel, channelSettings->mdac2Code));
+		DSSERRCHK(DADSS_UpdateMDAC2());
+	} else {
+		DSSERRCHK(DADSS_SetWaveformParametersPolar(channel, channelSettings->amplitude, channelSettings->phase));
+		DSSERRCHK(DADSS_UpdateWaveform());
+	}
+	
+	Delay(DADSS_ADJ_DELAY);
+	DSSERRCHK(DADSS_GetMDAC2(channel, &channelSettings->mdac2Code));
+	DSSERRCHK(DADSS_Mdac2CodeToValue(channelSettings->mdac2Code, &channelSettings->mdac2Val));
+	DSSERRCHK(DADSS_GetWaveformParametersPolar(channel, &channelSettings->amplitude, &channelSettings->phase));
+	ToRect(channelSettings->amplitude, channelSettings->phase, &channelSettings->real, &channelSettings->imag);
+	return 0;
+	
+Error:
+	return -1;
+}
+
+// Write the settings swapped between the active channel and command.swapChannel
+static int SwapChannels(void *data)
+{
+	int active = sourceSettings.activeChannel;
+	int other = command.swapChannel;
+	
+	DSSERRCHK(DADSS_SetMDAC2(active+1, modeSettings[0].channelSettings[active].mdac2Code));
+	DSSERRCHK(DADSS_SetMDAC2(other+1, modeSettings[0].channelSettings[other].mdac2Code));
+	DSSERRCHK(DADSS_UpdateMDAC2());
+	DSSERRCHK(DADSS_SetAmplitude(active+1, modeSettings[0].channelSettings[active].amplitude));
+	DSSERRCHK(DADSS_SetPhase(active+1, modeSettings[0].channelSettings[active].phase));
+	DSSERRCHK(DADSS_SetAmplitude(other+1, modeSettings[0].channelSettings[other].amplitude));
+	DSSERRCHK(DADSS_SetPhase(other+1, modeSettings[0].channelSettings[other].phase));
+	DSSERRCHK(DADSS_UpdateWaveform());
+	Delay(DADSS_ADJ_DELAY);
+	DSSERRCHK(DADSS_GetAmplitude(active+1, &modeSettings[0].channelSettings[active].amplitude));
+	DSSERRCHK(DADSS_GetPhase(active+1, &modeSettings[0].channelSettings[active].phase));
+	DSSERRCHK(DADSS_GetAmplitude(other+1, &modeSettings[0].channelSettings[other].amplitude));
+	DSSERRCHK(DADSS_GetPhase(other+1, &modeSettings[0].channelSettings[other].phase));
+	return 0;
+	
+Error:
+	return -1;
+}
+
+// Fetch the samples of the active channel into its workspace buffer
+static int FetchActiveWaveform(void *data)
+{
+	WaveformWorkspace *workspace = WorkspaceCreate();
+	
+	DSSERRCHK(DADSS_GetNumberSamples(&command.nSamples));
+	DSSERRCHK(DADSS_GetWaveform(sourceSettings.activeChannel+1, workspace->samples[sourceSettings.activeChannel],
+								command.nSamples));
+	return 0;
+	
+Error:
+	return -1;
+}
+
+// Put the samples fetched, or their phasor, on the clipboard
+static void CopyWaveformDone(int status, void *data)
+{
+	WaveformWorkspace *workspace = WorkspaceCreate();
+	int *samples = workspace->samples[sourceSettings.activeChannel];
+	char *buf = workspace->clipboard;
+	double real, imag, dacScale;
+	
+	RestoreProgramState(status, data);
+	if (status < 0)
+		return;
+	switch (command.copyControl) {
+		case PANEL_COPY_SAMPLES:
+			if ((buf = WorkspaceReserveClipboard((size_t)command.nSamples*DADSS_SAMPLE_TEXT_SZ+1)) == NULL) {
+				warn(msgStrings[MSG_OUT_OF_MEMORY]);
+				return;
+			}
+			DADSS_FormatSamples(samples, command.nSamples, buf);
+			break;
+		case PANEL_COPY_FFT:
+			DSSERRCHK(DADSS_GetWaveformPhasor(samples, command.nSamples, &real, &imag));
+			dacScale = (modeSettings[0].channelSettings[sourceSettings.activeChannel].mdac2Val) * \
+					   (DADSS_RangeMultipliers[sourceSettings.range[sourceSettings.activeChannel]]/DADSS_MDAC1_CODE_RANGE) * \
+					   DADSS_REFERENCE_VOLTAGE;
+			snprintf(buf, CLIPBOARD_BUF_SZ, "%s = %.10g%+.10gi;", \
+					 sourceSettings.label[sourceSettings.activeChannel], \
+					 real * dacScale, \
+					 imag * dacScale);
+			break;
+	}
+	UIERRCHK(ClipboardPutText(buf));
+	
+Error:
+	return;
+}
+
+//==============================================================================
+// Global variables
+
+//==============================================================================
+// Global functions
+
+// Enter a busy state and queue a command for the instrument thread; its
+// completion moves the state on, and is called at once with an error status
+// if the command cannot be queued
+void RunCommand(int panel, ProgramState busyState, InstrumentFunction function,
+				InstrumentCompletion completion)
+{
+	command.panel = panel;
+	command.savedProgramState = programState;
+	programState = busyState;
 	UpdatePanel(panel);
+	if (InstrumentSubmit(function, completion, NULL) < 0)
+		completion(-1, NULL);
+}
+
+// Completion of the commands that leave the program state as it was
+void RestoreProgramState(int status, void *data)
+{
+	programState = command.savedProgramState;
+	UpdatePanel(command.panel);
+}
+
+int CVICALLBACK AutoZero (int panel, int control, int event,
+		void *callbackData, int eventData1, int eventData2)
+{
+	switch (event)
+	{
+		case EVENT_COMMIT:
+			command.nChannels = GetBalanceChannels(command.channels);
+			DisplayAutoZeroPanel();
+			RunCommand(panel, STATE_AUTOZEROING, RunAutoZero, AutoZeroDone);
+	}
 	return 0;
 }
 
 int CVICALLBACK Connect (int panel, int control, int event,
 						 void *callbackData, int eventData1, int eventData2)
 {
-	int pbPanel, ret;
-	
 	switch (event) {
 		case EVENT_COMMIT:
 			if (programState == STATE_IDLE) { 
-				programState = STATE_CONNECTING;
-				UpdatePanel(panel);
-				
-				pbPanel = LoadPanel(panel, panelsFile, PANEL_CON1);
-				UIERRCHK(pbPanel);
-				UIERRCHK(SetPanelAttribute(pbPanel, ATTR_TITLE, msgStrings[MSG_CONNECTING_TITLE]));
-				UIERRCHK(ProgressBar_ConvertFromSlide(pbPanel, PANEL_CON1_PROGRESSBAR));
-				UIERRCHK(ProgressBar_SetMilestones(pbPanel, PANEL_CON1_PROGRESSBAR, 
+				command.pbPanel = LoadPanel(panel, panelsFile, PANEL_CON1);
+				UIERRCHK(command.pbPanel);
+				UIERRCHK(SetPanelAttribute(command.pbPanel, ATTR_TITLE, msgStrings[MSG_CONNECTING_TITLE]));
+				UIERRCHK(ProgressBar_ConvertFromSlide(command.pbPanel, PANEL_CON1_PROGRESSBAR));
+				UIERRCHK(ProgressBar_SetMilestones(command.pbPanel, PANEL_CON1_PROGRESSBAR, 
 												   12.5, 25.0, 37.5, 50.0, 62.5, 75.0, 87.5, 0.0));
-				UIERRCHK(DisplayPanel(pbPanel));
-				
-				lockinSettings.lockinDesc = ibdev(0, lockinSettings.gpibAddress, 0, T100s, 1, 0);
-				if (ibsta & ERR) {
-					UIERRCHK(DiscardPanel(pbPanel));
-					warn("%s lock-in: %d", msgStrings[MSG_DEVICE_OPEN_ERROR], iberr);
-					programState = STATE_IDLE;
-					UpdatePanel(panel);
-					return 0;
-				}			
-				UIERRCHK(ProgressBar_AdvanceMilestone(pbPanel, PANEL_CON1_PROGRESSBAR, 0)); // 1
-				
-				ibwrt(lockinSettings.lockinDesc, lockinSettings.initString, strlen(lockinSettings.initString));
-				if (ibsta & ERR) {
-					UIERRCHK(DiscardPanel(pbPanel));
-					warn("%s lock-in: %d", msgStrings[MSG_DEVICE_INIT_ERROR], iberr);
-					ibonl(lockinSettings.lockinDesc, 0);
-					programState = STATE_IDLE;
-					UpdatePanel(panel);
-					return 0;
-				}
-				// SetLockinInputRaw per active channel
-				
-				SetLockinInputRaw(lockinSettings.lockinDesc, modeSettings[0].channelSettings[sourceSettings.activeChannel].lockinInputSettings);
-				if (ibsta & ERR) {
-					UIERRCHK(DiscardPanel(pbPanel));
-					warn("%s lock-in: %d", msgStrings[MSG_GPIB_ERROR], iberr);
-					ibonl(lockinSettings.lockinDesc, 0);
-					programState = STATE_IDLE;
-					UpdatePanel(panel);
-					return 0;
-				}
-				
-				UIERRCHK(ProgressBar_AdvanceMilestone(pbPanel, PANEL_CON1_PROGRESSBAR, 0)); // 2
-				
-				if ((ret = DADSS_StartStop(0)) < 0) {
-					UIERRCHK(DiscardPanel(pbPanel));
-					warn("%s DSS: %d", msgStrings[MSG_DEVICE_INIT_ERROR], ret);
-					ibonl(lockinSettings.lockinDesc, 0);
-					programState = STATE_IDLE;
-					UpdatePanel(panel);
-					return 0;
-				}
-				UIERRCHK(ProgressBar_AdvanceMilestone(pbPanel, PANEL_CON1_PROGRESSBAR, 0)); // 3
-				
-				// Update the source to current settings
-				if ((ret = DADSS_SetCLKFrequency(sourceSettings.clockFrequency)) < 0 ||
-							(Delay(DADSS_ADJ_DELAY), (ret = DADSS_SetFrequency(sourceSettings.frequency))) < 0 ||
-							(Delay(DADSS_ADJ_DELAY), (ret = DADSS_GetRealFrequency(&sourceSettings.realFrequency))) < 0) {
-					UIERRCHK(DiscardPanel(pbPanel));
-					warn("%s DSS: %d", msgStrings[MSG_DEVICE_INIT_ERROR], ret);
-					ibonl(lockinSettings.lockinDesc, 0);
-					programState = STATE_IDLE;
-					UpdatePanel(panel);
-					return 0;
-				}
-				UIERRCHK(ProgressBar_AdvanceMilestone(pbPanel, PANEL_CON1_PROGRESSBAR, 0)); // 4
-				
-				for (int i = 0; i < DADSS_CHANNELS; ++i) {
-					if ((ret = DADSS_SetRange(i+1, sourceSettings.range[i])) < 0)  {
-						UIERRCHK(DiscardPanel(pbPanel));
-						warn("%s DSS: %d", msgStrings[MSG_DEVICE_INIT_ERROR], ret);
-						ibonl(lockinSettings.lockinDesc, 0);
-						programState = STATE_IDLE;
-						UpdatePanel(panel);
-						return 0;
-					} 
-				}
-				
-				if ((ret = DADSS_UpdateConfiguration()) < 0) {
-					UIERRCHK(DiscardPanel(pbPanel));
-					warn("%s DSS: %d", msgStrings[MSG_DEVICE_INIT_ERROR], ret);
-					ibonl(lockinSettings.lockinDesc, 0);
-					programState = STATE_IDLE;
-					UpdatePanel(panel);
-					return 0;
-				}
-				UIERRCHK(ProgressBar_AdvanceMilestone(pbPanel, PANEL_CON1_PROGRESSBAR, 0)); // 5
-				
-				for (int i = 0; i < DADSS_CHANNELS; ++i) {
-					if ((ret = DADSS_SetMDAC2(i+1, modeSettings[0].channelSettings[i].mdac2Code)) < 0)  {
-						UIERRCHK(DiscardPanel(pbPanel));
-						warn("%s DSS: %d", msgStrings[MSG_DEVICE_INIT_ERROR], ret);
-						ibonl(lockinSettings.lockinDesc, 0);
-						programState = STATE_IDLE;
-						UpdatePanel(panel);
-						return 0;
-					}
-				}
-				if ((ret = DADSS_UpdateMDAC2()) < 0) {
-					UIERRCHK(DiscardPanel(pbPanel));
-					warn("%s DSS: %d", msgStrings[MSG_DEVICE_INIT_ERROR], ret);
-					ibonl(lockinSettings.lockinDesc, 0);
-					programState = STATE_IDLE;
-					UpdatePanel(panel);
-					return 0;
-				}
-				UIERRCHK(ProgressBar_AdvanceMilestone(pbPanel, PANEL_CON1_PROGRESSBAR, 0)); // 6
-				
-				for (int i = 0; i < DADSS_CHANNELS; ++i) {
-					if ((ret = DADSS_SetAmplitude(i+1, modeSettings[0].channelSettings[i].amplitude)) < 0 ||
-					   	(ret = DADSS_SetPhase(i+1, modeSettings[0].channelSettings[i].phase)) < 0)  {
-						UIERRCHK(DiscardPanel(pbPanel));
-						warn("%s DSS: %d", msgStrings[MSG_DEVICE_INIT_ERROR], ret);
-						ibonl(lockinSettings.lockinDesc, 0);
-						programState = STATE_IDLE;
-						UpdatePanel(panel);
-						return 0;
-					} 							 
-				}
-				if ((ret = DADSS_UpdateWaveform()) < 0) {
-					UIERRCHK(DiscardPanel(pbPanel));
-					warn("%s DSS: %d", msgStrings[MSG_DEVICE_INIT_ERROR], ret);
-					ibonl(lockinSettings.lockinDesc, 0);
-					programState = STATE_IDLE;
-					UpdatePanel(panel);
-					return 0;
-				}
-				UIERRCHK(ProgressBar_AdvanceMilestone(pbPanel, PANEL_CON1_PROGRESSBAR, 0)); // 7
-				
-				
-				Delay(DADSS_ADJ_DELAY);
-				for (int i = 0; i < DADSS_CHANNELS; ++i) {
-					if ((ret = DADSS_GetAmplitude(i+1, &modeSettings[0].channelSettings[i].amplitude)) < 0 ||
-					   	(ret = DADSS_GetPhase(i+1, &modeSettings[0].channelSettings[i].phase)) < 0)  {
-						UIERRCHK(DiscardPanel(pbPanel));
-						warn("%s DSS: %d", msgStrings[MSG_DEVICE_INIT_ERROR], ret);
-						ibonl(lockinSettings.lockinDesc, 0);
-						programState = STATE_IDLE;
-						UpdatePanel(panel);
-						return 0;
-					} 
-					ToRect(modeSettings[0].channelSettings[i].amplitude,
-						   modeSettings[0].channelSettings[i].phase, 
-						   &modeSettings[0].channelSettings[i].real, 
-						   &modeSettings[0].channelSettings[i].imag);
-				}
-				UIERRCHK(ProgressBar_AdvanceMilestone (pbPanel, PANEL_CON1_PROGRESSBAR, 0)); // 8
-				
-				UIERRCHK(DiscardPanel(pbPanel));
-				programState = STATE_CONNECTED;				
-				UpdatePanel(panel);
+				UIERRCHK(DisplayPanel(command.pbPanel));
+				RunCommand(panel, STATE_CONNECTING, OpenDevices, ConnectDone);
 			} else if (programState == STATE_CONNECTED) { // Disconnect
-				ibonl(lockinSettings.lockinDesc, 0);
-				if (ibsta & ERR)														 
-					warn("%s lock-in, iberr = %d", msgStrings[MSG_DEVICE_CLOSE_ERROR], iberr);
+				for (int i = 0; i < lockinSettings.nLockins; ++i)
+					if (TransportClose(&lockinSettings.lockins[i].transport) < 0)
+						warn("%s lock-in %d: %s", msgStrings[MSG_DEVICE_CLOSE_ERROR], i+1,
+							 TransportGetErrorString(&lockinSettings.lockins[i].transport));
 
 				programState = STATE_IDLE;
 				UpdatePanel(panel);
@@ -359,48 +725,32 @@ int CVICALLBACK Connect (int panel, int control, int event,
 int CVICALLBACK CopyWaveformParameters (int panel, int control, int event,
 		void *callbackData, int eventData1, int eventData2)
 {
-	char buf[CLIPBOARD_BUF_SZ];
-	int nSamples;
-	int samples[DADSS_SAMPLES_MAX] = {0};
-	double xReal[DADSS_SAMPLES_MAX] = {0.0};
-	double xImag[DADSS_SAMPLES_MAX] = {0.0};
-	double dacScale;
+	char *buf;
+	WaveformWorkspace *workspace;
 	
 
 	switch (event)
 	{
 		case EVENT_COMMIT:
+			if ((workspace = WorkspaceCreate()) == NULL) {
+				warn(msgStrings[MSG_OUT_OF_MEMORY]);
+				return 0;
+			}
+			buf = workspace->clipboard;
 			switch (control) {
 				case PANEL_COPY_REAL_FREQUENCY:
-					snprintf(buf, sizeof buf, "f = %.11g;", sourceSettings.realFrequency);
+					snprintf(buf, CLIPBOARD_BUF_SZ, "f = %.11g;", sourceSettings.realFrequency);
 					break;
 				case PANEL_COPY_PHASOR:
-					snprintf(buf, sizeof buf, "%s = %.10g%+.10gi;", sourceSettings.label[sourceSettings.activeChannel],
+					snprintf(buf, CLIPBOARD_BUF_SZ, "%s = %.10g%+.10gi;", sourceSettings.label[sourceSettings.activeChannel],
 							 modeSettings[0].channelSettings[sourceSettings.activeChannel].real, 
 							 modeSettings[0].channelSettings[sourceSettings.activeChannel].imag);
 					break;
-				case PANEL_COPY_SAMPLES:
-					DSSERRCHK(DADSS_GetNumberSamples(&nSamples));
-					DSSERRCHK(DADSS_GetWaveform(sourceSettings.activeChannel+1,samples,nSamples));
-					char *cur = buf;
-					char *end = buf + sizeof buf; 
-					for (int i = 0; i < nSamples && end > cur; ++i) {	
-						cur += snprintf(cur, end-cur, "%d\n", samples[i]);
-					}
-					break;
+				case PANEL_COPY_SAMPLES: // The samples are fetched by the instrument thread
 				case PANEL_COPY_FFT:
-					DSSERRCHK(DADSS_GetNumberSamples(&nSamples));
-					DSSERRCHK(DADSS_GetWaveform(sourceSettings.activeChannel+1,samples,nSamples));
-					for (int i = 0; i < DADSS_SAMPLES_MAX; ++i)
-						xReal[i] = samples[i];
-					ALERRCHK(FFT(xReal, xImag, nSamples)); 
-					dacScale = (modeSettings[0].channelSettings[sourceSettings.activeChannel].mdac2Val) * \ 
-							   (DADSS_RangeMultipliers[sourceSettings.range[sourceSettings.activeChannel]]/DADSS_MDAC1_CODE_RANGE) * \
-							   DADSS_REFERENCE_VOLTAGE/nSamples;
-					snprintf(buf, sizeof buf, "%s = %.10g%+.10gi;", \
-							 sourceSettings.label[sourceSettings.activeChannel], \
-							 (xImag[nSamples-1] - xImag[1]) * dacScale, \
-							 (xReal[1] + xReal[nSamples-1]) * dacScale);
+					command.copyControl = control;
+					RunCommand(panel, STATE_CONFIGURING, FetchActiveWaveform, CopyWaveformDone);
+					return 0;
 			}
 			UIERRCHK(ClipboardPutText(buf));
 			break;
@@ -417,15 +767,19 @@ int CVICALLBACK ManagePanel (int panel, int event, void *callbackData,
 {
 	switch (event) {
 		case EVENT_CLOSE: 
+			if (InstrumentIsBusy())
+				return 0; // The close is ignored until the command completes
 			int ret = 0;
 			UIERRCHK(ret = ConfirmPopup(msgStrings[MSG_POPUP_CONFIRM_TITLE], msgStrings[MSG_POPUP_QUIT]));
 			if (ret == 0)
 				return 0;
-			if (sourceSettings.dataFileHandle != NULL)
-				fclose(sourceSettings.dataFileHandle);
+			FileClose(0, 0, NULL, panel);
+			CaptureWait();
 			switch (programState) {
 				case STATE_RUNNING:
+					command.isQuitting = 1; // StartStopDone disconnects and quits
 					StartStop(panel, PANEL_START_STOP, EVENT_COMMIT, NULL, 0, 0);
+					return 0;
 				case STATE_CONNECTED:
 					Connect(panel, PANEL_CONNECT, EVENT_COMMIT, NULL, 0, 0);
 					break;
@@ -443,22 +797,12 @@ int CVICALLBACK ManagePanel (int panel, int event, void *callbackData,
 int CVICALLBACK ReadLockin (int panel, int control, int event,
 		void *callbackData, int eventData1, int eventData2)
 {
-	char buf[GPIB_BUF_SZ];
-	LockinReading lockinReading;
-
 	switch (event)
 	{
 		case EVENT_COMMIT:
-			if (modeSettings[0].channelSettings[sourceSettings.activeChannel].lockinGainType == LOCKIN_GAIN_AUTO_INTERNAL) {
-				snprintf(buf, GPIB_BUF_SZ, "AGAN");	
-				GPIBERRCHK(ibwrt(lockinSettings.lockinDesc, buf, strlen(buf)));
-			}
-			GPIBERRCHK(ReadLockinRaw(lockinSettings.lockinDesc, &lockinReading));
-			UpdatePanelLockinReading(panel, lockinReading); 
+			RunLockinCommand(panel, ReadActiveLockin, ReadLockinDone);
 			break;
 	}
-
-Error:
 	return 0;
 }
 
@@ -468,12 +812,9 @@ int CVICALLBACK SetActiveChannel (int panel, int control, int event,
 	switch (event) {
 		case EVENT_COMMIT:
 			UIERRCHK(GetCtrlVal(panel, control, &sourceSettings.activeChannel));
-			GPIBERRCHK(SetLockinInputRaw(lockinSettings.lockinDesc, modeSettings[0].channelSettings[sourceSettings.activeChannel].lockinInputSettings)); 
-			UpdatePanelActiveChannel(panel);
+			RunLockinCommand(panel, SetActiveLockinInput, RefreshPanel);
 			break;
 	}
-	
-Error:
 	return 0;
 }
 
@@ -497,7 +838,7 @@ int CVICALLBACK SetConnection (int panel, int control, int event,
 				case PANEL_CON2_OK:
 					UIERRCHK(GetCtrlVal(panel, PANEL_CON2_NV_SERVER, &sourceSettings.nvServer));  // 0 - IME-PXI8101  1 - Localhost
 					DADSS_SetNameNVServer(sourceSettings.nvServer);
-					UIERRCHK(GetCtrlVal(panel, PANEL_CON2_LOCKIN_GPIB_ADDRESS, &lockinSettings.gpibAddress));
+					UIERRCHK(GetCtrlVal(panel, PANEL_CON2_LOCKIN_GPIB_ADDRESS, &lockinSettings.lockins[0].transportSettings.gpibAddress));
 					UIERRCHK(RemovePopup(0));
 					break;
 				case PANEL_CON2_CANCEL:
@@ -517,21 +858,14 @@ int CVICALLBACK SetFrequency (int panel, int control, int event,
 			switch (control) {
 				case PANEL_CLOCKFREQUENCY:
 					UIERRCHK(GetCtrlVal(panel, control, &sourceSettings.clockFrequency));
-					DSSERRCHK(DADSS_SetCLKFrequency(sourceSettings.clockFrequency));
-					Delay(DADSS_ADJ_DELAY);
-					UIERRCHK(SetCtrlVal(panel, PANEL_CLOCKFREQUENCY, sourceSettings.clockFrequency));
 				case PANEL_FREQUENCY:
 					UIERRCHK(GetCtrlVal(panel, PANEL_FREQUENCY, &sourceSettings.frequency));
-					DSSERRCHK(DADSS_SetFrequency(sourceSettings.frequency));
-					Delay(DADSS_ADJ_DELAY);
-					DSSERRCHK(DADSS_GetRealFrequency(&sourceSettings.realFrequency));
-					UIERRCHK(SetCtrlVal(panel, PANEL_REAL_FREQUENCY, sourceSettings.realFrequency));
+					command.isClockChanged = control == PANEL_CLOCKFREQUENCY;
+					RunCommand(panel, STATE_CONFIGURING, ChangeFrequency, RestoreProgramState);
 					break;
 			}
 			break;
 	}
-
-Error:
 	return 0;
 }
 
@@ -555,10 +889,12 @@ int CVICALLBACK SetLockinInput (int panel, int control, int event,
 				case PANEL_LOCKIN_GAIN_TYPE:
 					 UIERRCHK(GetCtrlVal(panel, control, 
 								(int *)&modeSettings[0].channelSettings[sourceSettings.activeChannel].lockinGainType));
+					InvalidateLockinTimeConstant();
 					break;
 				case PANEL_LOCKIN_INPUT_TYPE:
 					 UIERRCHK(GetCtrlVal(panel, control, 
 								(int *)&modeSettings[0].channelSettings[sourceSettings.activeChannel].lockinInputSettings.lockinInputType));
+					modeSettings[0].channelSettings[sourceSettings.activeChannel].sensitivityCache.isValid = 0;
 					break;
 				case PANEL_LOCKIN_RESERVE_TYPE:
 					 UIERRCHK(GetCtrlVal(panel, control, 
@@ -577,8 +913,7 @@ int CVICALLBACK SetLockinInput (int panel, int control, int event,
 							!modeSettings[0].channelSettings[sourceSettings.activeChannel].lockinInputSettings.lockinGroundConnection;
 					break;
 			}
-			SetLockinInputRaw(lockinSettings.lockinDesc, modeSettings[0].channelSettings[sourceSettings.activeChannel].lockinInputSettings);
-			UpdatePanelLockinInputSettings(panel); 
+			RunLockinCommand(panel, SetActiveLockinInput, RefreshPanel);
 			break;
 	}
 	
@@ -591,23 +926,9 @@ int CVICALLBACK SetRange (int panel, int control, int event,
 	switch (event) {
 		case EVENT_COMMIT:
 			UIERRCHK(GetCtrlVal(panel, control, (int *)&sourceSettings.range[sourceSettings.activeChannel]));
-			DSSERRCHK(DADSS_SetRange(sourceSettings.activeChannel+1, 
-									 sourceSettings.range[sourceSettings.activeChannel]));
-			DSSERRCHK(DADSS_UpdateConfiguration());
-			DSSERRCHK(DADSS_UpdateWaveform());
-			Delay(DADSS_ADJ_DELAY);
-			DSSERRCHK(DADSS_GetWaveformParametersPolar(sourceSettings.activeChannel+1, 
-							&modeSettings[0].channelSettings[sourceSettings.activeChannel].amplitude,
-							&modeSettings[0].channelSettings[sourceSettings.activeChannel].phase));
-			ToRect(modeSettings[0].channelSettings[sourceSettings.activeChannel].amplitude,
-					modeSettings[0].channelSettings[sourceSettings.activeChannel].phase, 
-				   &modeSettings[0].channelSettings[sourceSettings.activeChannel].real, 
-				   &modeSettings[0].channelSettings[sourceSettings.activeChannel].imag);
-			UpdatePanelActiveChannel(panel);
+			RunCommand(panel, STATE_CONFIGURING, ChangeRange, RestoreProgramState);
 			break;
 	}
-
-Error:
 	return 0;
 }
 
@@ -616,18 +937,13 @@ int CVICALLBACK SetWaveformParameters (int panel, int control, int event,
 {
 	switch (event) {
 		case EVENT_COMMIT:
+			command.isMdac2Changed = 0;
 			switch (control) {
 				case PANEL_AMPLITUDE:
 					UIERRCHK(GetCtrlVal(panel, control, &modeSettings[0].channelSettings[sourceSettings.activeChannel].amplitude));
-					DSSERRCHK(DADSS_SetAmplitude(sourceSettings.activeChannel+1,
-													   modeSettings[0].channelSettings[sourceSettings.activeChannel].amplitude));
-					DSSERRCHK(DADSS_UpdateWaveform());
 					break;
 				case PANEL_PHASE:
 					UIERRCHK(GetCtrlVal(panel, control, &modeSettings[0].channelSettings[sourceSettings.activeChannel].phase));
-					DSSERRCHK(DADSS_SetPhase(sourceSettings.activeChannel+1,
-												   modeSettings[0].channelSettings[sourceSettings.activeChannel].phase));
-					DSSERRCHK(DADSS_UpdateWaveform());
 					break;
 				case PANEL_REAL:
 					UIERRCHK(GetCtrlVal(panel, control, &modeSettings[0].channelSettings[sourceSettings.activeChannel].real));
@@ -637,10 +953,6 @@ int CVICALLBACK SetWaveformParameters (int panel, int control, int event,
 							&modeSettings[0].channelSettings[sourceSettings.activeChannel].phase);
 					if (modeSettings[0].channelSettings[sourceSettings.activeChannel].amplitude > DADSS_AMPLITUDE_MAX)
 						modeSettings[0].channelSettings[sourceSettings.activeChannel].amplitude = DADSS_AMPLITUDE_MAX;
-					DSSERRCHK(DADSS_SetWaveformParametersPolar(sourceSettings.activeChannel+1,
-									modeSettings[0].channelSettings[sourceSettings.activeChannel].amplitude,
-									modeSettings[0].channelSettings[sourceSettings.activeChannel].phase));
-					DSSERRCHK(DADSS_UpdateWaveform());
 					break;
 				case PANEL_IMAG:
 					UIERRCHK(GetCtrlVal(panel, control, &modeSettings[0].channelSettings[sourceSettings.activeChannel].imag));
@@ -650,31 +962,20 @@ int CVICALLBACK SetWaveformParameters (int panel, int control, int event,
 							&modeSettings[0].channelSettings[sourceSettings.activeChannel].phase);
 					if (modeSettings[0].channelSettings[sourceSettings.activeChannel].amplitude > DADSS_AMPLITUDE_MAX)
 						modeSettings[0].channelSettings[sourceSettings.activeChannel].amplitude = DADSS_AMPLITUDE_MAX;
-					DSSERRCHK(DADSS_SetWaveformParametersPolar(sourceSettings.activeChannel+1,
-									modeSettings[0].channelSettings[sourceSettings.activeChannel].amplitude,
-									modeSettings[0].channelSettings[sourceSettings.activeChannel].phase));
-					DSSERRCHK(DADSS_UpdateWaveform());
 					break;
 				case PANEL_MDAC2_CODE:
 					UIERRCHK(GetCtrlVal(panel, control, &modeSettings[0].channelSettings[sourceSettings.activeChannel].mdac2Code));
-					DSSERRCHK(DADSS_SetMDAC2(sourceSettings.activeChannel+1, 
-												 modeSettings[0].channelSettings[sourceSettings.activeChannel].mdac2Code));
-					DSSERRCHK(DADSS_UpdateMDAC2());
+					command.isMdac2Changed = 1;
 					break;
 				case PANEL_MDAC2_VAL:
 					UIERRCHK(GetCtrlVal(panel, control, &modeSettings[0].channelSettings[sourceSettings.activeChannel].mdac2Val));
 					DSSERRCHK(DADSS_Mdac2ValueToCode(modeSettings[0].channelSettings[sourceSettings.activeChannel].mdac2Val,
 														   &modeSettings[0].channelSettings[sourceSettings.activeChannel].mdac2Code));
-					DSSERRCHK(DADSS_SetMDAC2(sourceSettings.activeChannel+1, 
-												   modeSettings[0].channelSettings[sourceSettings.activeChannel].mdac2Code));
-					DSSERRCHK(DADSS_UpdateMDAC2());
+					command.isMdac2Changed = 1;
 					break;
 				case PANEL_PHASE_ADD_PIHALF:
 					if (modeSettings[0].channelSettings[sourceSettings.activeChannel].phase + PI/2 <= DADSS_PHASE_MAX) {
 						modeSettings[0].channelSettings[sourceSettings.activeChannel].phase += PI/2;
-						DSSERRCHK(DADSS_SetPhase(sourceSettings.activeChannel+1,
-													   modeSettings[0].channelSettings[sourceSettings.activeChannel].phase));
-						DSSERRCHK(DADSS_UpdateWaveform());
 					} else {
 						return 0;
 					}
@@ -682,9 +983,6 @@ int CVICALLBACK SetWaveformParameters (int panel, int control, int event,
 				case PANEL_PHASE_ADD_PI:
 					if (modeSettings[0].channelSettings[sourceSettings.activeChannel].phase + PI <= DADSS_PHASE_MAX) {
 						modeSettings[0].channelSettings[sourceSettings.activeChannel].phase += PI;
-						DSSERRCHK(DADSS_SetPhase(sourceSettings.activeChannel+1,
-													   modeSettings[0].channelSettings[sourceSettings.activeChannel].phase));
-						DSSERRCHK(DADSS_UpdateWaveform());
 					} else {
 						return 0;
 					}
@@ -692,9 +990,6 @@ int CVICALLBACK SetWaveformParameters (int panel, int control, int event,
 				case PANEL_PHASE_SUBTRACT_PIHALF:
 					if (modeSettings[0].channelSettings[sourceSettings.activeChannel].phase - PI/2 >= DADSS_PHASE_MIN) {
 						modeSettings[0].channelSettings[sourceSettings.activeChannel].phase -= PI/2;
-						DSSERRCHK(DADSS_SetPhase(sourceSettings.activeChannel+1,
-													   modeSettings[0].channelSettings[sourceSettings.activeChannel].phase));
-						DSSERRCHK(DADSS_UpdateWaveform());
 					} else {
 						return 0;
 					}
@@ -702,9 +997,6 @@ int CVICALLBACK SetWaveformParameters (int panel, int control, int event,
 				case PANEL_PHASE_SUBTRACT_PI:
 					if (modeSettings[0].channelSettings[sourceSettings.activeChannel].phase - PI >= DADSS_PHASE_MIN) {
 						modeSettings[0].channelSettings[sourceSettings.activeChannel].phase -= PI;
-						DSSERRCHK(DADSS_SetPhase(sourceSettings.activeChannel+1,
-													   modeSettings[0].channelSettings[sourceSettings.activeChannel].phase));
-						DSSERRCHK(DADSS_UpdateWaveform());
 					} else {
 						return 0;
 					}
@@ -726,33 +1018,18 @@ int CVICALLBACK SetWaveformParameters (int panel, int control, int event,
 					}
 					double realTmp;
 					double imagTmp;
-					if (sscanf(clipboardTextTrimmed, "%lf %lf", &realTmp, &imagTmp) == 2) {
-						ToPolar(realTmp,imagTmp,
-								&modeSettings[0].channelSettings[sourceSettings.activeChannel].amplitude, 
-								&modeSettings[0].channelSettings[sourceSettings.activeChannel].phase);
+					int isPasted = sscanf(clipboardTextTrimmed, "%lf %lf", &realTmp, &imagTmp) == 2;
+					free(clipboardText);
+					if (!isPasted)
+						return 0;
+					ToPolar(realTmp,imagTmp,
+							&modeSettings[0].channelSettings[sourceSettings.activeChannel].amplitude, 
+							&modeSettings[0].channelSettings[sourceSettings.activeChannel].phase);
 					if (modeSettings[0].channelSettings[sourceSettings.activeChannel].amplitude > DADSS_AMPLITUDE_MAX)
 						modeSettings[0].channelSettings[sourceSettings.activeChannel].amplitude = DADSS_AMPLITUDE_MAX;
-						DSSERRCHK(DADSS_SetWaveformParametersPolar(sourceSettings.activeChannel+1,
-										modeSettings[0].channelSettings[sourceSettings.activeChannel].amplitude,
-										modeSettings[0].channelSettings[sourceSettings.activeChannel].phase));
-						DSSERRCHK(DADSS_UpdateWaveform());
-					}
-					free(clipboardText);
 					break;
 			}
-			Delay(DADSS_ADJ_DELAY);
-			DSSERRCHK(DADSS_GetMDAC2(sourceSettings.activeChannel+1,
-										   &modeSettings[0].channelSettings[sourceSettings.activeChannel].mdac2Code));
-			DSSERRCHK(DADSS_Mdac2CodeToValue(modeSettings[0].channelSettings[sourceSettings.activeChannel].mdac2Code,
-												   &modeSettings[0].channelSettings[sourceSettings.activeChannel].mdac2Val));
-			DSSERRCHK(DADSS_GetWaveformParametersPolar(sourceSettings.activeChannel+1,
-							&modeSettings[0].channelSettings[sourceSettings.activeChannel].amplitude,
-							&modeSettings[0].channelSettings[sourceSettings.activeChannel].phase));
-			ToRect(modeSettings[0].channelSettings[sourceSettings.activeChannel].amplitude, 
-				   modeSettings[0].channelSettings[sourceSettings.activeChannel].phase, 
-				   &modeSettings[0].channelSettings[sourceSettings.activeChannel].real, 
-				   &modeSettings[0].channelSettings[sourceSettings.activeChannel].imag);
-			UpdatePanelWaveformParameters(panel);
+			RunCommand(panel, STATE_CONFIGURING, ChangeWaveform, RestoreProgramState);
 			break;
 	}
 
@@ -763,132 +1040,27 @@ Error:
 int CVICALLBACK StartStop (int panel, int control, int event,
 						   void *callbackData, int eventData1, int eventData2)
 {
-	int pbPanel;
-	
 	switch (event) {
 		case EVENT_COMMIT:
-			if (programState == STATE_CONNECTED) { // Start
-				programState = STATE_RUNNING_UP;
-				UpdatePanel(panel);
-	
-				UIERRCHK(pbPanel = LoadPanel(panel, panelsFile, PANEL_S));
-				UIERRCHK(SetPanelAttribute(pbPanel, ATTR_TITLE, msgStrings[MSG_STARTING_TITLE]));
-				UIERRCHK(ProgressBar_ConvertFromSlide(pbPanel, PANEL_S_PROGRESSBAR));
-				UIERRCHK(DisplayPanel(pbPanel));
-				for (int i = 0; i < DADSS_CHANNELS; ++i)
-					DSSERRCHK(DADSS_SetMDAC2(i+1, 0));
-				DSSERRCHK(DADSS_UpdateMDAC2());
-				DSSERRCHK(DADSS_StartStop(1));
-				
-				int interruptFlag = 0;
-				for (int i = 1; i <= STARTSTOP_STEPS && !interruptFlag; ++i) {
-					double t = (double)i/STARTSTOP_STEPS;
-					for (int j = 0; j < DADSS_CHANNELS; ++j) {
-						unsigned int mdac2Code = (unsigned int)RoundRealToNearestInteger(modeSettings[0].channelSettings[j].mdac2Code*t);
-						DSSERRCHK(DADSS_SetMDAC2(j+1, mdac2Code));
-					}
-					DSSERRCHK(DADSS_UpdateMDAC2());
-					Delay(STARTSTOP_STEP_DELAY);
-					UIERRCHK(ProgressBar_SetPercentage(pbPanel, PANEL_S_PROGRESSBAR, 100.0*t, 0));
-					
-					int eventHandle, ctrlHandle;
-					UIERRCHK(GetUserEvent(0, &eventHandle, &ctrlHandle));
-					switch (ctrlHandle) {
-						case PANEL_S_INTERRUPT:
-							interruptFlag = 1;
-							break;
-						default:
-							 break;
-					}
-				}
-				
-				Delay(DADSS_ADJ_DELAY);
-				for (int i = 0; i < DADSS_CHANNELS; ++i) {
-						DSSERRCHK(DADSS_GetMDAC2(i+1, &modeSettings[0].channelSettings[i].mdac2Code));
-						DSSERRCHK(DADSS_Mdac2CodeToValue(modeSettings[0].channelSettings[i].mdac2Code, 
-															   &modeSettings[0].channelSettings[i].mdac2Val));
-						DSSERRCHK(DADSS_GetWaveformParametersPolar(i+1, &modeSettings[0].channelSettings[i].amplitude, 
-										&modeSettings[0].channelSettings[i].phase));
-						ToRect(modeSettings[0].channelSettings[i].amplitude, 
-							   modeSettings[0].channelSettings[i].phase, 
-							   &modeSettings[0].channelSettings[i].real,
-							   &modeSettings[0].channelSettings[i].imag);
-				}
-					
-				UIERRCHK(DiscardPanel(pbPanel));
-				programState = STATE_RUNNING;
-				UpdatePanel(panel);
-			} else if (programState == STATE_RUNNING) { // Stop
-				programState = STATE_RUNNING_DOWN;
-				UpdatePanel(panel);
-	
-				UIERRCHK(pbPanel = LoadPanel(panel, panelsFile, PANEL_S));
-				UIERRCHK(SetPanelAttribute(pbPanel, ATTR_TITLE, msgStrings[MSG_STOPPING_TITLE]));
-				UIERRCHK(ProgressBar_ConvertFromSlide(pbPanel, PANEL_S_PROGRESSBAR));
-				UIERRCHK(DisplayPanel(pbPanel));
-
-				int interruptFlag = 0;
-				for (int i = STARTSTOP_STEPS; i >= 0 && !interruptFlag; --i) {
-					double t = (double)i/STARTSTOP_STEPS;
-					for (int j = 0; j < DADSS_CHANNELS; ++j) {
-						unsigned int mdac2Code = (unsigned int)RoundRealToNearestInteger(modeSettings[0].channelSettings[j].mdac2Code*t);
-						DSSERRCHK(DADSS_SetMDAC2(j+1, mdac2Code));
-					}
-					DSSERRCHK(DADSS_UpdateMDAC2());
-					Delay(STARTSTOP_STEP_DELAY);
-					UIERRCHK(ProgressBar_SetPercentage(pbPanel, PANEL_S_PROGRESSBAR, 100.0*t, 0));
-					
-					int eventHandle, ctrlHandle;
-					UIERRCHK(GetUserEvent(0, &eventHandle, &ctrlHandle));
-					switch (ctrlHandle) {
-						case PANEL_S_INTERRUPT:
-							interruptFlag = 1;
-							break;
-						default:
-							 break;
-					}				
-				}
-				Delay(DADSS_ADJ_DELAY);
-				
-				if (!interruptFlag) {
-					DSSERRCHK(DADSS_StartStop(0));
-
-					for (int i = 0; i < DADSS_CHANNELS; ++i)
-						DSSERRCHK(DADSS_SetMDAC2(i+1, modeSettings[0].channelSettings[i].mdac2Code));
-					DSSERRCHK(DADSS_UpdateMDAC2());
-
-					UIERRCHK(DiscardPanel(pbPanel));
-					programState = STATE_CONNECTED;				
-					UpdatePanel(panel);
-				} else {
-					for (int i = 0; i < DADSS_CHANNELS; ++i) {
-						DSSERRCHK(DADSS_GetMDAC2(i+1, &modeSettings[0].channelSettings[i].mdac2Code));
-						DSSERRCHK(DADSS_Mdac2CodeToValue(modeSettings[0].channelSettings[i].mdac2Code, 
-															   &modeSettings[0].channelSettings[i].mdac2Val));
-						DSSERRCHK(DADSS_GetWaveformParametersPolar(i+1, &modeSettings[0].channelSettings[i].amplitude,
-										&modeSettings[0].channelSettings[i].phase));
-						ToRect(modeSettings[0].channelSettings[i].amplitude, 
-							   modeSettings[0].channelSettings[i].phase, 
-							   &modeSettings[0].channelSettings[i].real,
-							   &modeSettings[0].channelSettings[i].imag);
-					}
-					
-					UIERRCHK(DiscardPanel(pbPanel));
-					programState = STATE_RUNNING;				
-					UpdatePanel(panel);				
-				}
-			} else
+			if (programState == STATE_CONNECTED) // Start
+				command.isStarting = 1;
+			else if (programState == STATE_RUNNING) // Stop
+				command.isStarting = 0;
+			else
 				die(msgStrings[MSG_INTERNAL_ERROR]);
+			command.isInterrupted = 0;
+			command.isStopped = 0;
+			
+			UIERRCHK(command.pbPanel = LoadPanel(panel, panelsFile, PANEL_S));
+			UIERRCHK(SetPanelAttribute(command.pbPanel, ATTR_TITLE, 
+									   msgStrings[command.isStarting ? MSG_STARTING_TITLE : MSG_STOPPING_TITLE]));
+			UIERRCHK(ProgressBar_ConvertFromSlide(command.pbPanel, PANEL_S_PROGRESSBAR));
+			UIERRCHK(InstallCtrlCallback(command.pbPanel, PANEL_S_INTERRUPT, InterruptStartStop, NULL));
+			UIERRCHK(DisplayPanel(command.pbPanel));
+			RunCommand(panel, command.isStarting ? STATE_RUNNING_UP : STATE_RUNNING_DOWN, RampSource, StartStopDone);
 			break;
 	}
 	return 0;
-	
-Error:
-	UIERRCHK(DiscardPanel(pbPanel));
-	ibonl(lockinSettings.lockinDesc, 0);
-	programState = STATE_IDLE;
-	UpdatePanel(panel);
-	return 0;
 }
 
 int CVICALLBACK ToggleLock (int panel, int control, int event,
@@ -972,25 +1144,7 @@ int CVICALLBACK SetActiveMode (int panel, int control, int event,
 				case PANEL_ACTIVE_MODE:
 					UIERRCHK(GetCtrlVal(panel, control, &sourceSettings.activeMode));
 					modeSettings[0] = modeSettings[sourceSettings.activeMode];
-					ProgramState savedProgramState = programState;
-					programState = STATE_SWITCHING_MODE;
-					UpdatePanel(panel);
-					for (int i = 0; i < DADSS_CHANNELS; ++i)
-						DSSERRCHK(DADSS_SetMDAC2(i+1, modeSettings[0].channelSettings[i].mdac2Code));
-					DSSERRCHK(DADSS_UpdateMDAC2());
-					for (int i = 0; i < DADSS_CHANNELS; ++i) {
-						DSSERRCHK(DADSS_SetAmplitude(i+1, modeSettings[0].channelSettings[i].amplitude));
-						DSSERRCHK(DADSS_SetPhase(i+1, modeSettings[0].channelSettings[i].phase));
-					}
-					DSSERRCHK(DADSS_UpdateWaveform());
-					Delay(DADSS_ADJ_DELAY);
-					for (int i = 0; i < DADSS_CHANNELS; ++i) {
-						DSSERRCHK(DADSS_GetAmplitude(i+1, &modeSettings[0].channelSettings[i].amplitude));
-						DSSERRCHK(DADSS_GetPhase(i+1, &modeSettings[0].channelSettings[i].phase));
-					}
-					GPIBERRCHK(SetLockinInputRaw(lockinSettings.lockinDesc, modeSettings[0].channelSettings[sourceSettings.activeChannel].lockinInputSettings));     
-					programState = savedProgramState; 
-					UpdatePanel(panel);
+					RunCommand(panel, STATE_SWITCHING_MODE, SwitchMode, RestoreProgramState);
 					break;
 				case PANEL_SET_MODE:
 					modeSettings[sourceSettings.activeMode] = modeSettings[0];
@@ -998,8 +1152,6 @@ int CVICALLBACK SetActiveMode (int panel, int control, int event,
 			}
 			break;
 	}
-
-Error:
 	return 0;
 }
 
@@ -1045,22 +1197,13 @@ int CVICALLBACK SetSwapDestinationChannel (int panel, int control, int event,
 						channelSettingsTmp = modeSettings[0].channelSettings[sourceSettings.activeChannel];
 						modeSettings[0].channelSettings[sourceSettings.activeChannel] = modeSettings[0].channelSettings[swapDestinationChannel];
 						modeSettings[0].channelSettings[swapDestinationChannel] = channelSettingsTmp;
-						DSSERRCHK(DADSS_SetMDAC2(sourceSettings.activeChannel+1, modeSettings[0].channelSettings[sourceSettings.activeChannel].mdac2Code));
-						DSSERRCHK(DADSS_SetMDAC2(swapDestinationChannel+1, modeSettings[0].channelSettings[swapDestinationChannel].mdac2Code));
-						DSSERRCHK(DADSS_UpdateMDAC2());
-						DSSERRCHK(DADSS_SetAmplitude(sourceSettings.activeChannel+1, modeSettings[0].channelSettings[sourceSettings.activeChannel].amplitude));
-						DSSERRCHK(DADSS_SetPhase(sourceSettings.activeChannel+1, modeSettings[0].channelSettings[sourceSettings.activeChannel].phase));
-						DSSERRCHK(DADSS_SetAmplitude(swapDestinationChannel+1, modeSettings[0].channelSettings[swapDestinationChannel].amplitude));
-						DSSERRCHK(DADSS_SetPhase(swapDestinationChannel+1, modeSettings[0].channelSettings[swapDestinationChannel].phase));
-						DSSERRCHK(DADSS_UpdateWaveform());
-						Delay(DADSS_ADJ_DELAY);
-						DSSERRCHK(DADSS_GetAmplitude(sourceSettings.activeChannel+1, &modeSettings[0].channelSettings[sourceSettings.activeChannel].amplitude));
-						DSSERRCHK(DADSS_GetPhase(sourceSettings.activeChannel+1, &modeSettings[0].channelSettings[sourceSettings.activeChannel].phase));
-						DSSERRCHK(DADSS_GetAmplitude(swapDestinationChannel+1, &modeSettings[0].channelSettings[swapDestinationChannel].amplitude));
-						DSSERRCHK(DADSS_GetPhase(swapDestinationChannel+1, &modeSettings[0].channelSettings[swapDestinationChannel].phase));
+						// A cached slope belongs to the position of the channel in the bridge
+						modeSettings[0].channelSettings[sourceSettings.activeChannel].sensitivityCache.isValid = 0;
+						modeSettings[0].channelSettings[swapDestinationChannel].sensitivityCache.isValid = 0;
+						command.swapChannel = swapDestinationChannel;
+						UIERRCHK(panel = GetActivePanel());
+						RunCommand(panel, STATE_CONFIGURING, SwapChannels, RestoreProgramState);
 					}
-					UIERRCHK(panel = GetActivePanel());
-					UpdatePanelActiveChannel(panel);
 					break;
 				case PANEL_SWAP_CANCEL:
 					UIERRCHK(RemovePopup(0));
@@ -1069,8 +1212,6 @@ int CVICALLBACK SetSwapDestinationChannel (int panel, int control, int event,
 			}
 			break;
 	}
-
-Error:
 	return 0;
 }
 
@@ -1323,30 +1464,9 @@ int CVICALLBACK PresetBridgeParameters (int panel, int control, int event,
 					sourceSettings = sourceSettingsTmp;
 					modeSettings[0] = modeSettingsTmp;
 					
-					for (int i = 0; i < DADSS_CHANNELS; ++i)
-						DSSERRCHK(DADSS_SetRange(i+1, sourceSettings.range[i]));
-					DSSERRCHK(DADSS_UpdateConfiguration());
-					
-					for (int i = 0; i < DADSS_CHANNELS; ++i) {
-						DSSERRCHK(DADSS_SetRange(i+1, sourceSettings.range[i]));
-						DSSERRCHK(DADSS_SetAmplitude(i+1, modeSettings[0].channelSettings[i].amplitude));
-						DSSERRCHK(DADSS_SetPhase(i+1, modeSettings[0].channelSettings[i].phase));
-					}
-					DSSERRCHK(DADSS_UpdateWaveform());
-				
-					Delay(DADSS_ADJ_DELAY);
-					for (int i = 0; i < DADSS_CHANNELS; ++i) {
-						DSSERRCHK(DADSS_GetAmplitude(i+1, &modeSettings[0].channelSettings[i].amplitude));
-					   	DSSERRCHK(DADSS_GetPhase(i+1, &modeSettings[0].channelSettings[i].phase));
-						ToRect(modeSettings[0].channelSettings[i].amplitude, 
-							   modeSettings[0].channelSettings[i].phase, 
-							   &modeSettings[0].channelSettings[i].real, 
-							   &modeSettings[0].channelSettings[i].imag);
-					} 
-					
-					int mainPanel = (int)callbackData;
-					UpdatePanelActiveChannel(mainPanel);
 					UIERRCHK(RemovePopup(0)); 
+					int mainPanel = (int)callbackData;
+					RunCommand(mainPanel, STATE_CONFIGURING, PresetSource, RestoreProgramState);
 					break;
 				case PANEL_PRE_CANCEL:
 					UIERRCHK(RemovePopup(0));
@@ -1354,7 +1474,5 @@ int CVICALLBACK PresetBridgeParameters (int panel, int control, int event,
 			}
 			break;
 	}
-	
-Error:
 	return 0;
 }
@@ -0,0 +1,187 @@
+//==============================================================================
+//
+// VersICaL impedance bridge client
+//
+// Copyright 2018-2019	Massimo Ortolano <massimo.ortolano@polito.it> 
+//                		Martina Marzano <m.marzano@inrim.it>
+//
+// This code is licensed under MIT license (see LICENSE.txt for details)
+//
+//==============================================================================
+
+//==============================================================================
+// Include files
+
+#include <ansi_c.h>
+
+#include "main.h"
+#include "sensitivity.h"
+
+//==============================================================================
+// Constants
+
+//==============================================================================
+// Types
+
+//==============================================================================
+// Static global variables
+
+//==============================================================================
+// Static functions
+
+//==============================================================================
+// Global variables
+
+//==============================================================================
+// Global functions
+
+/// HIFN Prepares an estimator for a new balance, with no points
+/// HIPAR scale/Typical magnitude of the stimulus (e.g. the maximum amplitude)
+/// HIPAR forgetting/Weight given to a point for each later one, 0 to 1
+void SensitivityInit(SensitivityEstimator *estimator, double scale, double forgetting)
+{
+	estimator->scale = scale;
+	estimator->forgetting = forgetting;
+	estimator->nPoints = 0;
+}
+
+/// HIFN Updates the fit with a new stimulus/response point. The first two
+/// HIFN points determine the fit exactly, as the secant through them
+void SensitivityAddPoint(SensitivityEstimator *estimator, double stimulusReal, double stimulusImag,
+						 double responseReal, double responseImag)
+{
+	double lambda = estimator->forgetting;
+	double zr = stimulusReal/estimator->scale, zi = stimulusImag/estimator->scale;
+	double v0r, v0i, v1r, v1i, d, er, ei;
+
+	if (estimator->nPoints == 0) {
+		// Kept until the second point in place of the offset and slope
+		estimator->real[0] = responseReal;
+		estimator->imag[0] = responseImag;
+		estimator->real[1] = zr;
+		estimator->imag[1] = zi;
+		estimator->nPoints = 1;
+		return;
+	}
+	if (estimator->nPoints == 1) {
+		double z0r = estimator->real[1], z0i = estimator->imag[1];
+		double dzr = zr-z0r, dzi = zi-z0i, dz2 = dzr*dzr+dzi*dzi;
+		double drr = responseReal-estimator->real[0], dri = responseImag-estimator->imag[0];
+		double m00 = lambda+1.0, m11 = lambda*(z0r*z0r+z0i*z0i)+zr*zr+zi*zi;
+		double m01r = lambda*z0r+zr, m01i = lambda*z0i+zi;
+		double det = m00*m11-m01r*m01r-m01i*m01i;
+
+		if (dz2 == 0.0 || det <= 0.0)
+			return;
+
+		// Secant b = dr/dz, a = r-b*z, and the covariance of the two-point
+		// fit, P = (sum of w*conj(x)*x^T)^-1
+		estimator->real[1] = (drr*dzr+dri*dzi)/dz2;
+		estimator->imag[1] = (dri*dzr-drr*dzi)/dz2;
+		estimator->real[0] = responseReal-(estimator->real[1]*zr-estimator->imag[1]*zi);
+		estimator->imag[0] = responseImag-(estimator->real[1]*zi+estimator->imag[1]*zr);
+		estimator->p00 = m11/det;
+		estimator->p11 = m00/det;
+		estimator->p01Real = -m01r/det;
+		estimator->p01Imag = -m01i/det;
+		estimator->nPoints = 2;
+		return;
+	}
+
+	// With x = (1, z): v = P*conj(x) and d = lambda+x^T*v, real
+	v0r = estimator->p00+estimator->p01Real*zr+estimator->p01Imag*zi;
+	v0i = estimator->p01Imag*zr-estimator->p01Real*zi;
+	v1r = estimator->p01Real+estimator->p11*zr;
+	v1i = -estimator->p01Imag-estimator->p11*zi;
+	d = lambda+v0r+zr*v1r-zi*v1i;
+
+	// Prediction error e = y-x^T*theta, then theta += v*e/d
+	er = responseReal-estimator->real[0]-(zr*estimator->real[1]-zi*estimator->imag[1]);
+	ei = responseImag-estimator->imag[0]-(zr*estimator->imag[1]+zi*estimator->real[1]);
+	estimator->real[0] += (v0r*er-v0i*ei)/d;
+	estimator->imag[0] += (v0r*ei+v0i*er)/d;
+	estimator->real[1] += (v1r*er-v1i*ei)/d;
+	estimator->imag[1] += (v1r*ei+v1i*er)/d;
+
+	// P = (P-v*v^H/d)/lambda
+	estimator->p00 = (estimator->p00-(v0r*v0r+v0i*v0i)/d)/lambda;
+	estimator->p11 = (estimator->p11-(v1r*v1r+v1i*v1i)/d)/lambda;
+	estimator->p01Real = (estimator->p01Real-(v0r*v1r+v0i*v1i)/d)/lambda;
+	estimator->p01Imag = (estimator->p01Imag-(v0i*v1r-v0r*v1i)/d)/lambda;
+	++estimator->nPoints;
+}
+
+/// HIFN Completes the first point with a slope known beforehand, e.g. from an
+/// HIFN earlier balance, so that the null can be estimated without a second
+/// HIFN point. The slope enters the fit as a prior, outweighed by the later
+/// HIFN points as they are added
+/// HIPAR real/Slope db/ds of the response to the stimulus
+/// HIPAR uncertainty/Relative standard uncertainty of the slope
+/// HIPAR noise/Rms noise of the responses
+/// HIRET 0 on success, -1 if not exactly one point was added or the slope is 0
+int SensitivitySetSlope(SensitivityEstimator *estimator, double real, double imag, double uncertainty,
+						double noise)
+{
+	double z0r = estimator->real[1], z0i = estimator->imag[1];
+	double br = real*estimator->scale, bi = imag*estimator->scale;
+	double sigma = uncertainty*sqrt(br*br+bi*bi), variance;
+
+	if (estimator->nPoints != 1 || sigma == 0.0)
+		return -1;
+
+	// Prior variance of the slope per unit noise variance, bounded for
+	// noiseless responses
+	if (noise < SENSITIVITY_MIN_NOISE*sigma)
+		noise = SENSITIVITY_MIN_NOISE*sigma;
+	variance = sigma*sigma/(noise*noise);
+
+	// a = r-b*z, and P = (conj(x)*x^T+diag(0, 1/variance))^-1
+	estimator->real[1] = br;
+	estimator->imag[1] = bi;
+	estimator->real[0] -= br*z0r-bi*z0i;
+	estimator->imag[0] -= br*z0i+bi*z0r;
+	estimator->p00 = 1.0+variance*(z0r*z0r+z0i*z0i);
+	estimator->p11 = variance;
+	estimator->p01Real = -variance*z0r;
+	estimator->p01Imag = -variance*z0i;
+	estimator->nPoints = 2;
+	return 0;
+}
+
+/// HIFN Slope db/ds of the response to the stimulus
+/// HIRET 0 on success, -1 if fewer than two points were added
+int SensitivityGetSlope(const SensitivityEstimator *estimator, double *real, double *imag)
+{
+	if (estimator->nPoints < 2)
+		return -1;
+	*real = estimator->real[1]/estimator->scale;
+	*imag = estimator->imag[1]/estimator->scale;
+	return 0;
+}
+
+/// HIFN Stimulus that nulls the fitted response
+/// HIRET 0 on success, -1 if fewer than two points were added or the response
+/// HIRET does not depend on the stimulus
+int SensitivityGetNull(const SensitivityEstimator *estimator, double *real, double *imag)
+{
+	double br = estimator->real[1], bi = estimator->imag[1];
+	double norm = br*br+bi*bi;
+
+	if (estimator->nPoints < 2 || norm == 0.0)
+		return -1;
+	*real = -estimator->scale*(estimator->real[0]*br+estimator->imag[0]*bi)/norm;
+	*imag = -estimator->scale*(estimator->imag[0]*br-estimator->real[0]*bi)/norm;
+	return 0;
+}
+
+/// HIFN Relative standard uncertainty of the sensitivity
+/// HIPAR noise/Rms noise of the responses
+double SensitivityUncertainty(const SensitivityEstimator *estimator, double noise)
+{
+	double br = estimator->real[1], bi = estimator->imag[1];
+	double norm = br*br+bi*bi;
+
+	if (estimator->nPoints < 2 || norm == 0.0)
+		return HUGE_VAL;
+	return noise*sqrt(estimator->p11/norm);
+}
@@ -0,0 +1,74 @@
+//==============================================================================
+//
+// VersICaL impedance bridge client
+//
+// Copyright 2018-2019	Massimo Ortolano <massimo.ortolano@polito.it> 
+//                		Martina Marzano <m.marzano@inrim.it>
+//
+// This code is licensed under MIT license (see LICENSE.txt for details)
+//
+//==============================================================================
+
+//==============================================================================
+//
+// AutoZero sensitivity estimation.
+//
+// Around the balance the detector response r of a channel is an affine
+// function of its stimulus s, r = a+b*s, with complex a and b. A
+// SensitivityEstimator fits a and b to all the stimulus/response points of a
+// balance by recursive least squares, with exponential forgetting of the older
+// points so that a drift of the bridge is followed. The two-point secant is
+// the special case of the first two points. The stimulus that nulls the
+// fitted response, -a/b, averages the noise of all the points instead of
+// relying on the last one. The covariance of the fit, scaled by the noise of
+// the readings, gives the uncertainty of the sensitivity ds/dr = 1/b, which
+// AutoZero uses to damp its steps. A slope known from an earlier balance can
+// stand in for the second point, as a prior on b.
+//
+//==============================================================================
+
+#ifndef SENSITIVITY_H
+#define SENSITIVITY_H
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+//==============================================================================
+// Include files
+
+//==============================================================================
+// Constants
+
+#define SENSITIVITY_MIN_NOISE 1.0e-6 // Of the slope uncertainty, bounding a prior slope weight
+
+//==============================================================================
+// Types
+
+typedef struct {
+	double scale;		// Of the stimulus, to keep the covariance well conditioned
+	double forgetting;	// Weight of a point per new point
+	int nPoints;
+	double real[2];		// Offset a and slope b (per unit of scale)
+	double imag[2];
+	double p00;			// Hermitian covariance of a and b, per unit noise variance
+	double p11;
+	double p01Real;
+	double p01Imag;
+} SensitivityEstimator;
+
+//==============================================================================
+// Global functions
+
+void SensitivityInit(SensitivityEstimator *, double, double);
+void SensitivityAddPoint(SensitivityEstimator *, double, double, double, double);
+int SensitivitySetSlope(SensitivityEstimator *, double, double, double, double);
+int SensitivityGetSlope(const SensitivityEstimator *, double *, double *);
+int SensitivityGetNull(const SensitivityEstimator *, double *, double *);
+double SensitivityUncertainty(const SensitivityEstimator *, double);
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif /* SENSITIVITY_H */
@@ -0,0 +1,347 @@
+//==============================================================================
+//
+// VersICaL impedance bridge client
+//
+// Copyright 2018-2019	Massimo Ortolano <massimo.ortolano@polito.it> 
+//                		Martina Marzano <m.marzano@inrim.it>
+//
+// This code is licensed under MIT license (see LICENSE.txt for details)
+//
+//==============================================================================
+
+//==============================================================================
+// Include files
+
+#include <ansi_c.h>
+
+#include "main.h"
+#include "settle.h"
+
+//==============================================================================
+// Constants
+
+#define FIT_GRID 16			// Initial search of the step time
+#define FIT_ITERATIONS 20	// Golden-section refinement of the step time
+
+//==============================================================================
+// Types
+
+//==============================================================================
+// Static global variables
+
+//==============================================================================
+// Static functions
+
+// Distance between two of the readings
+static double Distance(const SettleDetector *detector, int i, int j)
+{
+	double dr = detector->real[j]-detector->real[i];
+	double di = detector->imag[j]-detector->imag[i];
+
+	return sqrt(dr*dr+di*di);
+}
+
+// Fraction of a step of the filter input still to go s time constants later
+static double Tail(int nPoles, double s)
+{
+	double term = 1.0, sum = 1.0;
+
+	if (s <= 0.0)
+		return 1.0;
+	for (int k = 1; k < nPoles; ++k) {
+		term *= s/k;
+		sum += term;
+	}
+	return exp(-s)*sum;
+}
+
+// Reading expected at a given time if the input had stayed at the last level
+static void Baseline(const SettleDetector *detector, double time, double *real, double *imag)
+{
+	int n = detector->nLevels;
+
+	*real = detector->levelReal[n-1];
+	*imag = detector->levelImag[n-1];
+	for (int j = 1; j < n; ++j) {
+		double tail = Tail(detector->nPoles, (time-detector->levelTime[j])/detector->timeConstant);
+
+		*real += (detector->levelReal[j-1]-detector->levelReal[j])*tail;
+		*imag += (detector->levelImag[j-1]-detector->levelImag[j])*tail;
+	}
+}
+
+// Least-squares fit of the step from the last level (fit[0], fit[1]) and of
+// the correction of the last level (fit[2], fit[3]) to the readings minus the
+// baseline, for a step at time stepTime. The correction enters the readings
+// with the response v to the step of the last level. Returns the sum of the
+// squared residuals
+static double Fit(const SettleDetector *detector, double stepTime, const double *resReal, const double *resImag,
+				  const double *v, double fit[4])
+{
+	double w[SETTLE_READINGS];
+	double sww = 0.0, swv = 0.0, svv = 0.0, swr = 0.0, swi = 0.0, svr = 0.0, svi = 0.0;
+	double det, ssr = 0.0;
+	int n = detector->nReadings;
+
+	for (int i = 0; i < n; ++i) {
+		w[i] = 1.0-Tail(detector->nPoles, (detector->time[i]-stepTime)/detector->timeConstant);
+		sww += w[i]*w[i];
+		swv += w[i]*v[i];
+		svv += v[i]*v[i];
+		swr += w[i]*resReal[i];
+		swi += w[i]*resImag[i];
+		svr += v[i]*resReal[i];
+		svi += v[i]*resImag[i];
+	}
+	det = sww*svv-swv*swv;
+	if (det <= 1e-9*sww*svv)
+		return HUGE_VAL;
+	fit[0] = (svv*swr-swv*svr)/det;
+	fit[1] = (svv*swi-swv*svi)/det;
+	fit[2] = (sww*svr-swv*swr)/det;
+	fit[3] = (sww*svi-swv*swi)/det;
+	for (int i = 0; i < n; ++i) {
+		double dr = resReal[i]-fit[0]*w[i]-fit[2]*v[i];
+		double di = resImag[i]-fit[1]*w[i]-fit[3]*v[i];
+
+		ssr += dr*dr+di*di;
+	}
+	return ssr;
+}
+
+// Fits the filter response to the readings and updates the prediction of the
+// final value. Returns whether the prediction can be accepted
+static int Predict(SettleDetector *detector)
+{
+	double resReal[SETTLE_READINGS], resImag[SETTLE_READINGS], v[SETTLE_READINGS], fit[4];
+	double lo = detector->stepTime, hi = detector->time[detector->nReadings-1];
+	double h = (hi-lo)/(FIT_GRID-1), a, b, x1, x2, f1, f2, stepTime, ssr, minSsr = HUGE_VAL;
+	double real, imag, dr, di;
+	int n = detector->nReadings, isConsistent;
+
+	if (detector->nMoved < AUTOZERO_PREDICT_MIN_READINGS)
+		return 0;
+	for (int i = 0; i < n; ++i) {
+		Baseline(detector, detector->time[i], &real, &imag);
+		resReal[i] = detector->real[i]-real;
+		resImag[i] = detector->imag[i]-imag;
+		v[i] = detector->nLevels > 1 ?
+			1.0-Tail(detector->nPoles, (detector->time[i]-detector->levelTime[detector->nLevels-1])/detector->timeConstant) : 1.0;
+	}
+
+	// Coarse search of the step time, then golden-section refinement around
+	// the best point
+	stepTime = lo;
+	for (int i = 0; i < FIT_GRID; ++i)
+		if ((ssr = Fit(detector, lo+i*h, resReal, resImag, v, fit)) < minSsr) {
+			minSsr = ssr;
+			stepTime = lo+i*h;
+		}
+	if (minSsr == HUGE_VAL)
+		return 0;
+	a = fmax(lo, stepTime-h);
+	b = fmin(hi, stepTime+h);
+	x1 = b-0.618034*(b-a);
+	x2 = a+0.618034*(b-a);
+	f1 = Fit(detector, x1, resReal, resImag, v, fit);
+	f2 = Fit(detector, x2, resReal, resImag, v, fit);
+	for (int i = 0; i < FIT_ITERATIONS; ++i)
+		if (f1 < f2) {
+			b = x2;
+			x2 = x1;
+			f2 = f1;
+			x1 = b-0.618034*(b-a);
+			f1 = Fit(detector, x1, resReal, resImag, v, fit);
+		} else {
+			a = x1;
+			x1 = x2;
+			f1 = f2;
+			x2 = a+0.618034*(b-a);
+			f2 = Fit(detector, x2, resReal, resImag, v, fit);
+		}
+	if (fmin(f1, f2) < minSsr) 
+		stepTime = f1 < f2 ? x1 : x2;
+	if ((ssr = Fit(detector, stepTime, resReal, resImag, v, fit)) == HUGE_VAL)
+		return 0;
+
+	real = detector->levelReal[detector->nLevels-1]+fit[2]+fit[0];
+	imag = detector->levelImag[detector->nLevels-1]+fit[3]+fit[1];
+	dr = real-detector->predictedReal;
+	di = imag-detector->predictedImag;
+	isConsistent = detector->hasPrediction && sqrt(dr*dr+di*di) <= detector->tolerance;
+	detector->hasPrediction = 1;
+	detector->fitTime = stepTime;
+	detector->predictedReal = real;
+	detector->predictedImag = imag;
+	detector->correctionReal = fit[2];
+	detector->correctionImag = fit[3];
+
+	return isConsistent &&
+		hi-stepTime >= AUTOZERO_PREDICT_TCS*detector->timeConstant &&
+		sqrt(ssr/n) <= fmax(AUTOZERO_PREDICT_RESIDUAL_SIGMAS*detector->noise, detector->tolerance);
+}
+
+//==============================================================================
+// Global variables
+
+//==============================================================================
+// Global functions
+
+/// HIFN Correlation of the output noise of an n-pole filter (white noise at
+/// HIFN its input) between two readings
+/// HIPAR lag/Time between the readings, in time constants
+double SettleNoiseCorrelation(int nPoles, double lag)
+{
+	// Autocorrelation of the impulse response t^m*exp(-t)/m!, m = n-1, up to
+	// a common factor
+	int m = nPoles-1;
+	double r = 0.0, r0 = 1.0, binomial = 1.0, power = 1.0;
+	
+	for (int i = 2; i <= 2*m; ++i)
+		r0 *= i;
+	r0 /= pow(2.0, 2*m+1);
+	for (int j = m; j >= 0; --j) {
+		double factorial = 1.0;
+
+		for (int i = 2; i <= m+j; ++i)
+			factorial *= i;
+		r += binomial*power*factorial/pow(2.0, m+j+1);
+		binomial = binomial*j/(m-j+1);
+		power *= fabs(lag);
+	}
+	return exp(-fabs(lag))*r/r0;
+}
+
+/// HIFN Prepares a detector for a sequence of steps, starting from a settled
+/// HIFN reading
+/// HIPAR timeConstant/Lock-in time constant, in seconds
+/// HIPAR nPoles/Order of the lock-in output filter
+/// HIPAR noise/Rms noise of the readings
+/// HIPAR time/Time of the settled reading
+void SettleInit(SettleDetector *detector, double timeConstant, int nPoles, double noise,
+				double time, double real, double imag)
+{
+	detector->timeConstant = timeConstant;
+	detector->nPoles = nPoles;
+	detector->noise = noise;
+	detector->nLevels = 1;
+	detector->levelTime[0] = time;
+	detector->levelReal[0] = real;
+	detector->levelImag[0] = imag;
+	detector->nReadings = 0;
+	detector->hasPrediction = 0;
+	detector->isPredicted = 0;
+}
+
+/// HIFN Prepares the detector for the approach that follows a step
+/// HIPAR tolerance/Acceptable distance from the final reading
+/// HIPAR expectedChange/Expected magnitude of the change of the reading, 0
+/// HIPAR expectedChange/if unknown
+/// HIPAR time/Time of the step
+void SettleStart(SettleDetector *detector, double tolerance, double expectedChange, double time)
+{
+	detector->tolerance = fmax(tolerance, detector->noise);
+	detector->moveThreshold = fmax(detector->tolerance, fmax(AUTOZERO_SETTLE_NOISE_SIGMAS*detector->noise,
+															 AUTOZERO_SETTLE_MOVE_FRACTION*expectedChange));
+	detector->stepTime = time;
+	detector->startTime = time;
+	detector->hasMoved = 0;
+	detector->nMoved = 0;
+	detector->nReadings = 0;
+	detector->remaining = HUGE_VAL;
+	detector->hasPrediction = 0;
+	detector->isPredicted = 0;
+}
+
+/// HIFN Adds a reading and decides whether the approach is over or, if not,
+/// HIFN its final value can be predicted, in which case the prediction is in the
+/// HIFN predictedReal and predictedImag fields of the detector
+/// HIRET SETTLE_PENDING while the reading is still moving towards its final
+/// HIRET value by more than the tolerance or the noise
+SettleState SettleAddReading(SettleDetector *detector, double time, double real, double imag)
+{
+	int n;
+	double change[2], ratio, minRatio, baseReal, baseImag;
+
+	if (detector->nReadings == SETTLE_READINGS) {
+		n = SETTLE_READINGS-1;
+		memmove(detector->time, detector->time+1, n*sizeof detector->time[0]);
+		memmove(detector->real, detector->real+1, n*sizeof detector->real[0]);
+		memmove(detector->imag, detector->imag+1, n*sizeof detector->imag[0]);
+		--detector->nReadings;
+	}
+	n = detector->nReadings++;
+	detector->time[n] = time;
+	detector->real[n] = real;
+	detector->imag[n] = imag;
+	
+	if (!detector->hasMoved) {
+		// Wait for the response to the step, which the source may apply late,
+		// comparing the readings with their course without the step. The
+		// response starts before the first of consecutive deviating readings,
+		// so that a noise spike is not taken for it
+		Baseline(detector, time, &baseReal, &baseImag);
+		if (sqrt((real-baseReal)*(real-baseReal)+(imag-baseImag)*(imag-baseImag)) <= detector->moveThreshold) {
+			detector->nMoved = 0;
+			return SETTLE_PENDING;
+		}
+		if (++detector->nMoved < AUTOZERO_SETTLE_MOVE_READINGS)
+			return SETTLE_PENDING;
+		detector->hasMoved = 1;
+		if (n >= detector->nMoved)
+			detector->startTime = detector->time[n-detector->nMoved];
+		--detector->nMoved;
+	}
+	++detector->nMoved;
+	detector->isPredicted = Predict(detector);
+	if (n < 2 || detector->nMoved < 2 ||
+			time-detector->startTime < AUTOZERO_SETTLE_MIN_TCS*detector->timeConstant)
+		return detector->isPredicted ? SETTLE_PREDICTED : SETTLE_PENDING;
+
+	change[0] = Distance(detector, n-2, n-1);
+	change[1] = Distance(detector, n-1, n);
+	if (change[1] >= change[0]) {
+		// Not converging: either still on the initial rise of a steep filter
+		// or down to the noise
+		detector->remaining = HUGE_VAL;
+		if (time-detector->startTime >= AUTOZERO_SETTLE_NOISE_TCS*detector->timeConstant)
+			return SETTLE_NOISE;
+		return detector->isPredicted ? SETTLE_PREDICTED : SETTLE_PENDING;
+	}
+
+	// Geometric tail of the changes. A single-pole filter gives a ratio of
+	// exp(-dt/tc), steeper filters and noise a larger one: the larger of the
+	// two is used, so that the extrapolation errs on the long side
+	ratio = change[1]/change[0];
+	minRatio = exp(-(detector->time[n]-detector->time[n-1])/detector->timeConstant);
+	if (ratio < minRatio)
+		ratio = minRatio;
+	detector->remaining = change[1]*ratio/(1.0-ratio);
+	if (detector->remaining <= detector->tolerance)
+		return SETTLE_CONVERGED;
+	return detector->isPredicted ? SETTLE_PREDICTED : SETTLE_PENDING;
+}
+
+/// HIFN Closes the current step, recording the final reading taken as its
+/// HIFN outcome (the prediction or a reading after settling) as the new level
+/// HIFN of the readings
+void SettleEnd(SettleDetector *detector, double real, double imag)
+{
+	int n = detector->nLevels;
+
+	if (detector->isPredicted) {
+		detector->levelReal[n-1] += detector->correctionReal;
+		detector->levelImag[n-1] += detector->correctionImag;
+	}
+	if (n == SETTLE_LEVELS) {
+		// The oldest steps are taken as settled
+		--n;
+		memmove(detector->levelTime, detector->levelTime+1, n*sizeof detector->levelTime[0]);
+		memmove(detector->levelReal, detector->levelReal+1, n*sizeof detector->levelReal[0]);
+		memmove(detector->levelImag, detector->levelImag+1, n*sizeof detector->levelImag[0]);
+	}
+	detector->levelTime[n] = detector->hasPrediction ? detector->fitTime : detector->startTime;
+	detector->levelReal[n] = real;
+	detector->levelImag[n] = imag;
+	detector->nLevels = n+1;
+}
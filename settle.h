@@ -0,0 +1,117 @@
+//==============================================================================
+//
+// VersICaL impedance bridge client
+//
+// Copyright 2018-2019	Massimo Ortolano <massimo.ortolano@polito.it> 
+//                		Martina Marzano <m.marzano@inrim.it>
+//
+// This code is licensed under MIT license (see LICENSE.txt for details)
+//
+//==============================================================================
+
+//==============================================================================
+//
+// Lock-in settle detection and prediction.
+//
+// After a step of the stimulus, the lock-in outputs approach their new value
+// through the output filter. A SettleDetector is fed readings polled at a
+// fraction of the time constant and decides when the approach is over: the
+// distance still to go is extrapolated from the ratio of the last two changes
+// of the reading, as for an exponential, and compared with a tolerance. When
+// the changes stop decreasing the readings are limited by noise and waiting
+// longer would not improve them. No decision is taken until consecutive
+// readings have moved away from their expected course by clearly more than
+// their noise and by a fraction of the expected change, so that a late
+// response of the source is not mistaken for a settled one.
+//
+// The detector also predicts the settled value before the approach is over.
+// The output filter is made of n equal poles (n from the filter slope), whose
+// response to a step of its input at time t0 is still
+//
+//	g(s) = exp(-s)*(1+s+s^2/2!+...+s^(n-1)/(n-1)!),	s = (t-t0)/tc
+//
+// away from the final value. The input is taken as piecewise constant, one
+// level per step, so that the readings are the sum of the responses to the
+// steps so far: the final value of the last step, its correction to the level
+// of the previous step (which may have been predicted as well) and the time of
+// the step, which the source applies with some delay, are fitted to the
+// readings by least squares. The prediction is accepted once the readings span
+// a few time constants from the step, the fit matches them within the noise
+// and two successive predictions agree within the tolerance.
+//
+//==============================================================================
+
+#ifndef SETTLE_H
+#define SETTLE_H
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+//==============================================================================
+// Include files
+
+//==============================================================================
+// Constants
+
+#define SETTLE_READINGS 64	// Kept for the current step
+#define SETTLE_LEVELS 8		// Past steps whose response is still modelled
+
+//==============================================================================
+// Types
+
+typedef enum {
+	SETTLE_PENDING,
+	SETTLE_CONVERGED,	// Extrapolated distance within tolerance
+	SETTLE_NOISE,		// Readings no longer converging
+	SETTLE_PREDICTED	// Final value predicted from the filter response
+} SettleState;
+
+typedef struct {
+	double timeConstant;
+	int nPoles;			// Of the output filter
+	double noise;		// Rms noise of the readings
+	
+	// Past levels of the settled readings and times of their steps, oldest first
+	int nLevels;
+	double levelTime[SETTLE_LEVELS];
+	double levelReal[SETTLE_LEVELS];
+	double levelImag[SETTLE_LEVELS];
+	
+	// Current step
+	double tolerance;
+	double moveThreshold;	// Change marking the response to the step
+	double stepTime;
+	double startTime;	// Of the step, then of the response to it
+	int hasMoved;
+	int nMoved;			// Readings since the response started
+	int nReadings;
+	double time[SETTLE_READINGS];	// Readings since the step, oldest first
+	double real[SETTLE_READINGS];
+	double imag[SETTLE_READINGS];
+	double remaining;	// Extrapolated distance to the final value
+	
+	// Last fit of the filter response
+	int hasPrediction;
+	double fitTime;		// Fitted time of the step
+	double predictedReal;	// Final reading
+	double predictedImag;
+	double correctionReal;	// Of the previous level
+	double correctionImag;
+	int isPredicted;	// The prediction has been accepted
+} SettleDetector;
+
+//==============================================================================
+// Global functions
+
+double SettleNoiseCorrelation(int, double);
+void SettleInit(SettleDetector *, double, int, double, double, double, double);
+void SettleStart(SettleDetector *, double, double, double);
+SettleState SettleAddReading(SettleDetector *, double, double, double);
+void SettleEnd(SettleDetector *, double, double);
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif /* SETTLE_H */
@@ -0,0 +1,116 @@
+//==============================================================================
+//
+// VersICaL impedance bridge client
+//
+// Copyright 2018-2019	Massimo Ortolano <massimo.ortolano@polito.it> 
+//                		Martina Marzano <m.marzano@inrim.it>
+//
+// This code is licensed under MIT license (see LICENSE.txt for details)
+//
+//==============================================================================
+
+//==============================================================================
+// Include files
+
+#include <ansi_c.h>
+#include <utility.h>
+
+#include "sim.h"
+
+//==============================================================================
+// Constants
+
+//==============================================================================
+// Types
+
+//==============================================================================
+// Static global variables
+
+static int isVirtualTime = 0;
+static double virtualTime = 0.0;
+static unsigned long long randomState = SIM_DEFAULT_SEED;
+
+//==============================================================================
+// Static functions
+
+//==============================================================================
+// Global variables
+
+//==============================================================================
+// Global functions
+
+/// HIFN Current time of the simulation clock in seconds
+/// HIRET Wall-clock time (Timer) or, in virtual time mode, the accumulated
+/// HIRET simulated time
+double SimTime(void)
+{
+	return isVirtualTime ? virtualTime : Timer();
+}
+
+/// HIFN Wait on the simulation clock. In virtual time mode the clock is
+/// HIFN advanced without sleeping, so that long settling periods cost nothing
+/// HIPAR seconds/Time to wait
+void SimDelay(double seconds)
+{
+	if (seconds <= 0.0)
+		return;
+	if (isVirtualTime)
+		virtualTime += seconds;
+	else
+		Delay(seconds);
+}
+
+/// HIFN Switch between wall-clock time and virtual (simulated) time
+/// HIPAR enable/Non-zero to select virtual time
+void SimSetVirtualTime(int enable)
+{
+	if (enable && !isVirtualTime)
+		virtualTime = Timer();
+	isVirtualTime = enable != 0;
+}
+
+int SimIsVirtualTime(void)
+{
+	return isVirtualTime;
+}
+
+/// HIFN Read a numeric simulation parameter from the environment
+/// HIPAR name/Name of the environment variable
+/// HIPAR defaultValue/Value returned if the variable is missing or invalid
+double SimGetEnvDouble(const char *name, double defaultValue)
+{
+	const char *s = getenv(name);
+	char *end;
+	double value;
+
+	if (s == NULL)
+		return defaultValue;
+	value = strtod(s, &end);
+	return (end == s) ? defaultValue : value;
+}
+
+/// HIFN Seed the simulation random number generator, so that simulated noise
+/// HIFN is reproducible from run to run
+void SimSeed(unsigned int seed)
+{
+	randomState = seed ? seed : SIM_DEFAULT_SEED;
+}
+
+/// HIFN Uniform random number in [0, 1) (xorshift64*)
+double SimUniform(void)
+{
+	randomState ^= randomState >> 12;
+	randomState ^= randomState << 25;
+	randomState ^= randomState >> 27;
+	return ((randomState * 0x2545F4914F6CDD1DULL) >> 11) * (1.0/9007199254740992.0);
+}
+
+/// HIFN Normally distributed random number with zero mean and unit variance
+/// HIFN (Box-Muller)
+double SimGaussian(void)
+{
+	double u = SimUniform();
+	double v = SimUniform();
+
+	return sqrt(-2.0*log(1.0-u))*cos(2.0*3.1415926535897932*v);
+}
@@ -0,0 +1,47 @@
+//==============================================================================
+//
+// VersICaL impedance bridge client
+//
+// Copyright 2018-2019	Massimo Ortolano <massimo.ortolano@polito.it> 
+//                		Martina Marzano <m.marzano@inrim.it>
+//
+// This code is licensed under MIT license (see LICENSE.txt for details)
+//
+//==============================================================================
+
+#ifndef SIM_H
+#define SIM_H
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+//==============================================================================
+// Include files
+
+//==============================================================================
+// Constants
+
+#define SIM_DEFAULT_SEED 20190101u
+
+//==============================================================================
+// Types
+
+//==============================================================================
+// Global functions
+
+double SimTime(void);
+void SimDelay(double);
+void SimSetVirtualTime(int);
+int SimIsVirtualTime(void);
+double SimGetEnvDouble(const char *, double);
+
+void SimSeed(unsigned int);
+double SimUniform(void);
+double SimGaussian(void);
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif /* SIM_H */
@@ -0,0 +1,481 @@
+//==============================================================================
+//
+// VersICaL impedance bridge client
+//
+// Copyright 2018-2019	Massimo Ortolano <massimo.ortolano@polito.it> 
+//                		Martina Marzano <m.marzano@inrim.it>
+//
+// This code is licensed under MIT license (see LICENSE.txt for details)
+//
+//==============================================================================
+
+//==============================================================================
+// Include files
+
+#include <ansi_c.h>
+#include <utility.h>
+#include <gpib.h>
+#include <tcpsupp.h>
+#include <rs232.h>
+
+#include "transport.h"
+#include "lockin_sim.h"
+#include "sim.h"
+
+//==============================================================================
+// Constants
+
+#define GPIB_TIMEOUT_CODES 18
+
+//==============================================================================
+// Types
+
+//==============================================================================
+// Static global variables
+
+// NI-488 timeout codes TNONE, T10us, T30us... T1000s
+static const double gpibTimeouts[GPIB_TIMEOUT_CODES] = {
+	0.0, 10e-6, 30e-6, 100e-6, 300e-6, 1e-3, 3e-3, 10e-3, 30e-3,
+	100e-3, 300e-3, 1.0, 3.0, 10.0, 30.0, 100.0, 300.0, 1000.0
+};
+
+//==============================================================================
+// Static functions
+
+static int SetError(Transport *transport, TransportErrorCode code, int nativeCode, const char *fmt, ...)
+{
+	va_list ap;
+
+	transport->error.code = code;
+	transport->error.nativeCode = nativeCode;
+	va_start(ap, fmt);
+	vsnprintf(transport->error.message, TRANSPORT_ERROR_SZ, fmt, ap);
+	va_end(ap);
+	++transport->stats.nErrors;
+	return code;
+}
+
+static void ClearError(Transport *transport)
+{
+	transport->error.code = TRANSPORT_ERROR_NONE;
+	transport->error.nativeCode = 0;
+	transport->error.message[0] = '\0';
+}
+
+static void AddTransaction(Transport *transport, double startTime)
+{
+	double elapsed = SimTime()-startTime;
+
+	transport->stats.totalTime += elapsed;
+	if (elapsed > transport->stats.maxTime)
+		transport->stats.maxTime = elapsed;
+}
+
+static int GpibTimeoutCode(double timeout)
+{
+	int code = 1;
+
+	if (timeout <= 0.0)
+		return 0;
+	while (code < GPIB_TIMEOUT_CODES-1 && gpibTimeouts[code] < timeout)
+		++code;
+	return code;
+}
+
+static int CVICALLBACK TcpCallback(unsigned handle, int event, int error, void *callbackData)
+{
+	Transport *transport = callbackData;
+
+	// Data are read synchronously in TransportRead
+	if (event == TCP_DISCONNECT)
+		transport->isOpen = 0;
+	return 0;
+}
+
+// Move a terminated response from the receive buffer to the caller's buffer
+static int PopResponse(Transport *transport, char terminator, char *buf, int len)
+{
+	char *eol = memchr(transport->rxBuf, terminator, transport->rxLen);
+	int n;
+
+	if (eol == NULL)
+		return 0;
+	n = (int)(eol-transport->rxBuf)+1;
+	if (n > len-1)
+		return SetError(transport, TRANSPORT_ERROR_OVERFLOW, 0, "Response longer than %d bytes", len-1);
+	memcpy(buf, transport->rxBuf, n);
+	buf[n] = '\0';
+	transport->rxLen -= n;
+	memmove(transport->rxBuf, transport->rxBuf+n, transport->rxLen);
+	return n;
+}
+
+static int ReadGpib(Transport *transport, char *buf, int len)
+{
+	ibrd(transport->handle, buf, len-1);
+	if (ibsta & ERR) {
+		if (ibsta & TIMO)
+			return SetError(transport, TRANSPORT_ERROR_TIMEOUT, iberr, "GPIB read timeout");
+		return SetError(transport, TRANSPORT_ERROR_READ, iberr, "GPIB read error %d", iberr);
+	}
+	buf[ibcntl] = '\0';
+	return (int)ibcntl;
+}
+
+static int ReadTcp(Transport *transport, char *buf, int len)
+{
+	double deadline = Timer()+transport->settings.timeout;
+	int n;
+
+	while ((n = PopResponse(transport, '\n', buf, len)) == 0) {
+		double remaining = deadline-Timer();
+
+		if (transport->rxLen == TRANSPORT_RX_BUF_SZ)
+			return SetError(transport, TRANSPORT_ERROR_OVERFLOW, 0, "TCP receive buffer full");
+		if (remaining <= 0.0)
+			return SetError(transport, TRANSPORT_ERROR_TIMEOUT, 0, "TCP read timeout");
+		n = ClientTCPRead(transport->handle, transport->rxBuf+transport->rxLen,
+						  TRANSPORT_RX_BUF_SZ-transport->rxLen, (unsigned int)(remaining*1000.0)+1);
+		if (n == kTCP_TimeOutErr)
+			return SetError(transport, TRANSPORT_ERROR_TIMEOUT, n, "TCP read timeout");
+		if (n < 0)
+			return SetError(transport, TRANSPORT_ERROR_READ, n, "TCP read error: %s", GetTCPErrorString(n));
+		transport->rxLen += n;
+	}
+	return n;
+}
+
+// Binary block of known length, which may be sent in several GPIB messages
+static int ReadGpibBinary(Transport *transport, char *buf, int len)
+{
+	int n = 0;
+
+	while (n < len) {
+		ibrd(transport->handle, buf+n, len-n);
+		if (ibsta & ERR) {
+			if (ibsta & TIMO)
+				return SetError(transport, TRANSPORT_ERROR_TIMEOUT, iberr, "GPIB read timeout");
+			return SetError(transport, TRANSPORT_ERROR_READ, iberr, "GPIB read error %d", iberr);
+		}
+		if (ibcntl == 0)
+			return SetError(transport, TRANSPORT_ERROR_READ, 0, "GPIB binary block short by %d bytes", len-n);
+		n += (int)ibcntl;
+	}
+	return n;
+}
+
+static int ReadTcpBinary(Transport *transport, char *buf, int len)
+{
+	double deadline = Timer()+transport->settings.timeout;
+	int n = transport->rxLen < len ? transport->rxLen : len;
+
+	// Bytes already received after the last response
+	memcpy(buf, transport->rxBuf, n);
+	transport->rxLen -= n;
+	memmove(transport->rxBuf, transport->rxBuf+n, transport->rxLen);
+	while (n < len) {
+		double remaining = deadline-Timer();
+		int ret;
+
+		if (remaining <= 0.0)
+			return SetError(transport, TRANSPORT_ERROR_TIMEOUT, 0, "TCP read timeout");
+		ret = ClientTCPRead(transport->handle, buf+n, len-n, (unsigned int)(remaining*1000.0)+1);
+		if (ret == kTCP_TimeOutErr)
+			return SetError(transport, TRANSPORT_ERROR_TIMEOUT, ret, "TCP read timeout");
+		if (ret < 0)
+			return SetError(transport, TRANSPORT_ERROR_READ, ret, "TCP read error: %s", GetTCPErrorString(ret));
+		n += ret;
+	}
+	return n;
+}
+
+static int ReadSerial(Transport *transport, char *buf, int len)
+{
+	// Room for the newline and the null: a read stopped by the count has not
+	// reached the terminator
+	int n = ComRdTerm(transport->settings.serialPort, buf, len-2, '\r');
+
+	if (n < 0) {
+		if (n == kRS_IOTimeOut)
+			return SetError(transport, TRANSPORT_ERROR_TIMEOUT, n, "Serial read timeout");
+		return SetError(transport, TRANSPORT_ERROR_READ, n, "Serial read error: %s", GetRS232ErrorString(n));
+	}
+	if (n == 0 && ReturnRS232Err() == kRS_IOTimeOut)
+		return SetError(transport, TRANSPORT_ERROR_TIMEOUT, kRS_IOTimeOut, "Serial read timeout");
+	if (n == len-2)
+		return SetError(transport, TRANSPORT_ERROR_OVERFLOW, 0, "Response not terminated within %d bytes", len-2);
+	// ComRdTerm strips the terminator: restore the newline of the other transports
+	buf[n++] = '\n';
+	buf[n] = '\0';
+	return n;
+}
+
+static int ReadMock(Transport *transport, char *buf, int len)
+{
+	int n = LockinSimRead(transport->handle, buf, len-1);
+
+	if (n < 0)
+		return SetError(transport, TRANSPORT_ERROR_READ, n, "Mock device %d not available", transport->handle);
+	if (n == 0)
+		return SetError(transport, TRANSPORT_ERROR_TIMEOUT, 0, "Mock read timeout (no pending response)");
+	buf[n] = '\0';
+	return n;
+}
+
+static int ReadMockBinary(Transport *transport, char *buf, int len)
+{
+	int n = LockinSimReadBinary(transport->handle, buf, len);
+
+	if (n < 0)
+		return SetError(transport, TRANSPORT_ERROR_READ, n, "Mock device %d not available", transport->handle);
+	if (n < len)
+		return SetError(transport, TRANSPORT_ERROR_TIMEOUT, 0, "Mock read timeout (%d of %d bytes)", n, len);
+	return n;
+}
+
+//==============================================================================
+// Global variables
+
+const char *TransportTypeNames[TRANSPORT_TYPE_COUNT] = {
+	[TRANSPORT_GPIB] = "GPIB",
+	[TRANSPORT_TCP] = "TCP",
+	[TRANSPORT_SERIAL] = "Serial",
+	[TRANSPORT_MOCK] = "Mock"
+};
+
+//==============================================================================
+// Global functions
+
+void TransportSetDefaultSettings(TransportSettings *settings)
+{
+	memset(settings, 0, sizeof *settings);
+#ifdef LOCKIN_SIMULATION
+	settings->type = TRANSPORT_MOCK;
+#else
+	settings->type = TRANSPORT_GPIB;
+#endif
+	settings->gpibAddress = 8;
+	strncpy(settings->host, "localhost", TRANSPORT_HOST_SZ);
+	settings->port = TRANSPORT_TCP_PORT;
+	settings->serialPort = 1;
+	settings->baudRate = TRANSPORT_BAUD_RATE;
+	settings->timeout = TRANSPORT_TIMEOUT;
+}
+
+/// HIFN Open a transport to an instrument
+/// HIPAR transport/Transport object, whose statistics are reset
+/// HIPAR settings/Transport type, address and timeout
+/// HIRET The return value is 0 on success or a negative TransportErrorCode
+int TransportOpen(Transport *transport, const TransportSettings *settings)
+{
+	int ret;
+
+	memset(transport, 0, sizeof *transport);
+	transport->settings = *settings;
+	switch (settings->type) {
+		case TRANSPORT_GPIB:
+			transport->handle = ibdev(0, settings->gpibAddress, 0, GpibTimeoutCode(settings->timeout), 1, 0);
+			if (ibsta & ERR)
+				return SetError(transport, TRANSPORT_ERROR_OPEN, iberr, "GPIB error %d opening address %d",
+								iberr, settings->gpibAddress);
+			break;
+		case TRANSPORT_TCP:
+			if ((ret = ConnectToTCPServer((unsigned int *)&transport->handle, settings->port, settings->host,
+										  TcpCallback, transport, (unsigned int)(settings->timeout*1000.0))) < 0)
+				return SetError(transport, TRANSPORT_ERROR_OPEN, ret, "Cannot connect to %s:%u: %s",
+								settings->host, settings->port, GetTCPErrorString(ret));
+			break;
+		case TRANSPORT_SERIAL:
+			if ((ret = OpenComConfig(settings->serialPort, "", settings->baudRate, 0, 8, 1, 512, 512)) < 0)
+				return SetError(transport, TRANSPORT_ERROR_OPEN, ret, "Cannot open COM%d: %s",
+								settings->serialPort, GetRS232ErrorString(ret));
+			if ((ret = SetComTime(settings->serialPort, settings->timeout)) < 0) {
+				CloseCom(settings->serialPort);
+				return SetError(transport, TRANSPORT_ERROR_OPEN, ret, "Cannot configure COM%d: %s",
+								settings->serialPort, GetRS232ErrorString(ret));
+			}
+			transport->handle = settings->serialPort;
+			break;
+		case TRANSPORT_MOCK:
+			if (LockinSimOpen(settings->gpibAddress) < 0)
+				return SetError(transport, TRANSPORT_ERROR_OPEN, 0, "Invalid mock device address %d",
+								settings->gpibAddress);
+			transport->handle = settings->gpibAddress;
+			break;
+		default:
+			return SetError(transport, TRANSPORT_ERROR_ARGUMENT, 0, "Unknown transport type %d", settings->type);
+	}
+	transport->isOpen = 1;
+	return 0;
+}
+
+int TransportClose(Transport *transport)
+{
+	int ret = 0;
+
+	if (!transport->isOpen)
+		return 0;
+	transport->isOpen = 0;
+	switch (transport->settings.type) {
+		case TRANSPORT_GPIB:
+			ibonl(transport->handle, 0);
+			if (ibsta & ERR)
+				ret = SetError(transport, TRANSPORT_ERROR_CLOSE, iberr, "GPIB error %d", iberr);
+			break;
+		case TRANSPORT_TCP:
+			if ((ret = DisconnectFromTCPServer(transport->handle)) < 0)
+				ret = SetError(transport, TRANSPORT_ERROR_CLOSE, ret, "%s", GetTCPErrorString(ret));
+			break;
+		case TRANSPORT_SERIAL:
+			if ((ret = CloseCom(transport->handle)) < 0)
+				ret = SetError(transport, TRANSPORT_ERROR_CLOSE, ret, "%s", GetRS232ErrorString(ret));
+			break;
+		case TRANSPORT_MOCK:
+			LockinSimClose(transport->handle);
+			break;
+		default:
+			break;
+	}
+	return ret < 0 ? ret : 0;
+}
+
+/// HIFN Send a command line. The line terminator required by the transport
+/// HIFN (none for GPIB, which uses EOI) is appended
+/// HIRET The return value is 0 on success or a negative TransportErrorCode
+int TransportWrite(Transport *transport, const char *command)
+{
+	char buf[TRANSPORT_RX_BUF_SZ];
+	int len = (int)strlen(command);
+	double startTime = SimTime();
+	int ret;
+
+	if (!transport->isOpen)
+		return SetError(transport, TRANSPORT_ERROR_NOT_OPEN, 0, "%s transport not open",
+						TransportTypeNames[transport->settings.type]);
+	if (len > TRANSPORT_COMMAND_LEN)
+		return SetError(transport, TRANSPORT_ERROR_ARGUMENT, 0, "Command longer than %d bytes", TRANSPORT_COMMAND_LEN);
+	ClearError(transport);
+	++transport->stats.nWrites;
+	switch (transport->settings.type) {
+		case TRANSPORT_GPIB:
+			ibwrt(transport->handle, command, len);
+			if (ibsta & ERR)
+				return SetError(transport, (ibsta & TIMO) ? TRANSPORT_ERROR_TIMEOUT : TRANSPORT_ERROR_WRITE, iberr,
+								"GPIB write error %d", iberr);
+			break;
+		case TRANSPORT_TCP:
+			len = snprintf(buf, sizeof buf, "%s\n", command);
+			if ((ret = ClientTCPWrite(transport->handle, buf, len, (unsigned int)(transport->settings.timeout*1000.0))) < len)
+				return SetError(transport, TRANSPORT_ERROR_WRITE, ret, "TCP write error: %s",
+								ret < 0 ? GetTCPErrorString(ret) : "incomplete write");
+			break;
+		case TRANSPORT_SERIAL:
+			len = snprintf(buf, sizeof buf, "%s\r", command);
+			if ((ret = ComWrt(transport->handle, buf, len)) < len)
+				return SetError(transport, TRANSPORT_ERROR_WRITE, ret, "Serial write error: %s",
+								GetRS232ErrorString(ret < 0 ? ret : ReturnRS232Err()));
+			break;
+		case TRANSPORT_MOCK:
+			if ((ret = LockinSimWrite(transport->handle, command, len)) < 0)
+				return SetError(transport, TRANSPORT_ERROR_WRITE, ret, "Mock device %d not available",
+								transport->handle);
+			break;
+		default:
+			return SetError(transport, TRANSPORT_ERROR_ARGUMENT, 0, "Unknown transport type");
+	}
+	AddTransaction(transport, startTime);
+	return 0;
+}
+
+/// HIFN Read one response, null-terminated and including its line terminator
+/// HIPAR len/Size of buf, including the terminating null character
+/// HIRET The return value is the number of bytes read or a negative
+/// HIRET TransportErrorCode
+int TransportRead(Transport *transport, char *buf, int len)
+{
+	double startTime = SimTime();
+	int ret;
+
+	if (!transport->isOpen)
+		return SetError(transport, TRANSPORT_ERROR_NOT_OPEN, 0, "%s transport not open",
+						TransportTypeNames[transport->settings.type]);
+	if (len < 2)
+		return SetError(transport, TRANSPORT_ERROR_ARGUMENT, 0, "Read buffer too short");
+	ClearError(transport);
+	++transport->stats.nReads;
+	switch (transport->settings.type) {
+		case TRANSPORT_GPIB:
+			ret = ReadGpib(transport, buf, len);
+			break;
+		case TRANSPORT_TCP:
+			ret = ReadTcp(transport, buf, len);
+			break;
+		case TRANSPORT_SERIAL:
+			ret = ReadSerial(transport, buf, len);
+			break;
+		case TRANSPORT_MOCK:
+			ret = ReadMock(transport, buf, len);
+			break;
+		default:
+			return SetError(transport, TRANSPORT_ERROR_ARGUMENT, 0, "Unknown transport type");
+	}
+	AddTransaction(transport, startTime);
+	return ret;
+}
+
+/// HIFN Read a binary block of known length, such as the SR830 TRCB? and
+/// HIFN TRCL? responses, which have no line terminator
+/// HIPAR len/Number of bytes to read
+/// HIRET The return value is len or a negative TransportErrorCode
+int TransportReadBinary(Transport *transport, void *buf, int len)
+{
+	double startTime = SimTime();
+	int ret;
+
+	if (!transport->isOpen)
+		return SetError(transport, TRANSPORT_ERROR_NOT_OPEN, 0, "%s transport not open",
+						TransportTypeNames[transport->settings.type]);
+	if (len < 1)
+		return SetError(transport, TRANSPORT_ERROR_ARGUMENT, 0, "Invalid binary block length");
+	ClearError(transport);
+	++transport->stats.nReads;
+	switch (transport->settings.type) {
+		case TRANSPORT_GPIB:
+			ret = ReadGpibBinary(transport, buf, len);
+			break;
+		case TRANSPORT_TCP:
+			ret = ReadTcpBinary(transport, buf, len);
+			break;
+		case TRANSPORT_SERIAL:
+			if ((ret = ComRd(transport->handle, buf, len)) < 0)
+				ret = SetError(transport, TRANSPORT_ERROR_READ, ret, "Serial read error: %s", GetRS232ErrorString(ret));
+			else if (ret < len)
+				ret = SetError(transport, TRANSPORT_ERROR_TIMEOUT, kRS_IOTimeOut, "Serial read timeout");
+			break;
+		case TRANSPORT_MOCK:
+			ret = ReadMockBinary(transport, buf, len);
+			break;
+		default:
+			return SetError(transport, TRANSPORT_ERROR_ARGUMENT, 0, "Unknown transport type");
+	}
+	AddTransaction(transport, startTime);
+	return ret;
+}
+
+const char *TransportGetErrorString(const Transport *transport)
+{
+	return transport->error.message[0] != '\0' ? transport->error.message : "No error";
+}
+
+/// HIFN Mean duration of a write or read transaction, in seconds
+double TransportGetMeanLatency(const Transport *transport)
+{
+	unsigned long n = transport->stats.nWrites+transport->stats.nReads;
+
+	return n > 0 ? transport->stats.totalTime/n : 0.0;
+}
+
+void TransportResetStats(Transport *transport)
+{
+	memset(&transport->stats, 0, sizeof transport->stats);
+}
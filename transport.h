@@ -0,0 +1,123 @@
+//==============================================================================
+//
+// VersICaL impedance bridge client
+//
+// Copyright 2018-2019	Massimo Ortolano <massimo.ortolano@polito.it> 
+//                		Martina Marzano <m.marzano@inrim.it>
+//
+// This code is licensed under MIT license (see LICENSE.txt for details)
+//
+//==============================================================================
+
+//==============================================================================
+//
+// Instrument transport layer.
+//
+// A Transport carries command lines to an instrument and reads its responses
+// over GPIB (NI-488), a raw TCP socket (e.g. a VISA-TCP or GPIB-Ethernet
+// bridge), a serial port or the in-process lock-in emulator (mock). Each
+// transport keeps the last error and its own latency statistics.
+//
+//==============================================================================
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+//==============================================================================
+// Include files
+
+//==============================================================================
+// Constants
+
+#define TRANSPORT_HOST_SZ 256
+#define TRANSPORT_ERROR_SZ 256
+#define TRANSPORT_RX_BUF_SZ 1024
+#define TRANSPORT_COMMAND_LEN (TRANSPORT_RX_BUF_SZ-2) // Longest command, leaving room for the terminator
+#define TRANSPORT_TIMEOUT 100.0
+#define TRANSPORT_TCP_PORT 1234
+#define TRANSPORT_BAUD_RATE 9600
+
+//==============================================================================
+// Types
+
+typedef enum {
+	TRANSPORT_GPIB,
+	TRANSPORT_TCP,
+	TRANSPORT_SERIAL,
+	TRANSPORT_MOCK,
+	TRANSPORT_TYPE_COUNT
+} TransportType;
+
+typedef enum {
+	TRANSPORT_ERROR_NONE = 0,
+	TRANSPORT_ERROR_ARGUMENT = -1,
+	TRANSPORT_ERROR_OPEN = -2,
+	TRANSPORT_ERROR_NOT_OPEN = -3,
+	TRANSPORT_ERROR_WRITE = -4,
+	TRANSPORT_ERROR_READ = -5,
+	TRANSPORT_ERROR_TIMEOUT = -6,
+	TRANSPORT_ERROR_OVERFLOW = -7,
+	TRANSPORT_ERROR_CLOSE = -8
+} TransportErrorCode;
+
+typedef struct {
+	TransportErrorCode code;
+	int nativeCode; // iberr, TCP library or RS-232 library error
+	char message[TRANSPORT_ERROR_SZ];
+} TransportError;
+
+typedef struct {
+	unsigned long nWrites;
+	unsigned long nReads;
+	unsigned long nErrors;
+	double totalTime;
+	double maxTime;
+} TransportStats;
+
+typedef struct {
+	TransportType type;
+	int gpibAddress;
+	char host[TRANSPORT_HOST_SZ];
+	unsigned int port;
+	int serialPort;
+	int baudRate;
+	double timeout;
+} TransportSettings;
+
+typedef struct {
+	TransportSettings settings;
+	int isOpen;
+	int handle;
+	char rxBuf[TRANSPORT_RX_BUF_SZ]; // Bytes received after the last terminator
+	int rxLen;
+	TransportError error;
+	TransportStats stats;
+} Transport;
+
+//==============================================================================
+// External variables
+
+extern const char *TransportTypeNames[TRANSPORT_TYPE_COUNT];
+
+//==============================================================================
+// Global functions
+
+void TransportSetDefaultSettings(TransportSettings *);
+int TransportOpen(Transport *, const TransportSettings *);
+int TransportClose(Transport *);
+int TransportWrite(Transport *, const char *);
+int TransportRead(Transport *, char *, int);
+int TransportReadBinary(Transport *, void *, int);
+const char *TransportGetErrorString(const Transport *);
+double TransportGetMeanLatency(const Transport *);
+void TransportResetStats(Transport *);
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif /* TRANSPORT_H */
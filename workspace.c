@@ -0,0 +1,101 @@
+//==============================================================================
+//
+// VersICaL impedance bridge client
+//
+// Copyright 2018-2019	Massimo Ortolano <massimo.ortolano@polito.it> 
+//                		Martina Marzano <m.marzano@inrim.it>
+//
+// This code is licensed under MIT license (see LICENSE.txt for details)
+//
+//==============================================================================
+
+//==============================================================================
+// Include files
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "main.h"
+#include "workspace.h"
+
+//==============================================================================
+// Constants
+
+//==============================================================================
+// Types
+
+//==============================================================================
+// Static global variables
+
+static void *workspaceBlock = NULL;
+static char *clipboardBlock = NULL; // Clipboard buffer grown beyond CLIPBOARD_BUF_SZ
+static WaveformWorkspace waveformWorkspace;
+
+//==============================================================================
+// Static functions
+
+static size_t AlignSize(size_t size)
+{
+	return (size + WORKSPACE_ALIGNMENT - 1) & ~(size_t)(WORKSPACE_ALIGNMENT - 1);
+}
+
+//==============================================================================
+// Global variables
+
+//==============================================================================
+// Global functions
+
+/// HIFN Allocates the waveform workspace, unless it has already been allocated.
+/// HIRET The workspace, or NULL if it cannot be allocated.
+WaveformWorkspace *WorkspaceCreate(void)
+{
+	size_t samplesSize = AlignSize(DADSS_SAMPLES_MAX * sizeof(int));
+	char *p;
+
+	if (workspaceBlock != NULL)
+		return &waveformWorkspace;
+
+	// A single block, without zero-filling, split into aligned buffers
+	workspaceBlock = malloc(DADSS_CHANNELS * samplesSize + AlignSize(CLIPBOARD_BUF_SZ) + WORKSPACE_ALIGNMENT);
+	if (workspaceBlock == NULL)
+		return NULL;
+	p = (char *)AlignSize((uintptr_t)workspaceBlock);
+	for (int i = 0; i < DADSS_CHANNELS; ++i) {
+		waveformWorkspace.samples[i] = (int *)p;
+		p += samplesSize;
+	}
+	waveformWorkspace.clipboard = p;
+	waveformWorkspace.clipboardSize = CLIPBOARD_BUF_SZ;
+	return &waveformWorkspace;
+}
+
+/// HIFN Grows the clipboard buffer of the workspace, if needed. The content is not kept.
+/// HIPAR size/The number of characters needed.
+/// HIRET The clipboard buffer, or NULL if it cannot be allocated.
+char *WorkspaceReserveClipboard(size_t size)
+{
+	char *buf;
+
+	if (WorkspaceCreate() == NULL)
+		return NULL;
+	if (size <= waveformWorkspace.clipboardSize)
+		return waveformWorkspace.clipboard;
+	if (size < 2*waveformWorkspace.clipboardSize)
+		size = 2*waveformWorkspace.clipboardSize;
+	if ((buf = malloc(size)) == NULL)
+		return NULL;
+	free(clipboardBlock);
+	clipboardBlock = buf;
+	waveformWorkspace.clipboard = buf;
+	waveformWorkspace.clipboardSize = size;
+	return buf;
+}
+
+/// HIFN Frees the waveform workspace.
+void WorkspaceDiscard(void)
+{
+	free(workspaceBlock);
+	free(clipboardBlock);
+	workspaceBlock = NULL;
+	clipboardBlock = NULL;
+}
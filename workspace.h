@@ -0,0 +1,62 @@
+//==============================================================================
+//
+// VersICaL impedance bridge client
+//
+// Copyright 2018-2019	Massimo Ortolano <massimo.ortolano@polito.it> 
+//                		Martina Marzano <m.marzano@inrim.it>
+//
+// This code is licensed under MIT license (see LICENSE.txt for details)
+//
+//==============================================================================
+
+//==============================================================================
+//
+// Waveform workspace.
+//
+// The buffers used to fetch and format the source waveforms are carved out of
+// a single block, allocated once when the devices are connected and kept until
+// the program exits. Their content is not cleared between uses: every caller
+// overwrites the samples it reads. The clipboard buffer grows on demand.
+//
+//==============================================================================
+
+#ifndef WORKSPACE_H
+#define WORKSPACE_H
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+//==============================================================================
+// Include files
+
+#include <stddef.h>
+
+#include "DA_DSS_cvi_driver.h"
+
+//==============================================================================
+// Constants
+
+#define WORKSPACE_ALIGNMENT 32
+
+//==============================================================================
+// Types
+
+typedef struct {
+	int *samples[DADSS_CHANNELS]; // DADSS_SAMPLES_MAX samples per channel
+	char *clipboard;
+	size_t clipboardSize; // CLIPBOARD_BUF_SZ characters at least
+} WaveformWorkspace;
+
+//==============================================================================
+// Global functions
+
+WaveformWorkspace *WorkspaceCreate(void);
+char *WorkspaceReserveClipboard(size_t);
+void WorkspaceDiscard(void);
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif /* WORKSPACE_H */